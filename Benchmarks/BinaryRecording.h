@@ -0,0 +1,252 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BINARY_RECORDING_H_INCLUDED
+#define BINARY_RECORDING_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+
+Offline access to Open Ephys binary recordings, shared by the batch and sweep tools:
+
+- BinaryRecording:  a continuous.dat file (interleaved int16 samples), memory-mapped read-only.
+                    The number of channels, sample rate and bit volts are read from the
+                    recording's structure.oebin (two directories up), unless given explicitly.
+- runChunked:       processes a recording chunk by chunk on a pool of threads. Within a chunk,
+                    each stage's tasks run in parallel and the stages run one after the other;
+                    all threads then move on to the next chunk together, so that each part of
+                    the file is read from disk once while it is in memory.
+
+*/
+
+namespace PhaseCalculator
+{
+namespace Bench
+{
+    class BinaryRecording
+    {
+    public:
+        /*
+            * Maps the file. numChannels and sampleRate override structure.oebin (0 to read them
+            * from it). Returns false, with a message in getError(), on failure.
+            */
+        bool open (const File& datFile, int numChannelsOverride = 0, double sampleRateOverride = 0)
+        {
+            file = datFile;
+            stream = var();
+            numChannels = numChannelsOverride;
+            sampleRate = sampleRateOverride;
+            bitVolts.clear();
+
+            // .../continuous/<stream folder>/continuous.dat -> .../structure.oebin
+            File oebin = datFile.getParentDirectory().getParentDirectory().getParentDirectory().getChildFile ("structure.oebin");
+            if (oebin.existsAsFile())
+            {
+                structure = JSON::parse (oebin);
+                stream = findStream (structure, datFile.getParentDirectory().getFileName());
+            }
+
+            if (stream.isObject())
+            {
+                numChannels = numChannels > 0 ? numChannels : int (stream["num_channels"]);
+                sampleRate = sampleRate > 0 ? sampleRate : double (stream["sample_rate"]);
+                if (auto channels = stream["channels"].getArray())
+                {
+                    for (const auto& channel : *channels)
+                    {
+                        bitVolts.add (float (double (channel["bit_volts"])));
+                    }
+                }
+            }
+
+            if (numChannels <= 0 || sampleRate <= 0)
+            {
+                error = "the number of channels and sample rate are not in " + oebin.getFullPathName() + "; give them explicitly";
+                return false;
+            }
+
+            bitVolts.resize (numChannels);
+            for (auto& scale : bitVolts)
+            {
+                scale = scale > 0 ? scale : 1.0f;
+            }
+
+            mapped = std::make_unique<MemoryMappedFile> (datFile, MemoryMappedFile::readOnly);
+            if (mapped->getData() == nullptr)
+            {
+                error = "could not map " + datFile.getFullPathName();
+                return false;
+            }
+
+            numSamples = int64 (mapped->getSize() / (sizeof (int16) * size_t (numChannels)));
+            return true;
+        }
+
+        const String& getError() const { return error; }
+
+        const File& getFile() const { return file; }
+
+        int getNumChannels() const { return numChannels; }
+
+        double getSampleRate() const { return sampleRate; }
+
+        int64 getNumSamples() const { return numSamples; }
+
+        float getBitVolts (int chan) const { return bitVolts[chan]; }
+
+        /** The whole structure.oebin, and the entry of this file's stream (void if not found) */
+        const var& getStructure() const { return structure; }
+
+        const var& getStream() const { return stream; }
+
+        const int16* getData() const { return static_cast<const int16*> (mapped->getData()); }
+
+        /** Copies n samples of a channel, from sample start, converted to its units */
+        void readChannel (int chan, int64 start, int n, float* dest) const
+        {
+            const int16* source = getData() + start * numChannels + chan;
+            const float scale = bitVolts[chan];
+            for (int i = 0; i < n; ++i)
+            {
+                dest[i] = scale * float (source[int64 (i) * numChannels]);
+            }
+        }
+
+    private:
+        static var findStream (const var& structure, const String& folderName)
+        {
+            const Array<var>* streams = structure["continuous"].getArray();
+            if (streams == nullptr)
+            {
+                return var();
+            }
+
+            for (const auto& entry : *streams)
+            {
+                if (entry["folder_name"].toString().trimCharactersAtEnd ("/") == folderName)
+                {
+                    return entry;
+                }
+            }
+
+            // a single stream must be this one
+            return streams->size() == 1 ? streams->getReference (0) : var();
+        }
+
+        File file;
+        var structure;
+        var stream;
+        int numChannels = 0;
+        double sampleRate = 0;
+        int64 numSamples = 0;
+        Array<float> bitVolts;
+        std::unique_ptr<MemoryMappedFile> mapped;
+        String error;
+    };
+
+    struct Stage
+    {
+        int numTasks;
+        std::function<void (int task, int64 chunk)> process;
+    };
+
+    /*
+        * For each chunk in order, runs every stage in order, with the tasks of each stage spread
+        * over numThreads threads. afterChunk (if set) runs on one thread once a chunk is done.
+        */
+    inline void runChunked (int numThreads, int64 numChunks, const std::vector<Stage>& stages, const std::function<void (int64 chunk)>& afterChunk = nullptr)
+    {
+        numThreads = jmax (1, numThreads);
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        int64 chunk = 0;
+        size_t stage = 0;
+        int nextTask = 0;
+        int numRunning = 0;
+
+        // threads take tasks from the current stage; the last one to finish a stage moves on
+        auto worker = [&]()
+        {
+            std::unique_lock<std::mutex> lock (mutex);
+            while (chunk < numChunks)
+            {
+                if (stage < stages.size() && nextTask < stages[stage].numTasks)
+                {
+                    int task = nextTask++;
+                    int64 taskChunk = chunk;
+                    size_t taskStage = stage;
+                    ++numRunning;
+
+                    lock.unlock();
+                    stages[taskStage].process (task, taskChunk);
+                    lock.lock();
+
+                    --numRunning;
+                }
+
+                if (numRunning == 0 && (stage >= stages.size() || nextTask >= stages[stage].numTasks))
+                {
+                    // stage complete
+                    nextTask = 0;
+                    if (++stage >= stages.size())
+                    {
+                        if (afterChunk)
+                        {
+                            afterChunk (chunk);
+                        }
+                        stage = 0;
+                        ++chunk;
+                    }
+                    changed.notify_all();
+                }
+                else if (stage >= stages.size() || nextTask >= stages[stage].numTasks)
+                {
+                    changed.wait (lock);
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int t = 1; t < numThreads; ++t)
+        {
+            threads.emplace_back (worker);
+        }
+        worker();
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+} // namespace Bench
+} // namespace PhaseCalculator
+
+#endif // BINARY_RECORDING_H_INCLUDED
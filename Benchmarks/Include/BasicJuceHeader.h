@@ -0,0 +1,39 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BASIC_JUCE_HEADER_H_INCLUDED
+#define BASIC_JUCE_HEADER_H_INCLUDED
+
+/*
+
+Stand-in for the GUI's BasicJuceHeader.h when building the phase engine outside of the
+GUI (benchmarks and offline tools): only juce_core, which the engine sources need, is
+compiled into these executables.
+
+*/
+
+#include <juce_core/juce_core.h>
+
+using namespace juce;
+
+#endif // BASIC_JUCE_HEADER_H_INCLUDED
@@ -0,0 +1,31 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef DSP_LIB_H_INCLUDED
+#define DSP_LIB_H_INCLUDED
+
+// Stand-in for the GUI's DspLib.h outside of the GUI: the filter library itself is
+// compiled from the GUI's sources (see CMakeLists.txt).
+#include <Dsp/Dsp.h>
+
+#endif // DSP_LIB_H_INCLUDED
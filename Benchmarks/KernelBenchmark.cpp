@@ -0,0 +1,583 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Micro-benchmarks of the individual kernels of the phase estimation pipeline, each with the
+sizes it sees in the plugin for every band and sample rate:
+
+- htFilterSamp:     one Hilbert transformer step, per band (built-in, and designed with the same
+                    delay in time at each higher modeling rate), and for transformers designed
+                    at runtime (see HilbertDesigner.h) with each of --delays
+- arPredict:        prediction of Hilbert::delay + 1 samples, per band and sample rate
+- arExtend:         full-rate prediction of Hilbert::delay * dsFactor samples (every polyphase
+                    branch), per band and sample rate
+- htPhaseFullRate:  full-rate transformer output and phase of one block, per band and sample
+                    rate (at the default block size, 512)
+- fitModel:         ARModeler::fitModel over the full history, per sample rate and AR order
+- enqueue:          ReverseStack::enqueue of one block, per sample rate and block size
+- unwrapAndCopy:    ReverseStack::unwrapAndCopy of the full history (with the lock), per sample rate
+- unwrapBuffer:     glitch unwrapping of one block of phase output, with and without a glitch
+- smoothBuffer:     start-of-buffer smoothing of one block of phase output, with and without a glitch
+- bandpass:         Dsp::SimpleFilter bandpass over one block, per band and sample rate
+- resample:         FractionalResampler::process of one block to Hilbert::fs, for sample rates
+                    that are not a multiple of it (1250 and 24414 Hz), per block size
+
+Each kernel is run in batches until the batch takes at least --min-time / --reps seconds, then
+--reps batches are timed and the median is reported as ns per call and ns per item (sample or
+coefficient, as listed). The numbers are meant for comparing kernels and changes on one machine.
+
+Usage: kernel_benchmark [--filter <substring>] [--rates 1000,10000,20000,30000]
+                        [--orders 10,20,40] [--blocks 64,512,2048] [--delays 8,16,32]
+                        [--min-time 0.5] [--reps 5] [--csv]
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+#include <functional>
+
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+// keeps the compiler from discarding the kernels' results
+volatile double sink;
+
+struct KernelOptions
+{
+    String filter;
+    double minTime = 0.5;
+    int reps = 5;
+    bool csv = false;
+};
+
+class KernelRunner
+{
+public:
+    KernelRunner (const KernelOptions& o)
+        : options (o)
+    {
+        if (options.csv)
+        {
+            std::printf ("kernel,args,ns_per_call,ns_per_item,items_per_call\n");
+        }
+        else
+        {
+            std::printf ("%-14s %-34s | %12s %10s %8s\n", "kernel", "args", "ns/call", "ns/item", "items");
+        }
+    }
+
+    /** Times op, which processes itemsPerCall items per call, unless the filter excludes it. */
+    void run (const String& kernel, const String& args, int itemsPerCall, const std::function<void()>& op)
+    {
+        if (options.filter.isNotEmpty() && ! (kernel + " " + args).containsIgnoreCase (options.filter))
+        {
+            return;
+        }
+
+        // find a batch size that takes long enough to time reliably
+        const double repSeconds = options.minTime / jmax (1, options.reps);
+        int64 batch = 1;
+        for (;;)
+        {
+            double seconds = timeBatch (op, batch) / 1e9;
+            if (seconds >= repSeconds || batch >= (int64 (1) << 40))
+            {
+                break;
+            }
+
+            batch = seconds > 0 ? jmax (batch * 2, int64 (batch * 1.2 * repSeconds / seconds)) : batch * 10;
+        }
+
+        std::vector<double> nsPerCall;
+        for (int rep = 0; rep < jmax (1, options.reps); ++rep)
+        {
+            nsPerCall.push_back (timeBatch (op, batch) / double (batch));
+        }
+
+        std::sort (nsPerCall.begin(), nsPerCall.end());
+        double median = nsPerCall[nsPerCall.size() / 2];
+        double perItem = median / jmax (1, itemsPerCall);
+
+        if (options.csv)
+        {
+            std::printf ("%s,\"%s\",%.2f,%.4f,%d\n", kernel.toRawUTF8(), args.toRawUTF8(), median, perItem, itemsPerCall);
+        }
+        else
+        {
+            std::printf ("%-14s %-34s | %12.1f %10.3f %8d\n", kernel.toRawUTF8(), args.toRawUTF8(), median, perItem, itemsPerCall);
+        }
+
+        std::fflush (stdout);
+    }
+
+private:
+    static double timeBatch (const std::function<void()>& op, int64 batch)
+    {
+        auto start = Clock::now();
+        for (int64 i = 0; i < batch; ++i)
+        {
+            op();
+        }
+        return elapsedNs (start, Clock::now());
+    }
+
+    const KernelOptions& options;
+};
+
+String rateArg (int sampleRate)
+{
+    return "fs=" + String (sampleRate);
+}
+
+String bandArg (Band band)
+{
+    return "band=" + Hilbert::bandName[band].replaceCharacter (' ', '_');
+}
+
+int getHistorySize (int sampleRate, int arOrder)
+{
+    // as in ChannelState::configure
+    int dsFactor = ChannelState::getDsFactor (float (sampleRate));
+    return dsFactor * jmax (historyMs * Hilbert::fs / 1000, arOrder + 1, 1 * Hilbert::fs);
+}
+
+/** Fills the stack with synthetic data in the given band */
+void fillHistory (ReverseStack& history, int sampleRate, Band band)
+{
+    double frequency = (Hilbert::defaultBand[band][0] + Hilbert::defaultBand[band][1]) / 2;
+    SyntheticSignal signal (sampleRate, frequency, 1.0, 2.0, 1);
+
+    std::vector<float> data (history.size());
+    signal.generate (data.data(), int (data.size()));
+    history.enqueue (data.data(), int (data.size()));
+}
+
+/*
+    * Phase output in degrees for one block: a ramp at the given frequency, continuing from
+    * lastPhase. With a glitch, the first few samples dip below lastPhase (as smoothBuffer
+    * looks for) and there is a spurious wrap in the middle (as unwrapBuffer looks for).
+    */
+std::vector<float> makePhaseBlock (int blockSize, int sampleRate, double frequency, float lastPhase, bool glitch)
+{
+    std::vector<float> block (blockSize);
+    double step = 360 * frequency / sampleRate;
+    double phase = lastPhase;
+    for (int i = 0; i < blockSize; ++i)
+    {
+        phase += step;
+        if (phase > 180)
+        {
+            phase -= 360;
+        }
+        block[i] = float (phase);
+    }
+
+    if (glitch)
+    {
+        for (int i = 0; i < jmin (10, blockSize); ++i)
+        {
+            block[i] = lastPhase - 1 - i * float (step);
+        }
+
+        int mid = blockSize / 2;
+        for (int i = mid; i < jmin (mid + 20, blockSize); ++i)
+        {
+            block[i] += block[i] > 0 ? -360.0f : 360.0f;
+        }
+    }
+
+    return block;
+}
+
+void printUsage()
+{
+    std::printf ("Usage: kernel_benchmark [--filter <substring>] [--rates 1000,10000,20000,30000]\n"
+                 "                        [--orders 10,20,40] [--blocks 64,512,2048] [--delays 8,16,32]\n"
+                 "                        [--min-time 0.5] [--reps 5] [--csv]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    Array<int> rates ({ 1000, 10000, 20000, 30000 });
+    Array<int> orders ({ 10, 20, 40 });
+    Array<int> blocks ({ 64, 512, 2048 });
+    Array<int> delays ({ 8, 16, 32 });
+    const int defaultRate = 30000;
+    const int defaultOrder = 20;
+    const int defaultBlock = 512;
+
+    KernelOptions options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+
+        if (arg == "--csv")
+        {
+            options.csv = true;
+            continue;
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (i + 1 >= argc)
+        {
+            printUsage();
+            return 1;
+        }
+
+        String value (argv[++i]);
+        if (arg == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (arg == "--rates")
+        {
+            rates = parseList (value);
+        }
+        else if (arg == "--orders")
+        {
+            orders = parseList (value);
+        }
+        else if (arg == "--blocks")
+        {
+            blocks = parseList (value);
+        }
+        else if (arg == "--delays")
+        {
+            delays = parseList (value);
+        }
+        else if (arg == "--min-time")
+        {
+            options.minTime = value.getDoubleValue();
+        }
+        else if (arg == "--reps")
+        {
+            options.reps = value.getIntValue();
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    for (int i = rates.size(); --i >= 0;)
+    {
+        if (ChannelState::getDsFactor (float (rates[i])) == 0)
+        {
+            std::fprintf (stderr, "Skipping sample rate %d (must be a multiple of %d Hz)\n", rates[i], Hilbert::fs);
+            rates.remove (i);
+        }
+    }
+
+    orders.removeIf ([] (int order) { return order <= 0; });
+    blocks.removeIf ([] (int block) { return block <= 0; });
+    delays.removeIf ([] (int delay) { return delay <= 0 || delay > Hilbert::maxDesignDelay; });
+
+    KernelRunner runner (options);
+
+    // ---- htFilterSamp ----
+    auto runTransformer = [&] (const String& args, const Hilbert::Transformer& transformer)
+    {
+        Array<double> state;
+        state.insertMultiple (0, 0.0, transformer.delay * 2 + 1);
+
+        SyntheticSignal signal (Hilbert::fs, 10, 1.0, 2.0, 1);
+        std::vector<float> input (1024);
+        signal.generate (input.data(), int (input.size()));
+        size_t ind = 0;
+
+        runner.run ("htFilterSamp",
+                    args + " taps=" + String (transformer.delay),
+                    transformer.delay,
+                    [&]
+                    {
+                        sink = PhaseEngine::htFilterSamp (input[ind], transformer, state);
+                        ind = (ind + 1) % input.size();
+                    });
+    };
+
+    for (int b = 0; b < NUM_BANDS; ++b)
+    {
+        runTransformer (bandArg (Band (b)), *Hilbert::getBuiltIn (Band (b)));
+
+        // the transformers used at the other modeling rates, which also run more often
+        for (int modelRate : EngineParams::getModelRates())
+        {
+            if (modelRate != Hilbert::fs)
+            {
+                EngineParams params;
+                params.band = Band (b);
+                params.lowCut = Hilbert::defaultBand[b][0];
+                params.highCut = Hilbert::defaultBand[b][1];
+                params.modelRate = modelRate;
+                params.updateTransformer();
+                runTransformer (bandArg (Band (b)) + " rate=" + String (modelRate), *params.transformer);
+            }
+        }
+    }
+
+    for (int delay : delays)
+    {
+        const Array<float>& passband = Hilbert::defaultBand[ALPHA_THETA];
+        runTransformer ("designed", *Hilbert::getDesign (Hilbert::fs, passband[0], passband[1], delay));
+    }
+
+    // ---- arPredict ----
+    for (int b = 0; b < NUM_BANDS; ++b)
+    {
+        Band band = Band (b);
+        for (int fs : rates)
+        {
+            int stride = ChannelState::getDsFactor (float (fs));
+            int historySize = getHistorySize (fs, defaultOrder);
+
+            ReverseStack history (historySize);
+            fillHistory (history, fs, band);
+
+            ARModeler modeler (defaultOrder, historySize, stride);
+            Array<double> reverseData;
+            reverseData.resize (historySize);
+            history.unwrapAndCopy (reverseData.getRawDataPointer(), false);
+            modeler.fitModel (reverseData);
+
+            Array<double, CriticalSection> params;
+            modeler.getModel (params);
+
+            int samps = Hilbert::delay[band] + 1;
+            std::vector<double> prediction (samps);
+
+            runner.run ("arPredict",
+                        bandArg (band) + " " + rateArg (fs) + " order=" + String (defaultOrder),
+                        samps,
+                        [&]
+                        {
+                            PhaseEngine::arPredict (history, 0, prediction.data(), params.getRawDataPointer(), samps, stride, defaultOrder);
+                            sink = prediction[0];
+                        });
+        }
+    }
+
+    // ---- full-rate prediction and transformer ----
+    for (int b = 0; b < NUM_BANDS; ++b)
+    {
+        Band band = Band (b);
+        const Hilbert::Transformer& transformer = *Hilbert::getBuiltIn (band);
+        for (int fs : rates)
+        {
+            int stride = ChannelState::getDsFactor (float (fs));
+            int historySize = getHistorySize (fs, defaultOrder);
+
+            ReverseStack history (historySize);
+            fillHistory (history, fs, band);
+
+            ARModeler modeler (defaultOrder, historySize, stride);
+            Array<double> reverseData;
+            reverseData.resize (historySize);
+            history.unwrapAndCopy (reverseData.getRawDataPointer(), false);
+            modeler.fitModel (reverseData);
+
+            Array<double, CriticalSection> params;
+            modeler.getModel (params);
+
+            // as laid out by PhaseEngine: the past, one block and the prediction, in time order
+            const int blockSize = 512;
+            const int span = transformer.delay * stride;
+            const int nPast = jmax (transformer.delay, defaultOrder) * stride;
+            std::vector<double> data (size_t (nPast + blockSize + span));
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                data[i] = reverseData[int (data.size() - 1 - i)];
+            }
+            std::vector<float> phase (blockSize);
+
+            runner.run ("arExtend",
+                        bandArg (band) + " " + rateArg (fs) + " order=" + String (defaultOrder),
+                        span,
+                        [&]
+                        {
+                            PhaseEngine::arExtend (data.data(), nPast + blockSize, span, params.getRawDataPointer(), stride, defaultOrder);
+                            sink = data.back();
+                        });
+
+            runner.run ("htPhaseFullRate",
+                        bandArg (band) + " " + rateArg (fs) + " block=" + String (blockSize),
+                        blockSize,
+                        [&]
+                        {
+                            PhaseEngine::htPhaseFullRate (data.data() + nPast, phase.data(), blockSize, transformer, stride, 1.0);
+                            sink = phase[0];
+                        });
+        }
+    }
+
+    // ---- fitModel ----
+    for (int fs : rates)
+    {
+        for (int order : orders)
+        {
+            int stride = ChannelState::getDsFactor (float (fs));
+            int historySize = getHistorySize (fs, order);
+
+            ReverseStack history (historySize);
+            fillHistory (history, fs, ALPHA_THETA);
+
+            Array<double> reverseData;
+            reverseData.resize (historySize);
+            history.unwrapAndCopy (reverseData.getRawDataPointer(), false);
+
+            ARModeler modeler (order, historySize, stride);
+
+            runner.run ("fitModel",
+                        rateArg (fs) + " order=" + String (order),
+                        historySize / stride,
+                        [&] { modeler.fitModel (reverseData); });
+        }
+    }
+
+    // ---- ReverseStack ----
+    for (int fs : rates)
+    {
+        int historySize = getHistorySize (fs, defaultOrder);
+        ReverseStack history (historySize);
+        fillHistory (history, fs, ALPHA_THETA);
+
+        for (int blockSize : blocks)
+        {
+            std::vector<float> block (blockSize);
+            SyntheticSignal signal (fs, 10, 1.0, 2.0, 1);
+            signal.generate (block.data(), blockSize);
+
+            runner.run ("enqueue",
+                        rateArg (fs) + " block=" + String (blockSize),
+                        blockSize,
+                        [&] { history.enqueue (block.data(), blockSize); });
+        }
+
+        std::vector<double> dest (historySize);
+        runner.run ("unwrapAndCopy",
+                    rateArg (fs) + " history=" + String (historySize),
+                    historySize,
+                    [&]
+                    {
+                        history.unwrapAndCopy (dest.data(), true);
+                        sink = dest[0];
+                    });
+    }
+
+    // ---- unwrapBuffer / smoothBuffer ----
+    for (int blockSize : blocks)
+    {
+        for (bool glitch : { false, true })
+        {
+            const float lastPhase = 100;
+            std::vector<float> source = makePhaseBlock (blockSize, defaultRate, 8, lastPhase, glitch);
+            std::vector<float> block (blockSize);
+            String args = "block=" + String (blockSize) + (glitch ? " glitch" : " clean");
+
+            // (includes restoring the block, which is small next to the kernels)
+            runner.run ("unwrapBuffer",
+                        args,
+                        blockSize,
+                        [&]
+                        {
+                            std::copy (source.begin(), source.end(), block.begin());
+                            PhaseEngine::unwrapBuffer (block.data(), blockSize, lastPhase);
+                            sink = block[blockSize - 1];
+                        });
+
+            runner.run ("smoothBuffer",
+                        args,
+                        blockSize,
+                        [&]
+                        {
+                            std::copy (source.begin(), source.end(), block.begin());
+                            PhaseEngine::smoothBuffer (block.data(), blockSize, lastPhase);
+                            sink = block[blockSize - 1];
+                        });
+        }
+    }
+
+    // ---- resample ----
+    for (int fs : { 1250, 24414 })
+    {
+        for (int blockSize : blocks)
+        {
+            FractionalResampler resampler;
+            resampler.setRates (fs, Hilbert::fs, blockSize);
+
+            std::vector<float> block (blockSize);
+            SyntheticSignal signal (fs, 10, 1.0, 2.0, 1);
+            signal.generate (block.data(), blockSize);
+            std::vector<float> output (resampler.getMaxOutput (blockSize));
+
+            runner.run ("resample",
+                        rateArg (fs) + " block=" + String (blockSize),
+                        blockSize,
+                        [&] { sink = resampler.process (block.data(), blockSize, output.data()); });
+        }
+    }
+
+    // ---- bandpass ----
+    for (int b = 0; b < NUM_BANDS; ++b)
+    {
+        Band band = Band (b);
+        float lowCut = Hilbert::defaultBand[band][0];
+        float highCut = Hilbert::defaultBand[band][1];
+
+        for (int fs : rates)
+        {
+            ChannelState::BandpassFilter filter;
+            filter.setup (2, fs, (highCut + lowCut) / 2, highCut - lowCut);
+
+            std::vector<float> source (defaultBlock);
+            SyntheticSignal signal (fs, (highCut + lowCut) / 2, 1.0, 2.0, 1);
+            signal.generate (source.data(), defaultBlock);
+            std::vector<float> block (defaultBlock);
+
+            // (includes restoring the block; filtering the output again and again would end in denormals)
+            runner.run ("bandpass",
+                        bandArg (band) + " " + rateArg (fs) + " block=" + String (defaultBlock),
+                        defaultBlock,
+                        [&]
+                        {
+                            std::copy (source.begin(), source.end(), block.begin());
+                            float* channel = block.data();
+                            filter.process (defaultBlock, &channel);
+                            sink = block[0];
+                        });
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef OFFLINE_PHASE_H_INCLUDED
+#define OFFLINE_PHASE_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#include "PhaseEngine.h"
+
+/*
+
+Offline ("ground truth") phase of a whole recording, for evaluating the real-time output:
+the data is filtered forward and backward with the same bandpass filter design as the
+real-time path (so the result has zero phase delay), and the phase is the argument of the
+analytic signal obtained with an FFT-based Hilbert transform over the entire record.
+
+The FFT is a plain radix-2 implementation so that the benchmarks don't need the FFTW library;
+the record is zero-padded to a power of two. Results near either end of the record are
+affected by edge effects and should be excluded from comparisons.
+
+*/
+
+namespace PhaseCalculator
+{
+namespace OfflinePhase
+{
+    /** In-place radix-2 FFT (inverse if inverse is true, without the 1/n scaling). n must be a power of 2. */
+    inline void fft (std::complex<double>* x, int n, bool inverse)
+    {
+        // bit reversal permutation
+        for (int i = 1, j = 0; i < n; ++i)
+        {
+            int bit = n >> 1;
+            for (; j & bit; bit >>= 1)
+            {
+                j ^= bit;
+            }
+            j ^= bit;
+
+            if (i < j)
+            {
+                std::swap (x[i], x[j]);
+            }
+        }
+
+        for (int len = 2; len <= n; len <<= 1)
+        {
+            double angle = (inverse ? 2 : -2) * Dsp::doublePi / len;
+            std::complex<double> wLen (std::cos (angle), std::sin (angle));
+
+            for (int i = 0; i < n; i += len)
+            {
+                std::complex<double> w (1);
+                for (int k = 0; k < len / 2; ++k)
+                {
+                    std::complex<double> u = x[i + k];
+                    std::complex<double> v = x[i + k + len / 2] * w;
+                    x[i + k] = u + v;
+                    x[i + k + len / 2] = u - v;
+                    w *= wLen;
+                }
+            }
+        }
+    }
+
+    /*
+        * Computes the zero-phase bandpass-filtered analytic phase (in radians) of numSamples
+        * of data and writes it to phaseOut.
+        */
+    inline void compute (const float* data, int numSamples, float sampleRate, float lowCut, float highCut, double* phaseOut)
+    {
+        if (numSamples <= 0)
+        {
+            return;
+        }
+
+        ChannelState::BandpassFilter filter;
+        filter.setup (2, sampleRate, (highCut + lowCut) / 2, highCut - lowCut);
+
+        std::vector<float> filtered (data, data + numSamples);
+        float* channel = filtered.data();
+
+        // forward, then backward
+        filter.process (numSamples, &channel);
+        std::reverse (filtered.begin(), filtered.end());
+        filter.reset();
+        filter.process (numSamples, &channel);
+        std::reverse (filtered.begin(), filtered.end());
+
+        int n = nextPowerOfTwo (numSamples);
+        std::vector<std::complex<double>> spectrum (n);
+        for (int i = 0; i < numSamples; ++i)
+        {
+            spectrum[i] = filtered[i];
+        }
+
+        fft (spectrum.data(), n, false);
+
+        // analytic signal: double the positive frequencies, zero the negative ones
+        for (int i = 1; i < n / 2; ++i)
+        {
+            spectrum[i] *= 2;
+        }
+        for (int i = n / 2 + 1; i < n; ++i)
+        {
+            spectrum[i] = 0;
+        }
+
+        fft (spectrum.data(), n, true);
+
+        for (int i = 0; i < numSamples; ++i)
+        {
+            phaseOut[i] = std::arg (spectrum[i]);
+        }
+    }
+} // namespace OfflinePhase
+} // namespace PhaseCalculator
+
+#endif // OFFLINE_PHASE_H_INCLUDED
@@ -0,0 +1,493 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Computes the plugin's phase output for a whole Open Ephys binary recording (a continuous.dat
+file), as fast as the disk and CPUs allow instead of in real time. The input is read in place
+through a memory mapping, and the channels are processed in parallel on all cores, chunk by
+chunk (see runChunked in BinaryRecording.h). Each channel goes through the same engine as in the
+plugin (bandpass filter, AR prediction and Hilbert transformer), in blocks of --block samples,
+and its AR model is refit inline after every --refresh ms of signal time, so the output is
+deterministic.
+
+The output is a recording in the same format: a continuous.dat with the same channels, in which
+the processed channels hold the phase (in units of 0.01 degrees, i.e. with a bit_volts of 0.01)
+and the others are copied unchanged. If the input is part of a recording with a structure.oebin,
+the output directory gets the same layout (structure.oebin, continuous/<stream>/continuous.dat
+and the stream's sample numbers and timestamps), so it can be loaded with the usual tools.
+
+Usage: phase_batch <continuous.dat> --output <dir> [--channels <list>] [--band <n>]
+                   [--low <Hz>] [--high <Hz>] [--ht-delay <n>] [--model-rate <Hz>] [--order <n>]
+                   [--refresh <ms>] [--full-rate] [--horizon <ms>] [--block <n>] [--threads <n>]
+                   [--num-channels <n> --sample-rate <Hz>]
+
+--num-channels and --sample-rate are only needed without a structure.oebin. Channels are
+0-based indices within the file (default: all). --ht-delay is the "HT Delay" setting of the
+plugin: 0 (the default) uses the band's built-in Hilbert transformer. --model-rate is the
+"Model Rate" setting (500, the default, 1000 or 2000 Hz), and --full-rate turns on the "Full
+Rate" setting (the Hilbert transformer is evaluated at every sample rather than interpolated).
+--horizon is the "Horizon" setting: each output sample is the phase predicted that many ms ahead.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+#include <cstring> // memcpy
+
+#include "BinaryRecording.h"
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+// phase resolution of the output, in degrees per bit
+const float phaseBitVolts = 0.01f;
+
+// signal time processed by all threads before moving on together
+const double chunkSeconds = 10;
+
+struct BatchConfig
+{
+    EngineParams params;
+    int refreshMs = 50;
+    int blockSize = 1024;
+    int numThreads = 0;
+    Array<int> channels;
+};
+
+/** One processed channel: its engine state and scratch space */
+struct ChannelJob
+{
+    ChannelJob (int chan, const EngineParams& params, float sampleRate, int refreshMs, int blockSize)
+        : channel (chan),
+          refreshSamples (jmax (int64 (1), int64 (refreshMs * double (sampleRate) / 1000))),
+          samplesToRefresh (refreshSamples),
+          block (size_t (blockSize))
+    {
+        state.configure (params, sampleRate, historyMs);
+        reverseData.resize (state.history.size());
+        engine.setTimingEnabled (false);
+    }
+
+    const int channel;
+    const int64 refreshSamples;
+    int64 samplesToRefresh;
+
+    ChannelState state;
+    PhaseEngine engine;
+    Array<double> reverseData;
+    HeapBlock<float> block;
+};
+
+bool setFileLength (const File& file, int64 length)
+{
+    FileOutputStream stream (file);
+    if (stream.failedToOpen() || ! stream.setPosition (0) || ! stream.truncate().wasOk())
+    {
+        return false;
+    }
+
+    if (length > 0 && (! stream.setPosition (length - 1) || ! stream.writeByte (0)))
+    {
+        return false;
+    }
+
+    stream.flush();
+    return stream.getStatus().wasOk();
+}
+
+/** Writes structure.oebin for the output, describing the processed channels as phase */
+bool writeStructure (const BinaryRecording& recording, const BatchConfig& config, const File& outDir)
+{
+    // a deep copy, since vars share their objects
+    var structure = JSON::parse (JSON::toString (recording.getStructure()));
+    var stream = JSON::parse (JSON::toString (recording.getStream()));
+
+    if (auto channels = stream["channels"].getArray())
+    {
+        for (int chan : config.channels)
+        {
+            if (auto channel = channels->getReference (chan).getDynamicObject())
+            {
+                channel->setProperty ("bit_volts", phaseBitVolts);
+                channel->setProperty ("units", "degrees");
+                channel->setProperty ("description",
+                                      "Phase of " + channel->getProperty ("channel_name").toString() + " ("
+                                          + Hilbert::bandName[config.params.band] + ", " + String (config.params.lowCut, 1) + "-"
+                                          + String (config.params.highCut, 1) + " Hz, HT delay " + String (config.params.transformer->delay)
+                                          + " at " + String (config.params.modelRate) + " Hz"
+                                          + (config.params.horizonMs > 0 ? ", " + String (config.params.horizonMs, 1) + " ms ahead" : String())
+                                          + ", AR order " + String (config.params.arOrder) + ")");
+            }
+        }
+    }
+
+    // only this stream is written
+    if (auto object = structure.getDynamicObject())
+    {
+        object->setProperty ("continuous", Array<var> { stream });
+        object->setProperty ("events", Array<var>());
+        object->setProperty ("spikes", Array<var>());
+    }
+
+    return outDir.getChildFile ("structure.oebin").replaceWithText (JSON::toString (structure));
+}
+
+bool runBatch (const BinaryRecording& recording, const BatchConfig& config, const File& outFile)
+{
+    const int numChannels = recording.getNumChannels();
+    const int64 numSamples = recording.getNumSamples();
+    const float fs = float (recording.getSampleRate());
+    const int blockSize = config.blockSize;
+
+    const int64 bytes = numSamples * numChannels * int64 (sizeof (int16));
+    if (! setFileLength (outFile, bytes))
+    {
+        std::printf ("Error: could not create %s\n", outFile.getFullPathName().toRawUTF8());
+        return false;
+    }
+
+    MemoryMappedFile outMap (outFile, MemoryMappedFile::readWrite);
+    if (bytes > 0 && outMap.getData() == nullptr)
+    {
+        std::printf ("Error: could not map %s\n", outFile.getFullPathName().toRawUTF8());
+        return false;
+    }
+
+    const int16* in = recording.getData();
+    int16* out = static_cast<int16*> (outMap.getData());
+
+    OwnedArray<ChannelJob> jobs;
+    for (int chan : config.channels)
+    {
+        jobs.add (new ChannelJob (chan, config.params, fs, config.refreshMs, blockSize));
+    }
+
+    const int64 chunkSamples = jmax (int64 (1), int64 (chunkSeconds * fs / blockSize)) * blockSize;
+    const int64 numChunks = (numSamples + chunkSamples - 1) / chunkSamples;
+
+    // per chunk: copy all channels (one task), then overwrite the processed ones (one task each)
+    Stage copyStage = { 1, [&] (int, int64 chunk)
+                        {
+                            int64 start = chunk * chunkSamples;
+                            int64 end = jmin (numSamples, start + chunkSamples);
+                            std::memcpy (out + start * numChannels, in + start * numChannels, size_t (end - start) * size_t (numChannels) * sizeof (int16));
+                        } };
+
+    Stage processStage = { jobs.size(), [&] (int task, int64 chunk)
+                           {
+                               ChannelJob& job = *jobs[task];
+                               int64 end = jmin (numSamples, (chunk + 1) * chunkSamples);
+
+                               for (int64 start = chunk * chunkSamples; start < end; start += blockSize)
+                               {
+                                   int n = int (jmin (int64 (blockSize), end - start));
+                                   recording.readChannel (job.channel, start, n, job.block);
+                                   job.engine.processChannel (config.params, job.state, job.block, n);
+
+                                   int16* dest = out + start * numChannels + job.channel;
+                                   for (int i = 0; i < n; ++i)
+                                   {
+                                       dest[int64 (i) * numChannels] = int16 (roundToInt (job.block[i] / phaseBitVolts));
+                                   }
+
+                                   job.samplesToRefresh -= n;
+                                   if (job.samplesToRefresh <= 0)
+                                   {
+                                       job.samplesToRefresh += job.refreshSamples * (1 + (-job.samplesToRefresh) / job.refreshSamples);
+                                       job.state.fitModel (job.reverseData);
+                                   }
+                               }
+                           } };
+
+    int lastPercent = -1;
+    auto progress = [&] (int64 chunk)
+    {
+        int percent = int (100 * (chunk + 1) / numChunks);
+        if (percent / 10 != lastPercent / 10)
+        {
+            lastPercent = percent;
+            std::printf ("%d%%\n", percent);
+            std::fflush (stdout);
+        }
+    };
+
+    runChunked (config.numThreads, numChunks, { copyStage, processStage }, progress);
+    return true;
+}
+
+void printUsage()
+{
+    std::printf ("Usage: phase_batch <continuous.dat> --output <dir> [--channels <list>] [--band <n>]\n"
+                 "                   [--low <Hz>] [--high <Hz>] [--ht-delay <n>] [--model-rate <Hz>] [--order <n>]\n"
+                 "                   [--refresh <ms>] [--full-rate] [--horizon <ms>] [--block <n>] [--threads <n>]\n"
+                 "                   [--num-channels <n> --sample-rate <Hz>]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    File inputFile;
+    File outDir;
+    BatchConfig config;
+    String channelList;
+    int numChannelsOverride = 0;
+    double sampleRateOverride = 0;
+    float lowCut = -1, highCut = -1;
+
+    config.params.band = ALPHA_THETA;
+    config.params.arOrder = 20;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+        String value = i + 1 < argc ? String (argv[i + 1]) : String();
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--full-rate")
+        {
+            config.params.fullRate = true;
+            continue;
+        }
+        else if (hasValue && arg == "--output")
+        {
+            outDir = File::getCurrentWorkingDirectory().getChildFile (value);
+        }
+        else if (hasValue && arg == "--channels")
+        {
+            channelList = value;
+        }
+        else if (hasValue && arg == "--band")
+        {
+            int band = value.getIntValue();
+            if (band < 0 || band >= NUM_BANDS)
+            {
+                std::printf ("Error: the band must be from 0 to %d\n", NUM_BANDS - 1);
+                return 1;
+            }
+            config.params.band = Band (band);
+        }
+        else if (hasValue && arg == "--low")
+        {
+            lowCut = value.getFloatValue();
+        }
+        else if (hasValue && arg == "--high")
+        {
+            highCut = value.getFloatValue();
+        }
+        else if (hasValue && arg == "--ht-delay")
+        {
+            config.params.htDelay = value.getIntValue();
+            if (config.params.htDelay < 0 || config.params.htDelay > Hilbert::maxDesignDelay)
+            {
+                std::printf ("Error: the Hilbert transformer delay must be from 0 to %d\n", Hilbert::maxDesignDelay);
+                return 1;
+            }
+        }
+        else if (hasValue && arg == "--model-rate")
+        {
+            config.params.modelRate = value.getIntValue();
+            if (! EngineParams::getModelRates().contains (config.params.modelRate))
+            {
+                std::printf ("Error: the modeling rate must be 500, 1000 or 2000 Hz\n");
+                return 1;
+            }
+        }
+        else if (hasValue && arg == "--horizon")
+        {
+            config.params.horizonMs = value.getFloatValue();
+            if (config.params.horizonMs < 0 || config.params.horizonMs > EngineParams::maxHorizonMs)
+            {
+                std::printf ("Error: the horizon must be from 0 to %.0f ms\n", double (EngineParams::maxHorizonMs));
+                return 1;
+            }
+        }
+        else if (hasValue && arg == "--order")
+        {
+            config.params.arOrder = value.getIntValue();
+        }
+        else if (hasValue && arg == "--refresh")
+        {
+            config.refreshMs = value.getIntValue();
+        }
+        else if (hasValue && arg == "--block")
+        {
+            config.blockSize = value.getIntValue();
+        }
+        else if (hasValue && arg == "--threads")
+        {
+            config.numThreads = value.getIntValue();
+        }
+        else if (hasValue && arg == "--num-channels")
+        {
+            numChannelsOverride = value.getIntValue();
+        }
+        else if (hasValue && arg == "--sample-rate")
+        {
+            sampleRateOverride = value.getDoubleValue();
+        }
+        else if (! arg.startsWith ("--") && inputFile == File())
+        {
+            inputFile = File::getCurrentWorkingDirectory().getChildFile (arg);
+            continue;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if (inputFile == File() || outDir == File())
+    {
+        printUsage();
+        return 1;
+    }
+
+    BinaryRecording recording;
+    if (! recording.open (inputFile, numChannelsOverride, sampleRateOverride))
+    {
+        std::printf ("Error: %s\n", recording.getError().toRawUTF8());
+        return 1;
+    }
+
+    const Band band = config.params.band;
+    config.params.lowCut = lowCut >= 0 ? lowCut : Hilbert::defaultBand[band][0];
+    config.params.highCut = highCut >= 0 ? highCut : Hilbert::defaultBand[band][1];
+
+    const Array<float> validBand = config.params.getValidBand();
+    if (config.params.lowCut < validBand[0] || config.params.highCut > validBand[1]
+        || config.params.lowCut >= config.params.highCut)
+    {
+        std::printf ("Error: the passband must be within %.1f-%.1f Hz for the %s\n",
+                     validBand[0],
+                     validBand[1],
+                     config.params.htDelay > 0 ? "designed Hilbert transformers" : (Hilbert::bandName[band] + " band").toRawUTF8());
+        return 1;
+    }
+
+    config.params.updateTransformer();
+
+    if (config.params.arOrder < 1 || config.refreshMs < 1 || config.blockSize < 1)
+    {
+        std::printf ("Error: the AR order, refresh interval and block size must be positive\n");
+        return 1;
+    }
+
+    if (! ChannelState::isSupportedRate (float (recording.getSampleRate()), config.params.modelRate))
+    {
+        std::printf ("Error: the sample rate (%.1f Hz) is below the %d Hz modeling rate\n", recording.getSampleRate(), config.params.modelRate);
+        return 1;
+    }
+
+    for (int chan : parseList (channelList))
+    {
+        if (chan < 0 || chan >= recording.getNumChannels())
+        {
+            std::printf ("Error: channel %d is not in the file (%d channels)\n", chan, recording.getNumChannels());
+            return 1;
+        }
+        config.channels.addIfNotAlreadyThere (chan);
+    }
+
+    if (config.channels.isEmpty())
+    {
+        for (int chan = 0; chan < recording.getNumChannels(); ++chan)
+        {
+            config.channels.add (chan);
+        }
+    }
+
+    if (config.numThreads <= 0)
+    {
+        config.numThreads = jmax (1, int (std::thread::hardware_concurrency()));
+    }
+
+    // mirror the recording's layout if it has one
+    const bool hasStructure = recording.getStream().isObject();
+    const File inDir = inputFile.getParentDirectory();
+    const File outStreamDir = hasStructure ? outDir.getChildFile ("continuous").getChildFile (inDir.getFileName()) : outDir;
+
+    if (outStreamDir.getChildFile ("continuous.dat") == inputFile || ! outStreamDir.createDirectory())
+    {
+        std::printf ("Error: cannot write to %s\n", outStreamDir.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    std::printf ("%s: %d of %d channels, %.1f s at %.0f Hz; band %s (%.1f-%.1f Hz), HT delay %d%s at %d Hz%s, horizon %.1f ms, AR order %d, refresh %d ms, %d threads\n",
+                 inputFile.getFullPathName().toRawUTF8(),
+                 config.channels.size(),
+                 recording.getNumChannels(),
+                 recording.getNumSamples() / recording.getSampleRate(),
+                 recording.getSampleRate(),
+                 Hilbert::bandName[band].toRawUTF8(),
+                 config.params.lowCut,
+                 config.params.highCut,
+                 config.params.transformer->delay,
+                 config.params.htDelay > 0 ? " (designed)" : "",
+                 config.params.modelRate,
+                 config.params.fullRate ? " (full rate)" : "",
+                 config.params.horizonMs,
+                 config.params.arOrder,
+                 config.refreshMs,
+                 config.numThreads);
+
+    auto start = Clock::now();
+    if (! runBatch (recording, config, outStreamDir.getChildFile ("continuous.dat")))
+    {
+        return 1;
+    }
+    double seconds = elapsedNs (start, Clock::now()) / 1e9;
+
+    if (hasStructure)
+    {
+        for (auto name : { "sample_numbers.npy", "timestamps.npy" })
+        {
+            File source = inDir.getChildFile (name);
+            if (source.existsAsFile() && ! source.copyFileTo (outStreamDir.getChildFile (name)))
+            {
+                std::printf ("Warning: could not copy %s\n", source.getFullPathName().toRawUTF8());
+            }
+        }
+
+        if (! writeStructure (recording, config, outDir))
+        {
+            std::printf ("Error: could not write %s\n", outDir.getChildFile ("structure.oebin").getFullPathName().toRawUTF8());
+            return 1;
+        }
+    }
+
+    const double signalSeconds = recording.getNumSamples() / recording.getSampleRate();
+    std::printf ("done in %.1f s: %.1fx real time, %.1f MB/s, %.1f ns/samp/ch per thread\n",
+                 seconds,
+                 seconds > 0 ? signalSeconds / seconds : 0.0,
+                 seconds > 0 ? recording.getNumSamples() * recording.getNumChannels() * sizeof (int16) / seconds / 1e6 : 0.0,
+                 recording.getNumSamples() > 0 ? seconds * 1e9 * config.numThreads / (double (recording.getNumSamples()) * config.channels.size()) : 0.0);
+    std::printf ("output: %s (phase in units of %.2f degrees)\n", outStreamDir.getChildFile ("continuous.dat").getFullPathName().toRawUTF8(), phaseBitVolts);
+    return 0;
+}
@@ -0,0 +1,608 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Headless throughput benchmark of the real-time phase estimation pipeline.
+
+Synthetic signals (a sinusoid in the band of interest plus 1/f noise) are fed, one block at a
+time, through PhaseEngine::processChannel for every channel, exactly as Node::process does.
+The AR models are refit every --refresh ms of signal time, inline but timed separately, as
+Node::run would do on its own thread. Configurations vary the number of channels, sample rate,
+band, AR order, block size and modeling rate (the rate at which the AR model and Hilbert
+transformer run, see PhaseEngine.h). For each configuration, reports:
+
+- ns/samp/ch:   processing time per sample and channel
+- p50/p99/max:  time to process one block of all channels, in microseconds
+- p99 load:     p99 block time as a percentage of the block's duration (real-time budget)
+- fit us:       mean time of one AR model fit (one channel)
+- refits/s:     number of channel refits per second of CPU time
+
+Usage: phase_benchmark [--sweep one|full] [--channels 1,4,16,64] [--rates 1000,10000,30000]
+                       [--bands 0,1,2,3,4] [--orders 10,20,40] [--blocks 64,512,2048]
+                       [--model-rates 500,1000,2000] [--seconds 10] [--refresh 50] [--full-rate]
+                       [--horizon <ms>] [--endpoint] [--csv]
+
+With "--sweep one" (the default), each parameter is varied in turn while the others are held at
+the baseline (16 channels, 30000 Hz, band 0, order 20, 512-sample blocks, 500 Hz modeling rate);
+with "--sweep full", every combination is run. A list given on the command line replaces the
+corresponding values. Configurations whose sample rate is below the modeling rate are skipped.
+
+Accuracy mode (--mode accuracy) instead runs every combination of band, AR order, AR refresh
+interval and modeling rate (only 500 Hz unless --model-rates is given) over a fixed set of channels and compares each output sample with the zero-phase
+offline phase of the same data (see OfflinePhase.h), next to the CPU cost of that setting:
+
+- mean err:     circular mean of the error (online - offline), in degrees
+- circ std:     circular standard deviation of the error, in degrees
+- MAE / p95:    mean and 95th percentile of the absolute error, in degrees
+- ns/samp/ch:   as above
+- fit us:       as above
+- CPU %:        processing and AR refit time as a percentage of real time, per channel
+
+The first second after the models are first fit and the last second of the record are not
+evaluated. With --target <degrees>, the cheapest setting of each band whose MAE is within the
+target is listed at the end.
+
+Usage: phase_benchmark --mode accuracy [--channels 4] [--rates 30000] [--bands 0,1,2,3,4]
+                       [--orders 10,20,40] [--refreshes 10,50,200] [--blocks 512]
+                       [--model-rates 500] [--seconds 10] [--target 30] [--full-rate]
+                       [--horizon <ms>] [--endpoint] [--csv]
+                       [--input continuous.dat --input-channels <n> --input-rate <fs>]
+
+Only the first value of --channels, --rates and --blocks is used. By default the data is
+synthetic; --input reads a recording of interleaved 16-bit samples instead (e.g. an Open Ephys
+binary format continuous.dat file), using its first --channels channels.
+
+In both modes, --full-rate evaluates the Hilbert transformer at every sample instead of
+interpolating the phase (the plugin's "Full Rate" option; see PhaseEngine.h), and --horizon
+outputs the phase predicted that many ms ahead (the plugin's "Horizon" option). In accuracy
+mode, each output is then compared with the offline phase of the sample that much later.
+--endpoint uses the endpoint-corrected Hilbert transform instead of AR prediction (the plugin's
+"Estimator" option; see EndpointHilbert.h): AR orders and refresh intervals then make no
+difference, and no models are fit.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+struct BenchOptions
+{
+    double seconds = 10;
+    int refreshMs = 50;
+    bool csv = false;
+    bool fullRate = false;
+    float horizonMs = 0;
+    EngineParams::Estimator estimator = EngineParams::AR_PREDICTION;
+
+    // accuracy mode
+    double targetDegrees = -1;
+    String inputFile;
+    int inputChannels = 0;
+    int inputRate = 0;
+};
+
+void printHeader (const BenchOptions& options)
+{
+    if (options.csv)
+    {
+        std::printf ("channels,sample_rate,model_rate,band,ar_order,block_size,ns_per_sample_channel,"
+                     "p50_us,p99_us,max_us,p99_load_pct,fit_us,refits_per_s\n");
+    }
+    else
+    {
+        std::printf ("%4s %6s %5s %-16s %5s %6s | %10s %9s %9s %9s %8s | %9s %9s\n",
+                     "chan", "fs", "model", "band", "order", "block",
+                     "ns/samp/ch", "p50 us", "p99 us", "max us", "p99 load",
+                     "fit us", "refits/s");
+    }
+}
+
+void printResult (const BenchConfig& config, const BenchResult& result, const BenchOptions& options)
+{
+    String bandName = Hilbert::bandName[config.band];
+
+    if (options.csv)
+    {
+        std::printf ("%d,%d,%d,%d,%d,%d,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f\n",
+                     config.channels, config.sampleRate, config.modelRate, int (config.band), config.arOrder, config.blockSize,
+                     result.nsPerSampleChannel, result.p50Us, result.p99Us, result.maxUs, result.p99Load,
+                     result.fitUs, result.refitsPerSecond);
+    }
+    else
+    {
+        std::printf ("%4d %6d %5d %-16s %5d %6d | %10.2f %9.1f %9.1f %9.1f %7.2f%% | %9.1f %9.0f\n",
+                     config.channels, config.sampleRate, config.modelRate, bandName.toRawUTF8(), config.arOrder, config.blockSize,
+                     result.nsPerSampleChannel, result.p50Us, result.p99Us, result.maxUs, result.p99Load,
+                     result.fitUs, result.refitsPerSecond);
+    }
+
+    std::fflush (stdout);
+}
+
+void printAccuracyHeader (const BenchOptions& options)
+{
+    if (options.csv)
+    {
+        std::printf ("band,ar_order,ar_refresh_ms,model_rate,samples,mean_err_deg,circ_std_deg,mae_deg,p95_deg,"
+                     "ns_per_sample_channel,fit_us,cpu_pct\n");
+    }
+    else
+    {
+        std::printf ("%-16s %5s %7s %5s | %9s %9s %9s %9s | %10s %9s %8s\n",
+                     "band", "order", "refresh", "model",
+                     "mean err", "circ std", "MAE", "p95",
+                     "ns/samp/ch", "fit us", "CPU %");
+    }
+}
+
+void printAccuracyResult (const AccuracyConfig& config, const AccuracyResult& result, const BenchOptions& options)
+{
+    String bandName = Hilbert::bandName[config.band];
+
+    if (options.csv)
+    {
+        std::printf ("%d,%d,%d,%d,%lld,%.3f,%.3f,%.3f,%.1f,%.3f,%.2f,%.4f\n",
+                     int (config.band), config.arOrder, config.refreshMs, config.modelRate, (long long) result.numCompared,
+                     result.meanErrorDeg, result.circStdDeg, result.maeDeg, result.p95Deg,
+                     result.nsPerSampleChannel, result.fitUs, result.cpuPercent);
+    }
+    else
+    {
+        std::printf ("%-16s %5d %5d ms %5d | %9.2f %9.2f %9.2f %9.1f | %10.2f %9.1f %7.3f%%\n",
+                     bandName.toRawUTF8(), config.arOrder, config.refreshMs, config.modelRate,
+                     result.meanErrorDeg, result.circStdDeg, result.maeDeg, result.p95Deg,
+                     result.nsPerSampleChannel, result.fitUs, result.cpuPercent);
+    }
+
+    std::fflush (stdout);
+}
+
+int runAccuracyMode (const Array<int>& bands,
+                     const Array<int>& orders,
+                     const Array<int>& refreshes,
+                     const Array<int>& modelRates,
+                     int numChannels,
+                     int sampleRate,
+                     int blockSize,
+                     const BenchOptions& options)
+{
+    if (options.inputFile.isNotEmpty())
+    {
+        sampleRate = options.inputRate;
+    }
+
+    for (int modelRate : modelRates)
+    {
+        if (! ChannelState::isSupportedRate (float (sampleRate), modelRate))
+        {
+            std::fprintf (stderr, "Sample rate %d is below the %d Hz modeling rate\n", sampleRate, modelRate);
+            return 1;
+        }
+    }
+
+    // lead-in (history, plus one second), evaluated duration and one second of tail
+    const int numSamples = int ((historyMs / 1000.0 + 1 + options.seconds + 1) * sampleRate);
+
+    Recording recording;
+    if (options.inputFile.isNotEmpty())
+    {
+        if (! loadRecording (File::getCurrentWorkingDirectory().getChildFile (options.inputFile),
+                             options.inputChannels,
+                             options.inputRate,
+                             numChannels,
+                             numSamples,
+                             recording))
+        {
+            std::fprintf (stderr, "Could not read %s\n", options.inputFile.toRawUTF8());
+            return 1;
+        }
+    }
+
+    if (! options.csv)
+    {
+        std::printf ("%d channel(s) at %d Hz, %d-sample blocks, %s data%s%s, %.1f ms horizon\n",
+                     options.inputFile.isNotEmpty() ? int (recording.channels.size()) : numChannels,
+                     sampleRate,
+                     blockSize,
+                     options.inputFile.isNotEmpty() ? "recorded" : "synthetic",
+                     options.fullRate ? ", full-rate transformer" : "",
+                     options.estimator == EngineParams::ENDPOINT_HT ? ", endpoint-corrected HT" : "",
+                     options.horizonMs);
+    }
+
+    struct Best
+    {
+        AccuracyConfig config;
+        AccuracyResult result;
+    };
+    Array<Best> best;
+
+    printAccuracyHeader (options);
+    for (int band : bands)
+    {
+        if (options.inputFile.isEmpty())
+        {
+            recording = makeSyntheticRecording (Band (band), sampleRate, numChannels, numSamples);
+        }
+
+        bool found = false;
+        Best bandBest = {};
+
+        for (int order : orders)
+        {
+            for (int refresh : refreshes)
+            {
+                for (int modelRate : modelRates)
+                {
+                    AccuracyConfig config = { Band (band), order, refresh, modelRate, options.fullRate, options.horizonMs, options.estimator };
+                    AccuracyResult result = runAccuracy (config, recording, blockSize);
+                    if (result.numCompared == 0)
+                    {
+                        std::fprintf (stderr, "Record too short to evaluate order %d\n", order);
+                        continue;
+                    }
+
+                    printAccuracyResult (config, result, options);
+
+                    if (options.targetDegrees >= 0 && result.maeDeg <= options.targetDegrees
+                        && (! found || result.cpuPercent < bandBest.result.cpuPercent))
+                    {
+                        bandBest = { config, result };
+                        found = true;
+                    }
+                }
+            }
+        }
+
+        if (found)
+        {
+            best.add (bandBest);
+        }
+        else if (options.targetDegrees >= 0)
+        {
+            std::printf ("%s: no setting meets the target\n", Hilbert::bandName[band].toRawUTF8());
+        }
+    }
+
+    if (options.targetDegrees >= 0)
+    {
+        std::printf ("\nCheapest settings with MAE <= %.1f degrees:\n", options.targetDegrees);
+        for (auto& b : best)
+        {
+            printAccuracyResult (b.config, b.result, options);
+        }
+    }
+
+    return 0;
+}
+
+void printUsage()
+{
+    std::printf ("Usage: phase_benchmark [--sweep one|full] [--channels 1,4,16,64] [--rates 1000,10000,30000]\n"
+                 "                       [--bands 0,1,2,3,4] [--orders 10,20,40] [--blocks 64,512,2048]\n"
+                 "                       [--model-rates 500,1000,2000] [--seconds 10] [--refresh 50] [--full-rate]\n"
+                 "                       [--horizon <ms>] [--endpoint] [--csv]\n"
+                 "       phase_benchmark --mode accuracy [--channels 4] [--rates 30000] [--bands 0,1,2,3,4]\n"
+                 "                       [--orders 10,20,40] [--refreshes 10,50,200] [--blocks 512]\n"
+                 "                       [--model-rates 500] [--seconds 10] [--target 30] [--full-rate]\n"
+                 "                       [--horizon <ms>] [--endpoint] [--csv]\n"
+                 "                       [--input continuous.dat --input-channels <n> --input-rate <fs>]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    Array<int> channels ({ 1, 4, 16, 64 });
+    Array<int> rates ({ 1000, 10000, 30000 });
+    Array<int> bands ({ 0, 1, 2, 3, 4 });
+    Array<int> orders ({ 10, 20, 40 });
+    Array<int> blocks ({ 64, 512, 2048 });
+    Array<int> modelRates = EngineParams::getModelRates();
+    const BenchConfig baseline = { 16, 30000, ALPHA_THETA, 20, 512, Hilbert::fs };
+
+    Array<int> refreshes ({ 10, 50, 200 });
+
+    BenchOptions options;
+    bool fullSweep = false;
+    bool accuracyMode = false;
+    bool channelsGiven = false, ratesGiven = false, blocksGiven = false, modelRatesGiven = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+
+        if (arg == "--csv")
+        {
+            options.csv = true;
+            continue;
+        }
+        else if (arg == "--full-rate")
+        {
+            options.fullRate = true;
+            continue;
+        }
+        else if (arg == "--endpoint")
+        {
+            options.estimator = EngineParams::ENDPOINT_HT;
+            continue;
+        }
+        else if (arg == "--help" || arg == "-h")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (i + 1 >= argc)
+        {
+            printUsage();
+            return 1;
+        }
+
+        String value (argv[++i]);
+        if (arg == "--mode")
+        {
+            accuracyMode = value == "accuracy";
+        }
+        else if (arg == "--sweep")
+        {
+            fullSweep = value == "full";
+        }
+        else if (arg == "--channels")
+        {
+            channels = parseList (value);
+            channelsGiven = true;
+        }
+        else if (arg == "--rates")
+        {
+            rates = parseList (value);
+            ratesGiven = true;
+        }
+        else if (arg == "--bands")
+        {
+            bands = parseList (value);
+        }
+        else if (arg == "--orders")
+        {
+            orders = parseList (value);
+        }
+        else if (arg == "--blocks")
+        {
+            blocks = parseList (value);
+            blocksGiven = true;
+        }
+        else if (arg == "--model-rates")
+        {
+            modelRates = parseList (value);
+            modelRatesGiven = true;
+        }
+        else if (arg == "--seconds")
+        {
+            options.seconds = value.getDoubleValue();
+        }
+        else if (arg == "--refresh")
+        {
+            options.refreshMs = value.getIntValue();
+        }
+        else if (arg == "--horizon")
+        {
+            options.horizonMs = jlimit (0.0f, EngineParams::maxHorizonMs, value.getFloatValue());
+        }
+        else if (arg == "--refreshes")
+        {
+            refreshes = parseList (value);
+        }
+        else if (arg == "--target")
+        {
+            options.targetDegrees = value.getDoubleValue();
+        }
+        else if (arg == "--input")
+        {
+            options.inputFile = value;
+        }
+        else if (arg == "--input-channels")
+        {
+            options.inputChannels = value.getIntValue();
+        }
+        else if (arg == "--input-rate")
+        {
+            options.inputRate = value.getIntValue();
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    // the engine requires sample rates of at least the (lowest) modeling rate
+    for (int i = rates.size(); --i >= 0;)
+    {
+        if (! ChannelState::isSupportedRate (float (rates[i])))
+        {
+            std::fprintf (stderr, "Skipping sample rate %d (must be at least %d Hz)\n", rates[i], Hilbert::fs);
+            rates.remove (i);
+        }
+    }
+
+    for (int i = modelRates.size(); --i >= 0;)
+    {
+        if (! EngineParams::getModelRates().contains (modelRates[i]))
+        {
+            std::fprintf (stderr, "Skipping modeling rate %d (must be 500, 1000 or 2000 Hz)\n", modelRates[i]);
+            modelRates.remove (i);
+        }
+    }
+
+    for (int i = bands.size(); --i >= 0;)
+    {
+        if (bands[i] < 0 || bands[i] >= NUM_BANDS)
+        {
+            std::fprintf (stderr, "Skipping band %d (must be in [0, %d))\n", bands[i], int (NUM_BANDS));
+            bands.remove (i);
+        }
+    }
+
+    if (accuracyMode)
+    {
+        int numChannels = channelsGiven && ! channels.isEmpty() ? channels[0] : 4;
+        int sampleRate = ratesGiven && ! rates.isEmpty() ? rates[0] : baseline.sampleRate;
+        int blockSize = blocksGiven && ! blocks.isEmpty() ? blocks[0] : baseline.blockSize;
+
+        if (numChannels <= 0 || blockSize <= 0)
+        {
+            printUsage();
+            return 1;
+        }
+
+        return runAccuracyMode (bands,
+                                orders,
+                                refreshes,
+                                modelRatesGiven ? modelRates : Array<int> ({ Hilbert::fs }),
+                                numChannels,
+                                sampleRate,
+                                blockSize,
+                                options);
+    }
+
+    Array<BenchConfig> configs;
+    auto addConfig = [&configs] (const BenchConfig& config)
+    {
+        for (auto& existing : configs)
+        {
+            if (existing.channels == config.channels && existing.sampleRate == config.sampleRate
+                && existing.band == config.band && existing.arOrder == config.arOrder
+                && existing.blockSize == config.blockSize && existing.modelRate == config.modelRate)
+            {
+                return;
+            }
+        }
+        configs.add (config);
+    };
+
+    if (fullSweep)
+    {
+        for (int nChans : channels)
+        {
+            for (int fs : rates)
+            {
+                for (int band : bands)
+                {
+                    for (int order : orders)
+                    {
+                        for (int block : blocks)
+                        {
+                            for (int modelRate : modelRates)
+                            {
+                                addConfig ({ nChans, fs, Band (band), order, block, modelRate });
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        BenchConfig config = baseline;
+        for (int nChans : channels)
+        {
+            config.channels = nChans;
+            addConfig (config);
+        }
+
+        config = baseline;
+        for (int fs : rates)
+        {
+            config.sampleRate = fs;
+            addConfig (config);
+        }
+
+        config = baseline;
+        for (int band : bands)
+        {
+            config.band = Band (band);
+            addConfig (config);
+        }
+
+        config = baseline;
+        for (int order : orders)
+        {
+            config.arOrder = order;
+            addConfig (config);
+        }
+
+        config = baseline;
+        for (int block : blocks)
+        {
+            config.blockSize = block;
+            addConfig (config);
+        }
+
+        config = baseline;
+        for (int modelRate : modelRates)
+        {
+            config.modelRate = modelRate;
+            addConfig (config);
+        }
+    }
+
+    if (options.fullRate && ! options.csv)
+    {
+        std::printf ("Full-rate Hilbert transformer\n");
+    }
+
+    if (options.horizonMs > 0 && ! options.csv)
+    {
+        std::printf ("%.1f ms look-ahead horizon\n", options.horizonMs);
+    }
+
+    if (options.estimator == EngineParams::ENDPOINT_HT && ! options.csv)
+    {
+        std::printf ("Endpoint-corrected Hilbert transform (no AR models)\n");
+    }
+
+    printHeader (options);
+    for (auto& config : configs)
+    {
+        config.fullRate = options.fullRate;
+        config.horizonMs = options.horizonMs;
+        config.estimator = options.estimator;
+        if (config.channels <= 0 || config.blockSize <= 0 || config.arOrder <= 0
+            || ! ChannelState::isSupportedRate (float (config.sampleRate), config.modelRate))
+        {
+            continue;
+        }
+
+        printResult (config, runBenchmark (config, options.seconds, options.refreshMs), options);
+    }
+
+    return 0;
+}
@@ -0,0 +1,429 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Regression checks of the phase engine, run by CTest. Workloads and limits are read from a JSON
+file (Regression/thresholds.json):
+
+--perf:       runs a fixed synthetic workload (best of several runs) and fails if the cost per
+              sample and channel, the p99 block time or the maximum block time exceeds its limit.
+              With --baseline, the limits are ratios to the same statistics measured earlier on this
+              host (max_*_ratio); if there is no baseline file yet, the absolute limits (max_*)
+              apply, multiplied by --perf-scale (1 by default) to fit slower or faster machines.
+--accuracy:   runs a synthetic record per band and fails if the error against the offline phase
+              (mean absolute error, circular mean) exceeds its limit. With --golden, also fails if
+              the output drifts from the stored output of a known-good build: more than a given
+              fraction of samples may not differ by more than a given number of degrees. A missing
+              golden file is a failure.
+
+--write-golden <file> stores the output of the accuracy workload as the new golden reference.
+--write-baseline <file> stores the perf statistics of this host as its baseline.
+
+Usage: phase_regression --thresholds <file> [--perf] [--accuracy] [--baseline <file>] [--perf-scale <factor>]
+                        [--golden <file>] [--write-baseline <file>] [--write-golden <file>]
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+#include <cstring> // memcmp
+
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+const char goldenMagic[] = "PHCGLD01";
+
+// perf statistics: their names in the baseline file, and their absolute and relative limits
+const int numPerfStats = 3;
+const char* const perfStatLabels[] = { "perf: ns per sample and channel", "perf: p99 block time (us)", "perf: max block time (us)" };
+const char* const perfBaselineKeys[] = { "ns_per_sample_channel", "p99_block_us", "max_block_us" };
+const char* const perfLimitKeys[] = { "max_ns_per_sample_channel", "max_p99_block_us", "max_block_us" };
+const char* const perfRatioKeys[] = { "max_ns_per_sample_channel_ratio", "max_p99_block_ratio", "max_block_ratio" };
+
+// workload settings that a baseline must have been measured with
+const char* const perfWorkloadKeys[] = { "channels", "sample_rate", "ar_order", "block_size" };
+
+class Checker
+{
+public:
+    /** Reports a check; returns passed. */
+    bool check (const String& name, double value, double limit, bool passed)
+    {
+        std::printf ("%-4s %-44s %12.3f (limit %.3f)\n", passed ? "ok" : "FAIL", name.toRawUTF8(), value, limit);
+        std::fflush (stdout);
+        numFailed += passed ? 0 : 1;
+        return passed;
+    }
+
+    bool atMost (const String& name, double value, double limit)
+    {
+        return check (name, value, limit, value <= limit);
+    }
+
+    void fail (const String& message)
+    {
+        std::printf ("FAIL %s\n", message.toRawUTF8());
+        std::fflush (stdout);
+        ++numFailed;
+    }
+
+    int numFailed = 0;
+};
+
+void checkPerf (const var& limits, const File& baselineFile, const File& writeBaselineFile, double scale, Checker& checker)
+{
+    BenchConfig config;
+    config.channels = limits["channels"];
+    config.sampleRate = limits["sample_rate"];
+    config.band = ALPHA_THETA;
+    config.arOrder = limits["ar_order"];
+    config.blockSize = limits["block_size"];
+
+    const double seconds = limits["seconds"];
+    const int runs = jmax (1, int (limits["runs"]));
+
+    // take the best of each statistic over several runs to reject interference from other processes
+    BenchResult best = runBenchmark (config, seconds, 50);
+    for (int run = 1; run < runs; ++run)
+    {
+        BenchResult result = runBenchmark (config, seconds, 50);
+        best.nsPerSampleChannel = jmin (best.nsPerSampleChannel, result.nsPerSampleChannel);
+        best.p99Us = jmin (best.p99Us, result.p99Us);
+        best.maxUs = jmin (best.maxUs, result.maxUs);
+    }
+
+    const double stats[numPerfStats] = { best.nsPerSampleChannel, best.p99Us, best.maxUs };
+
+    if (writeBaselineFile != File())
+    {
+        DynamicObject::Ptr baseline = new DynamicObject();
+        for (auto key : perfWorkloadKeys)
+        {
+            baseline->setProperty (key, limits[key]);
+        }
+        for (int s = 0; s < numPerfStats; ++s)
+        {
+            baseline->setProperty (perfBaselineKeys[s], stats[s]);
+        }
+
+        if (writeBaselineFile.replaceWithText (JSON::toString (var (baseline.get()))))
+        {
+            std::printf ("Wrote the perf baseline of this host to %s\n", writeBaselineFile.getFullPathName().toRawUTF8());
+        }
+        else
+        {
+            checker.fail ("could not write " + writeBaselineFile.getFullPathName());
+        }
+        return;
+    }
+
+    if (baselineFile != File() && baselineFile.existsAsFile())
+    {
+        var baseline = JSON::parse (baselineFile);
+        if (! baseline.isObject())
+        {
+            checker.fail ("could not read perf baseline " + baselineFile.getFullPathName());
+            return;
+        }
+
+        for (auto key : perfWorkloadKeys)
+        {
+            if (int (baseline[key]) != int (limits[key]))
+            {
+                checker.fail ("perf baseline was measured with a different " + String (key) + " (rewrite it with --write-baseline)");
+                return;
+            }
+        }
+
+        for (int s = 0; s < numPerfStats; ++s)
+        {
+            double base = baseline[perfBaselineKeys[s]];
+            if (base <= 0)
+            {
+                checker.fail ("perf baseline has no " + String (perfBaselineKeys[s]));
+                continue;
+            }
+            checker.atMost (String (perfStatLabels[s]) + " / baseline", stats[s] / base, limits[perfRatioKeys[s]]);
+        }
+        return;
+    }
+
+    if (baselineFile != File())
+    {
+        std::printf ("     (no perf baseline for this host at %s: using the absolute limits times %.2f)\n",
+                     baselineFile.getFullPathName().toRawUTF8(),
+                     scale);
+    }
+
+    for (int s = 0; s < numPerfStats; ++s)
+    {
+        checker.atMost (perfStatLabels[s], stats[s], double (limits[perfLimitKeys[s]]) * scale);
+    }
+}
+
+bool readGolden (const File& file, std::vector<float>& golden)
+{
+    FileInputStream stream (file);
+    if (stream.failedToOpen())
+    {
+        return false;
+    }
+
+    char magic[8];
+    if (stream.read (magic, 8) != 8 || std::memcmp (magic, goldenMagic, 8) != 0)
+    {
+        return false;
+    }
+
+    int count = stream.readInt();
+    if (count < 0 || int64 (count) * 4 > stream.getNumBytesRemaining())
+    {
+        return false;
+    }
+
+    golden.resize (count);
+    for (auto& value : golden)
+    {
+        value = stream.readFloat();
+    }
+    return true;
+}
+
+bool writeGolden (const File& file, const std::vector<float>& output)
+{
+    file.deleteFile();
+    FileOutputStream stream (file);
+    if (stream.failedToOpen())
+    {
+        return false;
+    }
+
+    stream.write (goldenMagic, 8);
+    stream.writeInt (int (output.size()));
+    for (float value : output)
+    {
+        stream.writeFloat (value);
+    }
+    stream.flush();
+    return stream.getStatus().wasOk();
+}
+
+void checkAccuracy (const var& limits, const File& goldenFile, const File& writeGoldenFile, Checker& checker)
+{
+    const int numChannels = limits["channels"];
+    const int sampleRate = limits["sample_rate"];
+    const int blockSize = limits["block_size"];
+    const double seconds = limits["seconds"];
+    const int goldenStride = jmax (1, int (limits["golden_stride"]));
+
+    // lead-in (history, plus one second), evaluated duration and one second of tail
+    const int numSamples = int ((historyMs / 1000.0 + 1 + seconds + 1) * sampleRate);
+
+    std::vector<float> output;
+    std::vector<float> allOutput;
+
+    for (int b = 0; b < NUM_BANDS; ++b)
+    {
+        Band band = Band (b);
+        String bandName = Hilbert::bandName[band];
+
+        Recording recording = makeSyntheticRecording (band, sampleRate, numChannels, numSamples);
+        AccuracyConfig config = { band, int (limits["ar_order"]), int (limits["ar_refresh_ms"]) };
+        AccuracyResult result = runAccuracy (config, recording, blockSize, &output);
+
+        if (result.numCompared == 0)
+        {
+            checker.fail ("accuracy: nothing to compare in band " + bandName);
+            continue;
+        }
+
+        checker.atMost ("accuracy: " + bandName + " MAE (deg)", result.maeDeg, limits["max_mae_deg"][b]);
+        checker.atMost ("accuracy: " + bandName + " |mean error| (deg)", std::abs (result.meanErrorDeg), limits["max_abs_mean_err_deg"][b]);
+
+        for (size_t i = 0; i < output.size(); i += size_t (goldenStride))
+        {
+            allOutput.push_back (output[i]);
+        }
+    }
+
+    if (writeGoldenFile != File())
+    {
+        if (writeGolden (writeGoldenFile, allOutput))
+        {
+            std::printf ("Wrote %d golden samples to %s\n", int (allOutput.size()), writeGoldenFile.getFullPathName().toRawUTF8());
+        }
+        else
+        {
+            checker.fail ("could not write " + writeGoldenFile.getFullPathName());
+        }
+    }
+
+    if (goldenFile == File())
+    {
+        return;
+    }
+
+    if (! goldenFile.existsAsFile())
+    {
+        checker.fail ("golden reference " + goldenFile.getFullPathName() + " not found (write it from a known-good build with "
+                      + "the write_golden target, or --write-golden, and commit it)");
+        return;
+    }
+
+    std::vector<float> golden;
+    if (! readGolden (goldenFile, golden))
+    {
+        checker.fail ("could not read golden reference " + goldenFile.getFullPathName());
+        return;
+    }
+
+    if (golden.size() != allOutput.size())
+    {
+        checker.fail ("golden reference has " + String (int (golden.size())) + " samples, output has "
+                      + String (int (allOutput.size())) + " (workload changed? rewrite it with --write-golden)");
+        return;
+    }
+
+    const double maxDiff = limits["max_golden_diff_deg"];
+    double largestDiff = 0;
+    int64 numOutliers = 0;
+    for (size_t i = 0; i < golden.size(); ++i)
+    {
+        double diff = std::abs (radiansToDegrees (PhaseEngine::circDist (degreesToRadians (double (allOutput[i])),
+                                                                         degreesToRadians (double (golden[i])),
+                                                                         Dsp::doublePi)));
+        largestDiff = jmax (largestDiff, diff);
+        numOutliers += diff > maxDiff ? 1 : 0;
+    }
+
+    double outlierFraction = golden.empty() ? 0 : double (numOutliers) / double (golden.size());
+    checker.atMost ("golden: fraction of samples off by > " + String (maxDiff) + " deg", outlierFraction, limits["max_golden_outlier_fraction"]);
+    std::printf ("     (largest difference from the golden output: %.4f deg)\n", largestDiff);
+}
+
+void printUsage()
+{
+    std::printf ("Usage: phase_regression --thresholds <file> [--perf] [--accuracy] [--baseline <file>] [--perf-scale <factor>]\n"
+                 "                        [--golden <file>] [--write-baseline <file>] [--write-golden <file>]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    File thresholdsFile;
+    File goldenFile;
+    File writeGoldenFile;
+    File baselineFile;
+    File writeBaselineFile;
+    double perfScale = 1;
+    bool perf = false;
+    bool accuracy = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+
+        if (arg == "--perf")
+        {
+            perf = true;
+        }
+        else if (arg == "--accuracy")
+        {
+            accuracy = true;
+        }
+        else if (i + 1 < argc && arg == "--thresholds")
+        {
+            thresholdsFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "--golden")
+        {
+            goldenFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "--baseline")
+        {
+            baselineFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "--write-baseline")
+        {
+            writeBaselineFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+            perf = true;
+        }
+        else if (i + 1 < argc && arg == "--perf-scale")
+        {
+            perfScale = String (argv[++i]).getDoubleValue();
+            if (perfScale <= 0)
+            {
+                printUsage();
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && arg == "--write-golden")
+        {
+            writeGoldenFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+            accuracy = true;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    var thresholds = JSON::parse (thresholdsFile);
+    if (! thresholds.isObject())
+    {
+        std::printf ("FAIL could not read thresholds from %s\n", thresholdsFile.getFullPathName().toRawUTF8());
+        return 1;
+    }
+
+    if (! perf && ! accuracy)
+    {
+        perf = accuracy = true;
+    }
+
+    Checker checker;
+
+    if (perf)
+    {
+        checkPerf (thresholds["perf"], baselineFile, writeBaselineFile, perfScale, checker);
+    }
+
+    if (accuracy)
+    {
+        checkAccuracy (thresholds["accuracy"], goldenFile, writeGoldenFile, checker);
+    }
+
+    if (checker.numFailed > 0)
+    {
+        std::printf ("%d check(s) failed\n", checker.numFailed);
+        return 1;
+    }
+
+    return 0;
+}
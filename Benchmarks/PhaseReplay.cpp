@@ -0,0 +1,370 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Replays an input capture (written by the plugin's "Capture Input" option, see
+Source/CaptureFile.h) through the phase engine, with the block sizes, sample numbers and
+settings that were captured. The capture is read in place through a memory mapping.
+
+- By default, blocks are processed back to back and the AR models are refit inline after every
+  AR refresh interval of signal time, so the output only depends on the capture and the build:
+  compare the --output files of two builds (e.g. with cmp) to check that an optimization does
+  not change the result, and run this mode under perf to profile.
+- With --realtime, each block is released at the time it was captured, and the AR models are
+  refit on a separate thread every AR refresh interval of wall time, as in the plugin.
+
+Reports the time to process each block (percentiles and deadline misses, i.e. blocks that took
+longer than their duration), the AR fits, the overall speed relative to real time, and gaps in
+the sample numbers (e.g. records dropped during the capture). TTL events are counted but not
+analyzed: the visualizer's ground truth analysis needs FFTW and is not part of the engine library.
+
+Usage: phase_replay <capture file> [--realtime] [--loops <n>] [--output <file>]
+
+--output writes the phase output (float32 degrees) of each block, channel after channel.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstdio>
+#include <thread> // sleep_until
+
+#include "CaptureFile.h"
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+struct ReplayStats
+{
+    std::vector<double> blockNs;
+    int64 numSamples = 0;
+    int64 numDeadlineMisses = 0;
+    int64 numEvents = 0;
+    int64 numGaps = 0;
+    int64 numFits = 0;
+    double fitNs = 0;
+    double wallNs = 0;
+    double signalSeconds = 0;
+};
+
+/** Refits the AR models every refresh interval of wall time, like Node::run */
+class ModelFitter : public Thread
+{
+public:
+    ModelFitter (OwnedArray<ChannelState>& channelStates, int refreshMs)
+        : Thread ("AR Modeler"), states (channelStates), intervalMs (refreshMs)
+    {
+        int historySize = 0;
+        for (auto state : states)
+        {
+            historySize = jmax (historySize, state->history.size());
+        }
+        reverseData.resize (historySize);
+    }
+
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            auto start = Clock::now();
+            for (auto state : states)
+            {
+                if (state->fitModel (reverseData))
+                {
+                    ++numFits;
+                }
+            }
+            auto end = Clock::now();
+            fitNs += elapsedNs (start, end);
+
+            int remaining = intervalMs - int (elapsedNs (start, end) / 1e6);
+            if (remaining >= 1)
+            {
+                sleep (remaining);
+            }
+        }
+    }
+
+    OwnedArray<ChannelState>& states;
+    const int intervalMs;
+    Array<double> reverseData;
+
+    // read after the thread has stopped
+    int64 numFits = 0;
+    double fitNs = 0;
+};
+
+void replay (CaptureFile::Reader& reader, bool realtime, OutputStream* output, ReplayStats& stats)
+{
+    const CaptureFile::Info& info = reader.getInfo();
+    const int numChannels = info.channels.size();
+    const EngineParams params = info.getParams();
+
+    OwnedArray<ChannelState> states;
+    for (int c = 0; c < numChannels; ++c)
+    {
+        states.add (new ChannelState())->configure (params, float (info.sampleRate), historyMs);
+    }
+
+    PhaseEngine engine;
+    ModelFitter fitter (states, info.calcInterval);
+    HeapBlock<float> block;
+    int blockCapacity = 0;
+
+    const int64 refreshSamples = jmax (int64 (1), int64 (info.calcInterval * info.sampleRate / 1000));
+    int64 samplesToRefresh = refreshSamples;
+    int64 expectedSampleNumber = -1;
+    int64 firstCaptureTime = -1;
+
+    reader.rewind();
+    if (realtime)
+    {
+        fitter.startThread();
+    }
+
+    const auto replayStart = Clock::now();
+
+    CaptureFile::Reader::Record record;
+    while (reader.next (record))
+    {
+        if (record.type == CaptureFile::EVENT)
+        {
+            ++stats.numEvents;
+            continue;
+        }
+
+        const int n = record.block.numSamples;
+        if (n == 0)
+        {
+            continue;
+        }
+
+        if (expectedSampleNumber >= 0 && record.block.firstSampleNumber != expectedSampleNumber)
+        {
+            ++stats.numGaps;
+        }
+        expectedSampleNumber = record.block.firstSampleNumber + n;
+
+        if (realtime)
+        {
+            if (firstCaptureTime < 0)
+            {
+                firstCaptureTime = record.block.captureTimeNs;
+            }
+            std::this_thread::sleep_until (replayStart + std::chrono::nanoseconds (record.block.captureTimeNs - firstCaptureTime));
+        }
+
+        // the engine overwrites its input, and the mapping is read-only
+        if (n > blockCapacity)
+        {
+            blockCapacity = n;
+            block.allocate (size_t (numChannels) * size_t (n), false);
+        }
+        FloatVectorOperations::copy (block.get(), record.data, numChannels * n);
+
+        auto start = Clock::now();
+        for (int c = 0; c < numChannels; ++c)
+        {
+            engine.processChannel (params, *states[c], block + c * n, n);
+        }
+        auto end = Clock::now();
+
+        double ns = elapsedNs (start, end);
+        stats.blockNs.push_back (ns);
+        stats.numSamples += n;
+        stats.signalSeconds += n / info.sampleRate;
+        if (ns > 1e9 * n / info.sampleRate)
+        {
+            ++stats.numDeadlineMisses;
+        }
+
+        if (output != nullptr)
+        {
+            output->write (block.get(), sizeof (float) * size_t (numChannels) * size_t (n));
+        }
+
+        if (! realtime)
+        {
+            // refit after every refresh interval of signal time, as soon as the histories are full
+            samplesToRefresh -= n;
+            if (samplesToRefresh <= 0)
+            {
+                samplesToRefresh += refreshSamples * (1 + (-samplesToRefresh) / refreshSamples);
+
+                start = Clock::now();
+                for (auto state : states)
+                {
+                    stats.numFits += state->fitModel (fitter.reverseData) ? 1 : 0;
+                }
+                end = Clock::now();
+                stats.fitNs += elapsedNs (start, end);
+            }
+        }
+    }
+
+    stats.wallNs += elapsedNs (replayStart, Clock::now());
+
+    if (realtime)
+    {
+        fitter.stopThread (2000);
+        stats.numFits += fitter.numFits;
+        stats.fitNs += fitter.fitNs;
+    }
+}
+
+void printStats (const CaptureFile::Info& info, ReplayStats& stats)
+{
+    std::sort (stats.blockNs.begin(), stats.blockNs.end());
+
+    double processNs = 0;
+    for (double ns : stats.blockNs)
+    {
+        processNs += ns;
+    }
+
+    const int numChannels = info.channels.size();
+    std::printf ("blocks:           %d (%.1f s of signal, %d channels at %.0f Hz)\n",
+                 int (stats.blockNs.size()),
+                 stats.signalSeconds,
+                 numChannels,
+                 info.sampleRate);
+    std::printf ("block time (us):  p50 %.1f, p99 %.1f, max %.1f\n",
+                 percentile (stats.blockNs, 0.5) / 1000,
+                 percentile (stats.blockNs, 0.99) / 1000,
+                 stats.blockNs.empty() ? 0.0 : stats.blockNs.back() / 1000);
+    std::printf ("deadline misses:  %lld\n", (long long) stats.numDeadlineMisses);
+    std::printf ("ns/samp/ch:       %.2f\n", stats.numSamples > 0 ? processNs / (double (stats.numSamples) * jmax (1, numChannels)) : 0.0);
+    std::printf ("AR fits:          %lld, mean %.1f us\n", (long long) stats.numFits, stats.numFits > 0 ? stats.fitNs / stats.numFits / 1000 : 0.0);
+    std::printf ("speed:            %.1fx real time\n", stats.wallNs > 0 ? stats.signalSeconds * 1e9 / stats.wallNs : 0.0);
+    std::printf ("events:           %lld\n", (long long) stats.numEvents);
+    std::printf ("gaps:             %lld\n", (long long) stats.numGaps);
+}
+
+void printUsage()
+{
+    std::printf ("Usage: phase_replay <capture file> [--realtime] [--loops <n>] [--output <file>]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    File captureFile;
+    File outputFile;
+    bool realtime = false;
+    int loops = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+
+        if (arg == "--realtime")
+        {
+            realtime = true;
+        }
+        else if (i + 1 < argc && arg == "--loops")
+        {
+            loops = jmax (1, String (argv[++i]).getIntValue());
+        }
+        else if (i + 1 < argc && arg == "--output")
+        {
+            outputFile = File::getCurrentWorkingDirectory().getChildFile (argv[++i]);
+        }
+        else if (! arg.startsWith ("--") && captureFile == File())
+        {
+            captureFile = File::getCurrentWorkingDirectory().getChildFile (arg);
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (captureFile == File())
+    {
+        printUsage();
+        return 1;
+    }
+
+    CaptureFile::Reader reader (captureFile);
+    if (! reader.isValid())
+    {
+        std::printf ("Error: %s\n", reader.getError().toRawUTF8());
+        return 1;
+    }
+
+    const CaptureFile::Info& info = reader.getInfo();
+    if (info.channels.isEmpty() || ! ChannelState::isSupportedRate (float (info.sampleRate), info.modelRate))
+    {
+        std::printf ("Error: the capture has no channels, or its sample rate (%.1f Hz) is below %d Hz\n", info.sampleRate, info.modelRate);
+        return 1;
+    }
+
+    std::printf ("%s: band %s (%.1f-%.1f Hz), HT delay %d%s at %d Hz%s%s, horizon %.1f ms, AR order %d, refresh %d ms, %s\n",
+                 captureFile.getFileName().toRawUTF8(),
+                 Hilbert::bandName[info.band].toRawUTF8(),
+                 info.lowCut,
+                 info.highCut,
+                 info.getParams().transformer->delay,
+                 info.htDelay > 0 ? " (designed)" : "",
+                 info.modelRate,
+                 info.fullRate ? " (full rate)" : "",
+                 info.estimator == EngineParams::ENDPOINT_HT ? ", endpoint-corrected" : "",
+                 info.horizonMs,
+                 info.arOrder,
+                 info.calcInterval,
+                 realtime ? "real-time pacing" : "maximum speed");
+
+    std::unique_ptr<FileOutputStream> output;
+    if (outputFile != File())
+    {
+        outputFile.deleteFile();
+        output = outputFile.createOutputStream();
+        if (output == nullptr || output->failedToOpen())
+        {
+            std::printf ("Error: could not open %s\n", outputFile.getFullPathName().toRawUTF8());
+            return 1;
+        }
+    }
+
+    ReplayStats stats;
+    for (int loop = 0; loop < loops; ++loop)
+    {
+        // only the first pass is written out; the others are identical (or nearly, with --realtime)
+        replay (reader, realtime, loop == 0 ? output.get() : nullptr, stats);
+    }
+
+    if (reader.getPosition() != reader.getSize())
+    {
+        std::printf ("Warning: stopped at a truncated or unknown record at byte %lld of %lld\n",
+                     (long long) reader.getPosition(),
+                     (long long) reader.getSize());
+    }
+
+    printStats (info, stats);
+    return 0;
+}
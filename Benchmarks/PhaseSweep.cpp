@@ -0,0 +1,601 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+
+Evaluates every combination of band, passband, Hilbert transformer delay, AR order, AR refresh
+interval and AR window over
+the same recording (a memory-mapped continuous.dat, see BinaryRecording.h), in one pass and on
+all cores, to choose the settings for an experiment offline.
+
+Work that does not depend on the AR and Hilbert transformer settings is done once and shared:
+for each passband and channel, the causal bandpass output (the real-time filter) and the offline
+reference phase (zero-phase filter and FFT-based Hilbert transform, see OfflinePhase.h) are
+computed once per chunk. Every configuration then runs the rest of the real-time pipeline
+(PhaseEngine::processFiltered) on the shared filter output, refitting its AR models inline
+every refresh interval of signal time, and compares each output sample with the reference.
+
+For each configuration, prints the error against the reference (as in phase_benchmark --mode
+accuracy) and the cost of running it in the plugin: the time per sample and channel (including
+its share of filtering), the time per AR fit and the CPU use per channel. Costs are measured
+while all threads are busy, so compare them with each other rather than with phase_benchmark.
+
+The AR window is the length of the history that the models are trained on; the engine uses at
+least 1 second (or enough for the AR order), so shorter windows are rounded up.
+
+Usage: phase_sweep <continuous.dat> [--channels 0,1,2,3] [--bands 0,1,2,3,4]
+                   [--passbands <low>-<high>,...] [--delays 0] [--model-rates 500] [--orders 10,20,40]
+                   [--refreshes 50] [--windows 1024] [--block 1024] [--start <s>] [--seconds <s>]
+                   [--threads <n>] [--csv] [--num-channels <n> --sample-rate <Hz>]
+
+Without --passbands, each band is evaluated with its default passband; with it, each band is
+evaluated with every listed passband that is within its valid range. A delay of 0 (the default)
+uses the band's built-in Hilbert transformer; other delays use a transformer of that length
+designed for the passband (see HilbertDesigner.h), which can be any passband within the
+designable range, and show what a longer or shorter transformer gains or loses. --model-rates
+lists the modeling rates (the plugin's "Model Rate" setting) to evaluate each of them at; delays
+are in samples at the modeling rate, and at rates other than 500 Hz, a delay of 0 designs a
+transformer as long (in time) as the built-in one.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <algorithm> // any_of
+#include <cstdio>
+
+#include "BinaryRecording.h"
+#include "Workloads.h"
+
+using namespace PhaseCalculator;
+using namespace PhaseCalculator::Bench;
+
+namespace
+{
+// signal time processed by all threads before moving on together
+const double chunkSeconds = 10;
+
+// data on each side of a chunk used for its reference phase, to keep edge effects out
+const double referenceMarginSeconds = 2;
+
+struct Passband
+{
+    float lowCut;
+    float highCut;
+
+    bool operator== (const Passband& other) const { return lowCut == other.lowCut && highCut == other.highCut; }
+};
+
+struct SweepConfig
+{
+    Band band;
+    int passband; // index into the passbands
+    int htDelay; // 0 = the band's built-in transformer
+    int modelRate;
+    int arOrder;
+    int refreshMs;
+    int windowMs;
+};
+
+struct SweepOptions
+{
+    Array<int> channels;
+    int blockSize = 1024;
+    int numThreads = 0;
+    double startSeconds = 0;
+    double maxSeconds = 0;
+    bool csv = false;
+};
+
+/** Shared by all configurations with the same passband: one channel's filter output and reference */
+struct FilterJob
+{
+    FilterJob (const Passband& passband, float sampleRate, int chunkSamples)
+        : filtered (size_t (chunkSamples)),
+          reference (size_t (chunkSamples))
+    {
+        filter.setup (2, sampleRate, (passband.highCut + passband.lowCut) / 2, passband.highCut - passband.lowCut);
+    }
+
+    ChannelState::BandpassFilter filter;
+    std::vector<float> filtered;
+    std::vector<double> reference;
+    double filterNs = 0;
+};
+
+/** One configuration on one channel */
+struct SweepJob
+{
+    SweepJob (const EngineParams& params, float sampleRate, const SweepConfig& config, int blockSize)
+        : refreshSamples (jmax (int64 (1), int64 (config.refreshMs * double (sampleRate) / 1000))),
+          samplesToRefresh (refreshSamples),
+          block (size_t (blockSize))
+    {
+        state.configure (params, sampleRate, config.windowMs);
+        reverseData.resize (state.history.size());
+        engine.setTimingEnabled (false);
+    }
+
+    const int64 refreshSamples;
+    int64 samplesToRefresh;
+
+    ChannelState state;
+    PhaseEngine engine;
+    Array<double> reverseData;
+    HeapBlock<float> block;
+
+    PhaseErrorStats errors;
+    double processNs = 0;
+    double fitNs = 0;
+    int64 numFits = 0;
+};
+
+Array<Passband> parsePassbands (const String& text)
+{
+    Array<Passband> passbands;
+    for (auto& token : StringArray::fromTokens (text, ",", ""))
+    {
+        if (token.trim().isNotEmpty())
+        {
+            passbands.add ({ token.upToFirstOccurrenceOf ("-", false, false).getFloatValue(),
+                             token.fromFirstOccurrenceOf ("-", false, false).getFloatValue() });
+        }
+    }
+    return passbands;
+}
+
+EngineParams getParams (const SweepConfig& config, const Passband& passband)
+{
+    EngineParams params;
+    params.arOrder = config.arOrder;
+    params.band = config.band;
+    params.lowCut = passband.lowCut;
+    params.highCut = passband.highCut;
+    params.htDelay = config.htDelay;
+    params.modelRate = config.modelRate;
+    params.updateTransformer();
+    return params;
+}
+
+void printHeader (const SweepOptions& options)
+{
+    if (options.csv)
+    {
+        std::printf ("band,low_cut,high_cut,ht_delay,ht_taps,model_rate,ar_order,ar_refresh_ms,ar_window_ms,samples,mean_err_deg,circ_std_deg,"
+                     "mae_deg,p95_deg,ns_per_sample_channel,fit_us,cpu_pct\n");
+    }
+    else
+    {
+        std::printf ("%-16s %11s %4s %5s %5s %7s %7s | %9s %9s %9s %9s | %10s %9s %8s\n",
+                     "band", "passband", "HT", "model", "order", "refresh", "window",
+                     "mean err", "circ std", "MAE", "p95",
+                     "ns/samp/ch", "fit us", "CPU %");
+    }
+}
+
+void printResult (const SweepConfig& config, const Passband& passband, int windowMs, const AccuracyResult& result, const SweepOptions& options)
+{
+    const int htTaps = getParams (config, passband).transformer->delay;
+    if (options.csv)
+    {
+        std::printf ("%d,%.2f,%.2f,%d,%d,%d,%d,%d,%d,%lld,%.3f,%.3f,%.3f,%.1f,%.3f,%.2f,%.4f\n",
+                     int (config.band), passband.lowCut, passband.highCut, config.htDelay, htTaps, config.modelRate, config.arOrder, config.refreshMs, windowMs,
+                     (long long) result.numCompared, result.meanErrorDeg, result.circStdDeg, result.maeDeg, result.p95Deg,
+                     result.nsPerSampleChannel, result.fitUs, result.cpuPercent);
+    }
+    else
+    {
+        String passbandText = String (passband.lowCut, 1) + "-" + String (passband.highCut, 1);
+        String htText = String (htTaps) + (config.htDelay > 0 ? "d" : "");
+        std::printf ("%-16s %11s %4s %5d %5d %4d ms %4d ms | %9.2f %9.2f %9.2f %9.1f | %10.2f %9.1f %7.3f%%\n",
+                     Hilbert::bandName[config.band].toRawUTF8(), passbandText.toRawUTF8(), htText.toRawUTF8(), config.modelRate, config.arOrder, config.refreshMs, windowMs,
+                     result.meanErrorDeg, result.circStdDeg, result.maeDeg, result.p95Deg,
+                     result.nsPerSampleChannel, result.fitUs, result.cpuPercent);
+    }
+}
+
+void runSweep (const BinaryRecording& recording, const Array<Passband>& passbands, const Array<SweepConfig>& configs, const SweepOptions& options)
+{
+    const float fs = float (recording.getSampleRate());
+    const int numChannels = options.channels.size();
+    const int blockSize = options.blockSize;
+
+    const int64 segmentStart = jmin (recording.getNumSamples(), int64 (options.startSeconds * fs));
+    int64 numSamples = recording.getNumSamples() - segmentStart;
+    if (options.maxSeconds > 0)
+    {
+        numSamples = jmin (numSamples, int64 (options.maxSeconds * fs));
+    }
+
+    const int64 chunkSamples = jmax (int64 (1), int64 (chunkSeconds * fs / blockSize)) * blockSize;
+    const int64 numChunks = (numSamples + chunkSamples - 1) / chunkSamples;
+    const int64 margin = int64 (referenceMarginSeconds * fs);
+
+    OwnedArray<FilterJob> filterJobs; // passband-major
+    for (const auto& passband : passbands)
+    {
+        for (int c = 0; c < numChannels; ++c)
+        {
+            filterJobs.add (new FilterJob (passband, fs, int (chunkSamples)));
+        }
+    }
+
+    OwnedArray<SweepJob> jobs; // configuration-major
+    for (const auto& config : configs)
+    {
+        EngineParams params = getParams (config, passbands[config.passband]);
+        for (int c = 0; c < numChannels; ++c)
+        {
+            jobs.add (new SweepJob (params, fs, config, blockSize));
+        }
+    }
+
+    // stage 1: filter output and reference phase of each passband and channel
+    Stage filterStage = { filterJobs.size(), [&] (int task, int64 chunk)
+                          {
+                              FilterJob& job = *filterJobs[task];
+                              const Passband& passband = passbands[task / numChannels];
+                              const int chan = options.channels[task % numChannels];
+
+                              const int64 start = chunk * chunkSamples;
+                              const int n = int (jmin (chunkSamples, numSamples - start));
+
+                              recording.readChannel (chan, segmentStart + start, n, job.filtered.data());
+
+                              auto t0 = Clock::now();
+                              float* data = job.filtered.data();
+                              job.filter.process (n, &data);
+                              job.filterNs += elapsedNs (t0, Clock::now());
+
+                              const int64 refStart = jmax (int64 (0), start - margin);
+                              const int64 refEnd = jmin (numSamples, start + n + margin);
+                              std::vector<float> raw (size_t (refEnd - refStart));
+                              std::vector<double> phase (raw.size());
+                              recording.readChannel (chan, segmentStart + refStart, int (raw.size()), raw.data());
+                              OfflinePhase::compute (raw.data(), int (raw.size()), fs, passband.lowCut, passband.highCut, phase.data());
+                              std::copy_n (phase.begin() + (start - refStart), n, job.reference.begin());
+                          } };
+
+    // stage 2: the rest of the pipeline for each configuration and channel
+    Stage processStage = { jobs.size(), [&] (int task, int64 chunk)
+                           {
+                               SweepJob& job = *jobs[task];
+                               const SweepConfig& config = configs[task / numChannels];
+                               const FilterJob& input = *filterJobs[config.passband * numChannels + task % numChannels];
+                               const EngineParams params = getParams (config, passbands[config.passband]);
+
+                               // evaluate from one second after the history first fills, and not where the reference has edge effects
+                               const int64 evalStart = job.state.history.size() + int64 (fs);
+                               const int64 evalEnd = numSamples - margin;
+
+                               const int64 chunkStart = chunk * chunkSamples;
+                               const int64 chunkEnd = jmin (numSamples, chunkStart + chunkSamples);
+
+                               for (int64 start = chunkStart; start < chunkEnd; start += blockSize)
+                               {
+                                   const int n = int (jmin (int64 (blockSize), chunkEnd - start));
+                                   const int offset = int (start - chunkStart);
+                                   FloatVectorOperations::copy (job.block.get(), input.filtered.data() + offset, n);
+
+                                   auto t0 = Clock::now();
+                                   bool valid = job.engine.processFiltered (params, job.state, job.block, n);
+                                   job.processNs += elapsedNs (t0, Clock::now());
+
+                                   for (int i = int (jmax (int64 (0), evalStart - start)); valid && i < n && start + i < evalEnd; ++i)
+                                   {
+                                       job.errors.add (job.block[i], input.reference[size_t (offset + i)]);
+                                   }
+
+                                   job.samplesToRefresh -= n;
+                                   if (job.samplesToRefresh <= 0)
+                                   {
+                                       job.samplesToRefresh += job.refreshSamples * (1 + (-job.samplesToRefresh) / job.refreshSamples);
+
+                                       t0 = Clock::now();
+                                       if (job.state.fitModel (job.reverseData))
+                                       {
+                                           job.fitNs += elapsedNs (t0, Clock::now());
+                                           ++job.numFits;
+                                       }
+                                   }
+                               }
+                           } };
+
+    runChunked (options.numThreads, numChunks, { filterStage, processStage });
+
+    printHeader (options);
+
+    const double signalNs = 1e9 * double (numSamples) / fs;
+    for (int k = 0; k < configs.size(); ++k)
+    {
+        const SweepConfig& config = configs[k];
+
+        PhaseErrorStats errors;
+        double processNs = 0, fitNs = 0;
+        int64 numFits = 0;
+        for (int c = 0; c < numChannels; ++c)
+        {
+            const SweepJob& job = *jobs[k * numChannels + c];
+            errors.merge (job.errors);
+            processNs += job.processNs + filterJobs[config.passband * numChannels + c]->filterNs;
+            fitNs += job.fitNs;
+            numFits += job.numFits;
+        }
+
+        AccuracyResult result = {};
+        errors.getResult (result);
+        result.nsPerSampleChannel = numSamples > 0 ? processNs / (double (numSamples) * numChannels) : 0;
+        result.fitUs = numFits > 0 ? fitNs / numFits / 1000 : 0;
+        result.cpuPercent = signalNs > 0 ? 100 * (processNs + fitNs) / numChannels / signalNs : 0;
+
+        // the effective window (the history is at least 1 second long)
+        const int windowMs = roundToInt (1000 * jobs[k * numChannels]->state.history.size() / fs);
+        printResult (config, passbands[config.passband], windowMs, result, options);
+    }
+}
+
+void printUsage()
+{
+    std::printf ("Usage: phase_sweep <continuous.dat> [--channels 0,1,2,3] [--bands 0,1,2,3,4]\n"
+                 "                   [--passbands <low>-<high>,...] [--delays 0] [--model-rates 500] [--orders 10,20,40]\n"
+                 "                   [--refreshes 50] [--windows 1024] [--block 1024] [--start <s>] [--seconds <s>]\n"
+                 "                   [--threads <n>] [--csv] [--num-channels <n> --sample-rate <Hz>]\n");
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    File inputFile;
+    SweepOptions options;
+    Array<int> channels ({ 0, 1, 2, 3 });
+    Array<int> bands ({ 0, 1, 2, 3, 4 });
+    Array<Passband> passbandList;
+    Array<int> delays ({ 0 });
+    Array<int> modelRates ({ Hilbert::fs });
+    Array<int> orders ({ 10, 20, 40 });
+    Array<int> refreshes ({ 50 });
+    Array<int> windows ({ historyMs });
+    int numChannelsOverride = 0;
+    double sampleRateOverride = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg (argv[i]);
+        String value = i + 1 < argc ? String (argv[i + 1]) : String();
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--csv")
+        {
+            options.csv = true;
+            continue;
+        }
+
+        if (hasValue && arg == "--channels")
+        {
+            channels = parseList (value);
+        }
+        else if (hasValue && arg == "--bands")
+        {
+            bands = parseList (value);
+        }
+        else if (hasValue && arg == "--passbands")
+        {
+            passbandList = parsePassbands (value);
+        }
+        else if (hasValue && arg == "--delays")
+        {
+            delays = parseList (value);
+        }
+        else if (hasValue && arg == "--model-rates")
+        {
+            modelRates = parseList (value);
+        }
+        else if (hasValue && arg == "--orders")
+        {
+            orders = parseList (value);
+        }
+        else if (hasValue && arg == "--refreshes")
+        {
+            refreshes = parseList (value);
+        }
+        else if (hasValue && arg == "--windows")
+        {
+            windows = parseList (value);
+        }
+        else if (hasValue && arg == "--block")
+        {
+            options.blockSize = value.getIntValue();
+        }
+        else if (hasValue && arg == "--start")
+        {
+            options.startSeconds = value.getDoubleValue();
+        }
+        else if (hasValue && arg == "--seconds")
+        {
+            options.maxSeconds = value.getDoubleValue();
+        }
+        else if (hasValue && arg == "--threads")
+        {
+            options.numThreads = value.getIntValue();
+        }
+        else if (hasValue && arg == "--num-channels")
+        {
+            numChannelsOverride = value.getIntValue();
+        }
+        else if (hasValue && arg == "--sample-rate")
+        {
+            sampleRateOverride = value.getDoubleValue();
+        }
+        else if (! arg.startsWith ("--") && inputFile == File())
+        {
+            inputFile = File::getCurrentWorkingDirectory().getChildFile (arg);
+            continue;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+        ++i;
+    }
+
+    if (inputFile == File())
+    {
+        printUsage();
+        return 1;
+    }
+
+    BinaryRecording recording;
+    if (! recording.open (inputFile, numChannelsOverride, sampleRateOverride))
+    {
+        std::printf ("Error: %s\n", recording.getError().toRawUTF8());
+        return 1;
+    }
+
+    for (int modelRate : modelRates)
+    {
+        if (! EngineParams::getModelRates().contains (modelRate))
+        {
+            std::printf ("Error: the modeling rates must be 500, 1000 or 2000 Hz\n");
+            return 1;
+        }
+
+        if (! ChannelState::isSupportedRate (float (recording.getSampleRate()), modelRate))
+        {
+            std::printf ("Error: the sample rate (%.1f Hz) is below the %d Hz modeling rate\n", recording.getSampleRate(), modelRate);
+            return 1;
+        }
+    }
+
+    for (int chan : channels)
+    {
+        if (chan < 0 || chan >= recording.getNumChannels())
+        {
+            std::printf ("Error: channel %d is not in the file (%d channels)\n", chan, recording.getNumChannels());
+            return 1;
+        }
+        options.channels.addIfNotAlreadyThere (chan);
+    }
+
+    if (options.channels.isEmpty() || options.blockSize < 1)
+    {
+        printUsage();
+        return 1;
+    }
+
+    // the grid, skipping passbands outside a band's valid range
+    Array<Passband> passbands;
+    Array<SweepConfig> configs;
+    for (int band : bands)
+    {
+        if (band < 0 || band >= NUM_BANDS)
+        {
+            std::printf ("Error: the bands must be from 0 to %d\n", NUM_BANDS - 1);
+            return 1;
+        }
+
+        Array<Passband> bandPassbands = passbandList;
+        if (bandPassbands.isEmpty())
+        {
+            bandPassbands.add ({ Hilbert::defaultBand[band][0], Hilbert::defaultBand[band][1] });
+        }
+
+        for (const auto& passband : bandPassbands)
+        {
+            for (int delay : delays)
+            {
+                if (delay < 0 || delay > Hilbert::maxDesignDelay)
+                {
+                    std::printf ("Error: the delays must be from 0 to %d\n", Hilbert::maxDesignDelay);
+                    return 1;
+                }
+
+                for (int modelRate : modelRates)
+                {
+                    const Array<float> validBand = delay > 0 ? Hilbert::getDesignableBand (modelRate) : Hilbert::validBand[band];
+                    if (passband.lowCut < validBand[0] || passband.highCut > validBand[1] || passband.lowCut >= passband.highCut)
+                    {
+                        continue;
+                    }
+
+                    passbands.addIfNotAlreadyThere (passband);
+                    int passbandIndex = passbands.indexOf (passband);
+
+                    // designed transformers don't depend on the band, so evaluate them with the first one
+                    if (delay > 0 && std::any_of (configs.begin(), configs.end(), [&] (const SweepConfig& c)
+                                                  { return c.passband == passbandIndex && c.htDelay == delay && c.modelRate == modelRate; }))
+                    {
+                        continue;
+                    }
+
+                    for (int order : orders)
+                    {
+                        for (int refresh : refreshes)
+                        {
+                            for (int window : windows)
+                            {
+                                if (order > 0 && refresh > 0 && window > 0)
+                                {
+                                    configs.add ({ Band (band), passbandIndex, delay, modelRate, order, refresh, window });
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (configs.isEmpty())
+    {
+        std::printf ("Error: no valid configurations (check that the passbands are within the bands' valid ranges)\n");
+        return 1;
+    }
+
+    if (options.numThreads <= 0)
+    {
+        options.numThreads = jmax (1, int (std::thread::hardware_concurrency()));
+    }
+
+    if (! options.csv)
+    {
+        double available = recording.getNumSamples() / recording.getSampleRate() - options.startSeconds;
+        std::printf ("%s: %d configurations (%d passbands) x %d channels, %.1f s at %.0f Hz, %d threads\n",
+                     inputFile.getFullPathName().toRawUTF8(),
+                     configs.size(),
+                     passbands.size(),
+                     options.channels.size(),
+                     options.maxSeconds > 0 ? jmin (options.maxSeconds, available) : available,
+                     recording.getSampleRate(),
+                     options.numThreads);
+    }
+
+    auto start = Clock::now();
+    runSweep (recording, passbands, configs, options);
+
+    if (! options.csv)
+    {
+        std::printf ("done in %.1f s\n", elapsedNs (start, Clock::now()) / 1e9);
+    }
+    return 0;
+}
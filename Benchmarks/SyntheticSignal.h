@@ -0,0 +1,144 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef SYNTHETIC_SIGNAL_H_INCLUDED
+#define SYNTHETIC_SIGNAL_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <cmath>
+
+/*
+
+Synthetic test signal for one channel: a sinusoid plus 1/f ("pink") noise.
+
+The noise uses the Voss-McCartney algorithm: numRows random values, where row k is redrawn
+every 2^k samples, are summed with a white noise term. This gives an approximately 1/f power
+spectrum from fs/2 down to about fs / 2^(numRows + 1), independent of the sample rate (as long
+as there are enough rows). The output is deterministic for a given seed.
+
+*/
+
+namespace PhaseCalculator
+{
+class SyntheticSignal
+{
+public:
+    SyntheticSignal (double sampleRate, double frequency, double sineAmplitude, double noiseAmplitude, int64 seed)
+        : random (seed),
+          fs (sampleRate),
+          phaseStep (2 * double_Pi * frequency / sampleRate),
+          amplitude (sineAmplitude),
+          counter (0),
+          rowSum (0)
+    {
+        phase = random.nextDouble() * 2 * double_Pi;
+
+        // enough rows to reach ~0.5 Hz
+        numRows = jlimit (1, maxRows, int (std::ceil (std::log2 (sampleRate))));
+        noiseScale = noiseAmplitude / std::sqrt (double (numRows + 1));
+
+        for (int row = 0; row < numRows; ++row)
+        {
+            rows[row] = nextWhite();
+            rowSum += rows[row];
+        }
+    }
+
+    // instantaneous phase (in radians) of the sinusoid for the next sample
+    double getNextPhase() const { return phase; }
+
+    double getSampleRate() const { return fs; }
+
+    void generate (float* dest, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+        {
+            dest[i] = float (amplitude * std::cos (phase) + noiseScale * nextPink());
+
+            phase += phaseStep;
+            if (phase > double_Pi)
+            {
+                phase -= 2 * double_Pi;
+            }
+        }
+    }
+
+    /** Generates the sinusoid's phase (in radians) at each of the next numSamples samples, without advancing. */
+    void getPhases (double* dest, int numSamples) const
+    {
+        double p = phase;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            dest[i] = p;
+            p += phaseStep;
+            if (p > double_Pi)
+            {
+                p -= 2 * double_Pi;
+            }
+        }
+    }
+
+private:
+    double nextWhite()
+    {
+        return 2 * random.nextDouble() - 1;
+    }
+
+    double nextPink()
+    {
+        // redraw the row given by the number of trailing zeros of the counter
+        ++counter;
+        int row = 0;
+        for (uint32 c = counter; (c & 1) == 0 && row < numRows - 1; c >>= 1)
+        {
+            ++row;
+        }
+
+        rowSum -= rows[row];
+        rows[row] = nextWhite();
+        rowSum += rows[row];
+
+        return rowSum + nextWhite();
+    }
+
+    static const int maxRows = 24;
+
+    Random random;
+
+    double fs;
+    double phase;
+    double phaseStep;
+    double amplitude;
+
+    int numRows;
+    double noiseScale;
+    uint32 counter;
+    double rows[maxRows];
+    double rowSum;
+
+    JUCE_DECLARE_NON_COPYABLE (SyntheticSignal);
+};
+} // namespace PhaseCalculator
+
+#endif // SYNTHETIC_SIGNAL_H_INCLUDED
@@ -0,0 +1,522 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef WORKLOADS_H_INCLUDED
+#define WORKLOADS_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <algorithm>
+#include <cfloat> // DBL_MIN
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "OfflinePhase.h"
+#include "PhaseEngine.h"
+#include "SyntheticSignal.h"
+
+/*
+
+Workloads shared by the benchmark and regression test executables:
+
+- runBenchmark:  streams synthetic signals through PhaseEngine::processChannel block by block,
+                 refitting the AR models at a fixed interval of signal time, and times both.
+- runAccuracy:   streams a whole recording (synthetic or loaded from a file) through the engine
+                 and compares every output sample with its offline phase (OfflinePhase.h).
+
+*/
+
+namespace PhaseCalculator
+{
+namespace Bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    // length of the history, as in the plugin (GroundTruthEngine::hilbertLengthMs)
+    const int historyMs = 1024;
+
+    struct BenchConfig
+    {
+        int channels;
+        int sampleRate;
+        Band band;
+        int arOrder;
+        int blockSize;
+        int modelRate = Hilbert::fs;
+        bool fullRate = false;
+        float horizonMs = 0;
+        EngineParams::Estimator estimator = EngineParams::AR_PREDICTION;
+    };
+
+    struct BenchResult
+    {
+        double nsPerSampleChannel;
+        double p50Us;
+        double p99Us;
+        double maxUs;
+        double p99Load;
+        double fitUs;
+        double refitsPerSecond;
+    };
+
+    inline double elapsedNs (Clock::time_point start, Clock::time_point end)
+    {
+        return double (std::chrono::duration_cast<std::chrono::nanoseconds> (end - start).count());
+    }
+
+    inline double percentile (const std::vector<double>& sorted, double p)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+
+        size_t ind = size_t (p * (sorted.size() - 1) + 0.5);
+        return sorted[jmin (ind, sorted.size() - 1)];
+    }
+
+    /** Channels, signals and buffers for one configuration, driven one block at a time. */
+    class BenchRun
+    {
+    public:
+        BenchRun (const BenchConfig& benchConfig)
+            : config (benchConfig),
+              data (size_t (benchConfig.channels) * size_t (benchConfig.blockSize))
+        {
+            params.arOrder = config.arOrder;
+            params.band = config.band;
+            params.lowCut = Hilbert::defaultBand[config.band][0];
+            params.highCut = Hilbert::defaultBand[config.band][1];
+            params.modelRate = config.modelRate;
+            params.fullRate = config.fullRate;
+            params.horizonMs = config.horizonMs;
+            params.estimator = config.estimator;
+            params.updateTransformer();
+
+            double frequency = (params.lowCut + params.highCut) / 2;
+
+            int historySize = 0;
+            for (int c = 0; c < config.channels; ++c)
+            {
+                ChannelState* state = states.add (new ChannelState());
+                state->configure (params, float (config.sampleRate), historyMs);
+                historySize = state->history.size();
+
+                signals.add (new SyntheticSignal (config.sampleRate, frequency, 1.0, 2.0, c + 1));
+            }
+
+            reverseData.resize (historySize);
+        }
+
+        void generateBlock()
+        {
+            for (int c = 0; c < config.channels; ++c)
+            {
+                signals[c]->generate (getChannel (c), config.blockSize);
+            }
+        }
+
+        void processBlock()
+        {
+            for (int c = 0; c < config.channels; ++c)
+            {
+                engine.processChannel (params, *states[c], getChannel (c), config.blockSize);
+            }
+        }
+
+        // returns the number of models fit (none with the endpoint-corrected estimator)
+        int fitModels()
+        {
+            int numFit = 0;
+            for (auto state : states)
+            {
+                numFit += state->fitModel (reverseData) ? 1 : 0;
+            }
+            return numFit;
+        }
+
+        float* getChannel (int c) { return data.get() + size_t (c) * size_t (config.blockSize); }
+
+        const BenchConfig config;
+
+        EngineParams params;
+        OwnedArray<ChannelState> states;
+        OwnedArray<SyntheticSignal> signals;
+        PhaseEngine engine;
+
+        HeapBlock<float> data;
+        Array<double> reverseData;
+    };
+
+    inline BenchResult runBenchmark (const BenchConfig& config, double seconds, int refreshMs)
+    {
+        BenchRun run (config);
+
+        const double blockMs = 1000.0 * config.blockSize / config.sampleRate;
+        const int numBlocks = jmax (1, int (seconds * 1000 / blockMs));
+        const double refreshBlocks = jmax (1.0, refreshMs / blockMs);
+
+        // fill the histories and fit the models, then run one more second untimed to warm up
+        const int historyBlocks = run.states[0]->history.size() / config.blockSize + 1;
+        const int warmupBlocks = historyBlocks + int (1000 / blockMs) + 1;
+        for (int b = 0; b < warmupBlocks; ++b)
+        {
+            run.generateBlock();
+            run.processBlock();
+
+            if (b >= historyBlocks && (b - historyBlocks) % int (refreshBlocks) == 0)
+            {
+                run.fitModels();
+            }
+        }
+
+        std::vector<double> blockNs;
+        blockNs.reserve (numBlocks);
+
+        double fitNs = 0;
+        int numFits = 0;
+        double nextRefresh = refreshBlocks;
+
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            run.generateBlock();
+
+            auto start = Clock::now();
+            run.processBlock();
+            auto end = Clock::now();
+            blockNs.push_back (elapsedNs (start, end));
+
+            if (b + 1 >= nextRefresh)
+            {
+                nextRefresh += refreshBlocks;
+
+                start = Clock::now();
+                numFits += run.fitModels();
+                end = Clock::now();
+                fitNs += elapsedNs (start, end);
+            }
+        }
+
+        double totalNs = 0;
+        for (double ns : blockNs)
+        {
+            totalNs += ns;
+        }
+
+        std::sort (blockNs.begin(), blockNs.end());
+
+        BenchResult result;
+        result.nsPerSampleChannel = totalNs / (double (numBlocks) * config.blockSize * config.channels);
+        result.p50Us = percentile (blockNs, 0.5) / 1000;
+        result.p99Us = percentile (blockNs, 0.99) / 1000;
+        result.maxUs = blockNs.back() / 1000;
+        result.p99Load = 100 * result.p99Us / (1000 * blockMs);
+        result.fitUs = numFits > 0 ? fitNs / numFits / 1000 : 0;
+        result.refitsPerSecond = fitNs > 0 ? numFits / (fitNs / 1e9) : 0;
+        return result;
+    }
+
+    struct AccuracyConfig
+    {
+        Band band;
+        int arOrder;
+        int refreshMs;
+        int modelRate = Hilbert::fs;
+        bool fullRate = false;
+        float horizonMs = 0;
+        EngineParams::Estimator estimator = EngineParams::AR_PREDICTION;
+    };
+
+    struct AccuracyResult
+    {
+        int64 numCompared;
+        double meanErrorDeg;
+        double circStdDeg;
+        double maeDeg;
+        double p95Deg;
+        double nsPerSampleChannel;
+        double fitUs;
+        double cpuPercent;
+    };
+
+    /** Accumulates the errors of phase outputs against a reference, for an AccuracyResult */
+    class PhaseErrorStats
+    {
+    public:
+        PhaseErrorStats()
+            : errorHist (numErrorBins + 1)
+        {
+        }
+
+        /** Adds the error of an output in degrees against a reference phase in radians */
+        void add (float outputDeg, double reference)
+        {
+            double error = PhaseEngine::circDist (degreesToRadians (double (outputDeg)), reference, Dsp::doublePi);
+            sumCos += std::cos (error);
+            sumSin += std::sin (error);
+
+            double absDeg = std::abs (radiansToDegrees (error));
+            sumAbs += absDeg;
+            ++errorHist[jmin (numErrorBins, int (absDeg * 10))];
+            ++numCompared;
+        }
+
+        /** Adds the errors accumulated by other (e.g. on another channel) */
+        void merge (const PhaseErrorStats& other)
+        {
+            for (size_t bin = 0; bin < errorHist.size(); ++bin)
+            {
+                errorHist[bin] += other.errorHist[bin];
+            }
+            sumCos += other.sumCos;
+            sumSin += other.sumSin;
+            sumAbs += other.sumAbs;
+            numCompared += other.numCompared;
+        }
+
+        /** Fills in the error fields of result (numCompared and the statistics in degrees) */
+        void getResult (AccuracyResult& result) const
+        {
+            result.numCompared = numCompared;
+            if (numCompared == 0)
+            {
+                return;
+            }
+
+            double r = std::sqrt (sumCos * sumCos + sumSin * sumSin) / numCompared;
+            result.meanErrorDeg = radiansToDegrees (std::atan2 (sumSin, sumCos));
+            result.circStdDeg = radiansToDegrees (std::sqrt (-2 * std::log (jmax (r, DBL_MIN))));
+            result.maeDeg = sumAbs / numCompared;
+
+            int64 count = 0;
+            int64 p95Count = int64 (0.95 * numCompared);
+            for (int bin = 0; bin <= numErrorBins; ++bin)
+            {
+                count += errorHist[bin];
+                if (count > p95Count)
+                {
+                    result.p95Deg = (bin + 1) / 10.0;
+                    break;
+                }
+            }
+        }
+
+    private:
+        // resultant vector, sum of absolute errors and a 0.1-degree histogram
+        static const int numErrorBins = 1800;
+        std::vector<int64> errorHist;
+        double sumCos = 0, sumSin = 0, sumAbs = 0;
+        int64 numCompared = 0;
+    };
+
+    /** Whole-record data of several channels at one sample rate */
+    struct Recording
+    {
+        int sampleRate = 0;
+        std::vector<std::vector<float>> channels;
+
+        int getNumSamples() const { return channels.empty() ? 0 : int (channels[0].size()); }
+    };
+
+    inline Recording makeSyntheticRecording (Band band, int sampleRate, int numChannels, int numSamples)
+    {
+        Recording recording;
+        recording.sampleRate = sampleRate;
+
+        double frequency = (Hilbert::defaultBand[band][0] + Hilbert::defaultBand[band][1]) / 2;
+        for (int c = 0; c < numChannels; ++c)
+        {
+            SyntheticSignal signal (sampleRate, frequency, 1.0, 2.0, c + 1);
+            recording.channels.emplace_back (numSamples);
+            signal.generate (recording.channels.back().data(), numSamples);
+        }
+        return recording;
+    }
+
+    /** Reads up to maxSamples samples of the first numChannels channels of a file of interleaved int16 samples. */
+    inline bool loadRecording (const File& file, int numFileChannels, int sampleRate, int numChannels, int maxSamples, Recording& recording)
+    {
+        FileInputStream stream (file);
+        if (stream.failedToOpen() || numFileChannels <= 0)
+        {
+            return false;
+        }
+
+        numChannels = jmin (numChannels, numFileChannels);
+        int numSamples = int (jmin (int64 (maxSamples), stream.getTotalLength() / (2 * numFileChannels)));
+
+        recording.sampleRate = sampleRate;
+        recording.channels.assign (numChannels, std::vector<float> (numSamples));
+
+        const int chunkSamples = 4096;
+        HeapBlock<int16> chunk (size_t (chunkSamples) * size_t (numFileChannels));
+        for (int start = 0; start < numSamples; start += chunkSamples)
+        {
+            int n = jmin (chunkSamples, numSamples - start);
+            int bytes = n * numFileChannels * 2;
+            if (stream.read (chunk.get(), bytes) != bytes)
+            {
+                return false;
+            }
+
+            for (int i = 0; i < n; ++i)
+            {
+                for (int c = 0; c < numChannels; ++c)
+                {
+                    recording.channels[c][start + i] = float (int16 (ByteOrder::swapIfBigEndian (uint16 (chunk[i * numFileChannels + c]))));
+                }
+            }
+        }
+        return true;
+    }
+
+    /*
+        * Runs the recording through the engine and compares the output with the offline phase.
+        * If output is not null, it receives the output (in degrees) of every channel, one after
+        * the other, for all complete blocks.
+        */
+    inline AccuracyResult runAccuracy (const AccuracyConfig& config, const Recording& recording, int blockSize, std::vector<float>* output = nullptr)
+    {
+        const int numChannels = int (recording.channels.size());
+        const int numSamples = recording.getNumSamples();
+        const int fs = recording.sampleRate;
+
+        EngineParams params;
+        params.arOrder = config.arOrder;
+        params.band = config.band;
+        params.lowCut = Hilbert::defaultBand[config.band][0];
+        params.highCut = Hilbert::defaultBand[config.band][1];
+        params.modelRate = config.modelRate;
+        params.fullRate = config.fullRate;
+        params.horizonMs = config.horizonMs;
+        params.estimator = config.estimator;
+        params.updateTransformer();
+
+        // with a look-ahead horizon, each output is compared with the offline phase that much later
+        const int horizon = params.getHorizonSamples (float (fs));
+
+        OwnedArray<ChannelState> states;
+        for (int c = 0; c < numChannels; ++c)
+        {
+            states.add (new ChannelState())->configure (params, float (fs), historyMs);
+        }
+
+        PhaseEngine engine;
+        Array<double> reverseData;
+        reverseData.resize (states[0]->history.size());
+
+        // evaluate from one second after the history first fills until one second before the end
+        const int evalStart = states[0]->history.size() + fs;
+        const int evalEnd = numSamples - fs;
+
+        PhaseErrorStats errors;
+
+        std::vector<double> offline (numSamples);
+        HeapBlock<float> block (blockSize);
+
+        const int refreshSamples = jmax (1, config.refreshMs * fs / 1000);
+        int nextRefresh = 0;
+
+        double processNs = 0;
+        double fitNs = 0;
+        int numFits = 0;
+
+        if (output != nullptr)
+        {
+            output->clear();
+        }
+
+        for (int c = 0; c < numChannels; ++c)
+        {
+            const float* data = recording.channels[c].data();
+            OfflinePhase::compute (data, numSamples, float (fs), params.lowCut, params.highCut, offline.data());
+
+            ChannelState& state = *states[c];
+            nextRefresh = 0;
+
+            for (int start = 0; start + blockSize <= numSamples; start += blockSize)
+            {
+                FloatVectorOperations::copy (block.get(), data + start, blockSize);
+
+                auto t0 = Clock::now();
+                bool valid = engine.processChannel (params, state, block.get(), blockSize);
+                auto t1 = Clock::now();
+                processNs += elapsedNs (t0, t1);
+
+                if (output != nullptr)
+                {
+                    output->insert (output->end(), block.get(), block.get() + blockSize);
+                }
+
+                if (start + blockSize >= nextRefresh && state.history.isFull())
+                {
+                    nextRefresh = start + blockSize + refreshSamples;
+
+                    t0 = Clock::now();
+                    bool fitted = state.fitModel (reverseData);
+                    t1 = Clock::now();
+                    fitNs += elapsedNs (t0, t1);
+                    numFits += fitted ? 1 : 0;
+                }
+
+                if (! valid)
+                {
+                    continue;
+                }
+
+                for (int i = jmax (0, evalStart - start); i < blockSize && start + i < evalEnd; ++i)
+                {
+                    errors.add (block[i], offline[start + i + horizon]);
+                }
+            }
+        }
+
+        AccuracyResult result = {};
+        errors.getResult (result);
+
+        int numProcessed = (numSamples / blockSize) * blockSize;
+        double signalNs = 1e9 * numProcessed / fs;
+        result.nsPerSampleChannel = processNs / (double (numProcessed) * numChannels);
+        result.fitUs = numFits > 0 ? fitNs / numFits / 1000 : 0;
+        result.cpuPercent = 100 * (processNs + fitNs) / numChannels / signalNs;
+
+        return result;
+    }
+
+    inline Array<int> parseList (const String& text)
+    {
+        Array<int> values;
+        for (auto& token : StringArray::fromTokens (text, ",", ""))
+        {
+            if (token.trim().isNotEmpty())
+            {
+                values.add (token.trim().getIntValue());
+            }
+        }
+        return values;
+    }
+} // namespace Bench
+} // namespace PhaseCalculator
+
+#endif // WORKLOADS_H_INCLUDED
@@ -43,7 +43,7 @@ public:
         hasBeenUsed = false;
     }
 
-    bool hasBeenFit()
+    bool hasBeenFit() const
     {
         return hasBeenUsed;
     }
@@ -128,6 +128,12 @@ public:
         hasBeenUsed = true;
     }
 
+    // bytes allocated for the fit's working storage and coefficients
+    size_t getMemoryBytes() const
+    {
+        return sizeof (double) * size_t (j_per.size() + j_pef.size() + j_h.size() + j_coef_temp.size() + coefficients.size());
+    }
+
 private:
     void reallocateStorage()
     {
@@ -0,0 +1,265 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring> // memcpy
+
+#include "BlockCapture.h"
+#include "PhaseCalculator.h"
+
+namespace PhaseCalculator
+{
+BlockCapture::BlockCapture()
+    : Thread ("Block capture"),
+      capturing (false),
+      startTime (0),
+      fifo (fifoBytes),
+      fifoData (fifoBytes),
+      mapStart (0),
+      writePosition (0),
+      numDropped (0)
+{
+}
+
+BlockCapture::~BlockCapture()
+{
+    stop();
+}
+
+void BlockCapture::start (const File& fileWithoutExtension, const CaptureFile::Info& newInfo, const Array<int>& newBufferChannels)
+{
+    stop();
+
+    jassert (newInfo.channels.size() == newBufferChannels.size());
+
+    file = fileWithoutExtension.withFileExtension (getFileExtension());
+    info = newInfo;
+    bufferChannels = newBufferChannels;
+
+    fifo.reset();
+    numDropped = 0;
+    startTime = StageTimings::now();
+    capturing = true;
+
+    startThread();
+}
+
+void BlockCapture::stop()
+{
+    capturing = false;
+
+    if (isThreadRunning())
+    {
+        // the writer drains the FIFO before exiting
+        signalThreadShouldExit();
+        notify();
+        stopThread (10000);
+
+        if (numDropped > 0)
+        {
+            LOGC ("PhaseCalculator: ", numDropped.load(), " blocks or events could not be captured to ", outFile.getFullPathName());
+        }
+    }
+}
+
+void BlockCapture::pushBlock (const AudioBuffer<float>& buffer, int64 firstSampleNumber, int nSamples)
+{
+    if (! capturing || nSamples == 0)
+    {
+        return;
+    }
+
+    const int numChannels = bufferChannels.size();
+    const int recordSize = int (CaptureFile::getBlockRecordSize (numChannels, nSamples));
+    if (fifo.getFreeSpace() < recordSize)
+    {
+        ++numDropped;
+        return;
+    }
+
+    CaptureFile::BlockHeader header = { CaptureFile::BLOCK, nSamples, firstSampleNumber, StageTimings::now() - startTime };
+    writeToFifo (&header, sizeof (header));
+
+    for (int chan : bufferChannels)
+    {
+        writeToFifo (buffer.getReadPointer (chan), nSamples * int (sizeof (float)));
+    }
+
+    static const char padding[8] = {};
+    writeToFifo (padding, recordSize - int (sizeof (header)) - numChannels * nSamples * int (sizeof (float)));
+
+    // wake the writer once a batch is ready
+    if (fifo.getNumReady() >= fifoBytes / 16)
+    {
+        notify();
+    }
+}
+
+void BlockCapture::pushEvent (int line, int64 sampleNumber, bool state)
+{
+    if (! capturing)
+    {
+        return;
+    }
+
+    if (fifo.getFreeSpace() < int (sizeof (CaptureFile::EventRecord)))
+    {
+        ++numDropped;
+        return;
+    }
+
+    CaptureFile::EventRecord event = { CaptureFile::EVENT, line, sampleNumber, state ? 1 : 0, 0 };
+    writeToFifo (&event, sizeof (event));
+}
+
+void BlockCapture::writeToFifo (const void* source, int numBytes)
+{
+    if (numBytes <= 0)
+    {
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (numBytes, start1, size1, start2, size2);
+    jassert (size1 + size2 == numBytes);
+
+    const char* bytes = static_cast<const char*> (source);
+    std::memcpy (fifoData + start1, bytes, size_t (size1));
+    std::memcpy (fifoData + start2, bytes + size1, size_t (size2));
+    fifo.finishedWrite (size1 + size2);
+}
+
+void BlockCapture::run()
+{
+    // find a new name rather than overwriting a previous capture in the same directory
+    outFile = file.getNonexistentSibling();
+    outFile.getParentDirectory().createDirectory();
+
+    mapped.reset();
+    mapStart = 0;
+    writePosition = 0;
+
+    MemoryOutputStream header;
+    CaptureFile::writeHeader (info, header);
+
+    if (! outFile.create() || ! writeToFile (static_cast<const char*> (header.getData()), int64 (header.getDataSize())))
+    {
+        LOGE ("PhaseCalculator: Could not create ", outFile.getFullPathName(), " to capture input blocks");
+        capturing = false;
+        mapped.reset();
+        return;
+    }
+
+    LOGC ("PhaseCalculator: Capturing input blocks to ", outFile.getFullPathName());
+
+    bool ok = true;
+    while (ok && ! threadShouldExit())
+    {
+        ok = drain();
+        wait (200);
+    }
+
+    ok = ok && drain();
+
+    // unmap, then trim the last chunk to the data written
+    mapped.reset();
+    if (! ok || ! setFileLength (outFile, writePosition))
+    {
+        LOGE ("PhaseCalculator: Error writing ", outFile.getFullPathName(), "; the capture is incomplete");
+        capturing = false;
+    }
+}
+
+bool BlockCapture::drain()
+{
+    int numReady = fifo.getNumReady();
+    if (numReady == 0)
+    {
+        return true;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (numReady, start1, size1, start2, size2);
+    bool ok = writeToFile (fifoData + start1, size1) && writeToFile (fifoData + start2, size2);
+    fifo.finishedRead (size1 + size2);
+    return ok;
+}
+
+bool BlockCapture::writeToFile (const char* source, int64 numBytes)
+{
+    while (numBytes > 0)
+    {
+        if (mapped == nullptr || writePosition >= mapStart + mapChunkBytes)
+        {
+            // extend the file by one chunk and map it
+            mapped.reset();
+            mapStart = (writePosition / mapChunkBytes) * mapChunkBytes;
+            if (! setFileLength (outFile, mapStart + mapChunkBytes))
+            {
+                return false;
+            }
+
+            mapped = std::make_unique<MemoryMappedFile> (outFile, Range<int64> (mapStart, mapStart + mapChunkBytes), MemoryMappedFile::readWrite);
+            if (mapped->getData() == nullptr)
+            {
+                mapped.reset();
+                return false;
+            }
+        }
+
+        int64 offset = writePosition - mapStart;
+        int64 n = jmin (numBytes, mapChunkBytes - offset);
+        std::memcpy (static_cast<char*> (mapped->getData()) + offset, source, size_t (n));
+
+        source += n;
+        numBytes -= n;
+        writePosition += n;
+    }
+    return true;
+}
+
+bool BlockCapture::setFileLength (const File& f, int64 length)
+{
+    FileOutputStream stream (f);
+    if (stream.failedToOpen())
+    {
+        return false;
+    }
+
+    if (length < stream.getPosition())
+    {
+        return stream.setPosition (length) && stream.truncate().wasOk();
+    }
+
+    if (length > stream.getPosition())
+    {
+        // write the last byte to extend the file (sparsely, where supported)
+        if (! stream.setPosition (length - 1) || ! stream.writeByte (0))
+        {
+            return false;
+        }
+    }
+
+    stream.flush();
+    return stream.getStatus().wasOk();
+}
+} // namespace PhaseCalculator
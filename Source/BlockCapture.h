@@ -0,0 +1,118 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef BLOCK_CAPTURE_H_INCLUDED
+#define BLOCK_CAPTURE_H_INCLUDED
+
+/*
+
+Captures the input blocks and TTL events entering Node::process to a file (see CaptureFile.h),
+so that the exact workload can be replayed offline (Benchmarks/PhaseReplay.cpp).
+
+As in PhaseRecorder, the audio thread only copies records into a preallocated FIFO, and a
+writer thread does all file I/O: it copies the records into a memory mapping of the file,
+which it extends and remaps one chunk at a time. If the writer falls behind and the FIFO fills
+up, whole records are dropped and counted (the replay tool reports the resulting gaps).
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+
+#include "CaptureFile.h"
+
+namespace PhaseCalculator
+{
+class BlockCapture : public Thread
+{
+public:
+    BlockCapture();
+
+    ~BlockCapture();
+
+    /*
+        * Starts capturing to the given file (without extension) in a new thread. bufferChannels
+        * are the indices within the process() buffer of the channels listed in info.channels.
+        */
+    void start (const File& fileWithoutExtension, const CaptureFile::Info& info, const Array<int>& bufferChannels);
+
+    /** Writes out any remaining records, trims and closes the file and stops the thread. */
+    void stop();
+
+    bool isCapturing() const { return capturing.load(); }
+
+    // ---- audio thread (never blocks or allocates) ----
+
+    /** Queues the captured channels of a block, before it is processed. */
+    void pushBlock (const AudioBuffer<float>& buffer, int64 firstSampleNumber, int nSamples);
+
+    /** Queues a TTL event. */
+    void pushEvent (int line, int64 sampleNumber, bool state);
+
+    /** Number of records dropped because the writer could not keep up */
+    int64 getNumDropped() const { return numDropped.load(); }
+
+    /** Writer thread */
+    void run() override;
+
+    static String getFileExtension() { return ".phcap"; }
+
+    static const int fifoBytes = 1 << 25;
+    static const int64 mapChunkBytes = int64 (1) << 26;
+
+private:
+    // copies numBytes into the FIFO; the caller has checked that there is enough space
+    void writeToFifo (const void* source, int numBytes);
+
+    // copies everything queued into the file; returns false on an I/O error
+    bool drain();
+
+    // copies to the mapped file at writePosition, mapping further chunks as needed
+    bool writeToFile (const char* source, int64 numBytes);
+
+    // sets the file's length (which is where the next chunk is mapped from)
+    static bool setFileLength (const File& f, int64 length);
+
+    std::atomic<bool> capturing;
+
+    File file;
+    File outFile;
+    CaptureFile::Info info;
+    Array<int> bufferChannels;
+    int64 startTime;
+
+    AbstractFifo fifo;
+    HeapBlock<char> fifoData;
+
+    std::unique_ptr<MemoryMappedFile> mapped;
+    int64 mapStart;
+    int64 writePosition;
+
+    std::atomic<int64> numDropped;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BlockCapture);
+};
+} // namespace PhaseCalculator
+
+#endif // BLOCK_CAPTURE_H_INCLUDED
@@ -0,0 +1,325 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CAPTURE_FILE_H_INCLUDED
+#define CAPTURE_FILE_H_INCLUDED
+
+/*
+
+Format of the input capture files (.phcap) written by BlockCapture and read by the replay tool.
+A capture holds the raw input blocks of the captured channels and the TTL events, in the order
+in which Node::process received them, so that they can be pushed through the engine again.
+
+All values are in native byte order (little-endian on all supported platforms), and the header
+and every record are padded to a multiple of 8 bytes so that the file can be used in place when
+memory-mapped.
+
+- Header:       magic "PHCCAP01", int32 version, int32 header size (including the channel list
+                and padding), float64 sample rate, int32 number of channels, int32 AR order,
+                int32 band, int32 AR refresh interval (ms), float32 low cut, float32 high cut,
+                int32 Hilbert transformer delay (0 = the band's built-in transformer), int32 modeling
+                rate in Hz (0 in older captures, which were all at Hilbert::fs), and since version 2,
+                int32 option flags (FULL_RATE, ENDPOINT_HT) and int32 look-ahead horizon in microseconds (0 in
+                captures from before it was added); then one int32 per channel: its
+                index within the stream. Version 1 captures (without the flags) can still be read.
+- Block record: int32 type (1), int32 number of samples n, int64 sample number of the first
+                sample, int64 capture time (ns since the start of the capture), then n float32
+                samples of each channel, channel after channel.
+- Event record: int32 type (2), int32 TTL line, int64 sample number, int32 state (1 = on),
+                int32 reserved.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <cstring> // memcpy, memcmp
+
+#include "PhaseEngine.h" // EngineParams
+
+namespace PhaseCalculator
+{
+namespace CaptureFile
+{
+    const char magic[] = "PHCCAP01";
+    const int version = 2;
+
+    // size of the header before the channel list, by version
+    inline size_t getFixedHeaderSize (int fileVersion)
+    {
+        return fileVersion >= 2 ? 56 : 48;
+    }
+
+    // bits of the header's option flags
+    enum OptionFlags
+    {
+        FULL_RATE = 1,
+        ENDPOINT_HT = 2
+    };
+
+    enum RecordType
+    {
+        BLOCK = 1,
+        EVENT = 2
+    };
+
+    struct BlockHeader
+    {
+        int32 type;
+        int32 numSamples;
+        int64 firstSampleNumber;
+        int64 captureTimeNs;
+    };
+
+    struct EventRecord
+    {
+        int32 type;
+        int32 line;
+        int64 sampleNumber;
+        int32 state;
+        int32 reserved;
+    };
+
+    static_assert (sizeof (BlockHeader) == 24 && sizeof (EventRecord) == 24, "unexpected record layout");
+
+    inline size_t padTo8 (size_t numBytes)
+    {
+        return (numBytes + 7) & ~size_t (7);
+    }
+
+    inline size_t getBlockRecordSize (int numChannels, int numSamples)
+    {
+        return padTo8 (sizeof (BlockHeader) + sizeof (float) * size_t (numChannels) * size_t (numSamples));
+    }
+
+    inline size_t getHeaderSize (int numChannels, int fileVersion = version)
+    {
+        return padTo8 (getFixedHeaderSize (fileVersion) + sizeof (int32) * size_t (numChannels));
+    }
+
+    // what was captured, and the stream's settings at the time
+    struct Info
+    {
+        double sampleRate = 0;
+        int arOrder = 0;
+        Band band = Band (0);
+        int calcInterval = 0;
+        float lowCut = 0;
+        float highCut = 0;
+        int htDelay = 0;
+        int modelRate = Hilbert::fs;
+        bool fullRate = false;
+        float horizonMs = 0;
+        EngineParams::Estimator estimator = EngineParams::AR_PREDICTION;
+
+        // captured channels (indices within the stream)
+        Array<int> channels;
+
+        EngineParams getParams() const
+        {
+            EngineParams params;
+            params.arOrder = arOrder;
+            params.band = band;
+            params.lowCut = lowCut;
+            params.highCut = highCut;
+            params.htDelay = htDelay;
+            params.modelRate = modelRate;
+            params.fullRate = fullRate;
+            params.horizonMs = horizonMs;
+            params.estimator = estimator;
+            params.updateTransformer();
+            return params;
+        }
+    };
+
+    inline void writeHeader (const Info& info, MemoryOutputStream& out)
+    {
+        const size_t headerSize = getHeaderSize (info.channels.size());
+        const size_t start = out.getDataSize();
+
+        out.write (magic, 8);
+        out.writeInt (version);
+        out.writeInt (int (headerSize));
+        out.writeDouble (info.sampleRate);
+        out.writeInt (info.channels.size());
+        out.writeInt (info.arOrder);
+        out.writeInt (int (info.band));
+        out.writeInt (info.calcInterval);
+        out.writeFloat (info.lowCut);
+        out.writeFloat (info.highCut);
+        out.writeInt (info.htDelay);
+        out.writeInt (info.modelRate);
+        out.writeInt ((info.fullRate ? FULL_RATE : 0) | (info.estimator == EngineParams::ENDPOINT_HT ? ENDPOINT_HT : 0));
+        out.writeInt (roundToInt (info.horizonMs * 1000));
+
+        for (int chan : info.channels)
+        {
+            out.writeInt (chan);
+        }
+
+        out.writeRepeatedByte (0, headerSize - (out.getDataSize() - start));
+    }
+
+    /** Reads a capture file in place, through a read-only memory mapping. */
+    class Reader
+    {
+    public:
+        struct Record
+        {
+            RecordType type;
+
+            // for blocks: the header, and the samples of channel c at data + c * numSamples
+            BlockHeader block;
+            const float* data;
+
+            EventRecord event;
+        };
+
+        explicit Reader (const File& file)
+            : mapped (file, MemoryMappedFile::readOnly),
+              base (static_cast<const char*> (mapped.getData())),
+              size (mapped.getSize()),
+              position (0)
+        {
+            if (base == nullptr)
+            {
+                error = "could not map " + file.getFullPathName();
+                return;
+            }
+
+            if (size < getFixedHeaderSize (1) || std::memcmp (base, magic, 8) != 0)
+            {
+                error = file.getFullPathName() + " is not a capture file";
+                return;
+            }
+
+            MemoryInputStream header (base, size, false);
+            header.skipNextBytes (8);
+            int fileVersion = header.readInt();
+            int headerSize = header.readInt();
+            info.sampleRate = header.readDouble();
+            int numChannels = header.readInt();
+            info.arOrder = header.readInt();
+            int band = header.readInt();
+            info.calcInterval = header.readInt();
+            info.lowCut = header.readFloat();
+            info.highCut = header.readFloat();
+            info.htDelay = header.readInt();
+            info.modelRate = header.readInt();
+            if (info.modelRate == 0)
+            {
+                info.modelRate = Hilbert::fs;
+            }
+
+            if (fileVersion >= 2 && size >= getFixedHeaderSize (2))
+            {
+                int options = header.readInt();
+                info.fullRate = (options & FULL_RATE) != 0;
+                info.estimator = (options & ENDPOINT_HT) != 0 ? EngineParams::ENDPOINT_HT : EngineParams::AR_PREDICTION;
+                info.horizonMs = jlimit (0.0f, EngineParams::maxHorizonMs, header.readInt() / 1000.0f);
+            }
+
+            if (fileVersion < 1 || fileVersion > version || numChannels < 0 || band < 0 || band >= NUM_BANDS
+                || info.htDelay < 0 || info.htDelay > Hilbert::maxDesignDelay
+                || ! EngineParams::getModelRates().contains (info.modelRate)
+                || size_t (headerSize) != getHeaderSize (numChannels, fileVersion) || size_t (headerSize) > size)
+            {
+                error = file.getFullPathName() + " has an unsupported or corrupt header";
+                return;
+            }
+
+            info.band = Band (band);
+            for (int c = 0; c < numChannels; ++c)
+            {
+                info.channels.add (header.readInt());
+            }
+
+            dataStart = size_t (headerSize);
+            position = dataStart;
+        }
+
+        bool isValid() const { return error.isEmpty(); }
+
+        const String& getError() const { return error; }
+
+        const Info& getInfo() const { return info; }
+
+        /** Reads the next record; returns false at the end of the file or at a truncated record. */
+        bool next (Record& record)
+        {
+            if (! isValid() || position + sizeof (BlockHeader) > size)
+            {
+                return false;
+            }
+
+            int32 type;
+            std::memcpy (&type, base + position, sizeof (type));
+
+            if (type == BLOCK)
+            {
+                std::memcpy (&record.block, base + position, sizeof (BlockHeader));
+                size_t recordSize = getBlockRecordSize (info.channels.size(), record.block.numSamples);
+                if (record.block.numSamples < 0 || position + recordSize > size)
+                {
+                    return false;
+                }
+
+                record.type = BLOCK;
+                record.data = reinterpret_cast<const float*> (base + position + sizeof (BlockHeader));
+                position += recordSize;
+                return true;
+            }
+
+            if (type == EVENT)
+            {
+                std::memcpy (&record.event, base + position, sizeof (EventRecord));
+                record.type = EVENT;
+                position += sizeof (EventRecord);
+                return true;
+            }
+
+            // unknown record type: the rest cannot be parsed
+            return false;
+        }
+
+        void rewind() { position = dataStart; }
+
+        size_t getPosition() const { return position; }
+
+        size_t getSize() const { return size; }
+
+    private:
+        MemoryMappedFile mapped;
+        const char* base;
+        size_t size;
+        size_t dataStart = 0;
+        size_t position;
+
+        Info info;
+        String error;
+
+        JUCE_DECLARE_NON_COPYABLE (Reader);
+    };
+} // namespace CaptureFile
+} // namespace PhaseCalculator
+
+#endif // CAPTURE_FILE_H_INCLUDED
@@ -0,0 +1,405 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef CIRCULAR_STATS_H_INCLUDED
+#define CIRCULAR_STATS_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <cfloat> // DBL_MIN
+#include <cmath>
+#include <complex>
+
+/*
+
+Streaming circular statistics (resultant vector, mean and standard deviation) plus
+a binned histogram over a sequence of angles in radians. Each angle comes with a time
+in seconds, which is only used by the time-based modes.
+
+- CUMULATIVE:   every angle added since the last clear
+- LAST_EVENTS:  the most recent 'window' angles
+- LAST_SECONDS: angles within 'window' seconds of the most recent one
+- DECAY:        every angle, weighted by 2^(-age / window), i.e. 'window' is a half-life in seconds
+
+Adding an angle is O(1) (amortized) in every mode. The angles themselves are kept in a
+ring so that the histogram can be rebuilt when the binning or mode changes. Outside of
+CUMULATIVE mode the ring holds at most 'capacity' angles and is allocated by setMode, so
+memory stays bounded during long runs and adding never allocates; this also caps the
+LAST_SECONDS window, and switching back to CUMULATIVE only recovers the angles still held
+in the ring.
+
+*/
+
+namespace PhaseCalculator
+{
+class CircularStats
+{
+public:
+    enum Mode
+    {
+        CUMULATIVE = 0,
+        LAST_EVENTS,
+        LAST_SECONDS,
+        DECAY,
+        NUM_MODES
+    };
+
+    static const int defaultCapacity = 100000;
+
+    CircularStats (int numBins = 24, double referenceAngle = 0, int capacity = defaultCapacity)
+        : mode (CUMULATIVE),
+          window (0),
+          maxWindowedSize (jmax (1, capacity)),
+          numBins (jmax (1, numBins)),
+          reference (referenceAngle)
+    {
+        binWeights.insertMultiple (0, 0.0, numBins);
+        clear();
+    }
+
+    ~CircularStats() {}
+
+    void clear()
+    {
+        ring.clearQuick();
+        ringHead = 0;
+        ringSize = 0;
+        windowSize = 0;
+        numReceived = 0;
+        timeOffset = 0;
+        newestTime = 0;
+        resetAccumulators();
+    }
+
+    // Changes the mode and window size, then rebuilds the statistics from the ring.
+    void setMode (Mode newMode, double newWindow)
+    {
+        if (newMode < 0 || newMode >= NUM_MODES)
+        {
+            jassertfalse;
+            return;
+        }
+
+        mode = newMode;
+        window = newWindow;
+
+        if (mode == LAST_EVENTS)
+        {
+            window = jlimit (1.0, double (maxWindowedSize), std::round (window));
+        }
+        else if (mode != CUMULATIVE && ! (window > 0))
+        {
+            jassertfalse;
+            window = 1;
+        }
+
+        if (mode != CUMULATIVE)
+        {
+            // drop anything beyond the capacity that windowed modes are allowed to keep
+            while (ringSize > maxWindowedSize)
+            {
+                ++ringHead;
+                --ringSize;
+            }
+            compactRing();
+        }
+
+        rebuild();
+    }
+
+    Mode getMode() const { return mode; }
+
+    double getWindow() const { return window; }
+
+    // Changes the number of bins and/or the angle at which the first bin starts.
+    void setBinning (int newNumBins, double newReference)
+    {
+        jassert (newNumBins > 0);
+        numBins = jmax (1, newNumBins);
+        reference = newReference;
+        binWeights.clearQuick();
+        binWeights.insertMultiple (0, 0.0, numBins);
+        rebuild();
+    }
+
+    int getNumBins() const { return numBins; }
+
+    void add (double angle, double time)
+    {
+        // if time goes backwards (e.g. acquisition was restarted), shift the new timeline so
+        // that it continues from the most recent angle.
+        if (ringSize > 0 && time + timeOffset < newestTime)
+        {
+            timeOffset = newestTime - time;
+        }
+        time += timeOffset;
+        newestTime = time;
+        ++numReceived;
+
+        if (mode != CUMULATIVE && ringSize == maxWindowedSize)
+        {
+            // the oldest entry is about to be overwritten; it must leave the window first.
+            // (a decaying angle keeps its weight, which is negligible by now.)
+            if (windowSize == ringSize)
+            {
+                if (mode == DECAY)
+                {
+                    --windowSize;
+                }
+                else
+                {
+                    removeOldest();
+                }
+            }
+            ringHead = (ringHead + 1) % ring.size();
+            --ringSize;
+        }
+        else if (ringSize == ring.size())
+        {
+            growRing();
+        }
+
+        int index = (ringHead + ringSize) % ring.size();
+        ring.getReference (index) = { angle, time };
+        ++ringSize;
+
+        include (angle, time);
+        ++windowSize;
+
+        // evict from the window
+        if (mode == LAST_EVENTS)
+        {
+            while (windowSize > int (window))
+            {
+                removeOldest();
+            }
+        }
+        else if (mode == LAST_SECONDS)
+        {
+            while (windowSize > 0 && getEntry (ringSize - windowSize).time < newestTime - window)
+            {
+                removeOldest();
+            }
+        }
+    }
+
+    // number of angles received since the last clear
+    int64 getNumReceived() const { return numReceived; }
+
+    // number of angles currently contributing to the statistics
+    int getCount() const { return windowSize; }
+
+    // sum of the weights of all angles currently contributing (equals getCount() unless decaying)
+    double getTotalWeight() const { return totalWeight * getDecayScale(); }
+
+    // weighted mean angle in radians, in the range (-pi, pi]
+    double getMean() const
+    {
+        return windowSize > 0 ? std::arg (rSum) : 0;
+    }
+
+    // mean resultant length, in [0, 1]
+    double getResultantLength() const
+    {
+        if (windowSize == 0 || totalWeight <= 0)
+        {
+            return 0;
+        }
+        return jlimit (0.0, 1.0, std::abs (rSum) / totalWeight);
+    }
+
+    // circular standard deviation in radians
+    double getStd() const
+    {
+        if (windowSize == 0)
+        {
+            return 0;
+        }
+        return std::sqrt (-2 * std::log (jmax (getResultantLength(), DBL_MIN)));
+    }
+
+    // weight in each bin; bin 0 starts at the reference angle, and bins proceed counterclockwise
+    double getBinWeight (int bin) const
+    {
+        return binWeights[bin] * getDecayScale();
+    }
+
+    int getBin (double angle) const
+    {
+        static const double twoPi = 2 * double_Pi;
+        double dist = std::fmod (angle - reference, twoPi);
+        if (dist < 0)
+        {
+            dist += twoPi;
+        }
+        return jmin (numBins - 1, int (dist * numBins / twoPi));
+    }
+
+private:
+    struct Entry
+    {
+        double angle;
+        double time;
+    };
+
+    const Entry& getEntry (int i) const
+    {
+        return ring.getReference ((ringHead + i) % ring.size());
+    }
+
+    void resetAccumulators()
+    {
+        rSum = 0;
+        totalWeight = 0;
+        decayRefTime = newestTime;
+        FloatVectorOperations::clear (binWeights.getRawDataPointer(), binWeights.size());
+    }
+
+    // relative weight of an angle at the given time
+    double getWeight (double time)
+    {
+        if (mode != DECAY)
+        {
+            return 1;
+        }
+
+        // weights are stored relative to decayRefTime; rebase before they grow too large
+        if ((time - decayRefTime) / window > maxDecayExponent)
+        {
+            double scale = std::exp2 ((decayRefTime - time) / window);
+            rSum *= scale;
+            totalWeight *= scale;
+            FloatVectorOperations::multiply (binWeights.getRawDataPointer(), scale, binWeights.size());
+            decayRefTime = time;
+        }
+        return std::exp2 ((time - decayRefTime) / window);
+    }
+
+    // factor to convert stored weights to actual weights (relative to the newest angle)
+    double getDecayScale() const
+    {
+        return mode == DECAY ? std::exp2 ((decayRefTime - newestTime) / window) : 1.0;
+    }
+
+    void include (double angle, double time)
+    {
+        double weight = getWeight (time);
+        rSum += std::polar (weight, angle);
+        totalWeight += weight;
+        binWeights.getReference (getBin (angle)) += weight;
+    }
+
+    // removes the oldest angle in the window from the statistics (never used in DECAY mode)
+    void removeOldest()
+    {
+        jassert (windowSize > 0 && mode != DECAY);
+        const Entry& oldest = getEntry (ringSize - windowSize);
+        rSum -= std::polar (1.0, oldest.angle);
+        totalWeight -= 1;
+        binWeights.getReference (getBin (oldest.angle)) -= 1;
+        --windowSize;
+    }
+
+    void rebuild()
+    {
+        resetAccumulators();
+
+        int first = 0;
+        if (mode == LAST_EVENTS)
+        {
+            first = jmax (0, ringSize - int (window));
+        }
+        else if (mode == LAST_SECONDS)
+        {
+            while (first < ringSize && getEntry (first).time < newestTime - window)
+            {
+                ++first;
+            }
+        }
+
+        windowSize = ringSize - first;
+        for (int i = first; i < ringSize; ++i)
+        {
+            const Entry& entry = getEntry (i);
+            include (entry.angle, entry.time);
+        }
+    }
+
+    void growRing()
+    {
+        compactRing();
+        int newSize = jmax (initialRingSize, ring.size() * 2);
+        ring.resize (mode == CUMULATIVE ? newSize : jmin (newSize, maxWindowedSize));
+    }
+
+    // moves the oldest entry to index 0
+    void compactRing()
+    {
+        Array<Entry> unwrapped;
+        unwrapped.ensureStorageAllocated (ringSize);
+        for (int i = 0; i < ringSize; ++i)
+        {
+            unwrapped.add (getEntry (i));
+        }
+        // outside of CUMULATIVE mode, allocate the full capacity now so that adding never allocates
+        unwrapped.resize (mode == CUMULATIVE ? jmax (ringSize, ring.size()) : maxWindowedSize);
+        ring.swapWith (unwrapped);
+        ringHead = 0;
+    }
+
+    static const int initialRingSize = 1024;
+
+    // maximum exponent (in half-lives) of a stored decay weight before rebasing
+    static constexpr double maxDecayExponent = 512;
+
+    Mode mode;
+    double window;
+    int maxWindowedSize;
+
+    int numBins;
+    double reference;
+
+    // ring of recent angles, oldest at ringHead
+    Array<Entry> ring;
+    int ringHead;
+    int ringSize;
+
+    // number of (newest) entries in the ring that are currently included
+    int windowSize;
+
+    int64 numReceived;
+
+    double timeOffset;
+    double newestTime;
+    double decayRefTime;
+
+    // sum of weight * exp(j * angle) over included angles
+    std::complex<double> rSum;
+    double totalWeight;
+    Array<double> binWeights;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CircularStats);
+};
+} // namespace PhaseCalculator
+
+#endif // CIRCULAR_STATS_H_INCLUDED
@@ -0,0 +1,122 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cmath> // ceil, log2, sinh, sqrt
+#include <map>
+
+#include "EndpointHilbert.h"
+
+namespace PhaseCalculator
+{
+namespace Hilbert
+{
+    namespace
+    {
+        // window length, in cycles of the low cut
+        const double windowCycles = 2;
+
+        // shortest window, in samples, and longest, as a fraction of the rate
+        const int minWindow = 32;
+        const double maxWindowSeconds = 0.5;
+
+        // Response at w (radians per sample) of the second-order bandpass with unit gain at w0 and
+        // the given width in octaves (bilinear transform of the analog prototype)
+        std::complex<double> bandpassResponse (double w, double w0, double octaves)
+        {
+            const double alpha = std::sin (w0) * std::sinh (std::log (2.0) / 2 * octaves * w0 / std::sin (w0));
+            const std::complex<double> z1 = std::polar (1.0, -w);
+            const std::complex<double> z2 = z1 * z1;
+            return alpha * (1.0 - z2) / ((1 + alpha) - 2 * std::cos (w0) * z1 + (1 - alpha) * z2);
+        }
+    } // namespace
+
+    EndpointKernel makeEndpointKernel (double sampleRate, float lowCut, float highCut)
+    {
+        jassert (0 < lowCut && lowCut < highCut && highCut < sampleRate / 2);
+
+        EndpointKernel kernel;
+        kernel.sampleRate = sampleRate;
+        kernel.lowCut = lowCut;
+        kernel.highCut = highCut;
+        kernel.centerFreq = std::sqrt (double (lowCut) * highCut);
+
+        const int n = jlimit (minWindow,
+                              jmax (minWindow, int (maxWindowSeconds * sampleRate)),
+                              int (std::ceil (windowCycles * sampleRate / lowCut)));
+
+        const double w0 = 2 * double_Pi * kernel.centerFreq / sampleRate;
+        const double octaves = std::log2 (double (highCut) / lowCut);
+
+        // the N-th roots of unity, so that the exponentials are looked up rather than recomputed
+        Array<std::complex<double>> roots;
+        roots.resize (n);
+        for (int j = 0; j < n; ++j)
+        {
+            roots.set (j, std::polar (1.0, 2 * double_Pi * j / n));
+        }
+
+        // analytic mask (1 at DC and Nyquist, 2 for the positive frequencies, 0 for the negative
+        // ones) times the bandpass response, divided by N for the inverse transform
+        Array<std::complex<double>> spectrum;
+        spectrum.resize (n / 2 + 1);
+        for (int k = 0; k <= n / 2; ++k)
+        {
+            double mask = (k == 0 || 2 * k == n) ? 1.0 : 2.0;
+            spectrum.set (k, mask / n * bandpassResponse (2 * double_Pi * k / n, w0, octaves));
+        }
+
+        kernel.coefficients.resize (n);
+        for (int m = 0; m < n; ++m)
+        {
+            std::complex<double> coef = 0;
+            for (int k = 0; k <= n / 2; ++k)
+            {
+                coef += spectrum.getReference (k) * roots.getReference (int ((int64 (k) * m) % n));
+            }
+            kernel.coefficients.set (m, coef);
+        }
+
+        return kernel;
+    }
+
+    EndpointKernelPtr getEndpointKernel (double sampleRate, float lowCut, float highCut)
+    {
+        static CriticalSection cacheLock;
+        static std::map<String, EndpointKernelPtr> cache;
+
+        const String key = String (sampleRate, 3) + "_" + String (lowCut, 3) + "_" + String (highCut, 3);
+
+        const ScopedLock lock (cacheLock);
+
+        auto it = cache.find (key);
+        if (it != cache.end())
+        {
+            return it->second;
+        }
+
+        EndpointKernelPtr kernel = std::make_shared<EndpointKernel> (makeEndpointKernel (sampleRate, lowCut, highCut));
+        cache[key] = kernel;
+        return kernel;
+    }
+} // namespace Hilbert
+} // namespace PhaseCalculator
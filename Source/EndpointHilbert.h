@@ -0,0 +1,84 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef ENDPOINT_HILBERT_H_INCLUDED
+#define ENDPOINT_HILBERT_H_INCLUDED
+
+/*
+
+Kernels for the endpoint-corrected Hilbert transform (ecHT; Schreglmann et al., 2021), an
+estimator of the analytic signal at the most recent sample that needs no AR model: the last
+window of data is transformed to the frequency domain, its negative frequencies are removed
+(and its positive ones doubled), the spectrum is multiplied by the response of a causal
+second-order bandpass filter, and the last sample of the inverse transform is taken. Filtering
+in the frequency domain with a causal response is the endpoint correction: it weights the end
+of the window most, which removes most of the distortion that the window's edges otherwise cause
+there.
+
+All of these steps are linear, and only the last output sample is used, so they reduce to one
+complex FIR kernel over the window:
+    c[m] = 1/N * sum over k of A[k] * H[k] * exp(2 pi i k m / N),
+where m is the number of samples before the endpoint, N the window length, A the analytic mask
+and H the bandpass response at the k-th DFT bin. Each estimate then costs N complex
+multiply-adds, a fixed cost with no model to fit.
+
+The window is two cycles of the low cut (at most half a second), and the bandpass is centered
+(geometrically) on the passband, with the passband's width in octaves. Kernels are computed the
+first time a set of parameters is used and kept in memory.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <complex>
+#include <memory> // shared_ptr
+
+namespace PhaseCalculator
+{
+namespace Hilbert
+{
+    struct EndpointKernel
+    {
+        // rate the kernel runs at, and the passband (Hz)
+        double sampleRate;
+        float lowCut;
+        float highCut;
+
+        // center frequency of the bandpass (Hz), at which the phase is advanced past the last sample
+        double centerFreq;
+
+        // coefficients[m] multiplies the sample m samples before the endpoint
+        Array<std::complex<double>> coefficients;
+    };
+
+    using EndpointKernelPtr = std::shared_ptr<const EndpointKernel>;
+
+    /** Computes the kernel for the passband at the given rate */
+    EndpointKernel makeEndpointKernel (double sampleRate, float lowCut, float highCut);
+
+    /** Returns the kernel for these parameters from the cache, or computes it and adds it to the cache */
+    EndpointKernelPtr getEndpointKernel (double sampleRate, float lowCut, float highCut);
+} // namespace Hilbert
+} // namespace PhaseCalculator
+
+#endif // ENDPOINT_HILBERT_H_INCLUDED
@@ -0,0 +1,162 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cmath> // floor, ceil, sin, cos
+#include <cstring> // memmove
+
+#include "FractionalResampler.h"
+
+namespace PhaseCalculator
+{
+FractionalResampler::FractionalResampler()
+    : ratio (1)
+{
+    window.resize (numTaps - 1);
+    reset();
+}
+
+void FractionalResampler::setRates (double inputRate, double outputRate, int maxInput)
+{
+    jassert (inputRate > 0 && outputRate > 0);
+    ratio = inputRate / outputRate;
+    window.resize (numTaps - 1 + maxInput);
+    reset();
+}
+
+void FractionalResampler::reset()
+{
+    numInput = 0;
+    numOutput = 0;
+
+    // zeros before the first input sample
+    FloatVectorOperations::clear (window.getRawDataPointer(), numTaps - 1);
+}
+
+int FractionalResampler::getMaxOutput (int nInput) const
+{
+    return int (std::ceil (nInput / ratio)) + 1;
+}
+
+int64 FractionalResampler::getFirstOutputAtOrAfter (int64 inputIndex) const
+{
+    // correct for rounding in the division
+    int64 k = int64 (std::ceil (inputIndex / ratio));
+    while (k > 0 && getOutputPosition (k - 1) >= inputIndex)
+    {
+        --k;
+    }
+    while (getOutputPosition (k) < inputIndex)
+    {
+        ++k;
+    }
+    return k;
+}
+
+int FractionalResampler::process (const float* input, int n, float* dest)
+{
+    const int numKept = numTaps - 1;
+    jassert (numKept + n <= window.size());
+    float* w = window.getRawDataPointer();
+    FloatVectorOperations::copy (w + numKept, input, n);
+
+    // w[s] is input sample windowStart + s
+    const int64 windowStart = numInput - numKept;
+    const int64 end = numInput + n;
+    const float* kernel = getKernel().begin();
+
+    int numWritten = 0;
+    while (true)
+    {
+        double position = getOutputPosition (numOutput);
+        int64 base = int64 (std::floor (position));
+        if (base + numTaps / 2 >= end)
+        {
+            break; // needs input that hasn't arrived yet
+        }
+
+        double phasePosition = (position - base) * numPhases;
+        int phase = jmin (numPhases - 1, int (phasePosition));
+        float weight = float (phasePosition - phase);
+
+        const float* taps0 = kernel + phase * numTaps;
+        const float* taps1 = taps0 + numTaps;
+        const float* samples = w + (base - numTaps / 2 + 1 - windowStart);
+
+        float out0 = 0, out1 = 0;
+        for (int m = 0; m < numTaps; ++m)
+        {
+            out0 += taps0[m] * samples[m];
+            out1 += taps1[m] * samples[m];
+        }
+
+        dest[numWritten++] = out0 + weight * (out1 - out0);
+        ++numOutput;
+    }
+
+    // keep the most recent samples for the next call
+    std::memmove (w, w + n, numKept * sizeof (float));
+    numInput = end;
+
+    return numWritten;
+}
+
+const Array<float>& FractionalResampler::getKernel()
+{
+    static const Array<float> kernel = []
+    {
+        Array<float> taps;
+        const double halfWidth = numTaps / 2;
+
+        for (int phase = 0; phase <= numPhases; ++phase)
+        {
+            // distance from each tap to the output position (between taps numTaps/2 - 1 and numTaps/2)
+            double frac = double (phase) / numPhases;
+            double sum = 0;
+            int rowStart = taps.size();
+
+            for (int m = 0; m < numTaps; ++m)
+            {
+                double d = m - (halfWidth - 1) - frac;
+                double sinc = d == 0 ? 1 : std::sin (double_Pi * d) / (double_Pi * d);
+
+                // Blackman window over (-halfWidth, halfWidth)
+                double x = double_Pi * d / halfWidth;
+                double blackman = 0.42 + 0.5 * std::cos (x) + 0.08 * std::cos (2 * x);
+
+                taps.add (float (sinc * blackman));
+                sum += sinc * blackman;
+            }
+
+            // unity gain at DC
+            for (int m = 0; m < numTaps; ++m)
+            {
+                taps.set (rowStart + m, float (taps[rowStart + m] / sum));
+            }
+        }
+
+        return taps;
+    }();
+
+    return kernel;
+}
+} // namespace PhaseCalculator
@@ -0,0 +1,102 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef FRACTIONAL_RESAMPLER_H_INCLUDED
+#define FRACTIONAL_RESAMPLER_H_INCLUDED
+
+/*
+
+Streaming resampler from an arbitrary input rate to a lower output rate (the modeling rate),
+for channels whose sample rate is not a multiple of the modeling rate.
+
+Output sample k lies at input position k * ratio (ratio = input rate / output rate), counted
+from the first input sample since the last reset, and is interpolated from the numTaps input
+samples around that position with a polyphase windowed-sinc filter: one set of taps for each
+of numPhases fractional positions, linearly interpolated between neighboring phases. Like the
+integer downsampling in the engine, this relies on the bandpass filter that precedes it to
+remove content above the output Nyquist frequency.
+
+An output sample can only be computed once the input reaches numTaps / 2 samples past its
+position, so the output lags the input by up to getLatency() input samples; the engine covers
+that gap with the AR prediction.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+namespace PhaseCalculator
+{
+class FractionalResampler
+{
+public:
+    FractionalResampler();
+
+    // taps of each phase of the interpolation filter, and number of phases
+    static const int numTaps = 8;
+    static const int numPhases = 64;
+
+    // maxInput is the most samples that process will be given at once (the window is allocated here)
+    void setRates (double inputRate, double outputRate, int maxInput);
+
+    // start again from a new first input sample (with zeros before it)
+    void reset();
+
+    /*
+        * Consumes n (at most maxInput) input samples and writes the output samples that can now be
+        * computed to dest, which must have room for getMaxOutput (n) samples. Returns the number written.
+        */
+    int process (const float* input, int n, float* dest);
+
+    int getMaxOutput (int nInput) const;
+
+    // input samples per output sample
+    double getRatio() const { return ratio; }
+
+    // input samples consumed and output samples produced since the last reset
+    int64 getNumInput() const { return numInput; }
+    int64 getNumOutput() const { return numOutput; }
+
+    // index of the first output sample at or after the given input sample
+    int64 getFirstOutputAtOrAfter (int64 inputIndex) const;
+
+    // position of an output sample, in input samples
+    double getOutputPosition (int64 outputIndex) const { return outputIndex * ratio; }
+
+    static int getLatency() { return numTaps / 2; }
+
+private:
+    // taps for each phase (plus a copy of phase 0 shifted by one sample, to interpolate past the last phase)
+    static const Array<float>& getKernel();
+
+    double ratio;
+    int64 numInput;
+    int64 numOutput;
+
+    // the last numTaps - 1 input samples, followed by the current input (room for maxInput)
+    Array<float> window;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (FractionalResampler);
+};
+} // namespace PhaseCalculator
+
+#endif // FRACTIONAL_RESAMPLER_H_INCLUDED
@@ -0,0 +1,500 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cmath> // isnan
+#include <limits> // quiet_NaN
+
+#include "GroundTruth.h"
+#include "PhaseEngine.h"
+#include "PhaseRecorder.h"
+
+namespace PhaseCalculator
+{
+GroundTruthEngine::GroundTruthEngine()
+    : Thread ("Phase ground truth"),
+      sampleRate (0),
+      hilbertLength (0),
+      numTargets (0),
+      readyFifo (numJobs + 1),
+      freeFifo (numJobs + 1),
+      targetGeneration (0),
+      horizonSamples (0),
+      numDropped (0),
+      recorder (nullptr)
+{
+    for (int i = 0; i < numJobs; ++i)
+    {
+        Job* job = jobs.add (new Job());
+        job->events.ensureStorageAllocated (maxEventsPerJob);
+    }
+    reset();
+}
+
+GroundTruthEngine::~GroundTruthEngine()
+{
+    stopThread (2000);
+}
+
+void GroundTruthEngine::configure (float newSampleRate, const Array<Range<float>>& passbands)
+{
+    jassert (! isThreadRunning());
+
+    sampleRate = newSampleRate;
+    int newHilbertLength = roundToInt (hilbertLengthMs * sampleRate / 1000);
+
+    if (newHilbertLength != hilbertLength)
+    {
+        hilbertLength = newHilbertLength;
+
+        // one FFT buffer for all targets and channels
+        hilbertBuffer.resize (hilbertLength);
+        for (auto job : jobs)
+        {
+            job->data.resize (hilbertLength);
+        }
+    }
+
+    setPassbands (passbands);
+    reset();
+}
+
+void GroundTruthEngine::setPassbands (const Array<Range<float>>& passbands)
+{
+    if (sampleRate <= 0)
+    {
+        return;
+    }
+
+    const ScopedLock filterLock (filterCS);
+    reverseFilters.clear();
+    filterBands.clearQuick();
+    channelFilters.clearQuick();
+
+    for (auto passband : passbands)
+    {
+        int filter = filterBands.indexOf (passband);
+        if (filter < 0)
+        {
+            filter = filterBands.size();
+            filterBands.add (passband);
+            reverseFilters.add (new BandpassFilter())->setup (
+                2, // order
+                sampleRate, // sample rate
+                (passband.getStart() + passband.getEnd()) / 2, // center frequency
+                passband.getLength()); // bandwidth
+        }
+        channelFilters.add (filter);
+    }
+}
+
+void GroundTruthEngine::setTargets (const Array<Target>& newTargets)
+{
+    // new index of each old target, or -1 if it is removed
+    Array<int> newIndices;
+
+    {
+        const ScopedLock targetLock (targetCS);
+        if (newTargets == targets)
+        {
+            return;
+        }
+
+        OwnedArray<PendingQueue> newPending;
+        for (const auto& target : newTargets)
+        {
+            int oldIndex = targets.indexOf (target);
+            newPending.add (oldIndex >= 0 ? pendingEvents.removeAndReturn (oldIndex) : new PendingQueue());
+            if (oldIndex >= 0)
+            {
+                pendingEvents.insert (oldIndex, nullptr);
+            }
+        }
+
+        for (const auto& target : targets)
+        {
+            newIndices.add (newTargets.indexOf (target));
+        }
+
+        targets = newTargets;
+        numTargets = targets.size();
+        pendingEvents.swapWith (newPending);
+
+        // jobs queued before now refer to the old indices
+        ++targetGeneration;
+    }
+
+    // keep the phases and error statistics of remaining targets
+    const ScopedLock resultLock (resultCS);
+    std::queue<EventPhase> remainingPhases;
+    while (! phaseBuffer.empty())
+    {
+        EventPhase phase = phaseBuffer.front();
+        phaseBuffer.pop();
+        phase.target = newIndices[phase.target];
+        if (phase.target >= 0)
+        {
+            remainingPhases.push (phase);
+        }
+    }
+    phaseBuffer.swap (remainingPhases);
+
+    OwnedArray<CircularStats> newErrorStats;
+    for (int t = 0; t < newTargets.size(); ++t)
+    {
+        int oldIndex = newIndices.indexOf (t);
+        if (oldIndex >= 0 && oldIndex < errorStats.size())
+        {
+            newErrorStats.add (errorStats.removeAndReturn (oldIndex));
+            errorStats.insert (oldIndex, nullptr);
+        }
+        else
+        {
+            auto stats = newErrorStats.add (new CircularStats (numErrorBins, -Dsp::doublePi, maxTrackedErrors));
+            stats->setMode (CircularStats::LAST_EVENTS, maxTrackedErrors);
+        }
+    }
+    errorStats.swapWith (newErrorStats);
+}
+
+Array<GroundTruthEngine::Target> GroundTruthEngine::getTargets() const
+{
+    const ScopedLock targetLock (targetCS);
+    return targets;
+}
+
+void GroundTruthEngine::reset()
+{
+    jassert (! isThreadRunning());
+
+    {
+        const ScopedLock targetLock (targetCS);
+        for (auto pending : pendingEvents)
+        {
+            pending->clear();
+        }
+    }
+
+    // all job slots are free
+    readyFifo.reset();
+    freeFifo.reset();
+
+    int start1, size1, start2, size2;
+    freeFifo.prepareToWrite (numJobs, start1, size1, start2, size2);
+    jassert (size1 + size2 == numJobs);
+    for (int i = 0; i < size1; ++i)
+    {
+        freeJobs[start1 + i] = i;
+    }
+    for (int i = 0; i < size2; ++i)
+    {
+        freeJobs[start2 + i] = size1 + i;
+    }
+    freeFifo.finishedWrite (size1 + size2);
+
+    numDropped = 0;
+}
+
+void GroundTruthEngine::addEvent (int line, juce::int64 ts)
+{
+    const ScopedTryLock targetLock (targetCS);
+    if (! targetLock.isLocked())
+    {
+        // the targets are being changed
+        ++numDropped;
+        return;
+    }
+
+    for (int t = 0; t < targets.size(); ++t)
+    {
+        if (targets.getReference (t).eventLine == line)
+        {
+            auto pending = pendingEvents[t];
+            jassert (pending->isEmpty() || (*pending)[pending->size() - 1].ts <= ts);
+            if (! pending->push ({ ts, std::numeric_limits<double>::quiet_NaN() }))
+            {
+                ++numDropped;
+            }
+        }
+    }
+}
+
+void GroundTruthEngine::processChannel (int chan,
+                                        const ReverseStack& history,
+                                        const float* output,
+                                        bool outputValid,
+                                        juce::int64 sdbStartTs,
+                                        int nSamples)
+{
+    const ScopedTryLock targetLock (targetCS);
+    if (! targetLock.isLocked())
+    {
+        // the targets are being changed: try again after the next buffer
+        return;
+    }
+
+    juce::int64 sdbEndTs = sdbStartTs + nSamples;
+    juce::int64 minTs = sdbEndTs - roundToInt (maxDelayMs * sampleRate / 1000);
+    juce::int64 maxTs = sdbEndTs - roundToInt (minDelayMs * sampleRate / 1000);
+
+    bool anyReady = false;
+    for (int t = 0; t < targets.size(); ++t)
+    {
+        if (targets.getReference (t).chan != chan)
+        {
+            continue;
+        }
+
+        auto& pending = *pendingEvents[t];
+
+        if (outputValid)
+        {
+            // events in the current buffer were all received just now, so they are at the end of the queue
+            for (int i = pending.size() - 1; i >= 0 && pending[i].ts >= sdbStartTs; --i)
+            {
+                juce::int64 offset = pending[i].ts - sdbStartTs;
+                if (offset < nSamples)
+                {
+                    pending[i].onlinePhase = PhaseEngine::circDist (degreesToRadians (double (output[offset])), 0, Dsp::doublePi);
+                }
+            }
+        }
+
+        // discard any timestamps less than minTs
+        while (! pending.isEmpty() && pending.front().ts < minTs)
+        {
+            pending.popFront();
+            ++numDropped;
+        }
+
+        anyReady = anyReady || (! pending.isEmpty() && pending.front().ts <= maxTs);
+    }
+
+    if (! anyReady || ! history.isFull() || freeFifo.getNumReady() == 0)
+    {
+        // if no job slot is free, try again after the next buffer
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    freeFifo.prepareToRead (1, start1, size1, start2, size2);
+    Job* job = jobs[freeJobs[start1]];
+    freeFifo.finishedRead (1);
+
+    // don't need to use a lock here since it's the same thread as the one that writes to it.
+    history.unwrapAndCopy (job->data.getRawDataPointer(), false, hilbertLength);
+    job->sdbEndTs = sdbEndTs;
+    job->chan = chan;
+    job->targetGeneration = targetGeneration;
+    job->events.clearQuick();
+
+    for (int t = 0; t < targets.size(); ++t)
+    {
+        if (targets.getReference (t).chan != chan)
+        {
+            continue;
+        }
+
+        auto& pending = *pendingEvents[t];
+        while (! pending.isEmpty() && pending.front().ts <= maxTs && job->events.size() < maxEventsPerJob)
+        {
+            job->events.add ({ t, targets.getReference (t).eventLine, pending.front() });
+            pending.popFront();
+        }
+    }
+
+    readyFifo.prepareToWrite (1, start1, size1, start2, size2);
+    jassert (size1 == 1);
+    readyJobs[start1] = jobs.indexOf (job);
+    readyFifo.finishedWrite (1);
+
+    notify();
+}
+
+bool GroundTruthEngine::tryToReadPhases (std::queue<EventPhase>& other)
+{
+    const ScopedTryLock lock (resultCS);
+    if (! lock.isLocked())
+    {
+        return false;
+    }
+
+    while (! phaseBuffer.empty())
+    {
+        other.push (phaseBuffer.front());
+        phaseBuffer.pop();
+    }
+    return true;
+}
+
+bool GroundTruthEngine::tryToReadErrors (int target, PhaseErrorSnapshot& snapshot)
+{
+    const ScopedTryLock lock (resultCS);
+    if (! lock.isLocked() || target < 0 || target >= errorStats.size())
+    {
+        return false;
+    }
+
+    const CircularStats& errors = *errorStats[target];
+    snapshot.count = errors.getCount();
+    snapshot.mean = radiansToDegrees (errors.getMean());
+    snapshot.std = radiansToDegrees (errors.getStd());
+
+    snapshot.histogram.resize (numErrorBins);
+    for (int bin = 0; bin < numErrorBins; ++bin)
+    {
+        snapshot.histogram.set (bin, errors.getBinWeight (bin));
+    }
+    return true;
+}
+
+void GroundTruthEngine::clearErrors()
+{
+    const ScopedLock lock (resultCS);
+    for (auto errors : errorStats)
+    {
+        errors->clear();
+    }
+}
+
+GroundTruthEngine::QueueDepths GroundTruthEngine::getQueueDepths()
+{
+    QueueDepths depths;
+    depths.readyJobs = readyFifo.getNumReady();
+
+    {
+        const ScopedTryLock targetLock (targetCS);
+        if (targetLock.isLocked())
+        {
+            depths.pendingEvents = 0;
+            for (auto pending : pendingEvents)
+            {
+                depths.pendingEvents += pending->size();
+            }
+        }
+    }
+
+    const ScopedTryLock resultLock (resultCS);
+    if (resultLock.isLocked())
+    {
+        depths.phases = int (phaseBuffer.size());
+    }
+    return depths;
+}
+
+size_t GroundTruthEngine::getMemoryBytes() const
+{
+    // job histories, plus the complex FFT buffer
+    return size_t (numJobs) * sizeof (double) * size_t (hilbertLength)
+           + sizeof (std::complex<double>) * size_t (hilbertLength);
+}
+
+void GroundTruthEngine::run()
+{
+    while (! threadShouldExit())
+    {
+        while (readyFifo.getNumReady() > 0)
+        {
+            int start1, size1, start2, size2;
+            readyFifo.prepareToRead (1, start1, size1, start2, size2);
+            int jobIndex = readyJobs[start1];
+            readyFifo.finishedRead (1);
+
+            analyze (*jobs[jobIndex]);
+
+            freeFifo.prepareToWrite (1, start1, size1, start2, size2);
+            jassert (size1 == 1);
+            freeJobs[start1] = jobIndex;
+            freeFifo.finishedWrite (1);
+        }
+
+        wait (100);
+    }
+}
+
+void GroundTruthEngine::analyze (Job& job)
+{
+    // perform reverse filtering and Hilbert transform
+    double* wpHilbert = hilbertBuffer.getRealPointer();
+    FloatVectorOperations::copy (wpHilbert, job.data.getRawDataPointer(), hilbertLength);
+
+    {
+        const ScopedLock filterLock (filterCS);
+        BandpassFilter* reverseFilter = reverseFilters[channelFilters[job.chan]];
+        if (reverseFilter == nullptr)
+        {
+            // no passband for this channel
+            jassertfalse;
+            return;
+        }
+
+        reverseFilter->reset();
+        reverseFilter->process (hilbertLength, &wpHilbert);
+    }
+
+    // un-reverse values
+    hilbertBuffer.reverseReal (hilbertLength);
+
+    // Hilbert transform!
+    hilbertBuffer.hilbert();
+
+    const ScopedLock resultLock (resultCS);
+    if (job.targetGeneration != targetGeneration)
+    {
+        // the targets changed while this job was waiting
+        return;
+    }
+
+    const int horizon = horizonSamples;
+    for (const auto& jobEvent : job.events)
+    {
+        const PendingEvent& event = jobEvent.event;
+        int delay = static_cast<int> (job.sdbEndTs - event.ts);
+        std::complex<double> analyticPt = hilbertBuffer.getAsComplex (hilbertLength - delay);
+        double phaseRad = std::arg (analyticPt);
+        double time = event.ts / sampleRate;
+
+        // the output at the event is the phase predicted for the sample a horizon later: compare it
+        // with the ground truth there, by removing the ground truth's advance over the horizon
+        double onlinePhase = event.onlinePhase;
+        if (! std::isnan (onlinePhase) && horizon > 0 && horizon < delay)
+        {
+            double phaseAhead = std::arg (hilbertBuffer.getAsComplex (hilbertLength - delay + horizon));
+            onlinePhase = PhaseEngine::circDist (onlinePhase, phaseAhead - phaseRad, Dsp::doublePi);
+        }
+
+        EventPhase phase = { jobEvent.target, job.chan, jobEvent.eventLine, event.ts, time, phaseRad, onlinePhase, std::abs (analyticPt) };
+        phaseBuffer.push (phase);
+
+        if (recorder != nullptr)
+        {
+            recorder->push (phase);
+        }
+
+        if (! std::isnan (onlinePhase) && jobEvent.target < errorStats.size())
+        {
+            double error = PhaseEngine::circDist (onlinePhase, phaseRad, Dsp::doublePi);
+            errorStats[jobEvent.target]->add (error, time);
+        }
+    }
+}
+} // namespace PhaseCalculator
@@ -0,0 +1,342 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef GROUND_TRUTH_H_INCLUDED
+#define GROUND_TRUTH_H_INCLUDED
+
+/*
+
+Delayed but precise ("ground truth") phase estimation at event times, for the visualizer.
+
+Each target is a pair of a continuous channel and an event line. When an event is received on
+a target's line, the engine waits until enough data of the target's channel has been processed
+to calculate the phase at the event onset with a zero-phase filter and an FFT-based Hilbert
+transform over the recent history. The phase that was output in real time at the event sample
+is captured as well, so that the online error can be tracked.
+
+All targets share a single analysis worker thread and FFT buffer, and the channels with the same
+passband share a reverse filter (channels can have their own passband). The audio
+thread only copies the channel's history into one of a few preallocated job slots, at most once
+per channel and buffer, however many targets and events are waiting on it. It neither waits for
+the targets' lock (it skips the event or buffer if the targets are being changed) nor allocates:
+pending events go into fixed-size queues, allocated with the targets.
+
+*/
+
+#include <DspLib.h> // Filtering
+#include <OpenEphysFFTW.h> // Fourier transform
+
+#include <atomic>
+#include <queue>
+
+#include "CircularStats.h"
+
+namespace PhaseCalculator
+{
+class ReverseStack;
+class PhaseRecorder;
+
+// phase of a target's continuous channel at the onset of an event, sent to the visualizer
+struct EventPhase
+{
+    // index of the target in the engine's list of targets
+    int target;
+
+    // the target's continuous channel (index within its stream) and event line
+    int chan;
+    int eventLine;
+
+    juce::int64 sampleNumber;
+
+    // time of the event in seconds
+    double time;
+
+    // "ground truth" phase calculated with a delay, in radians
+    double phase;
+
+    // phase that was output in real time at the event sample, in radians (NaN if none was output).
+    // with a look-ahead horizon, that output predicted the phase a horizon later, so it is referred
+    // back to the event by the ground truth's advance over the horizon, to compare with phase.
+    double onlinePhase;
+
+    // magnitude of the analytic signal at the event, in the units of the continuous channel
+    double amplitude;
+};
+
+// streaming statistics of the online phase error (online minus ground truth) at events
+struct PhaseErrorSnapshot
+{
+    // number of errors included in the statistics
+    int count = 0;
+
+    // circular mean and standard deviation, in degrees
+    double mean = 0;
+    double std = 0;
+
+    // histogram of errors from -180 to 180 degrees
+    Array<double> histogram;
+};
+
+class GroundTruthEngine : public Thread
+{
+public:
+    struct Target
+    {
+        // index of the continuous channel within its stream
+        int chan;
+
+        // TTL line
+        int eventLine;
+
+        bool operator== (const Target& other) const
+        {
+            return chan == other.chan && eventLine == other.eventLine;
+        }
+    };
+
+    GroundTruthEngine();
+
+    ~GroundTruthEngine();
+
+    // ---- configuration (not concurrently with processing, except setPassbands) ----
+
+    /** Sets the stream's sample rate and the passband of each continuous channel (by index within the stream). */
+    void configure (float sampleRate, const Array<Range<float>>& passbands);
+
+    /** Updates the passbands only; safe to call during acquisition. */
+    void setPassbands (const Array<Range<float>>& passbands);
+
+    /** Sets the look-ahead horizon of the online phase, in samples (see EngineParams::horizonMs) */
+    void setHorizon (int samples) { horizonSamples = samples; }
+
+    /** Replaces the targets. Pending events, phases and error statistics are kept for targets that remain. */
+    void setTargets (const Array<Target>& newTargets);
+
+    Array<Target> getTargets() const;
+
+    // whether there are any targets (read without the lock, e.g. by the audio thread)
+    bool hasTargets() const { return numTargets > 0; }
+
+    /** Discards pending events and jobs (e.g. at the end of acquisition). */
+    void reset();
+
+    // ---- audio thread ----
+
+    /** Adds an event onset, if any target watches this line (dropped if the targets are being changed). */
+    void addEvent (int line, juce::int64 ts);
+
+    /*
+        * Called after each buffer of channel chan has been processed. Captures the online phase
+        * (in degrees, if outputValid) at pending events within the buffer, discards expired events
+        * and, if any events are ready, queues the channel's history for analysis. Does nothing if
+        * the targets are being changed. sdbStartTs = timestamp of the first sample of the buffer.
+        */
+    void processChannel (int chan,
+                         const ReverseStack& history,
+                         const float* output,
+                         bool outputValid,
+                         juce::int64 sdbStartTs,
+                         int nSamples);
+
+    // ---- readers ----
+
+    /** Reads the calculated phases if it can acquire a TryLock. Returns true if successful. */
+    bool tryToReadPhases (std::queue<EventPhase>& other);
+
+    /** Copies a target's online phase error statistics if it can acquire a TryLock. Returns true if successful. */
+    bool tryToReadErrors (int target, PhaseErrorSnapshot& snapshot);
+
+    /** Resets the online phase error statistics of all targets */
+    void clearErrors();
+
+    /** Also passes each calculated phase to the recorder (may be null); set before starting the thread. */
+    void setRecorder (PhaseRecorder* newRecorder) { recorder = newRecorder; }
+
+    /** Number of events that expired before their phase could be calculated, or could not be queued */
+    int getNumDropped() const { return numDropped.load(); }
+
+    struct QueueDepths
+    {
+        // events waiting for enough data (all targets), -1 if the targets were locked
+        int pendingEvents = -1;
+
+        // jobs queued for the analysis thread, out of numJobs
+        int readyJobs = 0;
+
+        // calculated phases not read by the visualizer yet, -1 if the results were locked
+        int phases = -1;
+    };
+
+    /** Current length of each queue, for monitoring. Does not wait for locks. */
+    QueueDepths getQueueDepths();
+
+    /** Bytes allocated for the job slots and the FFT buffer (shared by all channels) */
+    size_t getMemoryBytes() const;
+
+    /** Analysis thread */
+    void run() override;
+
+    // length of history used to calculate each phase, and range of delays relative to the end
+    // of the current buffer at which it is calculated. based on evaluation of phase error
+    // compared to offline processing.
+    static const int hilbertLengthMs = 1024;
+    static const int minDelayMs = 675;
+    static const int maxDelayMs = 1000;
+
+    /** number of online phase errors that the statistics of each target include (the most recent ones) */
+    static const int maxTrackedErrors = 10000;
+
+    /** number of bins of the online phase error histograms */
+    static const int numErrorBins = 72;
+
+    /** number of job slots (histories queued for analysis) */
+    static const int numJobs = 4;
+
+    /** number of events that can wait for their phase per target (more are dropped) */
+    static const int maxPendingEvents = 256;
+
+private:
+    struct PendingEvent
+    {
+        juce::int64 ts;
+
+        // phase output at ts, in radians (NaN if not output yet or not available)
+        double onlinePhase;
+    };
+
+    // a target's pending events, oldest first, in a ring of maxPendingEvents
+    class PendingQueue
+    {
+    public:
+        PendingQueue() : head (0), count (0) { events.resize (maxPendingEvents); }
+
+        int size() const { return count; }
+        bool isEmpty() const { return count == 0; }
+
+        // i-th oldest event
+        PendingEvent& operator[] (int i) { return events.getReference ((head + i) % maxPendingEvents); }
+        PendingEvent& front() { return (*this)[0]; }
+
+        // returns false if the queue is full
+        bool push (const PendingEvent& event)
+        {
+            if (count == maxPendingEvents)
+            {
+                return false;
+            }
+            events.getReference ((head + count++) % maxPendingEvents) = event;
+            return true;
+        }
+
+        void popFront()
+        {
+            jassert (count > 0);
+            head = (head + 1) % maxPendingEvents;
+            --count;
+        }
+
+        void clear() { head = count = 0; }
+
+    private:
+        Array<PendingEvent> events;
+        int head;
+        int count;
+    };
+
+    struct Job
+    {
+        struct Event
+        {
+            int target;
+            int eventLine;
+            PendingEvent event;
+        };
+
+        // unwrapped history, most recent sample first
+        Array<double> data;
+
+        juce::int64 sdbEndTs;
+
+        // continuous channel of the data
+        int chan;
+
+        // value of targetGeneration when the job was queued
+        int targetGeneration;
+
+        Array<Event> events;
+    };
+
+    // filter design copied from FilterNode
+    using BandpassFilter = Dsp::SimpleFilter<Dsp::Butterworth::BandPass // filter type
+                                             <2>, // order
+                                             1, // number of channels
+                                             Dsp::DirectFormII>; // realization
+
+    void analyze (Job& job);
+
+    static const int maxEventsPerJob = 256;
+
+    float sampleRate;
+    int hilbertLength;
+
+    Array<Target> targets;
+    OwnedArray<PendingQueue> pendingEvents;
+    CriticalSection targetCS;
+    std::atomic<int> numTargets; // targets.size(), updated under targetCS
+
+    // job slots, passed between the audio thread and the worker through two single-producer FIFOs
+    OwnedArray<Job> jobs;
+    AbstractFifo readyFifo;
+    int readyJobs[numJobs + 1];
+    AbstractFifo freeFifo;
+    int freeJobs[numJobs + 1];
+
+    // shared by all targets; only used by the worker thread
+    FFTWTransformableArray hilbertBuffer;
+
+    // one reverse filter per distinct passband, and the index of each channel's filter
+    OwnedArray<BandpassFilter> reverseFilters;
+    Array<Range<float>> filterBands;
+    Array<int> channelFilters;
+    CriticalSection filterCS;
+
+    std::queue<EventPhase> phaseBuffer;
+
+    // incremented whenever target indices change
+    std::atomic<int> targetGeneration;
+
+    // how far ahead of each sample the online phase was predicted, in samples
+    std::atomic<int> horizonSamples;
+
+    OwnedArray<CircularStats> errorStats;
+    CriticalSection resultCS;
+
+    std::atomic<int> numDropped;
+
+    PhaseRecorder* recorder;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GroundTruthEngine);
+};
+} // namespace PhaseCalculator
+
+#endif // GROUND_TRUTH_H_INCLUDED
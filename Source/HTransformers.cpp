@@ -21,6 +21,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
+#include <cfloat> // DBL_MAX
+#include <cmath> // sqrt, atan
+#include <complex>
+
 #include "HTransformers.h"
 
 namespace PhaseCalculator
@@ -37,7 +41,6 @@ namespace
         String bandName[NUM_BANDS];
         Array<float> validBand[NUM_BANDS];
         Array<float> defaultBand[NUM_BANDS];
-        Array<float> extrema[NUM_BANDS];
         int delay[NUM_BANDS];
         Array<double> transformer[NUM_BANDS];
 
@@ -52,7 +55,6 @@ namespace
             validBand[ALPHA_THETA] = Array<float> ({ 4, 18 });
             bandName[ALPHA_THETA] = alphaTheta + validBandToString (validBand[ALPHA_THETA]);
             defaultBand[ALPHA_THETA] = Array<float> ({ 4, 8 });
-            extrema[ALPHA_THETA] = Array<float>(/* none */);
             delay[ALPHA_THETA] = 9;
             // from Matlab: firpm(18, [4 246]/250, [1 1], 'hilbert')
             transformer[ALPHA_THETA] = Array<double> ({ -0.28757250783614413,
@@ -68,7 +70,6 @@ namespace
             validBand[BETA] = Array<float> ({ 10, 40 });
             bandName[BETA] = beta + validBandToString (validBand[BETA]);
             defaultBand[BETA] = Array<float> ({ 12, 30 });
-            extrema[BETA] = Array<float> ({ 21.5848 });
             delay[BETA] = 9;
             // from Matlab: firpm(18, [12 30 40 240]/250, [1 1 0.7 0.7], 'hilbert')
             transformer[BETA] = Array<double> ({ -0.099949575596234311,
@@ -84,7 +85,6 @@ namespace
             validBand[LOW_GAM] = Array<float> ({ 30, 55 });
             bandName[LOW_GAM] = "Lo " + gamma + validBandToString (validBand[LOW_GAM]);
             defaultBand[LOW_GAM] = Array<float> ({ 30, 55 });
-            extrema[LOW_GAM] = Array<float> ({ 43.3609 });
             delay[LOW_GAM] = 2;
             // from Matlab: firls(4, [30 55]/250, [1 1], 'hilbert')
             transformer[LOW_GAM] = Array<double> ({ -1.5933788446351915,
@@ -93,7 +93,6 @@ namespace
             validBand[MID_GAM] = Array<float> ({ 40, 90 });
             bandName[MID_GAM] = "Mid " + gamma + validBandToString (validBand[MID_GAM]);
             defaultBand[MID_GAM] = Array<float> ({ 40, 90 });
-            extrema[MID_GAM] = Array<float> ({ 64.4559 });
             delay[MID_GAM] = 2;
             // from Matlab: firls(4, [35 90]/250, [1 1], 'hilbert')
             transformer[MID_GAM] = Array<double> ({ -0.487176162115735,
@@ -102,7 +101,6 @@ namespace
             validBand[HIGH_GAM] = Array<float> ({ 60, 200 });
             bandName[HIGH_GAM] = "Hi " + gamma + validBandToString (validBand[HIGH_GAM]);
             defaultBand[HIGH_GAM] = Array<float> ({ 70, 150 });
-            extrema[HIGH_GAM] = Array<float> ({ 81.6443, 123.1104, 169.3574 });
             delay[HIGH_GAM] = 3;
             // from Matlab: firls(6, [60 200]/250, [1 1], 'hilbert')
             transformer[HIGH_GAM] = Array<double> ({ -0.10383410506573287,
@@ -123,10 +121,116 @@ namespace Hilbert
 
     extern const Array<float>* const defaultBand = hilbertInfo.defaultBand;
 
-    extern const Array<float>* const extrema = hilbertInfo.extrema;
-
     extern const int* const delay = hilbertInfo.delay;
 
     extern const Array<double>* const transformer = hilbertInfo.transformer;
+
+    double Transformer::getResponse (double freq) const
+    {
+        double normFreq = freq * 2 * double_Pi / sampleRate;
+        std::complex<double> response = 0;
+
+        const double* transf = coefficients.begin();
+        for (int kCoef = 0; kCoef < delay; ++kCoef)
+        {
+            double coef = transf[kCoef];
+
+            // near component
+            response += coef * std::polar (1.0, -(kCoef * normFreq));
+
+            // mirrored component
+            // there is no term for -delay because that coefficient is 0.
+            response -= coef * std::polar (1.0, -((2 * delay - kCoef) * normFreq));
+        }
+
+        return std::abs (response);
+    }
+
+    void Transformer::getResponseRange (double lowCut, double highCut, double& minResponse, double& maxResponse) const
+    {
+        maxResponse = -DBL_MAX;
+        minResponse = DBL_MAX;
+
+        Array<double> testFreqs ({ lowCut, highCut });
+        // also look at any magnitude response extrema that fall within the selected band
+        for (double freq : extrema)
+        {
+            if (freq > lowCut && freq < highCut)
+            {
+                testFreqs.add (freq);
+            }
+        }
+
+        for (double freq : testFreqs)
+        {
+            double response = getResponse (freq);
+            maxResponse = jmax (maxResponse, response);
+            minResponse = jmin (minResponse, response);
+        }
+    }
+
+    double Transformer::getScaleFactor (double lowCut, double highCut) const
+    {
+        double minResponse, maxResponse;
+        getResponseRange (lowCut, highCut, minResponse, maxResponse);
+
+        // scale factor is reciprocal of geometric mean of max and min
+        return 1 / std::sqrt (minResponse * maxResponse);
+    }
+
+    double Transformer::getMaxPhaseError (double lowCut, double highCut) const
+    {
+        double minResponse, maxResponse;
+        getResponseRange (lowCut, highCut, minResponse, maxResponse);
+
+        // after scaling, the imaginary component is off by a factor of up to g = sqrt(max / min)
+        // (or 1 / g), which shifts the phase by up to atan((g - 1) / (2 * sqrt(g)))
+        double g = std::sqrt (maxResponse / minResponse);
+        return std::atan ((g - 1) / (2 * std::sqrt (g))) * 180 / double_Pi;
+    }
+
+    void Transformer::updateExtrema()
+    {
+        // the response is flat at the extrema, so a fine grid gets their responses close enough
+        const int numPoints = 4096;
+        const double step = double (highFreq - lowFreq) / (numPoints - 1);
+
+        extrema.clearQuick();
+        double prevResponse = getResponse (lowFreq);
+        double response = getResponse (lowFreq + step);
+        for (int i = 1; i < numPoints - 1; ++i)
+        {
+            double nextResponse = getResponse (lowFreq + (i + 1) * step);
+            if ((response - prevResponse) * (nextResponse - response) < 0)
+            {
+                extrema.add (float (lowFreq + i * step));
+            }
+            prevResponse = response;
+            response = nextResponse;
+        }
+    }
+
+    TransformerPtr getBuiltIn (Band band)
+    {
+        static const Array<TransformerPtr> builtIn = []
+        {
+            Array<TransformerPtr> transformers;
+            for (int b = 0; b < NUM_BANDS; ++b)
+            {
+                auto transf = std::make_shared<Transformer>();
+                transf->sampleRate = fs;
+                transf->lowFreq = validBand[b][0];
+                transf->highFreq = validBand[b][1];
+                transf->delay = delay[b];
+                transf->coefficients = transformer[b];
+                transf->updateExtrema();
+                transformers.add (transf);
+            }
+            return transformers;
+        }();
+
+        jassert (band >= 0 && band < NUM_BANDS);
+        return builtIn[band];
+    }
 } // namespace Hilbert
 } // namespace PhaseCalculator
\ No newline at end of file
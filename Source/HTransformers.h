@@ -26,6 +26,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <BasicJuceHeader.h>
 
+#include <memory> // shared_ptr
+
 /*
 
 Defines the Hilbert transformers appropriate to use for each frequency band.
@@ -33,13 +35,16 @@ Defines the Hilbert transformers appropriate to use for each frequency band.
 - bandName:     display name for each frequency band.
 - validBand:    range of frequencies appropriate to use with each transformer
 - defaultBand:  band filled in by default when selecting each transformer
-- extrema:      locations of local extrema of the magnitude response within VALID_BAND (if any).
--               used to find the maximum and minimum response given a band of interest.
 - delay:        group delay of the transformer = # of samples to predict
                 also, the number of unique nonzero coefficients.
 - transformer:  first DELAY coefficients for each filter.
                 the remaining DELAY+1 are 0, followed by the leading coefficients
                 again, negated and in reverse order.
+
+Transformer holds the same information for one transformer, plus the locations of the local
+extrema of its magnitude response, which are used to find the maximum and minimum response
+over a band of interest. getBuiltIn returns the transformer of each band in this form; others
+can be designed at runtime (see HilbertDesigner.h).
 */
 
 namespace PhaseCalculator
@@ -68,14 +73,50 @@ namespace Hilbert
     /** each is a pair (low cut, high cut) */
     extern const Array<float>* const defaultBand;
 
-    /** Locations of local extrema of the magnitude response within VALID_BAND*/
-    extern const Array<float>* const extrema;
-
     /** Samples of group delay (= order of filter / 2) */
     extern const int* const delay;
 
     /** Contains the first delay[band] coefficients; the rest are redundant and can be inferred */
     extern const Array<double>* const transformer;
+
+    struct Transformer
+    {
+        // rate the transformer runs at, and the band it is valid for (Hz)
+        double sampleRate;
+        float lowFreq;
+        float highFreq;
+
+        // samples of group delay = number of unique nonzero coefficients
+        int delay;
+
+        // the first delay coefficients
+        Array<double> coefficients;
+
+        // locations of local extrema of the magnitude response within (lowFreq, highFreq)
+        Array<float> extrema;
+
+        // magnitude response at the given frequency
+        double getResponse (double freq) const;
+
+        // minimum and maximum magnitude response from lowCut to highCut
+        void getResponseRange (double lowCut, double highCut, double& minResponse, double& maxResponse) const;
+
+        // Reciprocal of the geometric mean (i.e. mean in decibels) of the maximum and minimum
+        // magnitude responses from lowCut to highCut: the multiplier for the imaginary component.
+        double getScaleFactor (double lowCut, double highCut) const;
+
+        // Largest phase error (in degrees) that the ripple of the magnitude response from lowCut
+        // to highCut causes, once the imaginary component is scaled by getScaleFactor.
+        double getMaxPhaseError (double lowCut, double highCut) const;
+
+        // finds the extrema from the coefficients
+        void updateExtrema();
+    };
+
+    using TransformerPtr = std::shared_ptr<const Transformer>;
+
+    /** The transformer of each band, valid over validBand[band] */
+    TransformerPtr getBuiltIn (Band band);
 } // namespace Hilbert
 } // namespace PhaseCalculator
 
@@ -0,0 +1,322 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm> // copy_n
+#include <cmath> // sin, sqrt, abs
+#include <map>
+
+#include "HilbertDesigner.h"
+
+namespace PhaseCalculator
+{
+namespace Hilbert
+{
+    namespace
+    {
+        // fraction of the rate to stay away from the Nyquist frequency
+        const double edgeMargin = 0.004;
+
+        // lowest frequency that can be designed for, at any rate (edgeMargin at 500 Hz)
+        const double minFreq = 2;
+
+        // reweighting iterations of Lawson's algorithm
+        const int numIterations = 100;
+
+        // weight of the coefficients' energy relative to the (unit total) weight of the band
+        const double energyPenalty = 1e-3;
+
+        // changes whenever the design method does, so that older cached designs are replaced
+        const int designVersion = 1;
+
+        /*
+            * Solves the symmetric positive definite system a * x = b in place by Cholesky
+            * decomposition (a is n x n, row-major, and is overwritten; x is written to b).
+            * Returns false if a is not positive definite.
+            */
+        bool solveCholesky (double* a, double* b, int n)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                double diag = a[j * n + j];
+                for (int k = 0; k < j; ++k)
+                {
+                    diag -= a[j * n + k] * a[j * n + k];
+                }
+                if (diag <= 0)
+                {
+                    return false;
+                }
+                diag = std::sqrt (diag);
+                a[j * n + j] = diag;
+
+                for (int i = j + 1; i < n; ++i)
+                {
+                    double val = a[i * n + j];
+                    for (int k = 0; k < j; ++k)
+                    {
+                        val -= a[i * n + k] * a[j * n + k];
+                    }
+                    a[i * n + j] = val / diag;
+                }
+            }
+
+            // forward substitution (L * y = b), then back substitution (L^T * x = y)
+            for (int i = 0; i < n; ++i)
+            {
+                for (int k = 0; k < i; ++k)
+                {
+                    b[i] -= a[i * n + k] * b[k];
+                }
+                b[i] /= a[i * n + i];
+            }
+            for (int i = n - 1; i >= 0; --i)
+            {
+                for (int k = i + 1; k < n; ++k)
+                {
+                    b[i] -= a[k * n + i] * b[k];
+                }
+                b[i] /= a[i * n + i];
+            }
+            return true;
+        }
+
+        String getCacheKey (double sampleRate, float lowFreq, float highFreq, int delay)
+        {
+            return "fs" + String (sampleRate, 2) + "_" + String (lowFreq, 3) + "-" + String (highFreq, 3)
+                   + "Hz_delay" + String (delay);
+        }
+
+        File getCacheFile (const String& key)
+        {
+            return getCacheDirectory().getChildFile ("hilbert_" + key + ".json");
+        }
+
+        // reads a cached design; returns nullptr if there is none or it doesn't match the parameters
+        TransformerPtr readCachedDesign (const File& file, double sampleRate, float lowFreq, float highFreq, int delay)
+        {
+            if (! file.existsAsFile())
+            {
+                return nullptr;
+            }
+
+            var cached = JSON::parse (file);
+            const Array<var>* coefficients = cached["coefficients"].getArray();
+            if (int (cached["version"]) != designVersion
+                || double (cached["sample_rate"]) != sampleRate
+                || float (cached["low_freq"]) != lowFreq
+                || float (cached["high_freq"]) != highFreq
+                || int (cached["delay"]) != delay
+                || coefficients == nullptr
+                || coefficients->size() != delay)
+            {
+                return nullptr;
+            }
+
+            auto transf = std::make_shared<Transformer>();
+            transf->sampleRate = sampleRate;
+            transf->lowFreq = lowFreq;
+            transf->highFreq = highFreq;
+            transf->delay = delay;
+            for (const var& coef : *coefficients)
+            {
+                transf->coefficients.add (double (coef));
+            }
+            transf->updateExtrema();
+            return transf;
+        }
+
+        void writeCachedDesign (const File& file, const Transformer& transf)
+        {
+            if (! file.getParentDirectory().createDirectory())
+            {
+                return;
+            }
+
+            DynamicObject::Ptr cached = new DynamicObject();
+            cached->setProperty ("version", designVersion);
+            cached->setProperty ("sample_rate", transf.sampleRate);
+            cached->setProperty ("low_freq", transf.lowFreq);
+            cached->setProperty ("high_freq", transf.highFreq);
+            cached->setProperty ("delay", transf.delay);
+
+            Array<var> coefficients;
+            for (double coef : transf.coefficients)
+            {
+                coefficients.add (coef);
+            }
+            cached->setProperty ("coefficients", coefficients);
+
+            // write to a temporary file first, in case another instance reads the cache meanwhile
+            TemporaryFile temp (file);
+            if (temp.getFile().replaceWithText (JSON::toString (var (cached.get()))))
+            {
+                temp.overwriteTargetFileWithTemporary();
+            }
+        }
+    } // namespace
+
+    Array<float> getDesignableBand (double sampleRate)
+    {
+        return Array<float> ({ float (minFreq), float (sampleRate * (0.5 - edgeMargin)) });
+    }
+
+    Transformer design (double sampleRate, float lowFreq, float highFreq, int delay)
+    {
+        jassert (delay >= 1 && delay <= maxDesignDelay);
+        jassert (lowFreq >= getDesignableBand (sampleRate)[0] && highFreq <= getDesignableBand (sampleRate)[1] && lowFreq < highFreq);
+
+        const int n = delay;
+
+        // frequency grid over the band, with sin(k * w) for each grid point w and k = 1..delay
+        const int numPoints = jmax (256, 16 * n);
+        HeapBlock<double> basis (size_t (numPoints) * n);
+        for (int j = 0; j < numPoints; ++j)
+        {
+            double freq = lowFreq + (highFreq - lowFreq) * j / (numPoints - 1.0);
+            double normFreq = freq * 2 * double_Pi / sampleRate;
+            for (int k = 0; k < n; ++k)
+            {
+                basis[j * n + k] = std::sin ((k + 1) * normFreq);
+            }
+        }
+
+        HeapBlock<double> weights (numPoints);
+        for (int j = 0; j < numPoints; ++j)
+        {
+            weights[j] = 1.0 / numPoints;
+        }
+
+        HeapBlock<double> normal (size_t (n) * n);
+        HeapBlock<double> amplitudes (n, true);
+        HeapBlock<double> solution (n);
+
+        for (int iter = 0; iter < numIterations; ++iter)
+        {
+            // normal equations of the weighted least squares fit to -1, plus the energy penalty
+            FloatVectorOperations::clear (normal.get(), n * n);
+            FloatVectorOperations::clear (solution.get(), n);
+            for (int j = 0; j < numPoints; ++j)
+            {
+                const double* row = basis + j * n;
+                for (int k = 0; k < n; ++k)
+                {
+                    solution[k] -= weights[j] * row[k];
+                    for (int m = 0; m <= k; ++m)
+                    {
+                        normal[k * n + m] += weights[j] * row[k] * row[m];
+                    }
+                }
+            }
+
+            for (int k = 0; k < n; ++k)
+            {
+                for (int m = 0; m < k; ++m)
+                {
+                    normal[m * n + k] = normal[k * n + m];
+                }
+                normal[k * n + k] += energyPenalty;
+            }
+
+            if (! solveCholesky (normal, solution, n))
+            {
+                jassertfalse; // can't happen with the penalty, but keep the last good fit
+                break;
+            }
+            std::copy_n (solution.get(), n, amplitudes.get());
+
+            // Lawson's update: weight each grid point by its error
+            double weightSum = 0;
+            for (int j = 0; j < numPoints; ++j)
+            {
+                double response = 1;
+                for (int k = 0; k < n; ++k)
+                {
+                    response += amplitudes[k] * basis[j * n + k];
+                }
+                weights[j] *= std::abs (response);
+                weightSum += weights[j];
+            }
+
+            if (weightSum <= 0)
+            {
+                break; // exact fit
+            }
+
+            for (int j = 0; j < numPoints; ++j)
+            {
+                weights[j] /= weightSum;
+            }
+        }
+
+        Transformer transf;
+        transf.sampleRate = sampleRate;
+        transf.lowFreq = lowFreq;
+        transf.highFreq = highFreq;
+        transf.delay = delay;
+
+        // a_k = 2 * h[delay - k]
+        for (int kCoef = 0; kCoef < delay; ++kCoef)
+        {
+            transf.coefficients.add (amplitudes[delay - 1 - kCoef] / 2);
+        }
+
+        transf.updateExtrema();
+        return transf;
+    }
+
+    TransformerPtr getDesign (double sampleRate, float lowFreq, float highFreq, int delay)
+    {
+        static CriticalSection cacheLock;
+        static std::map<String, TransformerPtr> cache;
+
+        const String key = getCacheKey (sampleRate, lowFreq, highFreq, delay);
+
+        const ScopedLock lock (cacheLock);
+
+        auto it = cache.find (key);
+        if (it != cache.end())
+        {
+            return it->second;
+        }
+
+        File file = getCacheFile (key);
+        TransformerPtr transf = readCachedDesign (file, sampleRate, lowFreq, highFreq, delay);
+        if (transf == nullptr)
+        {
+            transf = std::make_shared<Transformer> (design (sampleRate, lowFreq, highFreq, delay));
+            writeCachedDesign (file, *transf);
+        }
+
+        cache[key] = transf;
+        return transf;
+    }
+
+    File getCacheDirectory()
+    {
+        return File::getSpecialLocation (File::userApplicationDataDirectory)
+            .getChildFile ("open-ephys")
+            .getChildFile ("PhaseCalculator")
+            .getChildFile ("HilbertDesigns");
+    }
+} // namespace Hilbert
+} // namespace PhaseCalculator
@@ -0,0 +1,84 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef HILBERT_DESIGNER_H_INCLUDED
+#define HILBERT_DESIGNER_H_INCLUDED
+
+/*
+
+Runtime design of Hilbert transformers, for passbands and modeling rates that the built-in
+transformers (HTransformers.h) don't cover, or to trade length for accuracy: a transformer's
+delay is both the number of samples the AR model has to predict and the number of coefficients
+it costs per sample.
+
+Designs have the same form as the built-in ones (an odd-length, antisymmetric FIR filter with
+every other coefficient free, see HTransformers.h), so the magnitude response is
+A(w) = sum over k = 1..delay of a_k * sin(k * w), with a_k = 2 * h[delay - k]. The coefficients
+are fit to A(w) = -1 over the band with Lawson's algorithm: weighted least squares, repeatedly
+reweighted by the error, which converges towards the equiripple (minimax) design. A small penalty
+on the coefficients' energy (which by Parseval's theorem is the mean squared response over the
+whole spectrum) keeps narrow-band designs from amplifying noise outside the band.
+
+Designing takes up to a few hundred milliseconds for the longest transformers, so designs are
+kept in memory and in a cache directory on disk (one JSON file per set of parameters), and are
+only computed the first time a set of parameters is used.
+
+*/
+
+#include "HTransformers.h"
+
+namespace PhaseCalculator
+{
+namespace Hilbert
+{
+    // longest transformer that can be designed, in samples of delay
+    const int maxDesignDelay = 64;
+
+    /*
+        * Range of bands that transformers can be designed for at the given rate, as a pair
+        * (lower limit, upper limit). Every transformer's response is zero at 0 and at the
+        * Nyquist frequency, so this stops a little short of both (the lower limit is the same at
+        * every rate, so that the built-in bands can be designed for at higher rates).
+        */
+    Array<float> getDesignableBand (double sampleRate);
+
+    /*
+        * Designs a transformer with the given delay (1 to maxDesignDelay) that is valid from lowFreq
+        * to highFreq (within getDesignableBand) at the given rate.
+        */
+    Transformer design (double sampleRate, float lowFreq, float highFreq, int delay);
+
+    /*
+        * Returns the design for these parameters from the cache, or designs it and adds it to the
+        * cache. Designs that are read from the disk cache are checked against the parameters and
+        * redesigned if they don't match; failing to write to the cache only means designing again
+        * next time.
+        */
+    TransformerPtr getDesign (double sampleRate, float lowFreq, float highFreq, int delay);
+
+    /** Directory of the disk cache (in the user's application data directory) */
+    File getCacheDirectory();
+} // namespace Hilbert
+} // namespace PhaseCalculator
+
+#endif // HILBERT_DESIGNER_H_INCLUDED
@@ -21,10 +21,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
-#include <cfloat> // DBL_MAX
-#include <cmath> // sqrt
-#include <cstring> // memcpy, memmove
-
 #include "PhaseCalculator.h"
 #include "PhaseCalculatorEditor.h"
 
@@ -40,164 +36,73 @@ static const float passbandEps = 0.01F;
 // priority of the AR model calculating thread (0 = lowest, 10 = highest)
 static const int arPriority = 3;
 
-// "glitch limit" (how long of a segment is allowed to be unwrapped or smoothed, in samples)
-static const int glitchLimit = 200;
-
-// process length for real-time visualization ground truth hilbert transform
-// based on evaluation of phase error compared to offline processing
-static const int visHilbertLengthMs = 1024;
-static const int visMinDelayMs = 675;
-static const int visMaxDelayMs = 1000;
-
-/*** ReverseStack ***/
-ReverseStack::ReverseStack (int size)
-    : freeSpace (size), headOffset (size - 1)
-{
-    resize (size);
-}
-
-void ReverseStack::reset()
-{
-    const ScopedLock dataLock (getLock());
-    freeSpace = size();
-    headOffset = freeSpace - 1;
-}
-
-void ReverseStack::resetAndResize (int newSize)
-{
-    const ScopedLock dataLock (getLock());
-    resize (newSize);
-    freeSpace = newSize;
-    headOffset = newSize - 1;
-}
-
-bool ReverseStack::isFull() const
-{
-    return freeSpace == 0;
-}
-
-void ReverseStack::enqueue (const float* source, int n)
-{
-    const ScopedLock dataLock (getLock());
-
-    // skip samples that can't be written
-    int length = size();
-    int nToSkip = jmax (0, n - length);
-    int nToAdd = n - nToSkip;
-    source += nToSkip;
-
-    double* data = getRawDataPointer();
-
-    for (int nLeft = nToAdd; nLeft > 0; --nLeft)
-    {
-        data[headOffset--] = double (*(source++));
-        if (headOffset < 0)
-        {
-            headOffset = length - 1;
-        }
-    }
-
-    freeSpace = jmax (0, freeSpace - nToAdd);
-}
-
-int ReverseStack::getHeadOffset() const
+// modeling rate selected for a stream
+static int getModelRate (const DataStream* ds)
 {
-    return headOffset;
+    return EngineParams::getModelRates()[static_cast<CategoricalParameter*> (ds->getParameter ("model_rate"))->getSelectedIndex()];
 }
 
-void ReverseStack::unwrapAndCopy (double* dest, bool useLock) const
+// frequency for channel names, e.g. "30" or "12.5"
+static String formatFrequency (float freq)
 {
-    ScopedPointer<ScopedLock> lock;
-    if (useLock)
-    {
-        lock = new ScopedLock (getLock());
-    }
-
-    int length = size();
-
-    const double* block2Start = begin();
-    int block2Size = (headOffset + 1) % length;
-
-    const double* block1Start = block2Start + block2Size;
-    int block1Size = length - block2Size;
-
-    std::memcpy (dest, block1Start, block1Size * sizeof (double));
-    std::memcpy (dest + block1Size, block2Start, block2Size * sizeof (double));
+    return freq == std::round (freq) ? String (roundToInt (freq)) : String (freq, 1);
 }
 
 /**** channel info *****/
 ActiveChannelInfo::ActiveChannelInfo (const ChannelInfo* cInfo)
     : chanInfo (cInfo)
 {
-    bufferResizeThread = std::make_unique<BufferResizeThread> (&visHilbertBuffer);
-
     update();
 }
 
 void ActiveChannelInfo::update()
 {
-    const DataStream* ds = chanInfo->stream;
-    int arOrder = ds->getParameter ("ar_order")->getValue();
-    float highCut = ds->getParameter ("high_cut")->getValue();
-    float lowCut = ds->getParameter ("low_cut")->getValue();
-    Band band = (Band) static_cast<CategoricalParameter*> (ds->getParameter ("freq_range"))->getSelectedIndex();
-
-    // update length of history based on sample rate
-    // the history buffer should have enough samples to calculate phases for the viusalizer
-    // with the proper Hilbert transform length AND train an AR model of the requested order,
-    // using at least 1 second of data
-    int newHistorySize = chanInfo->dsFactor * jmax (visHilbertLengthMs * Hilbert::fs / 1000, arOrder + 1, 1 * Hilbert::fs);
-
-    LOGD ("PhaseCalculator: Resetting history size");
-    history.resetAndResize (newHistorySize);
-
-    // set filter parameters
-    for (auto filt : { &filter, &reverseFilter })
+    // the same parameters that the channel is processed with (see Settings::updateChannelConfigs),
+    // so that the AR model is fit with the order the engine predicts with
+    const Settings& streamSettings = *chanInfo->settings;
+
+    // the history must also hold enough data for the visualizer's Hilbert transform
+    LOGD ("PhaseCalculator: Configuring channel ", chanInfo->chan);
+    configure (streamSettings.getChannelParams (*chanInfo), chanInfo->sampleRate, GroundTruthEngine::hilbertLengthMs);
+
+    // the visualizer only uses the main band, so the extra bands' histories only have to fit the AR models.
+    // they keep the stream's parameters, whatever the channel's override.
+    const Array<EngineParams>& extraBands = streamSettings.extraBands;
+    while (bands.size() > extraBands.size())
     {
-        filt->setup (
-            2, // order
-            chanInfo->sampleRate, // sample rate
-            (highCut + lowCut) / 2, // center frequency
-            highCut - lowCut); // bandwidth
+        bands.removeLast();
     }
-
-    LOGD ("PhaseCalculator: Setting filter parameters");
-    arModeler.setParams (arOrder, newHistorySize, chanInfo->dsFactor);
-
-    LOGD ("PhaseCalculator: Resizing hilbert state");
-    htState.resize (Hilbert::delay[band] * 2 + 1);
-
-    // visualization stuff
-    hilbertLengthMultiplier = Hilbert::fs * chanInfo->dsFactor / 1000;
-
-    LOGD ("PhaseCalculator: Resizing visualization buffer to ", visHilbertLengthMs * hilbertLengthMultiplier);
-
-    if (bufferResizeThread->isThreadRunning())
+    while (bands.size() < extraBands.size())
+    {
+        bands.add (new ChannelState());
+    }
+    for (int b = 0; b < extraBands.size(); ++b)
     {
-        bufferResizeThread->waitForThreadToExit (5000);
+        bands[b]->configure (extraBands.getReference (b), chanInfo->sampleRate, 0);
     }
-    bufferResizeThread->setSize (visHilbertLengthMs * hilbertLengthMultiplier);
-    bufferResizeThread->startThread();
-    bufferResizeThread->waitForThreadToExit (10000);
 
-    LOGD ("PhaseCalculator: Resetting info");
-    reset();
+    updateCrossings();
 }
 
-void ActiveChannelInfo::reset()
+void ActiveChannelInfo::updateCrossings()
 {
-    history.reset();
-    filter.reset();
-    arModeler.reset();
-    FloatVectorOperations::clear (htState.begin(), htState.size());
-    interpCountdown = 0;
-    lastComputedPhase = 0;
-    lastComputedMag = 0;
-    lastPhase = 0;
+    const DataStream* ds = chanInfo->stream;
+
+    Array<float> targets;
+    if ((int) ds->getParameter ("crossing_chan")->getValue() == chanInfo->chan)
+    {
+        targets = Settings::parseCrossingPhases (ds->getParameter ("crossing_phases")->getValueAsString());
+    }
+
+    // at least a pulse apart, so that each pulse ends before the next one starts (see Node::addCrossingEvents)
+    int refractoryMs = ds->getParameter ("crossing_refractory")->getValue();
+    int refractorySamples = jmax (roundToInt (refractoryMs * chanInfo->sampleRate / 1000), Settings::getCrossingPulseSamples (chanInfo->sampleRate));
+    double minAmp = ds->getParameter ("crossing_min_amp")->getValue();
+    crossings.setTargets (targets, refractorySamples, minAmp);
 }
 
-ChannelInfo::ChannelInfo (const DataStream* ds, int i)
-    : chan (i), sampleRate (0), dsFactor (0), isActivated (false), stream (ds)
+ChannelInfo::ChannelInfo (const Settings* owner, const DataStream* ds, int i)
+    : chan (i), sampleRate (0), rateSupported (false), magnitudeOutput (-1), imaginaryOutput (-1), config (-1), settings (owner), stream (ds), isActivated (false)
 {
     update();
 }
@@ -213,15 +118,11 @@ void ChannelInfo::update()
     }
 
     sampleRate = contChannel->getSampleRate();
+    rateSupported = ChannelState::isSupportedRate (sampleRate, getModelRate (stream));
 
-    float fsMult = sampleRate / Hilbert::fs;
-    float fsMultRound = std::round (fsMult);
-
-    if (std::abs (fsMult - fsMultRound) < FLT_EPSILON)
+    if (rateSupported)
     {
-        // can be active - sample rate is multiple of Hilbert Fs
-        dsFactor = int (fsMultRound);
-
+        // can be active - sample rate is a multiple of the modeling rate, or can be resampled to it
         if (isActivated)
         {
             acInfo->update();
@@ -229,14 +130,13 @@ void ChannelInfo::update()
     }
     else
     {
-        dsFactor = 0;
         deactivate(); // this channel can no longer be active.
     }
 }
 
 bool ChannelInfo::activate()
 {
-    if (! isActivated && dsFactor != 0)
+    if (! isActivated && rateSupported)
     {
         acInfo.reset (new ActiveChannelInfo (this));
         isActivated = true;
@@ -257,9 +157,12 @@ bool ChannelInfo::isActive() const
 
 /******** Phase Calculator Stream Settings *****/
 Settings::Settings() : calcInterval (50),
-                       arOrder (20),
                        visContinuousChannel (-1),
-                       visEventChannel (-1)
+                       visEventChannel (-1),
+                       modelAgeChannel (-1),
+                       blockTimeChannel (-1),
+                       extraOutputs (0),
+                       crossingEventChannel (nullptr)
 {
     channelInfo.clear();
     setBand (Band (0), true);
@@ -280,6 +183,9 @@ Array<int> Settings::getActiveInputs() const
 
 void Settings::updateActiveChannels()
 {
+    updateExtraBands();
+    updateChannelConfigs();
+
     for (int ai : getActiveInputs())
     {
         jassert (channelInfo[ai] && channelInfo[ai]->isActive());
@@ -297,7 +203,9 @@ bool Settings::activateInputChannel (int chan)
 
     //jassert(!channelInfo[chan]->isActive()); // this shouldn't be called if it's already active.
 
-    return channelInfo[chan]->activate();
+    bool activated = channelInfo[chan]->activate();
+    updateProcessingOrder();
+    return activated;
 }
 
 void Settings::deactivateInputChannel (int chan)
@@ -310,88 +218,292 @@ void Settings::deactivateInputChannel (int chan)
 
     //jassert(channelInfo.getUnchecked(chan)->isActive());
     channelInfo.getUnchecked (chan)->deactivate();
+    updateProcessingOrder();
 }
 
-void Settings::setBand (Band newBand, bool force)
+Array<GroundTruthEngine::Target> Settings::getVisTargets() const
 {
-    if (! force && newBand == band)
+    Array<GroundTruthEngine::Target> targets;
+    if (visContinuousChannel >= 0 && visEventChannel >= 0)
     {
-        return;
+        targets.add ({ visContinuousChannel, visEventChannel });
     }
-    if (newBand < 0 || newBand >= NUM_BANDS)
+
+    for (const auto& target : visExtraTargets)
     {
-        jassertfalse;
-        return;
+        targets.addIfNotAlreadyThere (target);
     }
+    return targets;
+}
 
-    band = newBand;
+Array<GroundTruthEngine::Target> Settings::parseVisTargets (const String& targetString)
+{
+    Array<GroundTruthEngine::Target> targets;
+    for (const String& pair : StringArray::fromTokens (targetString, ",", ""))
+    {
+        if (! pair.containsChar (':'))
+        {
+            continue;
+        }
 
-    // set low and high cut to the defaults for this band, making sure to notify the editor
-    resetCutsToDefaults();
+        int chan = pair.upToFirstOccurrenceOf (":", false, false).trim().getIntValue();
+        int line = pair.fromFirstOccurrenceOf (":", false, false).trim().getIntValue();
+        if (chan >= 0 && line >= 0)
+        {
+            targets.addIfNotAlreadyThere ({ chan, line });
+        }
+    }
+    return targets;
+}
 
-    // resize htState for each active channel, htTempState, and predSamps
-    int delay = Hilbert::delay[band];
-    htTempState.resize (delay * 2 + 1);
-    predSamps.resize (delay + 1);
+String Settings::formatVisTargets (const Array<GroundTruthEngine::Target>& targets)
+{
+    StringArray pairs;
+    for (const auto& target : targets)
+    {
+        pairs.add (String (target.chan) + ":" + String (target.eventLine));
+    }
+    return pairs.joinIntoString (",");
 }
 
-void Settings::resetCutsToDefaults()
+Array<float> Settings::parseCrossingPhases (const String& phaseString)
 {
-    const Array<float>& defaultBand = Hilbert::defaultBand[band];
-    lowCut = defaultBand[0];
-    highCut = defaultBand[1];
+    Array<float> phases;
+    for (const String& token : StringArray::fromTokens (phaseString, ",", ""))
+    {
+        if (token.trim().isEmpty() || phases.size() == maxCrossingTargets)
+        {
+            continue;
+        }
 
-    updateScaleFactor();
-    updateActiveChannels();
+        phases.add (token.trim().getFloatValue());
+    }
+    return phases;
+}
+
+Array<Range<float>> Settings::parseExtraBands (const String& bandString)
+{
+    Array<Range<float>> bands;
+    for (const String& token : StringArray::fromTokens (bandString, ",", ""))
+    {
+        if (! token.containsChar ('-') || bands.size() == maxExtraBands)
+        {
+            continue;
+        }
+
+        float low = token.upToFirstOccurrenceOf ("-", false, false).trim().getFloatValue();
+        float high = token.fromFirstOccurrenceOf ("-", false, false).trim().getFloatValue();
+        if (low > 0 && high > low)
+        {
+            bands.add ({ low, high });
+        }
+    }
+    return bands;
 }
 
-void Settings::updateScaleFactor()
+EngineParams Settings::getBandParams (const EngineParams& base, Range<float> passband)
 {
-    htScaleFactor = getScaleFactor (band, lowCut, highCut);
+    EngineParams params (base);
+    params.lowCut = passband.getStart();
+    params.highCut = passband.getEnd();
+
+    if (params.htDelay == 0)
+    {
+        auto covers = [&params] (int b)
+        {
+            return Hilbert::validBand[b][0] <= params.lowCut && params.highCut <= Hilbert::validBand[b][1];
+        };
+
+        if (! covers (params.band))
+        {
+            int b = 0;
+            while (b < NUM_BANDS && ! covers (b))
+            {
+                ++b;
+            }
+
+            if (b < NUM_BANDS)
+            {
+                params.band = Band (b);
+            }
+            else if (params.modelRate == Hilbert::fs)
+            {
+                params.htDelay = base.transformer->delay;
+            }
+        }
+    }
+
+    if (params.htDelay > 0 || params.modelRate != Hilbert::fs)
+    {
+        // designed transformers: keep the passband within the designable range
+        const Array<float> designable = Hilbert::getDesignableBand (params.modelRate);
+        params.lowCut = jlimit (designable[0], designable[1] - passbandEps, params.lowCut);
+        params.highCut = jlimit (params.lowCut + passbandEps, designable[1], params.highCut);
+    }
+
+    params.updateTransformer();
+    return params;
 }
 
-double Settings::getScaleFactor (Band band, double lowCut, double highCut)
+void Settings::updateExtraBands()
 {
-    double maxResponse = -DBL_MAX;
-    double minResponse = DBL_MAX;
+    // the number of bands only changes while not acquiring (along with the output channels)
+    extraBands.resize (extraBandCuts.size());
+    for (int b = 0; b < extraBandCuts.size(); ++b)
+    {
+        extraBands.getReference (b) = getBandParams (*this, extraBandCuts[b]);
+    }
+}
 
-    Array<double> testFreqs ({ lowCut, highCut });
-    // also look at any magnitude response extrema that fall within the selected band
-    for (double freq : Hilbert::extrema[band])
+Array<Settings::ChannelOverride> Settings::parseChannelOverrides (const String& overrideString)
+{
+    Array<ChannelOverride> overrides;
+    for (const String& token : StringArray::fromTokens (overrideString, ",", ""))
     {
-        if (freq > lowCut && freq < highCut)
+        StringArray fields = StringArray::fromTokens (token, ":", "");
+        if (fields.size() < 2 || fields[0].trim().isEmpty())
+        {
+            continue;
+        }
+
+        ChannelOverride channelOverride { fields[0].trim().getIntValue(), {}, 0 };
+
+        if (fields[1].containsChar ('-'))
+        {
+            float low = fields[1].upToFirstOccurrenceOf ("-", false, false).trim().getFloatValue();
+            float high = fields[1].fromFirstOccurrenceOf ("-", false, false).trim().getFloatValue();
+            if (low > 0 && high > low)
+            {
+                channelOverride.passband = { low, high };
+            }
+        }
+
+        channelOverride.arOrder = jmax (0, fields[2].trim().getIntValue());
+
+        if (channelOverride.chan < 0 || (channelOverride.passband.isEmpty() && channelOverride.arOrder == 0))
+        {
+            continue;
+        }
+
+        for (int i = overrides.size(); --i >= 0;)
         {
-            testFreqs.add (freq);
+            if (overrides.getReference (i).chan == channelOverride.chan)
+            {
+                overrides.remove (i);
+            }
         }
+        overrides.add (channelOverride);
     }
+    return overrides;
+}
 
-    // at each frequency, calculate the filter response
-    int nCoefs = Hilbert::delay[band];
-    for (double freq : testFreqs)
+EngineParams Settings::applyOverride (const EngineParams& base, const ChannelOverride& channelOverride)
+{
+    EngineParams params = channelOverride.passband.isEmpty() ? base : getBandParams (base, channelOverride.passband);
+    if (channelOverride.arOrder > 0)
     {
-        double normFreq = freq * Dsp::doublePi / (Hilbert::fs / 2);
-        std::complex<double> response = 0;
+        params.arOrder = channelOverride.arOrder;
+    }
+    return params;
+}
 
-        const double* transf = Hilbert::transformer[band].begin();
-        for (int kCoef = 0; kCoef < nCoefs; ++kCoef)
+void Settings::updateChannelConfigs()
+{
+    // one configuration per distinct override (so their number only changes with the overrides)
+    Array<ChannelOverride> configOverrides;
+    for (auto chanInfo : channelInfo)
+    {
+        chanInfo->config = -1;
+        for (const auto& channelOverride : channelOverrides)
         {
-            double coef = transf[kCoef];
+            if (channelOverride.chan != chanInfo->chan)
+            {
+                continue;
+            }
+
+            int config = 0;
+            while (config < configOverrides.size() && ! configOverrides.getReference (config).sameConfig (channelOverride))
+            {
+                ++config;
+            }
+
+            if (config == configOverrides.size())
+            {
+                configOverrides.add (channelOverride);
+            }
+            chanInfo->config = config;
+        }
+    }
+
+    channelConfigs.resize (configOverrides.size());
+    for (int config = 0; config < configOverrides.size(); ++config)
+    {
+        channelConfigs.getReference (config) = applyOverride (*this, configOverrides.getReference (config));
+    }
+
+    updateProcessingOrder();
+}
+
+const EngineParams& Settings::getChannelParams (const ChannelInfo& chanInfo) const
+{
+    return isPositiveAndBelow (chanInfo.config, channelConfigs.size()) ? channelConfigs.getReference (chanInfo.config) : *this;
+}
 
-            // near component
-            response += coef * std::polar (1.0, -(kCoef * normFreq));
+Array<Range<float>> Settings::getChannelPassbands() const
+{
+    Array<Range<float>> passbands;
+    for (auto chanInfo : channelInfo)
+    {
+        const EngineParams& params = getChannelParams (*chanInfo);
+        passbands.add ({ params.lowCut, params.highCut });
+    }
+    return passbands;
+}
 
-            // mirrored component
-            // there is no term for -nCoefs because that coefficient is 0.
-            response -= coef * std::polar (1.0, -((2 * nCoefs - kCoef) * normFreq));
+void Settings::updateProcessingOrder()
+{
+    // rebuilt in place, within storage allocated for every channel, so that the audio thread
+    // never reads freed memory (at worst it sees a mix of the old and new orders for one block)
+    processingOrder.ensureStorageAllocated (channelInfo.size());
+    processingOrder.clearQuick();
+    for (int config = -1; config < channelConfigs.size(); ++config)
+    {
+        for (auto chanInfo : channelInfo)
+        {
+            if (chanInfo->isActive() && chanInfo->config == config)
+            {
+                processingOrder.add (chanInfo->chan);
+            }
         }
+    }
+}
 
-        double absResponse = std::abs (response);
-        maxResponse = jmax (maxResponse, absResponse);
-        minResponse = jmin (minResponse, absResponse);
+void Settings::setBand (Band newBand, bool force)
+{
+    if (! force && newBand == band)
+    {
+        return;
+    }
+    if (newBand < 0 || newBand >= NUM_BANDS)
+    {
+        jassertfalse;
+        return;
     }
 
-    // scale factor is reciprocal of geometric mean of max and min
-    return 1 / std::sqrt (minResponse * maxResponse);
+    band = newBand;
+
+    // set low and high cut to the defaults for this band, making sure to notify the editor
+    resetCutsToDefaults();
+}
+
+void Settings::resetCutsToDefaults()
+{
+    const Array<float>& defaultBand = Hilbert::defaultBand[band];
+    lowCut = defaultBand[0];
+    highCut = defaultBand[1];
+
+    updateTransformer();
+    updateActiveChannels();
 }
 
 /**** phase calculator node ****/
@@ -400,6 +512,10 @@ Node::Node()
 {
     selectedStream = 0;
     activeChansNeedsUpdate = true;
+    numDeadlineMisses = 0;
+    blockDurationNs = 0;
+
+    groundTruth.setRecorder (&phaseRecorder);
 }
 
 void Node::registerParameters()
@@ -430,6 +546,31 @@ void Node::registerParameters()
     desc = "Order of the autoregressive models used to predict future data";
     addIntParameter (Parameter::STREAM_SCOPE, "ar_order", "AR Order", desc, 20, 1, 1000);
 
+    desc = "Delay (in samples at the modeling rate) of a Hilbert transformer designed for the passband, or 0 to use "
+           + String ("the frequency range's built-in transformer. Longer transformers are more accurate, but have to be predicted further ahead and cost more.");
+    addIntParameter (Parameter::STREAM_SCOPE, "ht_delay", "HT Delay", desc, 0, 0, Hilbert::maxDesignDelay);
+
+    Array<String> modelRates;
+    for (int rate : EngineParams::getModelRates())
+        modelRates.add (String (rate));
+
+    desc = "Rate (Hz) at which the AR model and Hilbert transformer run. Higher rates interpolate the phase between closer "
+           + String ("frames (for fast oscillations), but cost more per channel and need channels sampled at least this fast.");
+    addCategoricalParameter (Parameter::STREAM_SCOPE, "model_rate", "Model Rate", desc, modelRates, 0);
+
+    desc = "Evaluate the Hilbert transformer at every sample instead of interpolating the phase between samples at the modeling rate "
+           + String ("(lower latency and more accurate fast phase; not for sample rates that are not a multiple of the modeling rate)");
+    addBooleanParameter (Parameter::STREAM_SCOPE, "full_rate", "Full Rate", desc, false);
+
+    desc = "Output the phase predicted this far ahead of each sample, e.g. to compensate for the output latency of a stimulator "
+           + String ("(the AR prediction is extended by as much, so accuracy decreases with the horizon)");
+    addFloatParameter (Parameter::STREAM_SCOPE, "horizon", "Horizon", desc, "ms", 0.0f, 0.0f, EngineParams::maxHorizonMs, 0.1f);
+
+    desc = "How the phase at the end of the buffer is estimated: AR prediction of the future signal followed by the Hilbert transformer, "
+           + String ("or an endpoint-corrected Hilbert transform of the recent signal (no model fitting and a fixed cost per frame, ")
+           + String ("but biased away from the center of the passband, so best with narrow bands)");
+    addCategoricalParameter (Parameter::STREAM_SCOPE, "estimator", "Estimator", desc, { "AR + HT", "Endpoint HT" }, 0);
+
     // Create a SelectedChannelsParameter with the first channel selected by default
     SelectedChannelsParameter* chansParam = new SelectedChannelsParameter (nullptr,
                                                                            Parameter::STREAM_SCOPE,
@@ -441,6 +582,45 @@ void Node::registerParameters()
 
     addIntParameter (Parameter::STREAM_SCOPE, "vis_cont", "Continuous Channel", "Phase calculation channel", -1, -1, 1000);
     addIntParameter (Parameter::STREAM_SCOPE, "vis_event", "Event Line", "Event line to plot phases", -1, -1, 1000);
+    addStringParameter (Parameter::STREAM_SCOPE, "vis_targets", "Extra Plots", "Additional continuous channel:event line pairs to plot phases", "");
+
+    desc = "Write the phase of each plotted event to a file in the recording directory while recording";
+    addCategoricalParameter (Parameter::PROCESSOR_SCOPE, "export_phases", "Export Phases", desc, { "Off", "CSV", "Binary" }, 0);
+
+    desc = "Time each processing stage of each channel (logged when acquisition stops)";
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "stage_timing", "Stage Timing", desc, true);
+
+    desc = "While acquiring, capture the input blocks and TTL events of the selected stream to a file, to replay offline with phase_replay";
+    addBooleanParameter (Parameter::PROCESSOR_SCOPE, "capture_input", "Capture Input", desc, false);
+
+    desc = "Add output channels with the age of the oldest AR model in use (ms) and the block processing time (us), to record with the data";
+    addBooleanParameter (Parameter::STREAM_SCOPE, "telemetry", "Telemetry", desc, false);
+
+    desc = "Add output channels with the magnitude and/or imaginary part of the analytic signal of each selected channel, "
+           + String ("computed with its phase (which still replaces the input)");
+    addCategoricalParameter (Parameter::STREAM_SCOPE, "extra_outputs", "Extra Outputs", desc, { "None", "Magnitude", "Imaginary", "Mag. + Imag." }, 0);
+
+    desc = "Passbands (Hz) to also compute the phase of for each selected channel, e.g. \"30-80,80-150\" (up to "
+           + String (Settings::maxExtraBands) + "). Each band's phase is written to an output channel added after the inputs.";
+    addStringParameter (Parameter::STREAM_SCOPE, "extra_bands", "Extra Bands", desc, "");
+
+    desc = "Per-channel passband (Hz) and/or AR order instead of the stream's, as channel:low-high:order separated by commas "
+           + String ("(e.g. \"2:13-30:8,5::10\" for a 13-30 Hz band with order 8 on channel 2 and order 10 on channel 5; channels are 0-based)");
+    addStringParameter (Parameter::STREAM_SCOPE, "chan_overrides", "Chan. Overrides", desc, "");
+
+    desc = "Channel whose phase crossings of the target phases are sent as TTL events (-1 = none)";
+    addIntParameter (Parameter::STREAM_SCOPE, "crossing_chan", "Trig. Channel", desc, -1, -1, 1000);
+
+    desc = "Target phases in degrees, separated by commas (up to " + String (Settings::maxCrossingTargets)
+           + "). A crossing of the n-th target is sent on TTL line n.";
+    addStringParameter (Parameter::STREAM_SCOPE, "crossing_phases", "Trig. Phases", desc, "0");
+
+    desc = "Minimum time (ms) between two crossing events of the channel (of any target), at least the length of a pulse ("
+           + String (Settings::crossingPulseMs) + " ms)";
+    addIntParameter (Parameter::STREAM_SCOPE, "crossing_refractory", "Refractory", desc, 50, 0, 10000);
+
+    desc = "Minimum magnitude of the analytic signal (in the units of the input, e.g. uV) for a crossing to be sent";
+    addFloatParameter (Parameter::STREAM_SCOPE, "crossing_min_amp", "Min. Amp.", desc, "uV", 0.0f, 0.0f, 10000.0f, 1.0f);
 }
 
 AudioProcessorEditor* Node::createEditor()
@@ -451,25 +631,43 @@ AudioProcessorEditor* Node::createEditor()
 
 void Node::process (AudioBuffer<float>& buffer)
 {
-    if (settings[selectedStream]->visEventChannel > -1)
+    const int64 blockStart = StageTimings::now();
+
+    if (groundTruth.hasTargets() || blockCapture.isCapturing())
     {
         checkForEvents();
     }
 
     for (auto stream : dataStreams)
     {
-        if ((*stream)["enable_stream"]
-            && stream->getStreamId() == selectedStream)
+        if (! (*stream)["enable_stream"]
+            || stream->getStreamId() != selectedStream)
+        {
+            // nothing to report for streams that are not processed
+            writeTelemetry (buffer, stream, getNumSamplesInBlock (stream->getStreamId()), -1);
+            clearExtraOutputs (buffer, stream, getNumSamplesInBlock (stream->getStreamId()), false);
+        }
+        else
         {
-            // iterate over active input channels
-            Array<int> activeChans = settings[stream->getStreamId()]->getActiveInputs();
+            // iterate over active input channels, with those that share parameters back to back
+            const Array<int>& activeChans = settings[stream->getStreamId()]->processingOrder;
             int numActiveChans = activeChans.size();
 
             int nSamples = getNumSamplesInBlock (stream->getStreamId());
 
+            // the raw input, before it is overwritten with the phase
+            blockCapture.pushBlock (buffer, getFirstSampleNumberForBlock (stream->getStreamId()), nSamples);
+
+            // e.g. inputs deselected during acquisition
+            clearExtraOutputs (buffer, stream, nSamples, true);
+
             for (int ac = 0; ac < numActiveChans; ++ac)
             {
                 ChannelInfo* chanInfo = settings[stream->getStreamId()]->channelInfo[activeChans[ac]];
+                if (chanInfo == nullptr || ! chanInfo->isActive()) // deselected since the order was built
+                {
+                    continue;
+                }
                 ActiveChannelInfo* acInfo = chanInfo->acInfo.get();
 
                 int chan = stream->getContinuousChannels().getUnchecked (chanInfo->chan)->getGlobalIndex();
@@ -478,111 +676,74 @@ void Node::process (AudioBuffer<float>& buffer)
                     continue;
                 }
 
-                // filter the data
-                float* const wpIn = buffer.getWritePointer (chan);
-                acInfo->filter.process (nSamples, &wpIn);
+                StageTimings* timings = engine.isTimingEnabled() ? &acInfo->timings : nullptr;
+                StageClock channelClock (timings);
 
-                // enqueue as much new data as can fit into history
-                acInfo->history.enqueue (wpIn, nSamples);
-
-                // calc phase and write out (only if AR model has been calculated)
-                if (acInfo->history.isFull() && acInfo->arModeler.hasBeenFit())
+                // the extra bands start from the same input, before the main band overwrites it
+                Settings* streamSettings = settings[stream->getStreamId()];
+                const int numBands = jmin (acInfo->bands.size(), chanInfo->bandOutputs.size(), streamSettings->extraBands.size());
+                for (int b = 0; b < numBands; ++b)
                 {
-                    // read current AR parameters safely (uses lock internally)
-                    acInfo->arModeler.getModel (localARParams);
-
-                    // use AR model to fill predSamps (which is downsampled) based on past data.
-                    int htDelay = Hilbert::delay[settings[stream->getStreamId()]->band];
-                    int stride = chanInfo->dsFactor;
-
-                    double* pPredSamps = settings[stream->getStreamId()]->predSamps.getRawDataPointer();
-                    const double* pLocalParam = localARParams.getRawDataPointer();
-                    arPredict (acInfo->history, acInfo->interpCountdown, pPredSamps, pLocalParam, htDelay + 1, stride, settings[stream->getStreamId()]->arOrder);
-
-                    // identify indices of current buffer to execute HT
-                    htInds.clearQuick();
-                    for (int i = acInfo->interpCountdown; i < nSamples; i += stride)
-                    {
-                        htInds.add (i);
-                    }
-
-                    int htOutputSamps = htInds.size() + 1;
-                    if (htOutput.size() < htOutputSamps)
-                    {
-                        htOutput.resize (htOutputSamps);
-                    }
-
-                    // execute tranformer on current buffer
-                    int kOut = -htDelay;
-                    for (int kIn = 0; kIn < htInds.size(); ++kIn, ++kOut)
-                    {
-                        double samp = htFilterSamp (wpIn[htInds[kIn]], settings[stream->getStreamId()]->band, acInfo->htState);
-                        if (kOut >= 0)
-                        {
-                            double rc = wpIn[htInds[kOut]];
-                            double ic = settings[stream->getStreamId()]->htScaleFactor * samp;
-                            htOutput.set (kOut, std::complex<double> (rc, ic));
-                        }
-                    }
+                    int bandChan = stream->getContinuousChannels().getUnchecked (chanInfo->bandOutputs[b])->getGlobalIndex();
+                    FloatVectorOperations::copy (buffer.getWritePointer (bandChan), buffer.getReadPointer (chan), nSamples);
+                }
 
-                    // copy state to transform prediction without changing the end-of-buffer state
-                    settings[stream->getStreamId()]->htTempState = acInfo->htState;
+                // the magnitude and imaginary part outputs, if any
+                ExtraOutputs extra;
+                if (chanInfo->magnitudeOutput >= 0)
+                {
+                    extra.magnitude = buffer.getWritePointer (stream->getContinuousChannels().getUnchecked (chanInfo->magnitudeOutput)->getGlobalIndex());
+                }
+                if (chanInfo->imaginaryOutput >= 0)
+                {
+                    extra.imaginary = buffer.getWritePointer (stream->getContinuousChannels().getUnchecked (chanInfo->imaginaryOutput)->getGlobalIndex());
+                }
 
-                    // execute transformer on prediction
-                    for (int i = 0; i <= htDelay; ++i, ++kOut)
-                    {
-                        double samp = htFilterSamp (settings[stream->getStreamId()]->predSamps[i],
-                                                    settings[stream->getStreamId()]->band,
-                                                    settings[stream->getStreamId()]->htTempState);
-                        if (kOut >= 0)
-                        {
-                            double rc = i == htDelay ? settings[stream->getStreamId()]->predSamps[0] : wpIn[htInds[kOut]];
-                            double ic = settings[stream->getStreamId()]->htScaleFactor * samp;
-                            htOutput.set (kOut, std::complex<double> (rc, ic));
-                        }
-                    }
+                // filter, calculate phase and write out (or zeros if the AR model is not ready)
+                bool phaseWritten = engine.processChannel (streamSettings->getChannelParams (*chanInfo), *acInfo, buffer.getWritePointer (chan), nSamples, extra);
 
-                    // output with upsampling (interpolation)
-                    float* wpOut = buffer.getWritePointer (chan);
+                for (int b = 0; b < numBands; ++b)
+                {
+                    int bandChan = stream->getContinuousChannels().getUnchecked (chanInfo->bandOutputs[b])->getGlobalIndex();
+                    engine.processChannel (streamSettings->extraBands.getReference (b), *acInfo->bands[b], buffer.getWritePointer (bandChan), nSamples);
+                }
 
-                    double nextComputedPhase, phaseStep;
+                // target phase crossings found while writing the phase out
+                if (! acInfo->crossings.getCrossings().isEmpty())
+                {
+                    addCrossingEvents (settings[stream->getStreamId()], acInfo, getFirstSampleNumberForBlock (stream->getStreamId()), nSamples);
+                }
 
-                    nextComputedPhase = std::arg (htOutput[0]);
-                    phaseStep = circDist (nextComputedPhase, acInfo->lastComputedPhase, Dsp::doublePi) / stride;
+                // if this channel is monitored for events, check whether we can add new phases
+                StageClock groundTruthClock (timings);
+                groundTruth.processChannel (chanInfo->chan,
+                                            acInfo->history,
+                                            buffer.getReadPointer (chan),
+                                            phaseWritten,
+                                            getFirstSampleNumberForBlock (stream->getStreamId()),
+                                            nSamples);
+                groundTruthClock.lap (StageTimings::GROUND_TRUTH);
+                channelClock.total (StageTimings::CHANNEL_TOTAL);
+            }
 
-                    for (int i = 0, frame = 0; i < nSamples; ++i, --acInfo->interpCountdown)
-                    {
-                        if (acInfo->interpCountdown == 0)
-                        {
-                            // update interpolation frame
-                            ++frame;
-                            acInfo->interpCountdown = stride;
-
-                            acInfo->lastComputedPhase = nextComputedPhase;
-                            nextComputedPhase = std::arg (htOutput[frame]);
-                        }
-
-                        double thisPhase, thisMag;
-                        thisPhase = circDist (nextComputedPhase, phaseStep * acInfo->interpCountdown, Dsp::doublePi);
-                        wpOut[i] = float (thisPhase * (180.0 / Dsp::doublePi));
-                    }
+            // ends of crossing pulses from earlier blocks
+            if (! settings[stream->getStreamId()]->pendingCrossingOffs.isEmpty())
+            {
+                addCrossingEvents (settings[stream->getStreamId()], nullptr, getFirstSampleNumberForBlock (stream->getStreamId()), nSamples);
+            }
 
-                    // unwrapping / smoothing
-                    unwrapBuffer (wpOut, nSamples, acInfo->lastPhase);
-                    smoothBuffer (wpOut, nSamples, acInfo->lastPhase);
-                    acInfo->lastPhase = wpOut[nSamples - 1];
-                }
-                else // fifo not full or AR model not ready
-                {
-                    // just output zeros
-                    buffer.clear (chan, 0, nSamples);
-                }
+            // the block must be processed in less time than it lasts to keep up with acquisition
+            if (nSamples > 0)
+            {
+                int64 blockTime = jmax (int64 (0), StageTimings::now() - blockStart);
+                writeTelemetry (buffer, stream, nSamples, blockTime);
 
-                // if this is the monitored channel for events, check whether we can add a new phase
-                if (chanInfo->chan == settings[stream->getStreamId()]->visContinuousChannel
-                    && acInfo->history.isFull())
+                int64 duration = int64 (1e9 * nSamples / stream->getSampleRate());
+                blockTimes.add (uint64 (blockTime));
+                blockDurationNs = duration;
+                if (blockTime > duration)
                 {
-                    calcVisPhases (acInfo, getFirstSampleNumberForBlock (stream->getStreamId()) + nSamples);
+                    ++numDeadlineMisses;
                 }
             }
         }
@@ -593,20 +754,28 @@ bool Node::startAcquisition()
 {
     if (isEnabled)
     {
-        // wait for initialization threads to finish
+        // timings cover one acquisition
+        blockTimes.clear();
+        numDeadlineMisses = 0;
         for (auto stream : getDataStreams())
         {
             for (auto chanInfo : settings[stream->getStreamId()]->channelInfo)
             {
                 if (chanInfo->isActive())
                 {
-                    chanInfo->acInfo->waitForThreadToExit();
+                    chanInfo->acInfo->timings.clear();
                 }
             }
         }
 
         activeChansNeedsUpdate = true;
         this->startThread();
+        groundTruth.startThread();
+
+        if ((bool) getParameter ("capture_input")->getValue())
+        {
+            startCapture();
+        }
 
         // have to manually enable editor, I guess...
         Editor* editor = static_cast<Editor*> (getEditor());
@@ -622,38 +791,101 @@ bool Node::stopAcquisition()
     editor->disable();
 
     stopThread (2000);
+    groundTruth.stopThread (2000);
+    blockCapture.stop();
+
+    if (engine.isTimingEnabled())
+    {
+        logStageTimings();
+    }
 
     // reset states of active inputs
     for (auto stream : getDataStreams())
     {
+        settings[stream->getStreamId()]->pendingCrossingOffs.clearQuick();
+
         for (auto chanInfo : settings[stream->getStreamId()]->channelInfo)
         {
             if (chanInfo->isActive())
             {
                 chanInfo->acInfo->reset();
+                for (auto band : chanInfo->acInfo->bands)
+                {
+                    band->reset();
+                }
             }
         }
     }
 
-    // clear timestamp and phase queues
-    while (! visTsBuffer.empty())
+    // clear timestamp queues
+    groundTruth.reset();
+
+    return true;
+}
+
+void Node::startRecording()
+{
+    auto format = PhaseRecorder::Format ((int) getParameter ("export_phases")->getValue());
+    if (format == PhaseRecorder::OFF || selectedStream == 0)
     {
-        visTsBuffer.pop();
+        return;
     }
 
-    ScopedLock phaseLock (visPhaseBufferCS);
-    while (! visPhaseBuffer.empty())
+    File recordingDir = CoreServices::getRecordingParentDirectory().getChildFile (CoreServices::getRecordingDirectoryName());
+    File file = recordingDir.getChildFile ("Phase Calculator " + String (getNodeId()) + " event phases");
+
+    // the writer thread creates the directory and file
+    phaseRecorder.start (file, format, getDataStream (selectedStream)->getSampleRate());
+}
+
+void Node::stopRecording()
+{
+    phaseRecorder.stop();
+}
+
+void Node::startCapture()
+{
+    DataStream* stream = getDataStream (selectedStream);
+    if (selectedStream == 0 || stream == nullptr)
     {
-        visPhaseBuffer.pop();
+        return;
     }
 
-    return true;
+    Settings* streamSettings = settings[selectedStream];
+
+    CaptureFile::Info info;
+    info.sampleRate = stream->getSampleRate();
+    info.arOrder = streamSettings->arOrder;
+    info.band = streamSettings->band;
+    info.htDelay = streamSettings->htDelay;
+    info.modelRate = streamSettings->modelRate;
+    info.fullRate = streamSettings->fullRate;
+    info.horizonMs = streamSettings->horizonMs;
+    info.estimator = streamSettings->estimator;
+    info.calcInterval = streamSettings->calcInterval;
+    info.lowCut = streamSettings->lowCut;
+    info.highCut = streamSettings->highCut;
+
+    Array<int> bufferChannels;
+    for (int chan : streamSettings->getActiveInputs())
+    {
+        info.channels.add (chan);
+        bufferChannels.add (stream->getContinuousChannels().getUnchecked (chan)->getGlobalIndex());
+    }
+
+    // next to the recordings, whether or not this acquisition is recorded
+    File dir = CoreServices::getRecordingParentDirectory();
+    String name = "Phase Calculator " + String (getNodeId()) + " capture " + Time::getCurrentTime().formatted ("%Y-%m-%d_%H-%M-%S");
+
+    // the writer thread creates the directory and file
+    blockCapture.start (dir.getChildFile (name), info, bufferChannels);
 }
 
 void Node::setSelectedStream (uint16 streamID)
 {
     selectedStream = streamID;
     activeChansNeedsUpdate = true;
+    updateVisTargets (true);
 }
 
 // thread routine
@@ -681,6 +913,10 @@ void Node::run()
                 {
                     activeChans.add (chanInfo->acInfo.get());
                     maxHistoryLength = jmax (maxHistoryLength, chanInfo->acInfo->history.size());
+                    for (auto band : chanInfo->acInfo->bands)
+                    {
+                        maxHistoryLength = jmax (maxHistoryLength, band->history.size());
+                    }
                 }
             }
 
@@ -690,17 +926,12 @@ void Node::run()
 
         for (auto acInfo : activeChans)
         {
-            if (! acInfo->history.isFull())
+            // calculate parameters (if the history is full)
+            acInfo->fitModel (reverseData, engine.isTimingEnabled());
+            for (auto band : acInfo->bands)
             {
-                continue;
+                band->fitModel (reverseData, engine.isTimingEnabled());
             }
-
-            // unwrap reversed history and add to temporary data array
-            double* dataPtr = reverseData.getRawDataPointer();
-            acInfo->history.unwrapAndCopy (dataPtr, true);
-
-            // calculate parameters
-            acInfo->arModeler.fitModel (reverseData);
         }
 
         endTime = Time::getMillisecondCounter();
@@ -724,23 +955,199 @@ void Node::updateSettings()
 
         for (int i = 0; i < stream->getChannelCount(); ++i)
         {
-            ChannelInfo* addChanInfo = new ChannelInfo (stream, i);
+            ChannelInfo* addChanInfo = new ChannelInfo (settings[stream->getStreamId()], stream, i);
             settings[stream->getStreamId()]->channelInfo.add (addChanInfo);
         }
 
+        // telemetry outputs, after the inputs
+        Settings* streamSettings = settings[stream->getStreamId()];
+        streamSettings->modelAgeChannel = -1;
+        streamSettings->blockTimeChannel = -1;
+        if ((bool) stream->getParameter ("telemetry")->getValue())
+        {
+            streamSettings->modelAgeChannel = addOutputChannel (stream,
+                                                                "MODEL_AGE",
+                                                                "Age of the oldest AR model in use at each block, in ms (-1 if a channel has no model yet)",
+                                                                "phasecalc.telemetry.modelage");
+            streamSettings->blockTimeChannel = addOutputChannel (stream,
+                                                                 "BLOCK_TIME",
+                                                                 "Time taken to process each block, in microseconds",
+                                                                 "phasecalc.telemetry.blocktime");
+        }
+
+        // magnitude, imaginary part and extra band outputs of the selected inputs, after the telemetry
+        streamSettings->extraOutputs = static_cast<CategoricalParameter*> (stream->getParameter ("extra_outputs"))->getSelectedIndex();
+        streamSettings->extraBandCuts = Settings::parseExtraBands (stream->getParameter ("extra_bands")->getValueAsString());
+        streamSettings->channelOverrides = Settings::parseChannelOverrides (stream->getParameter ("chan_overrides")->getValueAsString());
+        var selectedChannels = stream->getParameter ("Channels")->getValue();
+        for (auto chanInfo : streamSettings->channelInfo)
+        {
+            chanInfo->magnitudeOutput = -1;
+            chanInfo->imaginaryOutput = -1;
+            chanInfo->bandOutputs.clearQuick();
+
+            if ((streamSettings->extraOutputs == 0 && streamSettings->extraBandCuts.isEmpty()) || ! chanInfo->rateSupported
+                || selectedChannels.getArray() == nullptr || ! selectedChannels.getArray()->contains (chanInfo->chan))
+            {
+                continue;
+            }
+
+            const ContinuousChannel* input = stream->getContinuousChannels().getUnchecked (chanInfo->chan);
+            if ((streamSettings->extraOutputs & Settings::MAGNITUDE_OUTPUT) != 0)
+            {
+                chanInfo->magnitudeOutput = addOutputChannel (stream,
+                                                              input->getName() + "_MAG",
+                                                              "Magnitude of the analytic signal of " + input->getName() + " (same units)",
+                                                              "phasecalc.magnitude",
+                                                              input->getBitVolts());
+            }
+            if ((streamSettings->extraOutputs & Settings::IMAGINARY_OUTPUT) != 0)
+            {
+                chanInfo->imaginaryOutput = addOutputChannel (stream,
+                                                              input->getName() + "_IMAG",
+                                                              "Imaginary part of the analytic signal of " + input->getName() + " (same units)",
+                                                              "phasecalc.imaginary",
+                                                              input->getBitVolts());
+            }
+            for (auto cuts : streamSettings->extraBandCuts)
+            {
+                String band = formatFrequency (cuts.getStart()) + "-" + formatFrequency (cuts.getEnd());
+                chanInfo->bandOutputs.add (addOutputChannel (stream,
+                                                             input->getName() + "_" + band + "Hz",
+                                                             "Phase (degrees) of " + input->getName() + " in the " + band + " Hz band",
+                                                             "phasecalc.bandphase",
+                                                             input->getBitVolts()));
+            }
+        }
+
+        // TTL output for phase crossings (lines are only used while a channel and targets are set)
+        EventChannel::Settings crossingSettings {
+            EventChannel::Type::TTL,
+            "Phase crossings",
+            "Pulses when the phase of the trigger channel crosses a target phase (one line per target)",
+            "phasecalc.crossings",
+            stream
+        };
+
+        eventChannels.add (new EventChannel (crossingSettings));
+        eventChannels.getLast()->addProcessor (this);
+        stream->addChannel (eventChannels.getLast());
+        streamSettings->crossingEventChannel = eventChannels.getLast();
+        streamSettings->pendingCrossingOffs.ensureStorageAllocated (Settings::maxCrossingTargets);
+
+        // read directly: parameterValueChanged updates the signal chain
+        streamSettings->modelRate = getModelRate (stream);
+
         parameterValueChanged (stream->getParameter ("Channels"));
         parameterValueChanged (stream->getParameter ("freq_range"));
+        parameterValueChanged (stream->getParameter ("ht_delay"));
         parameterValueChanged (stream->getParameter ("low_cut"));
         parameterValueChanged (stream->getParameter ("high_cut"));
         parameterValueChanged (stream->getParameter ("ar_refresh"));
         parameterValueChanged (stream->getParameter ("ar_order"));
+        parameterValueChanged (stream->getParameter ("full_rate"));
+        parameterValueChanged (stream->getParameter ("horizon"));
+        parameterValueChanged (stream->getParameter ("estimator"));
         parameterValueChanged (stream->getParameter ("vis_event"));
         settings[stream->getStreamId()]->visContinuousChannel = (int) stream->getParameter ("vis_cont")->getValue();
+        settings[stream->getStreamId()]->visExtraTargets = Settings::parseVisTargets (stream->getParameter ("vis_targets")->getValueAsString());
     }
+
+    updateVisTargets (true);
 }
 
 void Node::parameterValueChanged (Parameter* param)
 {
+    if (param->getName().equalsIgnoreCase ("export_phases"))
+    {
+        // read when recording starts
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("stage_timing"))
+    {
+        engine.setTimingEnabled ((bool) param->getValue());
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("capture_input"))
+    {
+        // read when acquisition starts
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("telemetry"))
+    {
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("Telemetry channels cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        // adds or removes the output channels
+        CoreServices::updateSignalChain (getEditor());
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("extra_outputs"))
+    {
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("Extra outputs cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        // adds or removes the output channels
+        CoreServices::updateSignalChain (getEditor());
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("extra_bands"))
+    {
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("Extra bands cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        // adds or removes the output channels, and reconfigures the active channels
+        CoreServices::updateSignalChain (getEditor());
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("chan_overrides"))
+    {
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("Channel overrides cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        Settings* streamSettings = settings[param->getStreamId()];
+        streamSettings->channelOverrides = Settings::parseChannelOverrides (param->getValueAsString());
+        streamSettings->updateActiveChannels();
+        updateVisTargets (false);
+        return;
+    }
+
+    if (param->getName().equalsIgnoreCase ("model_rate"))
+    {
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("The modeling rate cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        // changes which channels can be activated, and reconfigures the active ones
+        CoreServices::updateSignalChain (getEditor());
+        return;
+    }
+
     juce::uint16 paramStreamId = param->getStreamId();
     auto stream = getDataStream (paramStreamId);
 
@@ -754,13 +1161,14 @@ void Node::parameterValueChanged (Parameter* param)
 
         bool paramNeedsUpdate = false;
 
+        int numInputs = settings[paramStreamId]->channelInfo.size();
         for (int i = 0; i < getDataStream (paramStreamId)->getChannelCount(); i++)
         {
             // mark channel as activated or deactivated
             if (paramValue.getArray()->contains (i))
             {
-                // check whether channel can be activated
-                if (! settings[paramStreamId]->activateInputChannel (i))
+                // check whether channel can be activated (telemetry outputs cannot)
+                if (i >= numInputs || ! settings[paramStreamId]->activateInputChannel (i))
                 {
                     LOGD ("Failed to activate input channel ", i);
                     paramValue.getArray()->removeFirstMatchingValue (i);
@@ -768,7 +1176,7 @@ void Node::parameterValueChanged (Parameter* param)
                     continue;
                 }
             }
-            else
+            else if (i < numInputs)
             {
                 settings[paramStreamId]->deactivateInputChannel (i);
             }
@@ -782,6 +1190,12 @@ void Node::parameterValueChanged (Parameter* param)
             param->valueChanged();
         }
 
+        // the extra outputs follow the selected channels (from the next acquisition, if one is running)
+        if (! CoreServices::getAcquisitionStatus() && extraOutputsNeedUpdate (paramStreamId))
+        {
+            CoreServices::updateSignalChain (getEditor());
+        }
+
         getEditor()->updateVisualizer();
     }
     else if (param->getName().equalsIgnoreCase ("freq_range"))
@@ -793,6 +1207,7 @@ void Node::parameterValueChanged (Parameter* param)
             stream->getParameter ("low_cut")->setNextValue (settings[paramStreamId]->lowCut, false);
             stream->getParameter ("high_cut")->setNextValue (settings[paramStreamId]->highCut, false);
             settings[paramStreamId]->updateActiveChannels();
+            updateVisTargets (false);
         }
     }
     else if (param->getName().equalsIgnoreCase ("ar_refresh"))
@@ -804,13 +1219,93 @@ void Node::parameterValueChanged (Parameter* param)
         settings[paramStreamId]->arOrder = param->getValue();
         settings[paramStreamId]->updateActiveChannels();
     }
+    else if (param->getName().equalsIgnoreCase ("full_rate"))
+    {
+        // reconfiguring resizes the full-rate buffers that the audio thread works in
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("Full rate cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        settings[paramStreamId]->fullRate = param->getValue();
+        settings[paramStreamId]->updateActiveChannels();
+    }
+    else if (param->getName().equalsIgnoreCase ("estimator"))
+    {
+        // reconfiguring replaces the endpoint kernels and the channel state the audio thread uses
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("The estimator cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        settings[paramStreamId]->estimator = (EngineParams::Estimator) static_cast<CategoricalParameter*> (param)->getSelectedIndex();
+        settings[paramStreamId]->updateActiveChannels();
+    }
+    else if (param->getName().equalsIgnoreCase ("horizon"))
+    {
+        // the audio thread reads the horizon of each configuration and sizes its prediction by it
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("The horizon cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        settings[paramStreamId]->horizonMs = param->getValue();
+        for (auto& bandParams : settings[paramStreamId]->extraBands)
+        {
+            bandParams.horizonMs = param->getValue();
+        }
+        for (auto& configParams : settings[paramStreamId]->channelConfigs)
+        {
+            configParams.horizonMs = param->getValue();
+        }
+        updateVisTargets (false);
+    }
+    else if (param->getName().equalsIgnoreCase ("ht_delay"))
+    {
+        // reconfiguring swaps the channels' transformers and resizes their histories, and a new
+        // design can take a while to compute and write to the cache
+        if (CoreServices::getAcquisitionStatus())
+        {
+            CoreServices::sendStatusMessage ("The Hilbert transformer delay cannot be changed during acquisition.");
+            param->restorePreviousValue();
+            return;
+        }
+
+        Settings* streamSettings = settings[paramStreamId];
+        streamSettings->htDelay = param->getValue();
+
+        // the built-in transformers only cover their band's valid range
+        const Array<float> validBand = streamSettings->getValidBand();
+        if (streamSettings->lowCut < validBand[0] || streamSettings->highCut > validBand[1])
+        {
+            streamSettings->resetCutsToDefaults();
+            stream->getParameter ("low_cut")->setNextValue (streamSettings->lowCut, false);
+            stream->getParameter ("high_cut")->setNextValue (streamSettings->highCut, false);
+        }
+        else
+        {
+            streamSettings->updateTransformer();
+            streamSettings->updateActiveChannels();
+        }
+
+        LOGD ("[PhaseCalc] Hilbert transformer delay ", streamSettings->transformer->delay,
+              ", worst-case phase error from its ripple: ",
+              streamSettings->transformer->getMaxPhaseError (streamSettings->lowCut, streamSettings->highCut), " degrees");
+        updateVisTargets (false);
+    }
     else if (param->getName().equalsIgnoreCase ("low_cut"))
     {
         float newLowCut = (float) param->getValue();
         if (newLowCut == settings[paramStreamId]->lowCut)
             return;
 
-        const Array<float>& validBand = Hilbert::validBand[settings[paramStreamId]->band];
+        const Array<float> validBand = settings[paramStreamId]->getValidBand();
 
         if (newLowCut < validBand[0] || newLowCut >= validBand[1])
         {
@@ -829,8 +1324,9 @@ void Node::parameterValueChanged (Parameter* param)
         }
         else
         {
-            settings[paramStreamId]->updateScaleFactor();
+            settings[paramStreamId]->updateTransformer();
             settings[paramStreamId]->updateActiveChannels();
+            updateVisTargets (false);
         }
     }
     else if (param->getName().equalsIgnoreCase ("high_cut"))
@@ -839,7 +1335,7 @@ void Node::parameterValueChanged (Parameter* param)
         if (newHighCut == settings[paramStreamId]->highCut)
             return;
 
-        const Array<float>& validBand = Hilbert::validBand[settings[paramStreamId]->band];
+        const Array<float> validBand = settings[paramStreamId]->getValidBand();
 
         if (newHighCut <= validBand[0] || newHighCut > validBand[1])
         {
@@ -857,8 +1353,9 @@ void Node::parameterValueChanged (Parameter* param)
         }
         else
         {
-            settings[paramStreamId]->updateScaleFactor();
+            settings[paramStreamId]->updateTransformer();
             settings[paramStreamId]->updateActiveChannels();
+            updateVisTargets (false);
         }
     }
     else if (param->getName().equalsIgnoreCase ("vis_cont"))
@@ -869,165 +1366,148 @@ void Node::parameterValueChanged (Parameter* param)
     {
         jassert ((int) param->getValue() >= -1);
         settings[paramStreamId]->visEventChannel = (int) param->getValue();
+        updateVisTargets (false);
     }
-    else
+    else if (param->getName().equalsIgnoreCase ("vis_targets"))
     {
-        //do nothing
+        settings[paramStreamId]->visExtraTargets = Settings::parseVisTargets (param->getValueAsString());
+        updateVisTargets (false);
     }
-}
-
-bool Node::tryToReadVisPhases (std::queue<double>& other)
-{
-    const ScopedTryLock lock (visPhaseBufferCS);
-    if (! lock.isLocked())
+    else if (param->getName().startsWithIgnoreCase ("crossing_"))
     {
-        return false;
+        // can change during acquisition: the detectors lock their targets while checking a buffer
+        for (int ai : settings[paramStreamId]->getActiveInputs())
+        {
+            settings[paramStreamId]->channelInfo[ai]->acInfo->updateCrossings();
+        }
     }
-
-    while (! visPhaseBuffer.empty())
+    else
     {
-        other.push (visPhaseBuffer.front());
-        visPhaseBuffer.pop();
+        //do nothing
     }
-    return true;
 }
 
-double Node::circDist (double x, double ref, double cutoff)
+bool Node::tryToReadVisPhases (std::queue<EventPhase>& other)
 {
-    static const double twoPi = 2 * Dsp::doublePi;
-    double xMod = std::fmod (x - ref, twoPi);
-    double xPos = (xMod < 0 ? xMod + twoPi : xMod);
-    return (xPos > cutoff ? xPos - twoPi : xPos);
+    return groundTruth.tryToReadPhases (other);
 }
 
-// ------------ PRIVATE METHODS ---------------
+bool Node::tryToReadPhaseErrors (int target, PhaseErrorSnapshot& snapshot)
+{
+    return groundTruth.tryToReadErrors (target, snapshot);
+}
 
-void Node::handleTTLEvent (TTLEventPtr event)
+void Node::clearPhaseErrors()
 {
-    if (settings[selectedStream]->visEventChannel < 0)
-    {
-        return;
-    }
+    groundTruth.clearErrors();
+}
 
-    if (event->getEventType() == EventChannel::TTL)
-    {
-        if (event->getStreamId() == selectedStream
-            && (int) event->getLine() == settings[selectedStream]->visEventChannel
-            && event->getState())
-        {
-            // add timestamp to the queue for visualization
-            juce::int64 ts = event->getSampleNumber();
-            jassert (visTsBuffer.empty() || visTsBuffer.back() <= ts);
-            visTsBuffer.push (ts);
-        }
-    }
+Array<GroundTruthEngine::Target> Node::getVisTargets()
+{
+    // the engine's copy is the one that EventPhase::target indexes into
+    return groundTruth.getTargets();
 }
 
-void Node::setVisContChan (int newChan)
+bool Node::getStageTimings (int chan, StageTimings::Snapshot& snapshot)
 {
-    if (newChan >= 0)
+    if (selectedStream == 0)
     {
-        // jassert(newChan < channelInfo.size() && channelInfo[newChan]->isActive());
-
-        // disable event receival temporarily so we can flush the buffer
-        int tempVisEventChan = settings[selectedStream]->visEventChannel;
-        settings[selectedStream]->visEventChannel = -1;
-
-        // clear timestamp queue
-        while (! visTsBuffer.empty())
-        {
-            visTsBuffer.pop();
-        }
+        return false;
+    }
 
-        settings[selectedStream]->visEventChannel = tempVisEventChan;
+    ChannelInfo* chanInfo = settings[selectedStream]->channelInfo[chan];
+    if (chanInfo == nullptr || ! chanInfo->isActive())
+    {
+        return false;
     }
 
-    settings[selectedStream]->visContinuousChannel = newChan;
+    snapshot = chanInfo->acInfo->timings.getSnapshot();
+    return true;
 }
 
-void Node::unwrapBuffer (float* wp, int nSamples, float lastPhase)
+void Node::logStageTimings()
 {
-    for (int startInd = 0; startInd < nSamples - 1; startInd++)
+    for (auto stream : getDataStreams())
     {
-        float diff = wp[startInd] - (startInd == 0 ? lastPhase : wp[startInd - 1]);
-        if (abs (diff) > 180)
+        for (auto chanInfo : settings[stream->getStreamId()]->channelInfo)
         {
-            // search forward for a jump in the opposite direction
-            int endInd;
-            int maxInd;
-            if (diff < 0)
-            // for downward jumps, unwrap if there's a jump back up within glitchLimit samples
-            {
-                endInd = -1;
-                maxInd = jmin (startInd + glitchLimit, nSamples - 1);
-            }
-            else
-            // for upward jumps, default to unwrapping until the end of the buffer, but stop if there's a jump back down sooner.
-            {
-                endInd = nSamples;
-                maxInd = nSamples - 1;
-            }
-            for (int currInd = startInd + 1; currInd <= maxInd; currInd++)
+            if (! chanInfo->isActive())
             {
-                float diff2 = wp[currInd] - wp[currInd - 1];
-                if (abs (diff2) > 180 && ((diff > 0) != (diff2 > 0)))
-                {
-                    endInd = currInd;
-                    break;
-                }
+                continue;
             }
 
-            // unwrap [startInd, endInd)
-            for (int i = startInd; i < endInd; i++)
+            StageTimings::Snapshot snapshot = chanInfo->acInfo->timings.getSnapshot();
+            if (snapshot.stages[StageTimings::CHANNEL_TOTAL].count == 0)
             {
-                wp[i] -= 360 * (diff / abs (diff));
+                continue;
             }
 
-            if (endInd > -1)
+            LOGC ("PhaseCalculator: stage timings of ", stream->getName(), " channel ", chanInfo->chan + 1, " (us: mean / p50 / p99 / max, count):");
+            for (int stage = 0; stage < StageTimings::NUM_STAGES; ++stage)
             {
-                // skip to the end of this unwrapped section
-                startInd = endInd;
+                const LatencyHistogram::Snapshot& hist = snapshot.stages[stage];
+                LOGC ("    ", StageTimings::getStageName (stage), ": ",
+                      String (hist.getMeanNs() / 1000, 2), " / ",
+                      String (hist.getPercentileNs (0.5) / 1000, 2), " / ",
+                      String (hist.getPercentileNs (0.99) / 1000, 2), " / ",
+                      String (hist.maxNs / 1000.0, 2), ", ",
+                      String (hist.count));
             }
         }
     }
 }
 
-void Node::smoothBuffer (float* wp, int nSamples, float lastPhase)
+// ------------ PRIVATE METHODS ---------------
+
+void Node::handleTTLEvent (TTLEventPtr event)
 {
-    int actualGL = jmin (glitchLimit, nSamples - 1);
-    float diff = wp[0] - lastPhase;
-    if (diff < 0 && diff > -180)
+    if (event->getEventType() == EventChannel::TTL)
     {
-        // identify whether signal exceeds last sample of the previous buffer within glitchLimit samples.
-        int endIndex = -1;
-        for (int i = 1; i <= actualGL; i++)
+        if (event->getStreamId() == selectedStream)
         {
-            if (wp[i] > lastPhase)
-            {
-                endIndex = i;
-                break;
-            }
-            // corner case where signal wraps before it exceeds lastSample
-            else if (wp[i] - wp[i - 1] < -180 && (wp[i] + 360) > lastPhase)
-            {
-                wp[i] += 360;
-                endIndex = i;
-                break;
-            }
+            blockCapture.pushEvent ((int) event->getLine(), event->getSampleNumber(), event->getState());
         }
 
-        if (endIndex != -1)
+        if (event->getStreamId() == selectedStream && event->getState())
         {
-            // interpolate points from buffer start to endIndex
-            float slope = (wp[endIndex] - lastPhase) / (endIndex + 1);
-            for (int i = 0; i < endIndex; i++)
-            {
-                wp[i] = lastPhase + (i + 1) * slope;
-            }
+            // add timestamp to the queues of targets watching this line
+            groundTruth.addEvent ((int) event->getLine(), event->getSampleNumber());
         }
     }
 }
 
+void Node::setVisContChan (int newChan)
+{
+    // jassert(newChan < channelInfo.size() && channelInfo[newChan]->isActive());
+    settings[selectedStream]->visContinuousChannel = newChan;
+
+    // changing targets flushes the timestamp queues
+    updateVisTargets (false);
+}
+
+void Node::updateVisTargets (bool reconfigure)
+{
+    if (selectedStream == 0 || getDataStream (selectedStream) == nullptr)
+    {
+        groundTruth.setTargets ({});
+        return;
+    }
+
+    Settings* streamSettings = settings[selectedStream];
+
+    if (reconfigure && ! groundTruth.isThreadRunning())
+    {
+        groundTruth.configure (getDataStream (selectedStream)->getSampleRate(), streamSettings->getChannelPassbands());
+    }
+    else
+    {
+        groundTruth.setPassbands (streamSettings->getChannelPassbands());
+    }
+
+    groundTruth.setHorizon (streamSettings->getHorizonSamples (getDataStream (selectedStream)->getSampleRate()));
+    groundTruth.setTargets (streamSettings->getVisTargets());
+}
+
 Array<int> Node::getActiveChannels()
 {
     Array<int> activeInputs;
@@ -1041,102 +1521,215 @@ Array<int> Node::getActiveChannels()
     return activeInputs;
 }
 
-void Node::calcVisPhases (ActiveChannelInfo* acInfo, juce::int64 sdbEndTs)
+bool Node::getPerformance (PerformanceSnapshot& snapshot)
 {
-    if (acInfo == nullptr)
+    if (selectedStream == 0)
+    {
+        return false;
+    }
+
+    Settings* streamSettings = settings[selectedStream];
+
+    snapshot.blockTimes = blockTimes.getSnapshot();
+    snapshot.numDeadlineMisses = numDeadlineMisses;
+    snapshot.blockDurationNs = blockDurationNs;
+    snapshot.calcInterval = streamSettings->calcInterval;
+    snapshot.arOrder = streamSettings->arOrder;
+    snapshot.timingEnabled = engine.isTimingEnabled();
+
+    snapshot.channels.clearQuick();
+    for (auto chanInfo : streamSettings->channelInfo)
+    {
+        if (! chanInfo->isActive())
+        {
+            continue;
+        }
+
+        const ActiveChannelInfo& acInfo = *chanInfo->acInfo;
+        PerformanceSnapshot::Channel channel;
+        channel.chan = chanInfo->chan;
+        channel.fitTimes = acInfo.timings.stages[StageTimings::FIT].getSnapshot();
+        channel.numFits = acInfo.numFits;
+        channel.modelAgeMs = acInfo.getModelAgeMs();
+        channel.memoryBytes = acInfo.getMemoryBytes();
+        for (auto band : acInfo.bands)
+        {
+            channel.memoryBytes += band->getMemoryBytes();
+        }
+        snapshot.channels.add (channel);
+    }
+
+    snapshot.queues = groundTruth.getQueueDepths();
+    snapshot.groundTruthMemoryBytes = groundTruth.getMemoryBytes();
+    return true;
+}
+
+int Node::addOutputChannel (DataStream* stream, const String& name, const String& description, const String& identifier, float bitVolts)
+{
+    // recorded as 16-bit integers, so telemetry has one unit per step (up to ~32 s of model age or
+    // ~32 ms of block time), and the analytic signal the resolution of its input
+    ContinuousChannel::Settings channelSettings {
+        ContinuousChannel::Type::AUX,
+        name,
+        description,
+        identifier,
+        bitVolts,
+        stream
+    };
+
+    continuousChannels.add (new ContinuousChannel (channelSettings));
+    continuousChannels.getLast()->addProcessor (this);
+    stream->addChannel (continuousChannels.getLast());
+
+    return stream->getChannelCount() - 1;
+}
+
+void Node::addCrossingEvents (Settings* streamSettings, const ActiveChannelInfo* acInfo, int64 firstSampleNumber, int nSamples)
+{
+    EventChannel* eventChannel = streamSettings->crossingEventChannel;
+    Array<Settings::PendingTTLOff>& pendingOffs = streamSettings->pendingCrossingOffs;
+    if (eventChannel == nullptr)
     {
-        jassertfalse;
         return;
     }
 
-    int maxDelay = visMaxDelayMs * acInfo->hilbertLengthMultiplier;
-    int minDelay = visMinDelayMs * acInfo->hilbertLengthMultiplier;
-    int hilbertLength = visHilbertLengthMs * acInfo->hilbertLengthMultiplier;
+    // Crossings are at least a pulse apart (see ActiveChannelInfo::updateCrossings), so the ends of
+    // earlier pulses come before the new crossings, and each pulse ends before the next one starts:
+    // the events are added in order of sample number.
 
-    juce::int64 minTs = sdbEndTs - maxDelay;
-    juce::int64 maxTs = sdbEndTs - minDelay;
+    // ends of earlier pulses within this block
+    for (int i = 0; i < pendingOffs.size();)
+    {
+        const Settings::PendingTTLOff off = pendingOffs.getReference (i);
+        if (off.sampleNumber < firstSampleNumber + nSamples)
+        {
+            int64 sampleNumber = jmax (off.sampleNumber, firstSampleNumber);
+            addEvent (TTLEvent::createTTLEvent (eventChannel, sampleNumber, off.line, false), int (sampleNumber - firstSampleNumber));
+            pendingOffs.remove (i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
 
-    // discard any timestamps less than minTs
-    while (! visTsBuffer.empty() && visTsBuffer.front() < minTs)
+    if (acInfo == nullptr)
     {
-        visTsBuffer.pop();
+        return;
     }
 
-    if (! visTsBuffer.empty() && visTsBuffer.front() <= maxTs)
+    const int pulseSamples = Settings::getCrossingPulseSamples (acInfo->chanInfo->sampleRate);
+    for (const auto& crossing : acInfo->crossings.getCrossings())
     {
-        // perform reverse filtering and Hilbert transform
-        // don't need to use a lock here since it's the same thread as the one
-        // that writes to it.
-        double* wpHilbert = acInfo->visHilbertBuffer.getRealPointer();
-        acInfo->history.unwrapAndCopy (wpHilbert, false);
+        const int64 sampleNumber = firstSampleNumber + crossing.sample;
+        jassert (pendingOffs.isEmpty());
 
-        acInfo->reverseFilter.reset();
-        acInfo->reverseFilter.process (hilbertLength, &wpHilbert);
+        addEvent (TTLEvent::createTTLEvent (eventChannel, sampleNumber, crossing.target, true), crossing.sample);
 
-        // un-reverse values
-        acInfo->visHilbertBuffer.reverseReal (hilbertLength);
+        if (crossing.sample + pulseSamples < nSamples)
+        {
+            addEvent (TTLEvent::createTTLEvent (eventChannel, sampleNumber + pulseSamples, crossing.target, false), crossing.sample + pulseSamples);
+        }
+        else
+        {
+            pendingOffs.add ({ sampleNumber + pulseSamples, crossing.target });
+        }
+    }
+}
 
-        // Hilbert transform!
-        acInfo->visHilbertBuffer.hilbert();
+bool Node::extraOutputsNeedUpdate (uint16 streamId)
+{
+    const Settings* streamSettings = settings[streamId];
+    if (streamSettings->extraOutputs == 0 && streamSettings->extraBandCuts.isEmpty())
+    {
+        return false;
+    }
 
-        juce::int64 ts;
-        ScopedLock phaseBufferLock (visPhaseBufferCS);
-        while (! visTsBuffer.empty() && (ts = visTsBuffer.front()) <= maxTs)
+    for (auto chanInfo : streamSettings->channelInfo)
+    {
+        if (chanInfo->isActive() != (chanInfo->magnitudeOutput >= 0 || chanInfo->imaginaryOutput >= 0 || ! chanInfo->bandOutputs.isEmpty()))
         {
-            visTsBuffer.pop();
-            int delay = static_cast<int> (sdbEndTs - ts);
-            std::complex<double> analyticPt = acInfo->visHilbertBuffer.getAsComplex (hilbertLength - delay);
-            double phaseRad = std::arg (analyticPt);
-            visPhaseBuffer.push (phaseRad);
+            return true;
         }
     }
+    return false;
 }
 
-void Node::arPredict (const ReverseStack& history, int interpCountdown, double* prediction, const double* params, int samps, int stride, int order)
+void Node::clearExtraOutputs (AudioBuffer<float>& buffer, DataStream* stream, int nSamples, bool streamProcessed)
 {
-    const double* rpHistory = history.begin();
-    int histSize = history.size();
-    int histStart = history.getHeadOffset() + stride - interpCountdown;
+    const Settings* streamSettings = settings[stream->getStreamId()];
+    if ((streamSettings->extraOutputs == 0 && streamSettings->extraBandCuts.isEmpty()) || nSamples == 0)
+    {
+        return;
+    }
 
-    // s = index to write output
-    for (int s = 0; s < samps; ++s)
+    for (auto chanInfo : streamSettings->channelInfo)
     {
-        prediction[s] = 0;
+        if (streamProcessed && chanInfo->isActive())
+        {
+            continue;
+        }
 
-        // p = which AR param we are on
-        for (int p = 0; p < order; ++p)
+        auto clearOutput = [&] (int output)
         {
-            double pastSamp = p < s
-                                  ? prediction[s - 1 - p]
-                                  : rpHistory[(histStart + (p - s) * stride) % histSize];
+            if (output >= 0)
+            {
+                int chan = stream->getContinuousChannels().getUnchecked (output)->getGlobalIndex();
+                FloatVectorOperations::clear (buffer.getWritePointer (chan), nSamples);
+            }
+        };
 
-            prediction[s] -= params[p] * pastSamp;
+        clearOutput (chanInfo->magnitudeOutput);
+        clearOutput (chanInfo->imaginaryOutput);
+        for (int output : chanInfo->bandOutputs)
+        {
+            clearOutput (output);
         }
     }
 }
 
-double Node::htFilterSamp (double input, Band band, Array<double>& state)
+void Node::writeTelemetry (AudioBuffer<float>& buffer, DataStream* stream, int nSamples, int64 blockTimeNs)
 {
-    double* state_p = state.getRawDataPointer();
-
-    // initialize new state entry
-    int nCoefs = Hilbert::delay[band];
-    int order = nCoefs * 2;
-    jassert (order == state.size() - 1);
-    state_p[order] = 0;
+    const Settings* streamSettings = settings[stream->getStreamId()];
+    if (nSamples == 0)
+    {
+        return;
+    }
 
-    // incorporate new input
-    const double* transf = Hilbert::transformer[band].begin();
-    for (int kCoef = 0; kCoef < nCoefs; ++kCoef)
+    if (streamSettings->modelAgeChannel >= 0)
     {
-        double val = input * transf[kCoef];
-        state_p[kCoef] += val; // near component
-        state_p[order - kCoef] -= val; // mirrored component
+        // -1 if any active channel has no model yet, or if the stream is not processed
+        // (channels using the endpoint-corrected estimator have no models and are skipped)
+        double maxAgeMs = -1;
+        if (blockTimeNs >= 0)
+        {
+            // the processing order is prebuilt, so this doesn't allocate on the audio thread
+            for (int ac : streamSettings->processingOrder)
+            {
+                const ChannelInfo* chanInfo = streamSettings->channelInfo[ac];
+                if (chanInfo == nullptr || ! chanInfo->isActive() || ! chanInfo->acInfo->usesModel())
+                {
+                    continue;
+                }
+
+                double ageMs = chanInfo->acInfo->getModelAgeMs();
+                if (ageMs < 0)
+                {
+                    maxAgeMs = -1;
+                    break;
+                }
+                maxAgeMs = jmax (maxAgeMs, ageMs);
+            }
+        }
+
+        int chan = stream->getContinuousChannels().getUnchecked (streamSettings->modelAgeChannel)->getGlobalIndex();
+        FloatVectorOperations::fill (buffer.getWritePointer (chan), float (maxAgeMs), nSamples);
     }
 
-    // output and shift state
-    double sampOut = state_p[0];
-    std::memmove (state_p, state_p + 1, order * sizeof (double));
-    return sampOut;
+    if (streamSettings->blockTimeChannel >= 0)
+    {
+        int chan = stream->getContinuousChannels().getUnchecked (streamSettings->blockTimeChannel)->getGlobalIndex();
+        FloatVectorOperations::fill (buffer.getWritePointer (chan), float (jmax (int64 (0), blockTimeNs) / 1000.0), nSamples);
+    }
 }
 } // namespace PhaseCalculator
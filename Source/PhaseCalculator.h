@@ -30,6 +30,7 @@ The Phase Calculator filters selected input channels to the given passband,
 generates an estimate of the phase of each band-limited signal in degrees
 using the Hilbert transform, and outputs this as a continuous stream.
 There are also options to output the magnitude or imaginary component of the analytic signal.
+Additional passbands can be computed for each selected channel, each to its own output channel.
 
 The visualizer panel serves a complementary role. When given a continuous channel
 (that is enabled for processing, i.e. selected in the param window) and an event
@@ -44,143 +45,46 @@ accuracy of phase-locked stimulation in real time.
 
 #define PROCESSOR_NAME "Phase Calculator"
 
-#include <DspLib.h> // Filtering
-#include <OpenEphysFFTW.h> // Fourier transform
 #include <ProcessorHeaders.h>
 
 #include <queue>
 #include <utility> // pair
 
-#include "ARModeler.h" // Autoregressive modeling
-#include "HTransformers.h" // Hilbert transformers & frequency bands
+#include "BlockCapture.h" // Input capture for offline replay
+#include "GroundTruth.h" // Visualization
+#include "PhaseEngine.h" // Phase estimation
+#include "PhaseRecorder.h" // Event phase export
 
 namespace PhaseCalculator
 {
 // forward declarations
 struct ChannelInfo;
+class Settings;
 class Node;
 
-class ReverseStack : public Array<double, CriticalSection>
-{
-public:
-    ReverseStack (int size = 0);
-
-    // Just resets the free space
-    void reset();
-
-    // Resets free space and resizes the array. There's no way to resize
-    // the array while keeping the data contained in it.
-    void resetAndResize (int newSize);
-
-    bool isFull() const;
-
-    void enqueue (const float* source, int n);
-
-    int getHeadOffset() const;
-
-    // copies to given array, with first element corresponding to most recent data point.
-    void unwrapAndCopy (double* dest, bool useLock) const;
-
-private:
-    int freeSpace;
-    int headOffset; // offset of write head from start of buffer
-
-    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReverseStack);
-};
-
-struct ActiveChannelInfo
+// per-channel state of an active channel, configured from its stream's settings
+struct ActiveChannelInfo : public ChannelState
 {
     ActiveChannelInfo (const ChannelInfo* cInfo);
 
     void update();
 
-    // reset to perform after end of acquisition or update
-    void reset();
-
-    // filter design copied from FilterNode
-    using BandpassFilter = Dsp::SimpleFilter<Dsp::Butterworth::BandPass // filter type
-                                             <2>, // order
-                                             1, // number of channels
-                                             Dsp::DirectFormII>; // realization
-
-    ReverseStack history;
-
-    BandpassFilter filter;
-
-    ARModeler arModeler;
-
-    Array<double> htState;
-
-    // number of samples until a new non-interpolated output. e.g. if this
-    // equals 1 after a buffer is processed, then there is one interpolated
-    // sample in the next buffer, and then the second sample will be computed.
-    // in range [0, dsFactor).
-    int interpCountdown;
-
-    // last non-interpolated ("computed") transformer output
-    double lastComputedPhase;
-    double lastComputedMag;
-
-    // last phase output, for glitch correction
-    float lastPhase;
-
-    // for visualization:
-    int hilbertLengthMultiplier;
-    FFTWTransformableArray visHilbertBuffer;
-    BandpassFilter reverseFilter;
+    // sets the crossing detector's targets from the stream's parameters (without a reset)
+    void updateCrossings();
 
     const ChannelInfo* chanInfo;
 
-    void waitForThreadToExit()
-    {
-        if (bufferResizeThread->isThreadRunning())
-        {
-            bufferResizeThread->waitForThreadToExit (1000);
-        }
-    }
+    // state of each of the stream's extra bands (see Settings::extraBands), in the same order.
+    // each has its own filter, history and AR model, and starts from the same input as this one.
+    OwnedArray<ChannelState> bands;
 
 private:
-    class BufferResizeThread : public Thread
-    {
-    public:
-        BufferResizeThread (FFTWTransformableArray* buffer_) : Thread ("buffer resize"),
-                                                               buffer (buffer_),
-                                                               bufferSize (0)
-        {
-        }
-
-        ~BufferResizeThread()
-        {
-            if (isThreadRunning())
-            {
-                waitForThreadToExit (5000);
-            }
-        }
-
-        void setSize (int lengthMultiplier)
-        {
-            bufferSize = lengthMultiplier;
-        }
-
-        void run()
-        {
-            buffer->resize (bufferSize);
-        }
-
-    private:
-        FFTWTransformableArray* buffer;
-
-        int bufferSize;
-    };
-
-    std::unique_ptr<BufferResizeThread> bufferResizeThread;
-
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ActiveChannelInfo);
 };
 
 struct ChannelInfo
 {
-    ChannelInfo (const DataStream* ds, int i);
+    ChannelInfo (const Settings* owner, const DataStream* ds, int i);
 
     void update();
 
@@ -196,11 +100,25 @@ struct ChannelInfo
 
     float sampleRate;
 
-    // 0 if sample rate is not a multiple of Hilbert::FS (in this case it cannot be activated.)
-    int dsFactor;
+    // false if the sample rate is below the stream's modeling rate (in this case it cannot be activated.)
+    // other rates that are not a multiple of the modeling rate are resampled.
+    bool rateSupported;
+
+    // magnitude and imaginary part output channels (indices within the stream), or -1 if none
+    int magnitudeOutput;
+    int imaginaryOutput;
+
+    // phase output channel of each extra band (indices within the stream; empty if none)
+    Array<int> bandOutputs;
+
+    // index of the channel's configuration in Settings::channelConfigs, or -1 if it has no override
+    int config;
 
     // info for ongoing phase calculation - null if non-active.
     std::unique_ptr<ActiveChannelInfo> acInfo;
+
+    // settings of the stream, which own this channel
+    const Settings* settings;
     const DataStream* stream;
 
 private:
@@ -209,7 +127,8 @@ private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ChannelInfo);
 };
 
-class Settings
+// the band, passband and AR order (inherited from EngineParams) and the other per-stream settings
+class Settings : public EngineParams
 {
 public:
     Settings();
@@ -239,17 +158,6 @@ public:
     // Resets lowCut and highCut to defaults for the current band
     void resetCutsToDefaults();
 
-    // Update the htScaleFactor depending on the lowCut and highCut of the filter.
-    void updateScaleFactor();
-
-    // Get the htScaleFactor for the given band's Hilbert transformer,
-    // over the range from lowCut and highCut. This is the reciprocal of the geometric
-    // mean (i.e. mean in decibels) of the maximum and minimum magnitude responses over the range.
-    static double getScaleFactor (Band band, double lowCut, double highCut);
-
-    // approximate multiplier for the imaginary component output of the HT (depends on filter band)
-    double htScaleFactor;
-
     OwnedArray<ChannelInfo> channelInfo;
 
     // ---- customizable parameters ------
@@ -257,24 +165,157 @@ public:
     // time to wait between AR model recalculations in ms
     int calcInterval;
 
-    // order of the AR model
-    int arOrder;
-
-    // frequency band (determines which Hilbert transformer to use)
-    Band band;
-
-    // filter passband
-    float highCut;
-    float lowCut;
-
     // event channel to watch for phases to plot on the canvas (-1 = none)
     int visEventChannel;
 
     // channel to calculate phases from at received stim event times
     int visContinuousChannel;
 
-    Array<double> predSamps;
-    Array<double> htTempState;
+    // additional (continuous channel, event line) pairs to plot
+    Array<GroundTruthEngine::Target> visExtraTargets;
+
+    // telemetry output channels (indices within the stream, after the inputs), or -1 if disabled:
+    // age of the oldest AR model in use in ms, and time taken to process the block in us
+    int modelAgeChannel;
+    int blockTimeChannel;
+
+    // extra outputs of each selected input (ExtraOutputFlags, from the "extra_outputs" parameter)
+    int extraOutputs;
+
+    enum ExtraOutputFlags
+    {
+        MAGNITUDE_OUTPUT = 1,
+        IMAGINARY_OUTPUT = 2
+    };
+
+    // passbands (Hz) computed for each selected channel besides the main one, from the "extra_bands"
+    // parameter, and their parameters: the stream's, with each passband and a transformer for it
+    Array<Range<float>> extraBandCuts;
+    Array<EngineParams> extraBands;
+
+    // Rebuilds extraBands from extraBandCuts and the stream's current parameters
+    void updateExtraBands();
+
+    // passband and/or AR order of a channel that differ from the stream's
+    struct ChannelOverride
+    {
+        int chan;
+
+        // empty to keep the stream's passband (and transformer)
+        Range<float> passband;
+
+        // 0 to keep the stream's order
+        int arOrder;
+
+        bool sameConfig (const ChannelOverride& other) const { return passband == other.passband && arOrder == other.arOrder; }
+    };
+
+    // from the "chan_overrides" parameter, at most one per channel
+    Array<ChannelOverride> channelOverrides;
+
+    // the stream's parameters with each distinct override applied, shared by the channels that have it
+    Array<EngineParams> channelConfigs;
+
+    // Rebuilds channelConfigs from channelOverrides and the stream's current parameters, and
+    // points each channel to its configuration
+    void updateChannelConfigs();
+
+    // the parameters a channel is processed with: its configuration's, or the stream's
+    const EngineParams& getChannelParams (const ChannelInfo& chanInfo) const;
+
+    // the passband of each channel (by index within the stream), for the visualizer's ground truth
+    Array<Range<float>> getChannelPassbands() const;
+
+    // Active inputs in the order they are processed: grouped by configuration, the channels
+    // without an override first, so that channels with the same parameters run back to back.
+    // Rebuilt when channels are (de)activated or the configurations change, not by process().
+    Array<int> processingOrder;
+
+    // Rebuilds processingOrder from the active channels and their configurations
+    void updateProcessingOrder();
+
+    // TTL output for target phase crossings of the "crossing_chan" channel (one line per target)
+    EventChannel* crossingEventChannel;
+
+    // end of a crossing pulse that falls after the block it started in (audio thread only)
+    struct PendingTTLOff
+    {
+        int64 sampleNumber;
+        int line;
+    };
+    Array<PendingTTLOff> pendingCrossingOffs;
+
+    // all pairs to plot: the main pair (if both are selected) followed by the additional ones
+    Array<GroundTruthEngine::Target> getVisTargets() const;
+
+    // parse/format visExtraTargets from/to the "vis_targets" parameter, e.g. "0:1,3:2"
+    static Array<GroundTruthEngine::Target> parseVisTargets (const String& targetString);
+    static String formatVisTargets (const Array<GroundTruthEngine::Target>& targets);
+
+    // parse the "crossing_phases" parameter (degrees, e.g. "0,180"), up to maxCrossingTargets
+    static Array<float> parseCrossingPhases (const String& phaseString);
+
+    static const int maxCrossingTargets = 8;
+
+    // parse the "extra_bands" parameter (passbands in Hz, e.g. "30-80,80-150"), up to maxExtraBands
+    static Array<Range<float>> parseExtraBands (const String& bandString);
+
+    // The parameters of an extra band: base's, with the given passband and the built-in transformer
+    // that covers it (base's band first), or if there is none, a design as long as base's transformer
+    static EngineParams getBandParams (const EngineParams& base, Range<float> passband);
+
+    static const int maxExtraBands = 4;
+
+    // parse the "chan_overrides" parameter, e.g. "2:13-30:8,5::10" (channel:low-high:order, with
+    // the passband or the order left out to keep the stream's). later entries for a channel win.
+    static Array<ChannelOverride> parseChannelOverrides (const String& overrideString);
+
+    // base with the override's passband (see getBandParams) and AR order
+    static EngineParams applyOverride (const EngineParams& base, const ChannelOverride& channelOverride);
+
+    // length of the TTL pulse at each crossing
+    static const int crossingPulseMs = 1;
+
+    static int getCrossingPulseSamples (float sampleRate) { return jmax (1, roundToInt (crossingPulseMs * sampleRate / 1000)); }
+};
+
+// state of the processing of the selected stream, for the visualizer's performance panel
+struct PerformanceSnapshot
+{
+    struct Channel
+    {
+        // index of the channel within the stream
+        int chan;
+
+        // AR model fit times (only recorded while stage timing is on)
+        LatencyHistogram::Snapshot fitTimes;
+
+        // number of fits since the channel was activated
+        int64 numFits;
+
+        // time since the last fit in ms, negative if none since acquisition started
+        double modelAgeMs;
+
+        size_t memoryBytes;
+    };
+
+    // time to process each block, and number of blocks that took longer than their duration
+    LatencyHistogram::Snapshot blockTimes;
+    int64 numDeadlineMisses = 0;
+
+    // duration of the last block in ns (0 if none)
+    int64 blockDurationNs = 0;
+
+    // AR refresh interval (ms) and order of the stream
+    int calcInterval = 0;
+    int arOrder = 0;
+
+    bool timingEnabled = false;
+
+    Array<Channel> channels;
+
+    GroundTruthEngine::QueueDepths queues;
+    size_t groundTruthMemoryBytes = 0;
 };
 
 class Node : public GenericProcessor, public Thread
@@ -306,6 +347,12 @@ public:
     /** Stops phase calculation code */
     bool stopAcquisition() override;
 
+    /** Starts exporting event phases to the recording directory, if enabled */
+    void startRecording() override;
+
+    /** Finishes exporting event phases */
+    void stopRecording() override;
+
     /** thread code - recalculates AR parameters. */
     void run() override;
 
@@ -315,19 +362,31 @@ public:
     /** Called whenever a parameter's value is changed (called by GenericProcessor::setParameter())*/
     void parameterValueChanged (Parameter* param) override;
 
-    /** reads from the visPhaseBuffer if it can acquire a TryLock. returns true if successful. */
-    bool tryToReadVisPhases (std::queue<double>& other);
+    /** reads phases calculated for the visualizer if it can acquire a TryLock. returns true if successful. */
+    bool tryToReadVisPhases (std::queue<EventPhase>& other);
+
+    /** copies a target's online phase error statistics if it can acquire a TryLock. returns true if successful. */
+    bool tryToReadPhaseErrors (int target, PhaseErrorSnapshot& snapshot);
+
+    /** resets the online phase error statistics of all targets */
+    void clearPhaseErrors();
+
+    /** (continuous channel, event line) pairs plotted by the visualizer for the selected stream */
+    Array<GroundTruthEngine::Target> getVisTargets();
+
+    /** copies the stage timings of a channel of the selected stream. returns false if it is not active. */
+    bool getStageTimings (int chan, StageTimings::Snapshot& snapshot);
+
+    /** writes a summary of the stage timings of every active channel to the log */
+    void logStageTimings();
+
+    /** copies block times, AR model statistics, queue depths and memory use of the selected stream.
+        returns false if no stream is selected. */
+    bool getPerformance (PerformanceSnapshot& snapshot);
 
     /** Returns array of active channels that only includes inputs (not extra outputs) */
     Array<int> getActiveChannels();
 
-    /*
-        * Circular distance between angles x and ref (in radians). The "cutoff" is the maximum
-        * possible positive output; greater differences will be wrapped to negative angles.
-        * For interpolation, and also RosePlot visualization.
-        */
-    static double circDist (double x, double ref, double cutoff = 2 * Dsp::doublePi);
-
     /** Get the current selected stream */
     juce::uint16 getSelectedStream() { return selectedStream; }
 
@@ -340,40 +399,30 @@ private:
     /** Responds to incoming events if a stimEventChannel is selected. */
     void handleTTLEvent (TTLEventPtr event) override;
 
-    /** Perform glitch unwrapping */
-    void unwrapBuffer (float* wp, int nSamples, float lastPhase);
+    /** Sets visContinuousChannel and updates the visualization targets */
+    void setVisContChan (int newChan);
 
-    /** Do start-of-buffer smoothing */
-    void smoothBuffer (float* wp, int nSamples, float lastPhase);
+    /** Passes the selected stream's visualization targets and filter to the ground truth engine */
+    void updateVisTargets (bool reconfigure);
 
-    /*
-        * Check the visualization timestamp queue, clear any that are expired
-        * (too late to calculate phase), and calculate phase of any that are ready.
-        * sdbEndTs = timestamp 1 past end of current buffer
-        * Precondition: chan is a valid input index.
-        */
-    void calcVisPhases (ActiveChannelInfo* acInfo, juce::int64 sdbEndTs);
+    /** Adds an output channel to the stream and returns its index within the stream */
+    int addOutputChannel (DataStream* stream, const String& name, const String& description, const String& identifier, float bitVolts = 1.0f);
 
-    /** Sets visContinuousChannel and updates the visualization filter */
-    void setVisContChan (int newChan);
+    /** Whether the extra outputs of the stream were made for a different set of active channels */
+    bool extraOutputsNeedUpdate (uint16 streamId);
 
-    // ---- static utility methods ----
+    /** Zeros the extra outputs of the stream's inputs that are not processed in this block */
+    void clearExtraOutputs (AudioBuffer<float>& buffer, DataStream* stream, int nSamples, bool streamProcessed);
 
-    /*
-        * arPredict: use autoregressive model of order to predict future data.
-        *
-        * lastSample points to the most recent sample of past data that will be used to
-        * compute phase, and there must be at least stride * (order - 1) samples
-        * preceding it in order to do the AR prediction.
-        *
-        * Input params is an array of coefficients of an AR model of length 'order'.
-        *
-        * Writes samps future data values to prediction.
-        */
-    static void arPredict (const ReverseStack& history, int interpCountdown, double* prediction, const double* params, int samps, int stride, int order);
+    /** Starts capturing the input of the selected stream, if enabled */
+    void startCapture();
+
+    /** Fills the stream's telemetry channels of the current block (block time in ns) */
+    void writeTelemetry (AudioBuffer<float>& buffer, DataStream* stream, int nSamples, int64 blockTimeNs);
 
-    /** Execute the hilbert transformer on one sample and update the state. */
-    static double htFilterSamp (double input, Band band, Array<double>& state);
+    /** Sends the TTL pulses for the crossings a channel found in the current block, and the ends of
+        earlier pulses that fall within it (if acInfo is null, only the latter) */
+    void addCrossingEvents (Settings* streamSettings, const ActiveChannelInfo* acInfo, int64 firstSampleNumber, int nSamples);
 
     // ---- internals -------
 
@@ -382,23 +431,26 @@ private:
     /** Only one stream can be activated at a time*/
     uint16 selectedStream;
 
-    // storage areas
-    Array<double, CriticalSection> localARParams;
-    Array<int> htInds;
-    Array<std::complex<double>> htOutput;
+    // processing kernels and scratch buffers for the audio thread
+    PhaseEngine engine;
 
-    // delayed analysis for visualization
+    // export of event phases (must outlive groundTruth)
+    PhaseRecorder phaseRecorder;
 
-    // holds stimulation timestamps until the delayed phase is ready to be calculated
-    std::queue<juce::int64> visTsBuffer;
+    // delayed analysis for visualization
+    GroundTruthEngine groundTruth;
 
-    // for phases of stimulations, to be read by the visualizer.
-    std::queue<double> visPhaseBuffer;
-    CriticalSection visPhaseBufferCS; // avoid race conditions when updating visualizer
+    // capture of the input blocks and events of the selected stream
+    BlockCapture blockCapture;
 
     /** Notify Node thread to update it's list of active channels and find maximum history length */
     bool activeChansNeedsUpdate;
 
+    // time to process each block of the selected stream (written by the audio thread)
+    LatencyHistogram blockTimes;
+    std::atomic<int64> numDeadlineMisses;
+    std::atomic<int64> blockDurationNs;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Node);
 };
 
@@ -23,16 +23,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "PhaseCalculatorCanvas.h"
 #include "PhaseCalculatorEditor.h"
+#include <cfloat> // DBL_MIN
 
 namespace PhaseCalculator
 {
 Canvas::Canvas (Node* pc)
-    : Visualizer ((GenericProcessor*) pc), processor (pc), viewport (new Viewport()), canvas (new Component ("canvas")), rosePlotOptions (new Component ("rosePlotOptions")), rosePlot (new RosePlot (this))
+    : Visualizer ((GenericProcessor*) pc), processor (pc), viewport (new Viewport()), canvas (new Component ("canvas")), rosePlotOptions (new Component ("rosePlotOptions")), selectedPlot (0)
 {
     refreshRate = 5;
 
-    canvas->addAndMakeVisible (rosePlot.get());
-
     // populate rosePlotOptions
     const Font textFont = FontOptions ("Inter", "Semi Bold", 18.0f);
     const int textHeight = 25;
@@ -67,8 +66,22 @@ Canvas::Canvas (Node* pc)
     eChannelBox->addListener (this);
     rosePlotOptions->addAndMakeVisible (eChannelBox.get());
 
+    addPlotButton = std::make_unique<UtilityButton> ("Add Plot");
+    addPlotButton->setFont (FontOptions (16.0f));
+    addPlotButton->setTooltip (plotsTooltip);
+    addPlotButton->addListener (this);
+    addPlotButton->setBounds (xPos = indent, yPos += textHeight + 8, 90, textHeight);
+    rosePlotOptions->addAndMakeVisible (addPlotButton.get());
+
+    removePlotButton = std::make_unique<UtilityButton> ("Remove Plot");
+    removePlotButton->setFont (FontOptions (16.0f));
+    removePlotButton->setTooltip (plotsTooltip);
+    removePlotButton->addListener (this);
+    removePlotButton->setBounds (xPos + 100, yPos, 100, textHeight);
+    rosePlotOptions->addAndMakeVisible (removePlotButton.get());
+
     numBinsLabel = std::make_unique<Label> ("numBinsLabel", "Number of bins:");
-    numBinsLabel->setBounds (xPos = indent, yPos += 2 * textHeight, 200, textHeight);
+    numBinsLabel->setBounds (xPos = indent, yPos += textHeight + 15, 200, textHeight);
     numBinsLabel->setFont (textFont);
     rosePlotOptions->addAndMakeVisible (numBinsLabel.get());
 
@@ -95,13 +108,41 @@ Canvas::Canvas (Node* pc)
 
     referenceEditable = std::make_unique<CustomTextBox> ("referenceEditable", String (RosePlot::startReference), "0123456789");
     referenceEditable->setEditable (true);
-    referenceEditable->addListener (rosePlot.get());
+    referenceEditable->addListener (this);
     referenceEditable->setBounds (xPos += refLabelWidth + 5, yPos, 60, textHeight);
     referenceEditable->setTooltip (refTooltip);
     rosePlotOptions->addAndMakeVisible (referenceEditable.get());
 
+    statsModeLabel = std::make_unique<Label> ("statsModeLabel", "Statistics:");
+    int statsLabelWidth = textFont.getStringWidth (statsModeLabel->getText());
+    statsModeLabel->setBounds (xPos = indent, yPos += 40, statsLabelWidth, textHeight);
+    statsModeLabel->setFont (textFont);
+    rosePlotOptions->addAndMakeVisible (statsModeLabel.get());
+
+    statsModeBox = std::make_unique<ComboBox> ("statsModeBox");
+    statsModeBox->addItem ("All events", CircularStats::CUMULATIVE + 1);
+    statsModeBox->addItem ("Last N events", CircularStats::LAST_EVENTS + 1);
+    statsModeBox->addItem ("Last T seconds", CircularStats::LAST_SECONDS + 1);
+    statsModeBox->addItem ("Exponential decay", CircularStats::DECAY + 1);
+    statsModeBox->setSelectedId (CircularStats::CUMULATIVE + 1, dontSendNotification);
+    statsModeBox->setTooltip (statsTooltip);
+    statsModeBox->setBounds (xPos += statsLabelWidth + 5, yPos, 150, textHeight);
+    statsModeBox->addListener (this);
+    rosePlotOptions->addAndMakeVisible (statsModeBox.get());
+
+    statsWindowEditable = std::make_unique<CustomTextBox> ("statsWindowEditable", "", "0123456789.");
+    statsWindowEditable->setEditable (true);
+    statsWindowEditable->addListener (this);
+    statsWindowEditable->setBounds (xPos, yPos += textHeight + 5, 60, textHeight);
+    rosePlotOptions->addChildComponent (statsWindowEditable.get());
+
+    statsWindowUnitLabel = std::make_unique<Label> ("statsWindowUnitLabel");
+    statsWindowUnitLabel->setBounds (xPos + 65, yPos, 150, textHeight);
+    statsWindowUnitLabel->setFont (textFont);
+    rosePlotOptions->addChildComponent (statsWindowUnitLabel.get());
+
     countLabel = std::make_unique<Label> ("countLabel");
-    countLabel->setBounds (xPos = indent, yPos += 45, optionsWidth, textHeight);
+    countLabel->setBounds (xPos = indent, yPos += 40, optionsWidth, textHeight);
     countLabel->setFont (textFont);
 
     meanLabel = std::make_unique<Label> ("meanLabel");
@@ -112,10 +153,57 @@ Canvas::Canvas (Node* pc)
     stdLabel->setBounds (xPos, yPos += textHeight, optionsWidth, textHeight);
     stdLabel->setFont (textFont);
 
-    updateStatLabels();
+    errorMeanLabel = std::make_unique<Label> ("errorMeanLabel");
+    errorMeanLabel->setBounds (xPos, yPos += textHeight + 15, optionsWidth, textHeight);
+    errorMeanLabel->setFont (textFont);
+    errorMeanLabel->setTooltip (errorTooltip);
+
+    errorStdLabel = std::make_unique<Label> ("errorStdLabel");
+    errorStdLabel->setBounds (xPos, yPos += textHeight, optionsWidth, textHeight);
+    errorStdLabel->setFont (textFont);
+    errorStdLabel->setTooltip (errorTooltip);
+
+    errorHistogram = std::make_unique<ErrorHistogram>();
+    errorHistogram->setBounds (xPos, yPos += textHeight + 5, optionsWidth - 2 * indent, 80);
+    errorHistogram->setTooltip (errorTooltip);
+    yPos += 80 - textHeight;
+
+    exportLabel = std::make_unique<Label> ("exportLabel", "Export phases:");
+    int exportLabelWidth = textFont.getStringWidth (exportLabel->getText());
+    exportLabel->setBounds (xPos = indent, yPos += textHeight + 15, exportLabelWidth, textHeight);
+    exportLabel->setFont (textFont);
+    rosePlotOptions->addAndMakeVisible (exportLabel.get());
+
+    exportBox = std::make_unique<ComboBox> ("exportBox");
+    exportBox->addItem ("Off", PhaseRecorder::OFF + 1);
+    exportBox->addItem ("CSV", PhaseRecorder::CSV + 1);
+    exportBox->addItem ("Binary", PhaseRecorder::BINARY + 1);
+    exportBox->setSelectedId (PhaseRecorder::OFF + 1, dontSendNotification);
+    exportBox->setTooltip (exportTooltip);
+    exportBox->setBounds (xPos += exportLabelWidth + 5, yPos, 100, textHeight);
+    exportBox->addListener (this);
+    rosePlotOptions->addAndMakeVisible (exportBox.get());
+
+    performanceButton = std::make_unique<UtilityButton> ("Performance");
+    performanceButton->setFont (FontOptions (16.0f));
+    performanceButton->setClickingTogglesState (true);
+    performanceButton->setTooltip (performanceTooltip);
+    performanceButton->addListener (this);
+    performanceButton->setBounds (xPos = indent, yPos += textHeight + 15, 110, textHeight);
+    rosePlotOptions->addAndMakeVisible (performanceButton.get());
+
+    optionsHeight = yPos + textHeight + indent;
+
+    performancePanel = std::make_unique<PerformancePanel>();
+    canvas->addChildComponent (performancePanel.get());
+
+    updatePlots ({});
     rosePlotOptions->addAndMakeVisible (countLabel.get());
     rosePlotOptions->addAndMakeVisible (meanLabel.get());
     rosePlotOptions->addAndMakeVisible (stdLabel.get());
+    rosePlotOptions->addAndMakeVisible (errorMeanLabel.get());
+    rosePlotOptions->addAndMakeVisible (errorStdLabel.get());
+    rosePlotOptions->addAndMakeVisible (errorHistogram.get());
 
     canvas->addAndMakeVisible (rosePlotOptions.get());
 
@@ -142,13 +230,35 @@ void Canvas::resized()
     int diameter = getRosePlotDiameter (vpHeight, &verticalPadding);
     int canvasWidth = getContentWidth (vpWidth, diameter, &leftPadding);
 
-    rosePlot->setBounds (leftPadding, verticalPadding, diameter, diameter);
+    // lay out the plots in a square grid
+    int numPlots = rosePlots.size();
+    int numCols = jmax (1, (int) std::ceil (std::sqrt (numPlots)));
+    int numRows = jmax (1, (numPlots + numCols - 1) / numCols);
+    int cellSize = (diameter - (numCols - 1) * plotSpacing) / numCols;
+    int gridTop = verticalPadding + (diameter - numRows * cellSize - (numRows - 1) * plotSpacing) / 2;
+    for (int i = 0; i < numPlots; ++i)
+    {
+        int row = i / numCols;
+        int col = i % numCols;
+        rosePlots[i]->setBounds (leftPadding + col * (cellSize + plotSpacing),
+                                 gridTop + row * (cellSize + plotSpacing),
+                                 cellSize,
+                                 cellSize);
+    }
 
     int optionsX = leftPadding * 2 + diameter;
     int optionsY = verticalPadding + (diameter - minDiameter) / 2;
-    rosePlotOptions->setBounds (optionsX, optionsY, optionsWidth, diameter);
+    rosePlotOptions->setBounds (optionsX, optionsY, optionsWidth, jmax (diameter, optionsHeight));
+
+    int canvasHeight = jmax (diameter + 2 * verticalPadding, optionsY + optionsHeight + minPadding);
+
+    if (performancePanel->isVisible())
+    {
+        int panelHeight = jmax (diameter, performancePanel->getPreferredHeight());
+        performancePanel->setBounds (optionsX + optionsWidth + minPadding, verticalPadding, performanceWidth, panelHeight);
+        canvasHeight = jmax (canvasHeight, verticalPadding + panelHeight + minPadding);
+    }
 
-    int canvasHeight = diameter + 2 * verticalPadding;
     canvas->setSize (canvasWidth, canvasHeight);
 }
 
@@ -166,6 +276,10 @@ int Canvas::getRosePlotDiameter (int vpHeight, int* verticalPadding)
 int Canvas::getContentWidth (int vpWidth, int diameter, int* leftPadding)
 {
     int widthWithoutPadding = diameter + optionsWidth;
+    if (performancePanel->isVisible())
+    {
+        widthWithoutPadding += minPadding + performanceWidth;
+    }
     int lp = jmax (minPadding, jmin (maxLeftPadding, vpWidth - widthWithoutPadding));
     if (leftPadding != nullptr)
     {
@@ -187,7 +301,6 @@ void Canvas::updateSettings()
 
         DataStream* currStream = processor->getDataStream (processor->getSelectedStream());
         int currContId = (int) currStream->getParameter ("vis_cont")->getValue() + 1;
-        int currEventId = (int) currStream->getParameter ("vis_event")->getValue() + 2;
 
         cChannelBox->clear (dontSendNotification);
 
@@ -197,26 +310,48 @@ void Canvas::updateSettings()
 
             int id = chan + 1;
             cChannelBox->addItem (String (id), id);
-            if (id == currContId)
-            {
-                cChannelBox->setSelectedId (id, sendNotification);
-            }
         }
 
-        if (cChannelBox->getNumItems() > 0 && cChannelBox->getSelectedId() == 0)
+        // make sure the main continuous channel is an active input
+        if (numActiveInputs > 0 && cChannelBox->indexOfItemId (currContId) == -1)
         {
-            int firstChannelId = activeInputs[0] + 1;
-            cChannelBox->setSelectedId (firstChannelId, sendNotification);
+            currStream->getParameter ("vis_cont")->setNextValue (activeInputs[0]);
         }
-
-        eChannelBox->setSelectedId (currEventId, sendNotification);
     }
+
+    exportBox->setSelectedId ((int) processor->getParameter ("export_phases")->getValue() + 1, dontSendNotification);
+
+    // the stream or its channels may have changed
+    performancePanel->clear();
+
+    updatePlots (processor->getVisTargets());
 }
 
 void Canvas::refresh()
 {
+    if (performancePanel->isVisible())
+    {
+        PerformanceSnapshot snapshot;
+        if (processor->getPerformance (snapshot))
+        {
+            int oldHeight = performancePanel->getPreferredHeight();
+            performancePanel->update (snapshot);
+            if (performancePanel->getPreferredHeight() != oldHeight)
+            {
+                resized();
+            }
+        }
+    }
+
+    // pick up targets changed through parameters (e.g. when loading settings)
+    Array<GroundTruthEngine::Target> targets = processor->getVisTargets();
+    if (targets != plotTargets)
+    {
+        updatePlots (targets);
+    }
+
     // if no event channel selected, do nothing
-    if (eChannelBox->getSelectedId() == 1)
+    if (plotTargets.isEmpty())
     {
         return;
     }
@@ -224,41 +359,126 @@ void Canvas::refresh()
     // get new angles from visualization phase buffer
     if (processor->tryToReadVisPhases (tempPhaseBuffer))
     {
-        // add new angles to rose plot
+        if (tempPhaseBuffer.empty())
+        {
+            return;
+        }
+
+        // add new angles to rose plots, then repaint each plot and update labels once for the whole batch
+        Array<RosePlot*> updatedPlots;
         while (! tempPhaseBuffer.empty())
         {
-            addAngle (tempPhaseBuffer.front());
+            const EventPhase& newPhase = tempPhaseBuffer.front();
+            if (RosePlot* plot = rosePlots[newPhase.target])
+            {
+                plot->addAngle (newPhase.phase, newPhase.time);
+                updatedPlots.addIfNotAlreadyThere (plot);
+            }
             tempPhaseBuffer.pop();
         }
+
+        for (auto plot : updatedPlots)
+        {
+            plot->repaint();
+        }
+
+        if (updatedPlots.contains (getSelectedPlot()))
+        {
+            updateStatLabels();
+
+            if (processor->tryToReadPhaseErrors (selectedPlot, errorSnapshot))
+            {
+                updateErrorStats();
+            }
+        }
     }
 }
 
-void Canvas::addAngle (double newAngle)
+void Canvas::clearAngles()
 {
-    rosePlot->addAngle (newAngle);
+    for (auto plot : rosePlots)
+    {
+        plot->clear();
+    }
     updateStatLabels();
+
+    processor->clearPhaseErrors();
+    errorSnapshot = PhaseErrorSnapshot();
+    updateErrorStats();
 }
 
-void Canvas::clearAngles()
+void Canvas::selectPlot (RosePlot* plot)
 {
-    rosePlot->clear();
+    int index = rosePlots.indexOf (plot);
+    if (index == -1)
+    {
+        return;
+    }
+
+    selectedPlot = index;
+    for (auto p : rosePlots)
+    {
+        p->setSelected (p == plot);
+    }
+
+    displaySelectedTarget();
     updateStatLabels();
+
+    errorSnapshot = PhaseErrorSnapshot();
+    processor->tryToReadPhaseErrors (selectedPlot, errorSnapshot);
+    updateErrorStats();
 }
 
 void Canvas::comboBoxChanged (ComboBox* comboBoxThatHasChanged)
 {
-    DataStream* currStream = processor->getDataStream (processor->getSelectedStream());
-    if (comboBoxThatHasChanged == cChannelBox.get())
+    if (comboBoxThatHasChanged == cChannelBox.get() || comboBoxThatHasChanged == eChannelBox.get())
+    {
+        // subtract 1 to change from 1-based to 0-based, and 2 for the event line since index 1 == no line (-1)
+        GroundTruthEngine::Target newTarget = { cChannelBox->getSelectedId() - 1, eChannelBox->getSelectedId() - 2 };
+        Array<GroundTruthEngine::Target> newTargets = plotTargets;
+
+        if (newTarget.chan < 0 || processor->getSelectedStream() == 0)
+        {
+            return;
+        }
+
+        if (selectedPlot >= newTargets.size())
+        {
+            // placeholder plot: this becomes the main pair
+            DataStream* currStream = processor->getDataStream (processor->getSelectedStream());
+            currStream->getParameter ("vis_cont")->setNextValue (newTarget.chan);
+            if (newTarget.eventLine < 0)
+            {
+                // still no line; just show the new channel
+                updatePlots (plotTargets);
+                return;
+            }
+            newTargets.add (newTarget);
+        }
+        else if (newTarget.eventLine < 0)
+        {
+            newTargets.remove (selectedPlot);
+        }
+        else if (! newTargets.contains (newTarget))
+        {
+            newTargets.set (selectedPlot, newTarget);
+        }
+        else
+        {
+            // already plotted; select that plot instead
+            selectPlot (rosePlots[newTargets.indexOf (newTarget)]);
+            return;
+        }
+
+        setTargets (newTargets);
+    }
+    else if (comboBoxThatHasChanged == exportBox.get())
     {
-        // subtract 1 to change from 1-based to 0-based
-        int newValue = cChannelBox->getSelectedId() - 1;
-        currStream->getParameter ("vis_cont")->setNextValue (newValue);
+        processor->getParameter ("export_phases")->setNextValue (exportBox->getSelectedId() - 1);
     }
-    else if (comboBoxThatHasChanged == eChannelBox.get())
+    else if (comboBoxThatHasChanged == statsModeBox.get())
     {
-        // subtract 2, since index 1 == no channel (-1)
-        int newValue = eChannelBox->getSelectedId() - 2;
-        currStream->getParameter ("vis_event")->setNextValue (newValue);
+        updateStatsMode();
     }
 }
 
@@ -266,7 +486,10 @@ void Canvas::sliderValueChanged (Slider* slider)
 {
     if (slider == numBinsSlider.get())
     {
-        rosePlot->setNumBins (static_cast<int> (slider->getValue()));
+        for (auto plot : rosePlots)
+        {
+            plot->setNumBins (static_cast<int> (slider->getValue()));
+        }
     }
 }
 
@@ -276,39 +499,273 @@ void Canvas::buttonClicked (Button* button)
     {
         clearAngles();
     }
+    else if (button == addPlotButton.get())
+    {
+        if (plotTargets.size() >= maxPlots || cChannelBox->getSelectedId() == 0)
+        {
+            return;
+        }
+
+        // same channel as the selected plot, on the first event line not plotted for it yet
+        GroundTruthEngine::Target newTarget = { cChannelBox->getSelectedId() - 1, 0 };
+        while (plotTargets.contains (newTarget) && newTarget.eventLine < 7)
+        {
+            ++newTarget.eventLine;
+        }
+
+        if (! plotTargets.contains (newTarget))
+        {
+            Array<GroundTruthEngine::Target> newTargets = plotTargets;
+            newTargets.add (newTarget);
+            setTargets (newTargets);
+        }
+    }
+    else if (button == performanceButton.get())
+    {
+        performancePanel->clear();
+        performancePanel->setVisible (button->getToggleState());
+        resized();
+    }
+    else if (button == removePlotButton.get())
+    {
+        if (selectedPlot < plotTargets.size())
+        {
+            Array<GroundTruthEngine::Target> newTargets = plotTargets;
+            newTargets.remove (selectedPlot);
+            setTargets (newTargets);
+        }
+    }
+}
+
+void Canvas::labelTextChanged (Label* labelThatHasChanged)
+{
+    if (labelThatHasChanged == referenceEditable.get())
+    {
+        // convert to radians
+        double doubleInput = labelThatHasChanged->getText().getDoubleValue();
+        double newReference = PhaseEngine::circDist (degreesToRadians (doubleInput), 0.0);
+        labelThatHasChanged->setText (String (radiansToDegrees (newReference)), dontSendNotification);
+
+        for (auto plot : rosePlots)
+        {
+            plot->setReference (newReference);
+        }
+        updateStatLabels();
+    }
+    else if (labelThatHasChanged == statsWindowEditable.get())
+    {
+        int mode = statsModeBox->getSelectedId() - 1;
+        double newWindow = statsWindowEditable->getText().getDoubleValue();
+
+        if (mode == CircularStats::LAST_EVENTS)
+        {
+            newWindow = std::round (newWindow);
+        }
+
+        if (newWindow > 0 && (mode != CircularStats::LAST_EVENTS || newWindow <= CircularStats::defaultCapacity))
+        {
+            statsWindows[mode] = newWindow;
+        }
+
+        updateStatsMode();
+    }
+}
+
+void Canvas::updateStatsMode()
+{
+    auto mode = CircularStats::Mode (statsModeBox->getSelectedId() - 1);
+    double window = statsWindows[mode];
+
+    bool windowed = mode != CircularStats::CUMULATIVE;
+    statsWindowEditable->setVisible (windowed);
+    statsWindowUnitLabel->setVisible (windowed);
+
+    statsWindowEditable->setText (String (window), dontSendNotification);
+    statsWindowUnitLabel->setText (mode == CircularStats::LAST_EVENTS ? "events"
+                                   : mode == CircularStats::LAST_SECONDS ? "seconds"
+                                                                          : "s half-life",
+                                   dontSendNotification);
+
+    for (auto plot : rosePlots)
+    {
+        plot->setStatsMode (mode, window);
+    }
+    updateStatLabels();
+}
+
+void Canvas::updatePlots (const Array<GroundTruthEngine::Target>& newTargets)
+{
+    GroundTruthEngine::Target selectedTarget = getSelectedPlot() != nullptr ? getSelectedPlot()->getTarget()
+                                                                            : GroundTruthEngine::Target { -1, -1 };
+
+    // reuse the plots of remaining targets
+    OwnedArray<RosePlot> newPlots;
+    for (const auto& target : newTargets)
+    {
+        RosePlot* plot = nullptr;
+        for (int i = 0; i < rosePlots.size(); ++i)
+        {
+            if (rosePlots[i]->getTarget() == target)
+            {
+                plot = rosePlots.removeAndReturn (i);
+                break;
+            }
+        }
+
+        newPlots.add (plot != nullptr ? plot : new RosePlot (this, target));
+    }
+
+    if (newPlots.isEmpty())
+    {
+        // empty plot for the main continuous channel
+        int visCont = cChannelBox->getSelectedId() - 1;
+        if (visCont < 0 && processor->getSelectedStream() != 0)
+        {
+            DataStream* currStream = processor->getDataStream (processor->getSelectedStream());
+            visCont = (int) currStream->getParameter ("vis_cont")->getValue();
+        }
+        newPlots.add (new RosePlot (this, { visCont, -1 }));
+    }
+
+    rosePlots.swapWith (newPlots);
+    newPlots.clear();
+    plotTargets = newTargets;
+
+    // apply the current display options to every plot (no-ops for existing plots)
+    auto mode = CircularStats::Mode (statsModeBox->getSelectedId() - 1);
+    double reference = PhaseEngine::circDist (degreesToRadians (referenceEditable->getText().getDoubleValue()), 0.0);
+    for (auto plot : rosePlots)
+    {
+        plot->setNumBins (static_cast<int> (numBinsSlider->getValue()));
+        plot->setReference (reference);
+        if (plot->getNumReceived() == 0)
+        {
+            plot->setStatsMode (mode, statsWindows[mode]);
+        }
+        plot->setShowTitle (rosePlots.size() > 1);
+        canvas->addAndMakeVisible (plot);
+    }
+
+    removePlotButton->setEnabled (! plotTargets.isEmpty());
+    addPlotButton->setEnabled (plotTargets.size() < maxPlots);
+
+    selectedPlot = 0;
+    for (int i = 0; i < rosePlots.size(); ++i)
+    {
+        if (rosePlots[i]->getTarget() == selectedTarget)
+        {
+            selectedPlot = i;
+        }
+    }
+
+    resized();
+    selectPlot (getSelectedPlot());
+}
+
+void Canvas::displaySelectedTarget()
+{
+    const GroundTruthEngine::Target& target = getSelectedPlot()->getTarget();
+    if (cChannelBox->indexOfItemId (target.chan + 1) != -1)
+    {
+        cChannelBox->setSelectedId (target.chan + 1, dontSendNotification);
+    }
+    eChannelBox->setSelectedId (target.eventLine + 2, dontSendNotification);
+}
+
+void Canvas::setTargets (const Array<GroundTruthEngine::Target>& newTargets)
+{
+    if (processor->getSelectedStream() == 0)
+    {
+        return;
+    }
+
+    DataStream* currStream = processor->getDataStream (processor->getSelectedStream());
+
+    if (newTargets.isEmpty())
+    {
+        currStream->getParameter ("vis_event")->setNextValue (-1);
+        currStream->getParameter ("vis_targets")->setNextValue ("");
+    }
+    else
+    {
+        Array<GroundTruthEngine::Target> extraTargets = newTargets;
+        extraTargets.remove (0);
+
+        currStream->getParameter ("vis_cont")->setNextValue (newTargets[0].chan);
+        currStream->getParameter ("vis_event")->setNextValue (newTargets[0].eventLine);
+        currStream->getParameter ("vis_targets")->setNextValue (Settings::formatVisTargets (extraTargets));
+    }
+
+    // the plots follow once the Node has applied the change (see refresh)
 }
 
 void Canvas::updateStatLabels()
 {
-    int numAngles = rosePlot->getNumAngles();
-    double mean = std::round (100 * rosePlot->getCircMean()) / 100;
-    double stddev = std::round (100 * rosePlot->getCircStd()) / 100;
+    RosePlot* plot = getSelectedPlot();
+    int numAngles = plot->getNumAngles();
+    int64 numReceived = plot->getNumReceived();
+    double mean = std::round (100 * plot->getCircMean()) / 100;
+    double stddev = std::round (100 * plot->getCircStd()) / 100;
+
+    String countText = "Events received: " + String (numReceived);
+    if (statsModeBox->getSelectedId() - 1 != CircularStats::CUMULATIVE)
+    {
+        countText += " (" + String (numAngles) + " in plot)";
+    }
 
-    countLabel->setText ("Events received: " + String (numAngles), dontSendNotification);
+    countLabel->setText (countText, dontSendNotification);
     meanLabel->setText ("Mean phase (vs. reference): " + String (mean) + "\u00b0", dontSendNotification);
     stdLabel->setText ("Standard deviation phase: " + String (stddev) + "\u00b0", dontSendNotification);
 }
 
+void Canvas::updateErrorStats()
+{
+    String count = " (" + String (errorSnapshot.count) + " events)";
+    if (errorSnapshot.count == 0)
+    {
+        errorMeanLabel->setText ("Online error (mean): -", dontSendNotification);
+        errorStdLabel->setText ("Online error (std. dev.): -", dontSendNotification);
+    }
+    else
+    {
+        errorMeanLabel->setText ("Online error (mean): " + String (errorSnapshot.mean, 2) + "\u00b0" + count, dontSendNotification);
+        errorStdLabel->setText ("Online error (std. dev.): " + String (errorSnapshot.std, 2) + "\u00b0", dontSendNotification);
+    }
+
+    errorHistogram->setData (errorSnapshot.histogram);
+}
+
 void Canvas::saveCustomParametersToXml (XmlElement* xml)
 {
     XmlElement* visValues = xml->createNewChildElement ("VISUALIZER");
-    visValues->setAttribute ("eventChannelId", eChannelBox->getSelectedId());
     visValues->setAttribute ("numBins", numBinsSlider->getValue());
     visValues->setAttribute ("phaseRef", referenceEditable->getText());
+    visValues->setAttribute ("statsMode", statsModeBox->getSelectedId() - 1);
+    visValues->setAttribute ("eventsWindow", statsWindows[CircularStats::LAST_EVENTS]);
+    visValues->setAttribute ("secondsWindow", statsWindows[CircularStats::LAST_SECONDS]);
+    visValues->setAttribute ("decayHalfLife", statsWindows[CircularStats::DECAY]);
+    visValues->setAttribute ("showPerformance", performanceButton->getToggleState());
 }
 
 void Canvas::loadCustomParametersFromXml (XmlElement* xml)
 {
     for (auto xmlNode : xml->getChildWithTagNameIterator ("VISUALIZER"))
     {
-        int eventChannelId = xmlNode->getIntAttribute ("eventChannelId", eChannelBox->getSelectedId());
-        if (eChannelBox->indexOfItemId (eventChannelId) != -1)
+        numBinsSlider->setValue (xmlNode->getDoubleAttribute ("numBins", numBinsSlider->getValue()), sendNotificationSync);
+        referenceEditable->setText (xmlNode->getStringAttribute ("phaseRef", referenceEditable->getText()), sendNotificationSync);
+
+        statsWindows[CircularStats::LAST_EVENTS] = jlimit (1.0, double (CircularStats::defaultCapacity), xmlNode->getDoubleAttribute ("eventsWindow", statsWindows[CircularStats::LAST_EVENTS]));
+        statsWindows[CircularStats::LAST_SECONDS] = jmax (DBL_MIN, xmlNode->getDoubleAttribute ("secondsWindow", statsWindows[CircularStats::LAST_SECONDS]));
+        statsWindows[CircularStats::DECAY] = jmax (DBL_MIN, xmlNode->getDoubleAttribute ("decayHalfLife", statsWindows[CircularStats::DECAY]));
+
+        int statsMode = xmlNode->getIntAttribute ("statsMode", statsModeBox->getSelectedId() - 1);
+        if (statsModeBox->indexOfItemId (statsMode + 1) != -1)
         {
-            eChannelBox->setSelectedId (eventChannelId, sendNotificationSync);
+            statsModeBox->setSelectedId (statsMode + 1, dontSendNotification);
         }
+        updateStatsMode();
 
-        numBinsSlider->setValue (xmlNode->getDoubleAttribute ("numBins", numBinsSlider->getValue()), sendNotificationSync);
-        referenceEditable->setText (xmlNode->getStringAttribute ("phaseRef", referenceEditable->getText()), sendNotificationSync);
+        performanceButton->setToggleState (xmlNode->getBoolAttribute ("showPerformance", performanceButton->getToggleState()), sendNotificationSync);
     }
 }
 
@@ -325,83 +782,47 @@ void Canvas::displayContinuousChan (int chan)
 
 /**** RosePlot ****/
 
-RosePlot::RosePlot (Canvas* c)
-    : canvas (c), referenceAngle (static_cast<double> (startReference)), numBins (startNumBins), edgeWeight (1), rSum (0)
+RosePlot::RosePlot (Canvas* c, const GroundTruthEngine::Target& t)
+    : canvas (c), target (t), showTitle (false), selected (false), numBins (startNumBins), referenceAngle (static_cast<double> (startReference)), angleData (startNumBins, startReference), edgeWeight (1), gridScale (0)
 {
     updateAngles();
-    reorganizeAngleData();
 }
 
 RosePlot::~RosePlot() {}
 
 void RosePlot::paint (Graphics& g)
 {
-    // dimensions
-    juce::Rectangle<float> bounds = getBounds().toFloat();
-    float squareSide = jmin (bounds.getHeight(), bounds.getWidth() - 2 * textBoxSize);
-    juce::Rectangle<float> plotBounds = bounds.withZeroOrigin();
-    plotBounds = plotBounds.withSizeKeepingCentre (squareSide, squareSide);
-    g.setColour (findColour (ThemeColours::widgetBackground));
-    g.fillEllipse (plotBounds);
+    juce::Rectangle<float> plotBounds = getPlotBounds();
+    float squareSide = plotBounds.getWidth();
 
-    // draw grid
-    // spokes and degree labels (every 30 degrees)
-    juce::Point<float> center = plotBounds.getCentre();
-    Line<float> spoke (center, center);
-    juce::Rectangle<int> textBox (textBoxSize, textBoxSize);
-    g.setFont (Font (textBoxSize / 2, Font::bold));
-    for (int i = 0; i < 12; ++i)
+    // static layers are only re-rendered when invalidated or when the pixel scale changes
+    float scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+    if (gridImage.isNull() || scale != gridScale)
     {
-        float juceAngle = i * float_Pi / 6;
-        spoke.setEnd (center.getPointOnCircumference (squareSide / 2, juceAngle));
-        g.setColour (findColour (ThemeColours::defaultFill));
-        g.drawLine (spoke);
-
-        float textRadius = (squareSide + textBoxSize) / 2;
-        juce::Point<int> textCenter = center.getPointOnCircumference (textRadius, juceAngle).toInt();
-        int degreeAngle = (450 - 30 * i) % 360;
-        g.setColour (findColour (ThemeColours::defaultText));
-        g.drawFittedText (String (degreeAngle), textBox.withCentre (textCenter), Justification::centred, 1);
+        renderGrid (scale);
     }
+    g.drawImage (gridImage, getLocalBounds().toFloat());
 
-    // concentric circles
-    int nCircles = 3;
-    juce::Rectangle<float> circleBounds;
-    g.setColour (findColour (ThemeColours::defaultFill));
-    for (int i = 1; i < nCircles; ++i)
-    {
-        float diameter = (squareSide * i) / nCircles;
-        circleBounds = plotBounds.withSizeKeepingCentre (diameter, diameter);
-        g.drawEllipse (circleBounds, 1);
-    }
-
-    // get count for each rose plot segment
-    int nSegs = binMidpoints.size();
-    Array<int> segmentCounts;
-    segmentCounts.resize (nSegs);
-    int maxCount = 0;
-    int totalCount = 0;
+    // get weight of each rose plot segment
+    int nSegs = segmentAngles.size();
+    jassert (nSegs == angleData.getNumBins());
+    double maxWeight = 0;
     for (int seg = 0; seg < nSegs; ++seg)
     {
-        int count = static_cast<int> (angleData->count (binMidpoints[seg] + referenceAngle));
-        segmentCounts.set (seg, count);
-        maxCount = jmax (maxCount, count);
-        totalCount += count;
+        maxWeight = jmax (maxWeight, angleData.getBinWeight (seg));
     }
 
-    jassert (totalCount == angleData->size());
-    jassert ((maxCount == 0) == (angleData->empty()));
-
     // construct path
     Path rosePath;
-    for (int seg = 0; seg < nSegs; ++seg)
+    for (int seg = 0; seg < nSegs && maxWeight > 0; ++seg)
     {
-        if (segmentCounts[seg] == 0)
+        double weight = angleData.getBinWeight (seg);
+        if (weight <= 0)
         {
             continue;
         }
 
-        float size = squareSide * segmentCounts[seg] / static_cast<float> (maxCount);
+        float size = float (squareSide * weight / maxWeight);
         rosePath.addPieSegment (plotBounds.withSizeKeepingCentre (size, size),
                                 segmentAngles[seg].first,
                                 segmentAngles[seg].second,
@@ -413,6 +834,56 @@ void RosePlot::paint (Graphics& g)
     g.fillPath (rosePath);
     g.setColour (findColour (ThemeColours::widgetBackground));
     g.strokePath (rosePath, PathStrokeType (edgeWeight));
+
+    if (showTitle)
+    {
+        String title = "Ch " + String (target.chan + 1) + " / "
+                       + (target.eventLine >= 0 ? "Line " + String (target.eventLine + 1) : String ("No line"));
+        g.setColour (findColour (ThemeColours::defaultText));
+        g.setFont (FontOptions (14.0f));
+        g.drawText (title, getLocalBounds().removeFromTop (titleHeight), Justification::topLeft);
+    }
+
+    if (selected && showTitle)
+    {
+        g.setColour (findColour (ThemeColours::highlightedFill));
+        g.drawRect (getLocalBounds(), 2);
+    }
+}
+
+void RosePlot::resized()
+{
+    gridImage = Image();
+}
+
+void RosePlot::lookAndFeelChanged()
+{
+    gridImage = Image();
+    repaint();
+}
+
+void RosePlot::mouseDown (const MouseEvent&)
+{
+    canvas->selectPlot (this);
+}
+
+void RosePlot::setShowTitle (bool shouldShow)
+{
+    if (shouldShow != showTitle)
+    {
+        showTitle = shouldShow;
+        gridImage = Image();
+        repaint();
+    }
+}
+
+void RosePlot::setSelected (bool isSelected)
+{
+    if (isSelected != selected)
+    {
+        selected = isSelected;
+        repaint();
+    }
 }
 
 void RosePlot::setNumBins (int newNumBins)
@@ -421,7 +892,7 @@ void RosePlot::setNumBins (int newNumBins)
     {
         numBins = newNumBins;
         updateAngles();
-        reorganizeAngleData();
+        angleData.setBinning (numBins, referenceAngle);
         repaint();
     }
 }
@@ -431,125 +902,587 @@ void RosePlot::setReference (double newReference)
     if (newReference != referenceAngle)
     {
         referenceAngle = newReference;
-        reorganizeAngleData();
+        angleData.setBinning (numBins, referenceAngle);
         repaint();
     }
 }
 
-void RosePlot::addAngle (double newAngle)
+void RosePlot::setStatsMode (CircularStats::Mode newMode, double newWindow)
 {
-    newAngle = Node::circDist (newAngle, 0.0);
-    angleData->insert (newAngle);
-    rSum += std::exp (std::complex<double> (0, newAngle));
+    angleData.setMode (newMode, newWindow);
     repaint();
 }
 
+void RosePlot::addAngle (double newAngle, double time)
+{
+    newAngle = PhaseEngine::circDist (newAngle, 0.0);
+    angleData.add (newAngle, time);
+}
+
 void RosePlot::clear()
 {
-    angleData->clear();
-    rSum = 0;
+    angleData.clear();
     repaint();
 }
 
 int RosePlot::getNumAngles()
 {
-    return static_cast<int> (angleData->size());
+    return angleData.getCount();
+}
+
+int64 RosePlot::getNumReceived()
+{
+    return angleData.getNumReceived();
 }
 
 double RosePlot::getCircMean (bool usingReference)
 {
-    if (angleData->empty())
+    if (angleData.getCount() == 0)
     {
         return 0;
     }
 
     double reference = usingReference ? referenceAngle : 0.0;
     // use range of (-90, 270] for ease of use
-    double meanRad = Node::circDist (std::arg (rSum), reference, 3 * double_Pi / 2);
+    double meanRad = PhaseEngine::circDist (angleData.getMean(), reference, 3 * double_Pi / 2);
     return radiansToDegrees (meanRad);
 }
 
 double RosePlot::getCircStd()
 {
-    if (angleData->empty())
+    return radiansToDegrees (angleData.getStd());
+}
+
+/*** RosePlot private members ***/
+
+int RosePlot::getTextBoxSize()
+{
+    return jlimit (minTextBoxSize, int (textBoxSize), jmin (getWidth(), getHeight()) / 10);
+}
+
+juce::Rectangle<float> RosePlot::getPlotBounds()
+{
+    juce::Rectangle<float> bounds = getLocalBounds().toFloat();
+    if (showTitle)
     {
-        return 0;
+        bounds.removeFromTop (titleHeight);
     }
 
-    double r = std::abs (rSum) / angleData->size();
-    double stdRad = std::sqrt (-2 * std::log (r));
-    return radiansToDegrees (stdRad);
+    int labelSize = getTextBoxSize();
+    float squareSide = jmax (0.0f, jmin (bounds.getHeight() - labelSize, bounds.getWidth() - 2 * labelSize));
+    return bounds.withSizeKeepingCentre (squareSide, squareSide);
 }
 
-void RosePlot::labelTextChanged (Label* labelThatHasChanged)
+void RosePlot::renderGrid (float scale)
 {
-    if (labelThatHasChanged->getName() == "referenceEditable")
+    gridScale = scale;
+    gridImage = Image (Image::ARGB,
+                       jmax (1, roundToInt (getWidth() * scale)),
+                       jmax (1, roundToInt (getHeight() * scale)),
+                       true);
+
+    Graphics g (gridImage);
+    g.addTransform (AffineTransform::scale (scale));
+
+    // dimensions
+    juce::Rectangle<float> plotBounds = getPlotBounds();
+    float squareSide = plotBounds.getWidth();
+    g.setColour (findColour (ThemeColours::widgetBackground));
+    g.fillEllipse (plotBounds);
+
+    // draw grid
+    // spokes and degree labels (every 30 degrees)
+    juce::Point<float> center = plotBounds.getCentre();
+    Line<float> spoke (center, center);
+    int labelSize = getTextBoxSize();
+    juce::Rectangle<int> textBox (labelSize, labelSize);
+    g.setFont (Font (labelSize / 2, Font::bold));
+    for (int i = 0; i < 12; ++i)
     {
-        double doubleInput;
-        double currReferenceDeg = radiansToDegrees (referenceAngle);
-        // bool valid = Editor::updateControl(labelThatHasChanged,
-        // -DBL_MAX, DBL_MAX, currReferenceDeg, doubleInput);
+        float juceAngle = i * float_Pi / 6;
+        spoke.setEnd (center.getPointOnCircumference (squareSide / 2, juceAngle));
+        g.setColour (findColour (ThemeColours::defaultFill));
+        g.drawLine (spoke);
 
-        if (true)
-        {
-            // convert to radians
-            double newReference = Node::circDist (degreesToRadians (doubleInput), 0.0);
-            labelThatHasChanged->setText (String (radiansToDegrees (newReference)), dontSendNotification);
-            setReference (newReference);
-            canvas->updateStatLabels();
-        }
+        float textRadius = (squareSide + labelSize) / 2;
+        juce::Point<int> textCenter = center.getPointOnCircumference (textRadius, juceAngle).toInt();
+        int degreeAngle = (450 - 30 * i) % 360;
+        g.setColour (findColour (ThemeColours::defaultText));
+        g.drawFittedText (String (degreeAngle), textBox.withCentre (textCenter), Justification::centred, 1);
+    }
+
+    // concentric circles
+    int nCircles = 3;
+    juce::Rectangle<float> circleBounds;
+    g.setColour (findColour (ThemeColours::defaultFill));
+    for (int i = 1; i < nCircles; ++i)
+    {
+        float diameter = (squareSide * i) / nCircles;
+        circleBounds = plotBounds.withSizeKeepingCentre (diameter, diameter);
+        g.drawEllipse (circleBounds, 1);
     }
 }
 
-/*** RosePlot private members ***/
+void RosePlot::updateAngles()
+{
+    float step = 2 * float_Pi / numBins;
+    segmentAngles.resize (numBins);
+    for (int i = 0; i < numBins; ++i)
+    {
+        float firstAngle = float (PhaseEngine::circDist (double_Pi / 2, step * (i + 1)));
+        segmentAngles.set (i, { firstAngle, firstAngle + step });
+    }
+}
+
+/**** ErrorHistogram ****/
+
+void ErrorHistogram::paint (Graphics& g)
+{
+    juce::Rectangle<float> bounds = getLocalBounds().toFloat();
+    g.setColour (findColour (ThemeColours::widgetBackground));
+    g.fillRect (bounds);
+
+    const float labelHeight = 14;
+    juce::Rectangle<float> plotArea = bounds.withTrimmedBottom (labelHeight).reduced (2);
+
+    // zero-error line
+    g.setColour (findColour (ThemeColours::defaultFill));
+    g.drawVerticalLine (roundToInt (plotArea.getCentreX()), plotArea.getY(), plotArea.getBottom());
+
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions (12.0f));
+    auto labelArea = bounds.removeFromBottom (labelHeight).reduced (2, 0).toNearestInt();
+    g.drawText (L"-180\u00b0", labelArea, Justification::left);
+    g.drawText (L"0\u00b0", labelArea, Justification::centred);
+    g.drawText (L"180\u00b0", labelArea, Justification::right);
+
+    double maxWeight = 0;
+    for (double weight : bins)
+    {
+        maxWeight = jmax (maxWeight, weight);
+    }
+
+    if (maxWeight <= 0)
+    {
+        return;
+    }
+
+    float barWidth = plotArea.getWidth() / bins.size();
+    g.setColour (findColour (ThemeColours::highlightedFill));
+    for (int bin = 0; bin < bins.size(); ++bin)
+    {
+        float barHeight = float (plotArea.getHeight() * bins[bin] / maxWeight);
+        g.fillRect (plotArea.getX() + bin * barWidth, plotArea.getBottom() - barHeight, barWidth, barHeight);
+    }
+}
+
+void ErrorHistogram::setData (const Array<double>& newBins)
+{
+    bins = newBins;
+    repaint();
+}
+
+/**** PerformancePanel ****/
 
-RosePlot::AngleDataMultiset::AngleDataMultiset (int numBins, double referenceAngle)
-    : std::multiset<double, std::function<bool (double, double)>> (
-          std::bind (circularBinCompare, numBins, referenceAngle, std::placeholders::_1, std::placeholders::_2))
+// duration in microseconds, or milliseconds if long
+static String formatNs (double ns)
 {
+    if (ns >= 1e6)
+    {
+        return String (ns / 1e6, 2) + " ms";
+    }
+    String us = ns < 1e4 ? String (ns / 1e3, 1) : String (roundToInt (ns / 1e3));
+    return us + L" \u00b5s";
+}
+
+static String formatPercent (double fraction)
+{
+    return String (roundToInt (100 * fraction)) + "%";
+}
+
+PerformancePanel::PerformancePanel()
+{
+    clear();
+}
+
+void PerformancePanel::clear()
+{
+    hasLatest = false;
+    hasWindowStart = false;
+    hasWindowStats = false;
+    windowStats = WindowStats();
+    evaluate();
+    repaint();
+}
+
+int PerformancePanel::getPreferredHeight() const
+{
+    // title and status, histogram, summary, table header and one row per channel
+    int numChannels = hasLatest ? latest.channels.size() : 0;
+    return 4 * padding + 3 * rowHeight + histogramHeight + numSummaryRows * rowHeight + (numChannels + 1) * rowHeight;
+}
+
+void PerformancePanel::update (const PerformanceSnapshot& snapshot)
+{
+    latest = snapshot;
+    hasLatest = true;
+
+    uint32 nowMs = Time::getMillisecondCounter();
+
+    // counts restart with each acquisition
+    if (hasWindowStart && latest.blockTimes.count < windowStart.blockTimes.count)
+    {
+        hasWindowStart = false;
+        hasWindowStats = false;
+    }
+
+    if (! hasWindowStart)
+    {
+        windowStart = latest;
+        windowStartMs = nowMs;
+        hasWindowStart = true;
+    }
+    else if (nowMs - windowStartMs >= uint32 (windowMs))
+    {
+        finishWindow ((nowMs - windowStartMs) / 1000.0);
+        windowStart = latest;
+        windowStartMs = nowMs;
+    }
+
+    evaluate();
+    repaint();
 }
 
-RosePlot::AngleDataMultiset::AngleDataMultiset (int numBins, double referenceAngle, AngleDataMultiset* dataSource)
-    : AngleDataMultiset (numBins, referenceAngle)
+double PerformancePanel::WindowStats::getRefreshRate (int chan) const
 {
-    insert (dataSource->begin(), dataSource->end());
+    for (const auto& rate : refreshRates)
+    {
+        if (rate.first == chan)
+        {
+            return rate.second;
+        }
+    }
+    return -1;
 }
 
-bool RosePlot::AngleDataMultiset::circularBinCompare (int numBins, double referenceAngle, double lhs, double rhs)
+void PerformancePanel::finishWindow (double seconds)
 {
-    double lhsDist = Node::circDist (lhs, referenceAngle);
-    double rhsDist = Node::circDist (rhs, referenceAngle);
-    int lhsBin = int (lhsDist * numBins / (2 * double_Pi));
-    int rhsBin = int (rhsDist * numBins / (2 * double_Pi));
-    return lhsBin < rhsBin;
+    WindowStats stats;
+
+    // block times within the window (the maximum is the overall one, which only loosens the percentile cap)
+    const LatencyHistogram::Snapshot& startTimes = windowStart.blockTimes;
+    const LatencyHistogram::Snapshot& endTimes = latest.blockTimes;
+    LatencyHistogram::Snapshot recent;
+    recent.count = endTimes.count - startTimes.count;
+    recent.totalNs = endTimes.totalNs - startTimes.totalNs;
+    recent.maxNs = endTimes.maxNs;
+    for (int bin = 0; bin < LatencyHistogram::numBins; ++bin)
+    {
+        recent.bins[bin] = endTimes.bins[bin] - startTimes.bins[bin];
+    }
+
+    stats.numBlocks = int64 (recent.count);
+    stats.numDeadlineMisses = latest.numDeadlineMisses - windowStart.numDeadlineMisses;
+    if (recent.count > 0 && latest.blockDurationNs > 0)
+    {
+        stats.blockLoad = recent.getPercentileNs (0.99) / double (latest.blockDurationNs);
+    }
+
+    // fits within the window; their times are only known if every fit was timed
+    bool fitTimesKnown = latest.timingEnabled;
+    double fitNs = 0;
+    for (const auto& channel : latest.channels)
+    {
+        for (const auto& startChannel : windowStart.channels)
+        {
+            if (startChannel.chan != channel.chan)
+            {
+                continue;
+            }
+
+            int64 numFits = jmax (int64 (0), channel.numFits - startChannel.numFits);
+            int64 numTimed = int64 (channel.fitTimes.count) - int64 (startChannel.fitTimes.count);
+            stats.refreshRates.add ({ channel.chan, numFits / seconds });
+
+            fitNs += double (channel.fitTimes.totalNs) - double (startChannel.fitTimes.totalNs);
+            fitTimesKnown = fitTimesKnown && numTimed == numFits;
+            break;
+        }
+    }
+
+    if (fitTimesKnown)
+    {
+        stats.arLoad = fitNs / (seconds * 1e9);
+    }
+
+    windowStats = stats;
+    hasWindowStats = true;
 }
 
-void RosePlot::reorganizeAngleData()
+void PerformancePanel::evaluate()
 {
-    AngleDataMultiset* newAngleData;
-    if (angleData == nullptr)
+    if (! hasLatest || latest.blockTimes.count == 0)
     {
-        // construct empty container
-        newAngleData = new AngleDataMultiset (numBins, referenceAngle);
+        status = IDLE;
+        statusText = "Waiting for data";
+        return;
+    }
+
+    if (! hasWindowStats)
+    {
+        status = IDLE;
+        statusText = "Measuring...";
+        return;
+    }
+
+    // slowest refresh rate of the channels that have a model
+    const double targetRate = 1000.0 / jmax (1, latest.calcInterval);
+    double slowestRate = -1;
+    for (const auto& channel : latest.channels)
+    {
+        double rate = windowStats.getRefreshRate (channel.chan);
+        if (channel.modelAgeMs >= 0 && rate >= 0)
+        {
+            slowestRate = slowestRate < 0 ? rate : jmin (slowestRate, rate);
+        }
+    }
+
+    String load = "p99 block time is " + formatPercent (windowStats.blockLoad) + " of the block duration";
+    if (windowStats.arLoad >= 0)
+    {
+        load += ", AR thread " + formatPercent (windowStats.arLoad) + " busy";
+    }
+
+    if (windowStats.numDeadlineMisses > 0)
+    {
+        status = UNSUSTAINABLE;
+        statusText = "Not sustainable: " + String (windowStats.numDeadlineMisses)
+                     + " block(s) took longer than their duration in the last second. Select fewer channels or a lower AR order.";
+    }
+    else if (windowStats.arLoad >= 0.9 || (slowestRate >= 0 && slowestRate < 0.5 * targetRate))
+    {
+        status = UNSUSTAINABLE;
+        statusText = "Not sustainable: the AR models cannot be refit every " + String (latest.calcInterval)
+                     + " ms. Select fewer channels, a lower AR order or a longer AR refresh interval.";
+    }
+    else if (windowStats.blockLoad > 0.5 || windowStats.arLoad > 0.5 || (slowestRate >= 0 && slowestRate < 0.8 * targetRate))
+    {
+        status = MARGINAL;
+        statusText = "Little headroom: " + load + ".";
+    }
+    else if (latest.queues.readyJobs >= GroundTruthEngine::numJobs)
+    {
+        status = MARGINAL;
+        statusText = "The visualizer's phase analysis is falling behind; events may be dropped.";
     }
     else
     {
-        // copy existing data to new container
-        newAngleData = new AngleDataMultiset (numBins, referenceAngle, angleData.get());
+        status = SUSTAINABLE;
+        statusText = "Sustainable: " + load + ".";
+    }
+}
+
+void PerformancePanel::paint (Graphics& g)
+{
+    g.fillAll (findColour (ThemeColours::componentBackground));
+
+    juce::Rectangle<int> area = getLocalBounds().reduced (padding);
+
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions ("Inter", "Semi Bold", 18.0f));
+    g.drawText ("Performance", area.removeFromTop (rowHeight), Justification::left);
+
+    // status indicator and explanation
+    juce::Rectangle<int> statusArea = area.removeFromTop (2 * rowHeight);
+    const Colour statusColours[] = { findColour (ThemeColours::defaultFill), Colours::limegreen, Colours::orange, Colours::red };
+    g.setColour (statusColours[status]);
+    g.fillEllipse (statusArea.removeFromLeft (rowHeight).withSizeKeepingCentre (12, 12).withY (statusArea.getY() + 3).toFloat());
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions (14.0f));
+    g.drawFittedText (statusText, statusArea.withTrimmedLeft (4), Justification::topLeft, 2);
+
+    area.removeFromTop (padding);
+    paintHistogram (g, area.removeFromTop (histogramHeight));
+    area.removeFromTop (padding);
+
+    if (! hasLatest)
+    {
+        return;
+    }
+
+    // summary
+    const LatencyHistogram::Snapshot& blocks = latest.blockTimes;
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions (14.0f));
+
+    String misses = "Blocks: " + String (int64 (blocks.count)) + ", deadline misses: " + String (latest.numDeadlineMisses);
+    if (hasWindowStats)
+    {
+        misses += " (" + String (windowStats.numDeadlineMisses) + " in the last second)";
+    }
+    g.drawText (misses, area.removeFromTop (rowHeight), Justification::left);
+
+    g.drawText ("Block time p50 / p99 / max: " + formatNs (blocks.getPercentileNs (0.5)) + " / "
+                    + formatNs (blocks.getPercentileNs (0.99)) + " / " + formatNs (double (blocks.maxNs))
+                    + " of " + formatNs (double (latest.blockDurationNs)),
+                area.removeFromTop (rowHeight),
+                Justification::left);
+
+    String arSummary = "AR order " + String (latest.arOrder) + ", refit every " + String (latest.calcInterval) + " ms";
+    if (! latest.timingEnabled)
+    {
+        arSummary += " (enable Stage Timing for fit times)";
+    }
+    else if (hasWindowStats && windowStats.arLoad >= 0)
+    {
+        arSummary += ", thread " + formatPercent (windowStats.arLoad) + " busy";
     }
+    g.drawText (arSummary, area.removeFromTop (rowHeight), Justification::left);
+
+    auto formatDepth = [] (int depth)
+    { return depth >= 0 ? String (depth) : String ("?"); };
+    g.drawText ("Queues: " + formatDepth (latest.queues.pendingEvents) + " pending events, "
+                    + String (latest.queues.readyJobs) + "/" + String (GroundTruthEngine::numJobs) + " analysis jobs, "
+                    + formatDepth (latest.queues.phases) + " unread phases",
+                area.removeFromTop (rowHeight),
+                Justification::left);
+
+    size_t channelBytes = 0;
+    for (const auto& channel : latest.channels)
+    {
+        channelBytes += channel.memoryBytes;
+    }
+    g.drawText ("Memory: " + String (channelBytes / 1024.0, 1) + " KiB (channels) + "
+                    + String (latest.groundTruthMemoryBytes / 1024.0, 1) + " KiB (visualizer analysis)",
+                area.removeFromTop (rowHeight),
+                Justification::left);
+
+    area.removeFromTop (padding);
+
+    // per-channel table
+    const int columnWidths[] = { 50, 120, 80, 100 };
+    auto drawRow = [&] (const Array<String>& cells, const Array<Colour>& colours)
+    {
+        juce::Rectangle<int> row = area.removeFromTop (rowHeight);
+        for (int col = 0; col < cells.size(); ++col)
+        {
+            juce::Rectangle<int> cell = col < 4 ? row.removeFromLeft (columnWidths[col]) : row;
+            g.setColour (colours[col]);
+            g.drawText (cells[col], cell, Justification::left);
+        }
+    };
+
+    const Colour textColour = findColour (ThemeColours::defaultText);
+    Array<Colour> headerColours;
+    headerColours.insertMultiple (0, textColour, 5);
+    g.setFont (FontOptions ("Inter", "Semi Bold", 14.0f));
+    drawRow ({ "Chan", L"Fit p50/p99 (\u00b5s)", "Refit (Hz)", "Model age (ms)", "Memory (KiB)" }, headerColours);
 
-    angleData.reset (newAngleData);
+    g.setFont (FontOptions (14.0f));
+    const double targetRate = 1000.0 / jmax (1, latest.calcInterval);
+    for (const auto& channel : latest.channels)
+    {
+        Array<Colour> colours = headerColours;
+
+        String fitTimes = "-";
+        if (channel.fitTimes.count > 0)
+        {
+            fitTimes = String (roundToInt (channel.fitTimes.getPercentileNs (0.5) / 1e3)) + " / "
+                       + String (roundToInt (channel.fitTimes.getPercentileNs (0.99) / 1e3));
+        }
+
+        String rate = "-";
+        double achievedRate = hasWindowStats ? windowStats.getRefreshRate (channel.chan) : -1;
+        if (achievedRate >= 0)
+        {
+            rate = String (achievedRate, 1) + " / " + String (targetRate, 1);
+            if (channel.modelAgeMs >= 0 && achievedRate < 0.8 * targetRate)
+            {
+                colours.set (2, Colours::orange);
+            }
+        }
+
+        // a model older than a few refresh intervals is not being refit in time
+        String age = channel.modelAgeMs >= 0 ? String (roundToInt (channel.modelAgeMs)) : String ("-");
+        if (channel.modelAgeMs > 3 * latest.calcInterval + 100)
+        {
+            colours.set (3, Colours::orange);
+        }
+
+        drawRow ({ String (channel.chan + 1), fitTimes, rate, age, String (channel.memoryBytes / 1024.0, 1) }, colours);
+    }
 }
 
-void RosePlot::updateAngles()
+void PerformancePanel::paintHistogram (Graphics& g, juce::Rectangle<int> area)
 {
-    float step = 2 * float_Pi / numBins;
-    binMidpoints.resize (numBins);
-    for (int i = 0; i < numBins; ++i)
+    g.setColour (findColour (ThemeColours::widgetBackground));
+    g.fillRect (area);
+
+    const int labelHeight = 14;
+    juce::Rectangle<int> labelArea = area.removeFromBottom (labelHeight).reduced (2, 0);
+    juce::Rectangle<float> plotArea = area.reduced (2).toFloat();
+
+    if (! hasLatest || latest.blockTimes.count == 0)
     {
-        binMidpoints.set (i, step * (i + 0.5));
-        float firstAngle = float (Node::circDist (double_Pi / 2, step * (i + 1)));
-        segmentAngles.set (i, { firstAngle, firstAngle + step });
+        return;
+    }
+
+    const LatencyHistogram::Snapshot& blocks = latest.blockTimes;
+
+    // show the occupied bins and the block duration, over at least minShownBins bins
+    const int minShownBins = 8;
+    int firstBin = LatencyHistogram::numBins - 1;
+    int lastBin = 0;
+    uint64 maxCount = 0;
+    for (int bin = 0; bin < LatencyHistogram::numBins; ++bin)
+    {
+        if (blocks.bins[bin] > 0)
+        {
+            firstBin = jmin (firstBin, bin);
+            lastBin = jmax (lastBin, bin);
+            maxCount = jmax (maxCount, blocks.bins[bin]);
+        }
+    }
+
+    double durationLog2 = latest.blockDurationNs > 0 ? std::log2 (double (latest.blockDurationNs)) : -1;
+    if (durationLog2 >= 0)
+    {
+        firstBin = jmin (firstBin, int (durationLog2));
+        lastBin = jmax (lastBin, int (durationLog2));
+    }
+
+    lastBin = jmin (LatencyHistogram::numBins - 1, jmax (lastBin, firstBin + minShownBins - 1));
+    firstBin = jmax (0, jmin (firstBin, lastBin - minShownBins + 1));
+
+    const int numShown = lastBin - firstBin + 1;
+    const float binWidth = plotArea.getWidth() / numShown;
+
+    // counts on a log scale, so that rare slow blocks are visible
+    const double logMax = std::log1p (double (maxCount));
+    for (int bin = firstBin; bin <= lastBin; ++bin)
+    {
+        if (blocks.bins[bin] == 0)
+        {
+            continue;
+        }
+
+        float barHeight = float (plotArea.getHeight() * std::log1p (double (blocks.bins[bin])) / logMax);
+        bool late = durationLog2 >= 0 && bin + 1 > durationLog2;
+        g.setColour (late ? Colours::red : findColour (ThemeColours::highlightedFill));
+        g.fillRect (plotArea.getX() + (bin - firstBin) * binWidth + 1, plotArea.getBottom() - barHeight, binWidth - 2, barHeight);
+    }
+
+    g.setColour (findColour (ThemeColours::defaultText));
+    g.setFont (FontOptions (12.0f));
+    g.drawText (formatNs (std::ldexp (1.0, firstBin)), labelArea, Justification::left);
+    g.drawText (formatNs (std::ldexp (1.0, lastBin + 1)), labelArea, Justification::right);
+
+    // block duration (deadline)
+    if (durationLog2 >= 0)
+    {
+        float x = plotArea.getX() + float ((durationLog2 - firstBin) / numShown) * plotArea.getWidth();
+        g.drawVerticalLine (roundToInt (x), plotArea.getY(), plotArea.getBottom());
+        g.drawText ("block", juce::Rectangle<float> (x - 30, float (labelArea.getY()), 60, float (labelHeight)), Justification::centred);
     }
 }
-} // namespace PhaseCalculator
\ No newline at end of file
+} // namespace PhaseCalculator
@@ -24,22 +24,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef PHASE_CALCULATOR_CANVAS_H_INCLUDED
 #define PHASE_CALCULATOR_CANVAS_H_INCLUDED
 
+#include "CircularStats.h"
 #include "PhaseCalculator.h"
 #include <VisualizerWindowHeaders.h>
-#include <functional>
-#include <set> // std::multiset
 
 namespace PhaseCalculator
 {
 class Canvas;
 
-class RosePlot
-    : public Component,
-      public Label::Listener
+class RosePlot : public Component
 {
 public:
     /** Constructor*/
-    RosePlot (Canvas* c);
+    RosePlot (Canvas* c, const GroundTruthEngine::Target& target);
 
     /** Destructor */
     ~RosePlot();
@@ -47,78 +44,200 @@ public:
     /** Draw the plot*/
     void paint (Graphics& g) override;
 
+    /** Invalidate the cached grid */
+    void resized() override;
+
+    /** Invalidate the cached grid (on theme change) */
+    void lookAndFeelChanged() override;
+
+    /** Select this plot in the canvas */
+    void mouseDown (const MouseEvent& event) override;
+
+    // (continuous channel, event line) pair plotted; eventLine < 0 if none
+    const GroundTruthEngine::Target& getTarget() const { return target; }
+
+    /** Show a "channel / line" title (when several plots are shown) */
+    void setShowTitle (bool shouldShow);
+
+    /** Highlight as the plot whose statistics are shown */
+    void setSelected (bool isSelected);
+
     /** Change number of bins and repaint*/
     void setNumBins (int newNumBins);
 
     /**Change reference angle and repaint*/
     void setReference (double newReference);
 
-    /** Add a new angle (in radians) and repaint*/
-    void addAngle (double newAngle);
+    /** Change which angles the plot and statistics cover (see CircularStats) and repaint*/
+    void setStatsMode (CircularStats::Mode newMode, double newWindow);
+
+    /** Add a new angle (in radians), received at the given time (in seconds).
+        Does not repaint, so that a batch of angles results in a single repaint. */
+    void addAngle (double newAngle, double time);
 
     /** Remove all angles from the plot and repaint*/
     void clear();
 
+    // number of angles currently included in the plot and statistics
     int getNumAngles();
 
+    // number of angles received since the last clear
+    int64 getNumReceived();
+
     // output statistics, in degrees
     double getCircMean (bool usingReference = true);
     double getCircStd();
 
-    // implements Label::Listener
-    void labelTextChanged (Label* labelThatHasChanged) override;
-
     static const int maxBins = 120;
     static const int startNumBins = 24;
     static const int startReference = 0;
     static const int textBoxSize = 50;
+    static const int minTextBoxSize = 16;
+    static const int titleHeight = 18;
 
 private:
-    class AngleDataMultiset : public std::multiset<double, std::function<bool (double, double)>>
-    {
-    public:
-        // create empty multiset
-        AngleDataMultiset (int numBins, double referenceAngle);
-
-        // copy nodes from dataSource to newly constructed multiset
-        AngleDataMultiset (int numBins, double referenceAngle, AngleDataMultiset* dataSource);
+    // make segmentAngles reflect current numBins
+    void updateAngles();
 
-    private:
-        static bool circularBinCompare (int numBins, double referenceAngle, double lhs, double rhs);
-    };
+    // size of the degree labels around the plot, scaled down for small plots
+    int getTextBoxSize();
 
-    // make binMidpoints and segmentAngles reflect current numBins
-    void updateAngles();
+    // bounds of the circular plot area, within local bounds
+    juce::Rectangle<float> getPlotBounds();
 
-    // reassign angleData to refer to a new AngleDataMultiset with the current parameters
-    // (but keep the same data points)
-    void reorganizeAngleData();
+    // draw the background, spokes, degree labels and concentric circles into gridImage
+    void renderGrid (float scale);
 
     Canvas* canvas;
 
-    std::unique_ptr<AngleDataMultiset> angleData;
+    GroundTruthEngine::Target target;
+    bool showTitle;
+    bool selected;
+
     int numBins;
     double referenceAngle;
 
+    // angles, statistics and per-segment weights (segment i == bin i)
+    CircularStats angleData;
+
     // for each rose plot segment:
-    // midpoint angle in radians CCW from positive x axis
-    Array<double> binMidpoints;
     // inputs to addPieSegment (clockwise from top)
     Array<std::pair<float, float>> segmentAngles;
 
     float edgeWeight;
 
-    // sum of exp(a*j) for each angle a
-    std::complex<double> rSum;
+    // static layers, rendered at the physical pixel scale of the last paint
+    Image gridImage;
+    float gridScale;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RosePlot);
 };
 
+/** Bar plot of the online phase error distribution, from -180 to 180 degrees */
+class ErrorHistogram : public Component
+{
+public:
+    ErrorHistogram() {}
+
+    void paint (Graphics& g) override;
+
+    /** Set the weight of each bin and repaint */
+    void setData (const Array<double>& newBins);
+
+private:
+    Array<double> bins;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ErrorHistogram);
+};
+
+/*
+    Live view of the processing load of the selected stream: histogram of block times against
+    the block duration, deadline misses, AR model fit times, achieved refresh rate and model age
+    per channel, ground truth queue depths and memory use, and whether the load is sustainable.
+    Rates and the recent load are computed over windows of at least windowMs.
+*/
+class PerformancePanel : public Component
+{
+public:
+    PerformancePanel();
+
+    void paint (Graphics& g) override;
+
+    /** Takes a new snapshot from the Node and repaints */
+    void update (const PerformanceSnapshot& snapshot);
+
+    /** Forgets all snapshots (e.g. when the stream or acquisition changes) */
+    void clear();
+
+    /** Height needed to show every channel */
+    int getPreferredHeight() const;
+
+    enum Status
+    {
+        IDLE = 0, // nothing processed yet
+        SUSTAINABLE,
+        MARGINAL, // keeping up, but with little headroom
+        UNSUSTAINABLE
+    };
+
+    static const int windowMs = 1000;
+    static const int rowHeight = 18;
+    static const int histogramHeight = 90;
+
+private:
+    // statistics of the last complete window
+    struct WindowStats
+    {
+        int64 numBlocks = 0;
+        int64 numDeadlineMisses = 0;
+
+        // p99 block time over the block duration
+        double blockLoad = 0;
+
+        // fraction of the AR thread's time spent fitting (negative if unknown)
+        double arLoad = -1;
+
+        // (channel index, achieved AR refresh rate in Hz) of each channel fit during the window
+        Array<std::pair<int, double>> refreshRates;
+
+        // rate of the given channel, or negative if unknown
+        double getRefreshRate (int chan) const;
+    };
+
+    // computes windowStats from windowStart and latest, which are the given number of seconds apart
+    void finishWindow (double seconds);
+
+    // sets status and statusText from latest and windowStats
+    void evaluate();
+
+    // block time histogram (log2 bins, log counts), with the block duration marked
+    void paintHistogram (Graphics& g, juce::Rectangle<int> area);
+
+    static const int padding = 8;
+    static const int numSummaryRows = 5;
+
+    PerformanceSnapshot latest;
+    bool hasLatest;
+
+    PerformanceSnapshot windowStart;
+    uint32 windowStartMs;
+    bool hasWindowStart;
+
+    WindowStats windowStats;
+    bool hasWindowStats;
+
+    Status status;
+    String statusText;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PerformancePanel);
+};
+
 class Canvas
     : public Visualizer,
       public ComboBox::Listener,
       public Slider::Listener,
-      public Button::Listener
+      public Button::Listener,
+      public Label::Listener
 {
 public:
     /** Constructor */
@@ -133,9 +252,11 @@ public:
     void paint (Graphics& g) override;
     void resized() override;
 
-    void addAngle (double newAngle);
     void clearAngles();
 
+    /** Show the statistics of the given plot and edit its channel and event line */
+    void selectPlot (RosePlot* plot);
+
     // implements ComboBox::Listener
     void comboBoxChanged (ComboBox* comboBoxThatHasChanged) override;
 
@@ -145,9 +266,15 @@ public:
     // implements Button::Listener
     void buttonClicked (Button* button) override;
 
+    // implements Label::Listener
+    void labelTextChanged (Label* labelThatHasChanged) override;
+
     // updates countLabel, meanLabel, and stdLabel
     void updateStatLabels();
 
+    // updates the online phase error labels and histogram from errorSnapshot
+    void updateErrorStats();
+
     /** Saves parameters to disk */
     void saveCustomParametersToXml (XmlElement* xml) override;
 
@@ -161,15 +288,37 @@ private:
     int getRosePlotDiameter (int height, int* verticalPadding);
     int getContentWidth (int width, int diameter, int* leftPadding);
 
+    // applies the selected statistics mode and window to the rose plots
+    void updateStatsMode();
+
+    // makes rosePlots match the Node's targets, keeping the data of plots whose target remains
+    void updatePlots (const Array<GroundTruthEngine::Target>& newTargets);
+
+    // shows the selected plot's channel and event line in the ComboBoxes
+    void displaySelectedTarget();
+
+    // writes a new list of targets to the "vis_cont", "vis_event" and "vis_targets" parameters
+    // (the first target becomes the main pair)
+    void setTargets (const Array<GroundTruthEngine::Target>& newTargets);
+
+    RosePlot* getSelectedPlot() { return rosePlots[selectedPlot]; }
+
     Node* processor;
 
     // to swap with the queue of phases from the Node
-    std::queue<double> tempPhaseBuffer;
+    std::queue<EventPhase> tempPhaseBuffer;
+
+    // latest online phase error statistics from the Node
+    PhaseErrorSnapshot errorSnapshot;
 
     std::unique_ptr<Viewport> viewport;
     std::unique_ptr<Component> canvas;
     std::unique_ptr<Component> rosePlotOptions;
-    std::unique_ptr<RosePlot> rosePlot;
+
+    // one plot per target (or one empty plot if there are none)
+    OwnedArray<RosePlot> rosePlots;
+    Array<GroundTruthEngine::Target> plotTargets;
+    int selectedPlot;
 
     // options panel
     std::unique_ptr<Label> cChannelLabel;
@@ -177,6 +326,9 @@ private:
     std::unique_ptr<Label> eChannelLabel;
     std::unique_ptr<ComboBox> eChannelBox;
 
+    std::unique_ptr<UtilityButton> addPlotButton;
+    std::unique_ptr<UtilityButton> removePlotButton;
+
     std::unique_ptr<Label> numBinsLabel;
     std::unique_ptr<Slider> numBinsSlider;
 
@@ -185,21 +337,49 @@ private:
     std::unique_ptr<Label> referenceLabel;
     std::unique_ptr<CustomTextBox> referenceEditable;
 
+    std::unique_ptr<Label> statsModeLabel;
+    std::unique_ptr<ComboBox> statsModeBox;
+    std::unique_ptr<CustomTextBox> statsWindowEditable;
+    std::unique_ptr<Label> statsWindowUnitLabel;
+
     std::unique_ptr<Label> countLabel;
     std::unique_ptr<Label> meanLabel;
     std::unique_ptr<Label> stdLabel;
 
+    std::unique_ptr<Label> errorMeanLabel;
+    std::unique_ptr<Label> errorStdLabel;
+    std::unique_ptr<ErrorHistogram> errorHistogram;
+
+    std::unique_ptr<Label> exportLabel;
+    std::unique_ptr<ComboBox> exportBox;
+
+    std::unique_ptr<UtilityButton> performanceButton;
+
+    // shown to the right of the options panel while performanceButton is on
+    std::unique_ptr<PerformancePanel> performancePanel;
+
     static const int minPadding = 5;
     static const int maxLeftPadding = 50;
     static const int minDiameter = 350;
     static const int maxDiameter = 550;
     static const int optionsWidth = 320;
+    static const int plotSpacing = 6;
+    static const int maxPlots = 16;
+    static const int performanceWidth = 440;
+
+    // height of the options panel contents
+    int optionsHeight;
+
+    // last valid window for each statistics mode (events, seconds, half-life in seconds)
+    double statsWindows[CircularStats::NUM_MODES] = { 0, 100, 60, 30 };
 
     const String cChanTooltip = "Channel containing data whose high-accuracy phase is calculated for each event";
+    const String plotsTooltip = "Plot several (channel, event line) pairs at once; click a plot to select it";
     const String refTooltip = "Base phase (in degrees) to subtract from each calculated phase";
-    const String countFmt = L"Events received: %d";
-    const String meanFmt = L"Mean phase (vs. reference): %.2f\u00b0";
-    const String stdFmt = L"Standard deviation phase: %.2f\u00b0";
+    const String errorTooltip = "Real-time output phase minus the delayed (accurate) phase, at each event";
+    const String statsTooltip = "Which events the rose plot and statistics include. Useful to monitor drift during long runs.";
+    const String performanceTooltip = "Show block processing times, AR model fits, queue depths and memory use, and whether the current channels and AR order can be sustained";
+    const String exportTooltip = "While recording, write each event's sample number, event line, channel, phase, online phase and amplitude to a file in the recording directory";
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Canvas);
 };
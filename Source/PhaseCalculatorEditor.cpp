@@ -30,7 +30,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 namespace PhaseCalculator
 {
 Editor::Editor (Node* parentNode)
-    : VisualizerEditor (parentNode, "Event Phase Plot", 310)
+    : VisualizerEditor (parentNode, "Event Phase Plot", 1010)
 {
     // make the canvas now, so that restoring its parameters always works.
     canvas = std::make_unique<Canvas> (parentNode);
@@ -47,6 +47,32 @@ Editor::Editor (Node* parentNode)
 
     addSelectedChannelsParameterEditor (Parameter::STREAM_SCOPE, "Channels", 10, 75);
 
+    addToggleParameterEditor (Parameter::STREAM_SCOPE, "telemetry", 310, 25);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "ht_delay", 310, 75);
+
+    addComboBoxParameterEditor (Parameter::STREAM_SCOPE, "model_rate", 410, 25);
+
+    addToggleParameterEditor (Parameter::STREAM_SCOPE, "full_rate", 410, 75);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "crossing_chan", 510, 25);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "crossing_phases", 510, 75);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "crossing_refractory", 610, 25);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "crossing_min_amp", 610, 75);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "horizon", 710, 25);
+
+    addComboBoxParameterEditor (Parameter::STREAM_SCOPE, "extra_outputs", 710, 75);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "extra_bands", 810, 25);
+
+    addTextBoxParameterEditor (Parameter::STREAM_SCOPE, "chan_overrides", 810, 75);
+
+    addComboBoxParameterEditor (Parameter::STREAM_SCOPE, "estimator", 910, 25);
+
     for (auto ed : parameterEditors)
     {
         ed->setLayout (ParameterEditor::Layout::nameOnTop);
@@ -0,0 +1,149 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <algorithm> // sort
+#include <cmath> // ceil, fmod
+#include <limits> // numeric_limits
+
+#include "PhaseCrossings.h"
+
+namespace PhaseCalculator
+{
+static const double sampleTolerance = 1e-9;
+
+CrossingDetector::CrossingDetector()
+    : locked (false), refractory (0), minMag (0), enabled (false), checked (false), bufferSize (0), maxCrossings (0)
+{
+    reset();
+}
+
+void CrossingDetector::setTargets (const Array<float>& targetDegrees, int refractorySamples, double minMagnitude)
+{
+    const ScopedLock settingsScope (settingsLock);
+
+    targets.clearQuick();
+    for (float degrees : targetDegrees)
+    {
+        targets.add (degrees * double_Pi / 180);
+    }
+
+    refractory = jmax (0, refractorySamples);
+    minMag = jmax (0.0, minMagnitude);
+    enabled = ! targets.isEmpty();
+
+    // the engine never adds more crossings than there is room for
+    maxCrossings = targets.size() * maxCrossingsPerTarget;
+    crossings.ensureStorageAllocated (maxCrossings);
+    segmentCrossings.ensureStorageAllocated (targets.size());
+}
+
+void CrossingDetector::reset()
+{
+    primed = false;
+    lastCrossing = std::numeric_limits<int64>::min() / 2;
+    crossings.clearQuick();
+}
+
+void CrossingDetector::beginBuffer (int nSamples)
+{
+    // the audio thread must not wait for setTargets, so the buffer is skipped if it holds the lock
+    locked = settingsLock.tryEnter();
+    crossings.clearQuick();
+    bufferSize = nSamples;
+    checked = false;
+}
+
+void CrossingDetector::checkSegment (double phase0, double mag0, double pos0, double phase1, double mag1, double pos1)
+{
+    if (! locked)
+    {
+        return;
+    }
+
+    const bool continues = primed || checked;
+    checked = true;
+    if (! continues)
+    {
+        return;
+    }
+
+    static const double twoPi = 2 * double_Pi;
+
+    // forward step from phase0 to phase1, in (-pi, pi]
+    double step = std::fmod (phase1 - phase0, twoPi);
+    step += step <= -double_Pi ? twoPi : (step > double_Pi ? -twoPi : 0);
+    if (step <= 0)
+    {
+        return;
+    }
+
+    segmentCrossings.clearQuick();
+    for (int t = 0; t < targets.size(); ++t)
+    {
+        // distance from phase0 forward to the target, in [0, 2 pi)
+        double dist = std::fmod (targets[t] - phase0, twoPi);
+        dist += dist < 0 ? twoPi : 0;
+        if (dist == 0 || dist > step)
+        {
+            continue;
+        }
+
+        // (crossings that land on a sample, up to rounding, are reported at that sample)
+        double fraction = dist / step;
+        double position = pos0 + fraction * (pos1 - pos0);
+        int sample = int (std::ceil (position - sampleTolerance));
+        if (sample >= 0 && sample < bufferSize && mag0 + fraction * (mag1 - mag0) >= minMag)
+        {
+            segmentCrossings.add ({ position, t });
+        }
+    }
+
+    std::sort (segmentCrossings.begin(), segmentCrossings.end());
+    for (auto& crossing : segmentCrossings)
+    {
+        int sample = int (std::ceil (crossing.first - sampleTolerance));
+        if (crossings.size() >= maxCrossings)
+        {
+            break; // (drop the rest rather than allocate)
+        }
+
+        if (sample - lastCrossing >= refractory)
+        {
+            crossings.add ({ crossing.second, sample });
+            lastCrossing = sample;
+        }
+    }
+}
+
+void CrossingDetector::endBuffer()
+{
+    lastCrossing -= bufferSize;
+    primed = checked;
+
+    if (locked)
+    {
+        settingsLock.exit();
+        locked = false;
+    }
+}
+} // namespace PhaseCalculator
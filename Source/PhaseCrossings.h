@@ -0,0 +1,135 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PHASE_CROSSINGS_H_INCLUDED
+#define PHASE_CROSSINGS_H_INCLUDED
+
+/*
+
+Detection of target phase crossings for a channel, so that TTL events can be sent from the same
+pass that writes the phase out (see Node::process), without another pass over the output.
+
+The engine calls checkSegment for each pair of consecutive computed frames (the Hilbert
+transformer outputs that the phase is interpolated between, or every sample in full-rate mode),
+with the same linear interpolation that produces the output. A target is crossed when the
+phase moves forward through it (backward steps, e.g. from noise, are ignored), at the
+interpolated fractional position; the crossing is reported at the first output sample at or
+after that position, so it is the first sample whose output phase has passed the target.
+
+Crossings are only counted while the magnitude of the analytic signal, interpolated the same
+way, is at least minMagnitude (in the units of the input), and at least refractorySamples after
+the previous crossing of any target.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+
+namespace PhaseCalculator
+{
+class CrossingDetector
+{
+public:
+    CrossingDetector();
+
+    struct Crossing
+    {
+        int target; // index into the targets
+        int sample; // index of the sample within the buffer
+    };
+
+    /*
+        * Sets the target phases (in degrees), the minimum time between crossings in samples and
+        * the minimum magnitude. No targets turns detection off. Can be called from any thread (a
+        * buffer that starts while the settings are being changed is not checked).
+        */
+    void setTargets (const Array<float>& targetDegrees, int refractorySamples, double minMagnitude);
+
+    bool isEnabled() const { return enabled; }
+
+    // forget the last frame and crossing (e.g. after the channel is reset)
+    void reset();
+
+    // ---- called by the engine for each buffer ----
+
+    /*
+        * Locks the settings for a buffer of nSamples, if they are not being changed (otherwise,
+        * the buffer is not checked), and clears the crossings of the last one.
+        */
+    class BufferScope
+    {
+    public:
+        BufferScope (CrossingDetector& d, int nSamples) : detector (d) { detector.beginBuffer (nSamples); }
+        ~BufferScope() { detector.endBuffer(); }
+
+    private:
+        CrossingDetector& detector;
+
+        JUCE_DECLARE_NON_COPYABLE (BufferScope);
+    };
+
+    /*
+        * Checks the segment between the frame (phase0, mag0) at position pos0 and the frame
+        * (phase1, mag1) at pos1 (in samples from the start of the buffer; phases in radians).
+        * Segments must be checked in order and without gaps; only crossings at samples within the
+        * buffer are kept, so segments may start before or end after it. The first segment of a
+        * buffer starts from the engine's last frame of the previous one, so it is skipped if no
+        * segment was checked in the previous buffer (e.g. after a reset, or while disabled).
+        */
+    void checkSegment (double phase0, double mag0, double pos0, double phase1, double mag1, double pos1);
+
+    // crossings found in the last buffer, in time order (at most maxCrossingsPerTarget per target)
+    const Array<Crossing>& getCrossings() const { return crossings; }
+
+    // crossings kept per target and buffer; storage for them is allocated by setTargets
+    static const int maxCrossingsPerTarget = 64;
+
+private:
+    void beginBuffer (int nSamples);
+
+    // releases the settings and moves the time of the last crossing back by the buffer's length
+    void endBuffer();
+
+    CriticalSection settingsLock;
+    bool locked; // whether the current buffer holds the settings lock (and is checked)
+    Array<double> targets; // radians
+    int refractory;
+    double minMag;
+    std::atomic<bool> enabled;
+
+    bool primed; // whether a segment was checked in the previous buffer
+    bool checked; // whether a segment was checked in the current buffer
+    int bufferSize;
+    int maxCrossings;
+    int64 lastCrossing; // sample of the last crossing, relative to the start of the current buffer
+    Array<Crossing> crossings;
+
+    // crossings within one segment, before they are sorted and checked against the refractory period
+    Array<std::pair<double, int>> segmentCrossings;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CrossingDetector);
+};
+} // namespace PhaseCalculator
+
+#endif // PHASE_CROSSINGS_H_INCLUDED
@@ -0,0 +1,1094 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cfloat> // FLT_EPSILON
+#include <cmath> // ceil, atan2
+#include <cstring> // memcpy, memmove
+
+#include "PhaseEngine.h"
+
+namespace PhaseCalculator
+{
+/*** ReverseStack ***/
+ReverseStack::ReverseStack (int size)
+    : freeSpace (size), headOffset (size - 1)
+{
+    resize (size);
+}
+
+void ReverseStack::reset()
+{
+    const ScopedLock dataLock (getLock());
+    freeSpace = size();
+    headOffset = freeSpace - 1;
+}
+
+void ReverseStack::resetAndResize (int newSize)
+{
+    const ScopedLock dataLock (getLock());
+    resize (newSize);
+    freeSpace = newSize;
+    headOffset = newSize - 1;
+}
+
+bool ReverseStack::isFull() const
+{
+    return freeSpace == 0;
+}
+
+void ReverseStack::enqueue (const float* source, int n)
+{
+    const ScopedLock dataLock (getLock());
+
+    // skip samples that can't be written
+    int length = size();
+    int nToSkip = jmax (0, n - length);
+    int nToAdd = n - nToSkip;
+    source += nToSkip;
+
+    double* data = getRawDataPointer();
+
+    for (int nLeft = nToAdd; nLeft > 0; --nLeft)
+    {
+        data[headOffset--] = double (*(source++));
+        if (headOffset < 0)
+        {
+            headOffset = length - 1;
+        }
+    }
+
+    freeSpace = jmax (0, freeSpace - nToAdd);
+}
+
+int ReverseStack::getHeadOffset() const
+{
+    return headOffset;
+}
+
+void ReverseStack::unwrapAndCopy (double* dest, bool useLock, int maxSamples) const
+{
+    ScopedPointer<ScopedLock> lock;
+    if (useLock)
+    {
+        lock = new ScopedLock (getLock());
+    }
+
+    int length = size();
+    int nToCopy = maxSamples < 0 ? length : jmin (maxSamples, length);
+
+    const double* block2Start = begin();
+    int block2Size = (headOffset + 1) % length;
+
+    const double* block1Start = block2Start + block2Size;
+    int block1Size = length - block2Size;
+
+    int block1Copy = jmin (block1Size, nToCopy);
+    std::memcpy (dest, block1Start, block1Copy * sizeof (double));
+    std::memcpy (dest + block1Copy, block2Start, (nToCopy - block1Copy) * sizeof (double));
+}
+
+/*** EngineParams ***/
+EngineParams::EngineParams()
+    : arOrder (20),
+      band (ALPHA_THETA),
+      highCut (Hilbert::defaultBand[ALPHA_THETA][1]),
+      lowCut (Hilbert::defaultBand[ALPHA_THETA][0]),
+      htDelay (0),
+      modelRate (Hilbert::fs),
+      fullRate (false),
+      horizonMs (0),
+      estimator (AR_PREDICTION)
+{
+    updateTransformer();
+}
+
+void EngineParams::updateTransformer()
+{
+    if (htDelay > 0)
+    {
+        transformer = Hilbert::getDesign (modelRate, lowCut, highCut, htDelay);
+    }
+    else if (modelRate == Hilbert::fs)
+    {
+        transformer = Hilbert::getBuiltIn (band);
+    }
+    else
+    {
+        // as long (in time) as the band's built-in transformer
+        int delay = jlimit (1, Hilbert::maxDesignDelay, roundToInt (Hilbert::delay[band] * double (modelRate) / Hilbert::fs));
+        transformer = Hilbert::getDesign (modelRate, lowCut, highCut, delay);
+    }
+
+    htScaleFactor = transformer->getScaleFactor (lowCut, highCut);
+}
+
+Array<float> EngineParams::getValidBand() const
+{
+    return htDelay > 0 ? Hilbert::getDesignableBand (modelRate) : Hilbert::validBand[band];
+}
+
+/*** ChannelState ***/
+ChannelState::ChannelState()
+    : sampleRate (0), modelRate (Hilbert::fs), dsFactor (0), estimator (EngineParams::AR_PREDICTION), lastFitTime (0), numFits (0)
+{
+    reset();
+}
+
+void ChannelState::configure (const EngineParams& params, float newSampleRate, int minHistoryMs)
+{
+    sampleRate = newSampleRate;
+    modelRate = params.modelRate;
+    dsFactor = getDsFactor (sampleRate, modelRate);
+    jassert (isSupportedRate (sampleRate, modelRate));
+
+    // update length of history based on sample rate
+    // the history buffer should have enough samples to cover minHistoryMs (e.g. to calculate
+    // phases for the visualizer with the proper Hilbert transform length) AND train an AR model
+    // of the requested order, using at least 1 second of data
+    int modelHistorySize = jmax (minHistoryMs * modelRate / 1000, params.arOrder + 1, 1 * modelRate);
+    int newHistorySize = isResampling()
+                             ? int (std::ceil (modelHistorySize * double (sampleRate) / modelRate))
+                             : dsFactor * modelHistorySize;
+    history.resetAndResize (newHistorySize);
+
+    // when resampling, the AR model is fit on resampled data of the same duration
+    modelHistory.resetAndResize (isResampling() ? modelHistorySize : 0);
+    resampler.setRates (sampleRate, modelRate, isResampling() ? newHistorySize : 0); // a block never exceeds the history
+
+    // set filter parameters
+    filter.setup (
+        2, // order
+        sampleRate, // sample rate
+        (params.highCut + params.lowCut) / 2, // center frequency
+        params.highCut - params.lowCut); // bandwidth
+
+    if (isResampling())
+    {
+        arModeler.setParams (params.arOrder, modelHistorySize, 1);
+    }
+    else
+    {
+        arModeler.setParams (params.arOrder, newHistorySize, dsFactor);
+    }
+
+    transformer = params.transformer;
+    jassert (transformer->sampleRate == modelRate);
+    htState.resize (transformer->delay * 2 + 1);
+
+    // a block never exceeds the history (see PhaseEngine::processFullRate)
+    if (params.fullRate && ! isResampling())
+    {
+        const int maxHorizon = roundToInt (EngineParams::maxHorizonMs * sampleRate / 1000);
+        fullRateData.resize (newHistorySize + maxHorizon + transformer->delay * dsFactor);
+        fullRateMag.resize (newHistorySize);
+    }
+    else
+    {
+        fullRateData.clear();
+        fullRateMag.clear();
+    }
+
+    estimator = params.estimator;
+    endpointKernel = usesModel() ? nullptr : Hilbert::getEndpointKernel (modelRate, params.lowCut, params.highCut);
+
+    reset();
+}
+
+void ChannelState::reset()
+{
+    history.reset();
+    modelHistory.reset();
+    resampler.reset();
+    filter.reset();
+    arModeler.reset();
+    FloatVectorOperations::clear (htState.begin(), htState.size());
+    interpCountdown = 0;
+    lastComputedPhase = 0;
+    lastComputedMag = 0;
+    lastPhase = 0;
+    lastFitTime = 0;
+    crossings.reset();
+}
+
+bool ChannelState::fitModel (Array<double>& reverseData, bool recordTiming)
+{
+    const ReverseStack& source = isResampling() ? modelHistory : history;
+    if (! usesModel() || ! source.isFull())
+    {
+        return false;
+    }
+
+    jassert (reverseData.size() >= source.size());
+
+    StageClock clock (recordTiming ? &timings : nullptr);
+
+    {
+        const ScopedLock historyLock (source.getLock());
+        clock.lap (StageTimings::FIT_LOCK_WAIT);
+
+        // unwrap reversed history and add to temporary data array
+        source.unwrapAndCopy (reverseData.getRawDataPointer(), false);
+    }
+
+    // calculate parameters
+    arModeler.fitModel (reverseData);
+
+    clock.total (StageTimings::FIT);
+    lastFitTime = StageTimings::now();
+    ++numFits;
+    return true;
+}
+
+double ChannelState::getModelAgeMs() const
+{
+    int64 fitTime = lastFitTime;
+    if (fitTime == 0)
+    {
+        return -1;
+    }
+    return jmax (int64 (0), StageTimings::now() - fitTime) / 1e6;
+}
+
+size_t ChannelState::getMemoryBytes() const
+{
+    return sizeof (*this)
+           + sizeof (double) * size_t (history.size() + modelHistory.size() + htState.size() + fullRateData.size())
+           + sizeof (float) * size_t (fullRateMag.size())
+           + arModeler.getMemoryBytes();
+}
+
+int ChannelState::getDsFactor (float sampleRate, int modelRate)
+{
+    float fsMult = sampleRate / modelRate;
+    float fsMultRound = std::round (fsMult);
+
+    if (fsMultRound >= 1 && std::abs (fsMult - fsMultRound) < FLT_EPSILON)
+    {
+        // sample rate is multiple of Hilbert Fs
+        return int (fsMultRound);
+    }
+    return 0;
+}
+
+bool ChannelState::isSupportedRate (float sampleRate, int modelRate)
+{
+    // below the modeling rate, the bands could extend past the input's Nyquist frequency
+    return sampleRate >= modelRate;
+}
+
+/*** PhaseEngine ***/
+PhaseEngine::PhaseEngine()
+    : timingEnabled (true)
+{
+}
+
+bool PhaseEngine::processChannel (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra)
+{
+    if (nSamples == 0) // nothing to do
+    {
+        return false;
+    }
+
+    StageClock clock (timingEnabled ? &state.timings : nullptr);
+
+    // filter the data
+    float* const wpIn = data;
+    state.filter.process (nSamples, &wpIn);
+    clock.lap (StageTimings::FILTER);
+
+    return processFiltered (params, state, data, nSamples, extra);
+}
+
+bool PhaseEngine::processFiltered (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra)
+{
+    if (nSamples == 0) // nothing to do
+    {
+        return false;
+    }
+
+    StageClock clock (timingEnabled ? &state.timings : nullptr);
+    float* const wpIn = data;
+
+    // clears the last buffer's crossings, and keeps the targets fixed while this one is checked
+    CrossingDetector::BufferScope crossingScope (state.crossings, nSamples);
+
+    // enqueue as much new data as can fit into history
+    state.history.enqueue (wpIn, nSamples);
+    clock.lap (StageTimings::ENQUEUE);
+
+    if (state.isResampling())
+    {
+        return processResampled (params, state, data, nSamples, extra, clock);
+    }
+
+    // calc phase and write out (only if AR model has been calculated)
+    if (! state.history.isFull() || ! state.isEstimatorReady())
+    {
+        // just output zeros
+        clearOutputs (data, extra, nSamples);
+        return false;
+    }
+
+    if (params.fullRate)
+    {
+        return processFullRate (params, state, data, nSamples, extra, clock);
+    }
+
+    int stride = state.dsFactor;
+    const int horizon = params.getHorizonSamples (state.sampleRate);
+
+    // identify indices of current buffer to execute HT
+    htInds.clearQuick();
+    for (int i = state.interpCountdown; i < nSamples; i += stride)
+    {
+        htInds.add (i);
+    }
+
+    // frames (downsampled samples, every stride samples from interpCountdown) up to the one after
+    // the horizon from the last sample are output; those after the buffer are predicted
+    const int lastTarget = nSamples - 1 + horizon;
+    int htOutputSamps = (lastTarget >= state.interpCountdown ? (lastTarget - state.interpCountdown) / stride + 1 : 0) + 1;
+    if (htOutput.size() < htOutputSamps)
+    {
+        htOutput.resize (htOutputSamps);
+    }
+
+    if (! state.usesModel())
+    {
+        // the frames within the buffer are estimated from the history; the ones after it advance
+        // from the previous frame at the center frequency (from the last buffer's last frame)
+        const Hilbert::EndpointKernel& kernel = *state.endpointKernel;
+        const std::complex<double> frameStep = std::polar (1.0, 2 * Dsp::doublePi * kernel.centerFreq * stride / state.sampleRate);
+        std::complex<double> frameOut = std::polar (state.lastComputedMag, state.lastComputedPhase);
+        for (int k = 0; k < htOutputSamps; ++k)
+        {
+            frameOut = k < htInds.size() ? endpointSample (state.history, nSamples - 1 - htInds[k], kernel, stride) : frameOut * frameStep;
+            htOutput.set (k, frameOut);
+        }
+        clock.lap (StageTimings::TRANSFORM);
+    }
+    else
+    {
+        // read current AR parameters safely (uses lock internally)
+        state.arModeler.getModel (localARParams);
+
+        const Hilbert::Transformer& transformer = *state.transformer;
+        int htDelay = transformer.delay;
+
+        // use AR model to fill predSamps (which is downsampled) based on past data: up to htDelay
+        // frames past the last frame output
+        int nPredict = htOutputSamps + htDelay - htInds.size();
+        if (predSamps.size() < nPredict)
+        {
+            predSamps.resize (nPredict);
+        }
+
+        double* pPredSamps = predSamps.getRawDataPointer();
+        const double* pLocalParam = localARParams.getRawDataPointer();
+        arPredict (state.history, state.interpCountdown, pPredSamps, pLocalParam, nPredict, stride, params.arOrder);
+        clock.lap (StageTimings::PREDICT);
+
+        // execute tranformer on current buffer
+        int kOut = -htDelay;
+        for (int kIn = 0; kIn < htInds.size(); ++kIn, ++kOut)
+        {
+            double samp = htFilterSamp (wpIn[htInds[kIn]], transformer, state.htState);
+            if (kOut >= 0)
+            {
+                double rc = wpIn[htInds[kOut]];
+                double ic = params.htScaleFactor * samp;
+                htOutput.set (kOut, std::complex<double> (rc, ic));
+            }
+        }
+
+        // copy state to transform prediction without changing the end-of-buffer state
+        htTempState = state.htState;
+
+        // execute transformer on prediction
+        for (int i = 0; i < nPredict; ++i, ++kOut)
+        {
+            double samp = htFilterSamp (predSamps[i], transformer, htTempState);
+            if (kOut >= 0)
+            {
+                double rc = kOut < htInds.size() ? wpIn[htInds[kOut]] : predSamps[kOut - htInds.size()];
+                double ic = params.htScaleFactor * samp;
+                htOutput.set (kOut, std::complex<double> (rc, ic));
+            }
+        }
+        clock.lap (StageTimings::TRANSFORM);
+    }
+
+    // output with upsampling (interpolation)
+    float* wpOut = data;
+
+    double nextComputedPhase, phaseStep;
+
+    // sample i is interpolated as if it were sample i + horizon: start from the frame (and the
+    // countdown to it) that sample horizon would start from
+    int countdown = state.interpCountdown - horizon % stride;
+    int frame = horizon / stride;
+    if (countdown < 0)
+    {
+        countdown += stride;
+        ++frame;
+    }
+
+    const int firstCountdown = countdown;
+    const int firstFrame = frame;
+
+    nextComputedPhase = std::arg (htOutput[frame]);
+    double prevComputedPhase = frame == 0 ? state.lastComputedPhase : std::arg (htOutput[frame - 1]);
+    phaseStep = circDist (nextComputedPhase, prevComputedPhase, Dsp::doublePi) / stride;
+
+    for (int i = 0; i < nSamples; ++i, --countdown)
+    {
+        if (countdown == 0)
+        {
+            // update interpolation frame
+            ++frame;
+            countdown = stride;
+
+            nextComputedPhase = std::arg (htOutput[frame]);
+        }
+
+        double thisPhase = circDist (nextComputedPhase, phaseStep * countdown, Dsp::doublePi);
+        wpOut[i] = float (thisPhase * (180.0 / Dsp::doublePi));
+    }
+
+    if (extra.any())
+    {
+        // the same frames, with each value interpolated between the frames on either side
+        std::complex<double> prev = firstFrame == 0 ? std::polar (state.lastComputedMag, state.lastComputedPhase) : htOutput[firstFrame - 1];
+        std::complex<double> next = htOutput[firstFrame];
+        double prevMag = std::abs (prev), nextMag = std::abs (next);
+
+        countdown = firstCountdown;
+        frame = firstFrame;
+        for (int i = 0; i < nSamples; ++i, --countdown)
+        {
+            if (countdown == 0)
+            {
+                ++frame;
+                countdown = stride;
+
+                prev = next;
+                prevMag = nextMag;
+                next = htOutput[frame];
+                nextMag = std::abs (next);
+            }
+
+            double prevWeight = double (countdown) / stride;
+            if (extra.magnitude != nullptr)
+            {
+                extra.magnitude[i] = float (nextMag + (prevMag - nextMag) * prevWeight);
+            }
+            if (extra.imaginary != nullptr)
+            {
+                extra.imaginary[i] = float (next.imag() + (prev.imag() - next.imag()) * prevWeight);
+            }
+        }
+    }
+
+    if (state.crossings.isEnabled())
+    {
+        // frame k is at sample interpCountdown + k * stride - horizon; the first one before the
+        // buffer is the last computed frame
+        double phase0 = state.lastComputedPhase;
+        double mag0 = state.lastComputedMag;
+        for (int k = 0; k < htOutputSamps; ++k)
+        {
+            double phase1 = std::arg (htOutput[k]);
+            double mag1 = std::abs (htOutput[k]);
+            int pos1 = state.interpCountdown + k * stride - horizon;
+            state.crossings.checkSegment (phase0, mag0, pos1 - stride, phase1, mag1, pos1);
+
+            phase0 = phase1;
+            mag0 = mag1;
+        }
+    }
+
+    // the next buffer continues from the last frame within this one
+    if (! htInds.isEmpty())
+    {
+        state.lastComputedPhase = std::arg (htOutput[htInds.size() - 1]);
+        state.lastComputedMag = std::abs (htOutput[htInds.size() - 1]);
+        state.interpCountdown = htInds.getLast() + stride - nSamples;
+    }
+    else
+    {
+        state.interpCountdown -= nSamples;
+    }
+    clock.lap (StageTimings::INTERPOLATE);
+
+    // unwrapping / smoothing
+    unwrapBuffer (wpOut, nSamples, state.lastPhase);
+    smoothBuffer (wpOut, nSamples, state.lastPhase);
+    state.lastPhase = wpOut[nSamples - 1];
+    clock.lap (StageTimings::UNWRAP);
+
+    return true;
+}
+
+bool PhaseEngine::processResampled (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra, StageClock& clock)
+{
+    FractionalResampler& resampler = state.resampler;
+    const int64 firstInput = resampler.getNumInput();
+
+    // resample the new data into the model history
+    int maxResampled = resampler.getMaxOutput (nSamples);
+    if (resampled.size() < maxResampled)
+    {
+        resampled.resize (maxResampled);
+    }
+
+    int nNew = resampler.process (data, nSamples, resampled.getRawDataPointer());
+    state.modelHistory.enqueue (resampled.getRawDataPointer(), nNew);
+    clock.lap (StageTimings::ENQUEUE);
+
+    if (! state.modelHistory.isFull() || ! state.isEstimatorReady())
+    {
+        // just output zeros
+        clearOutputs (data, extra, nSamples);
+        return false;
+    }
+
+    // The output is interpolated between "ticks" (resampled samples): from the first at or after
+    // the first input sample, to the first at or after the last one. The resampler lags behind
+    // the input, so the ticks after the last one it has computed are predicted, along with
+    // another htDelay ticks to get the transformer's output up to the end of the buffer.
+    const int64 lastTick = resampler.getNumOutput() - 1;
+    const int64 firstNewTick = lastTick - nNew + 1;
+
+    // sample i is interpolated as if it were sample i + horizon
+    const int64 firstTarget = firstInput + params.getHorizonSamples (state.sampleRate);
+    const int64 startTick = resampler.getFirstOutputAtOrAfter (firstTarget);
+    const int64 endTick = resampler.getFirstOutputAtOrAfter (firstTarget + nSamples - 1);
+    jassert (firstNewTick <= startTick && lastTick < endTick);
+
+    int numTicks = int (endTick - startTick + 1);
+    if (htOutput.size() < numTicks)
+    {
+        htOutput.resize (numTicks);
+    }
+
+    if (! state.usesModel())
+    {
+        // the ticks up to the last one computed are estimated from the model history; the ones
+        // after it advance from the previous one (or the last one computed) at the center frequency
+        const Hilbert::EndpointKernel& kernel = *state.endpointKernel;
+        const double tickRadians = 2 * Dsp::doublePi * kernel.centerFreq / state.modelRate;
+        std::complex<double> tickOut;
+        for (int64 tick = startTick; tick <= endTick; ++tick)
+        {
+            if (tick <= lastTick)
+            {
+                tickOut = endpointSample (state.modelHistory, int (lastTick - tick), kernel, 1);
+            }
+            else if (tick == startTick)
+            {
+                tickOut = endpointSample (state.modelHistory, 0, kernel, 1) * std::polar (1.0, tickRadians * double (tick - lastTick));
+            }
+            else
+            {
+                tickOut *= std::polar (1.0, tickRadians);
+            }
+            htOutput.set (int (tick - startTick), tickOut);
+        }
+        clock.lap (StageTimings::TRANSFORM);
+    }
+    else
+    {
+        state.arModeler.getModel (localARParams);
+
+        const Hilbert::Transformer& transformer = *state.transformer;
+        const int htDelay = transformer.delay;
+
+        int nPredict = int (endTick + htDelay - lastTick);
+        if (predSamps.size() < nPredict)
+        {
+            predSamps.resize (nPredict);
+        }
+
+        double* pPredSamps = predSamps.getRawDataPointer();
+        arPredict (state.modelHistory, 0, pPredSamps, localARParams.getRawDataPointer(), nPredict, 1, params.arOrder);
+        clock.lap (StageTimings::PREDICT);
+
+        auto getTick = [&] (int64 tick)
+        {
+            return tick <= lastTick ? double (resampled[int (tick - firstNewTick)]) : pPredSamps[tick - lastTick - 1];
+        };
+
+        // execute transformer on the new ticks; the output for a tick comes out htDelay ticks later
+        for (int64 tick = firstNewTick; tick <= lastTick; ++tick)
+        {
+            double samp = htFilterSamp (getTick (tick), transformer, state.htState);
+            int64 outTick = tick - htDelay;
+            if (outTick >= startTick)
+            {
+                htOutput.set (int (outTick - startTick), std::complex<double> (getTick (outTick), params.htScaleFactor * samp));
+            }
+        }
+
+        // copy state to transform prediction without changing the end-of-buffer state
+        htTempState = state.htState;
+
+        // execute transformer on prediction
+        for (int64 tick = lastTick + 1; tick <= endTick + htDelay; ++tick)
+        {
+            double samp = htFilterSamp (getTick (tick), transformer, htTempState);
+            int64 outTick = tick - htDelay;
+            if (outTick >= startTick)
+            {
+                htOutput.set (int (outTick - startTick), std::complex<double> (getTick (outTick), params.htScaleFactor * samp));
+            }
+        }
+        clock.lap (StageTimings::TRANSFORM);
+    }
+
+    // output with interpolation between the ticks before and after each sample
+    float* wpOut = data;
+    const double ratio = resampler.getRatio();
+
+    int64 nextTick = startTick;
+    double nextTickPosition = resampler.getOutputPosition (nextTick);
+    double nextComputedPhase = std::arg (htOutput[0]);
+    double phaseStep = circDist (nextComputedPhase, state.lastComputedPhase, Dsp::doublePi);
+
+    for (int i = 0; i < nSamples; ++i)
+    {
+        const int64 input = firstTarget + i;
+        if (nextTickPosition < input)
+        {
+            // ticks are at least one sample apart, so this passes at most one
+            double lastComputedPhase = nextComputedPhase;
+            ++nextTick;
+            nextTickPosition = resampler.getOutputPosition (nextTick);
+            nextComputedPhase = std::arg (htOutput[int (nextTick - startTick)]);
+            phaseStep = circDist (nextComputedPhase, lastComputedPhase, Dsp::doublePi);
+        }
+
+        double ticksToNext = (nextTickPosition - input) / ratio;
+        double thisPhase = circDist (nextComputedPhase, phaseStep * ticksToNext, Dsp::doublePi);
+        wpOut[i] = float (thisPhase * (180.0 / Dsp::doublePi));
+    }
+
+    if (extra.any())
+    {
+        // the same ticks, with each value interpolated between the ticks on either side
+        std::complex<double> prev = std::polar (state.lastComputedMag, state.lastComputedPhase);
+        std::complex<double> next = htOutput[0];
+        double prevMag = std::abs (prev), nextMag = std::abs (next);
+
+        nextTick = startTick;
+        nextTickPosition = resampler.getOutputPosition (nextTick);
+        for (int i = 0; i < nSamples; ++i)
+        {
+            const int64 input = firstTarget + i;
+            if (nextTickPosition < input)
+            {
+                ++nextTick;
+                nextTickPosition = resampler.getOutputPosition (nextTick);
+
+                prev = next;
+                prevMag = nextMag;
+                next = htOutput[int (nextTick - startTick)];
+                nextMag = std::abs (next);
+            }
+
+            double prevWeight = (nextTickPosition - input) / ratio;
+            if (extra.magnitude != nullptr)
+            {
+                extra.magnitude[i] = float (nextMag + (prevMag - nextMag) * prevWeight);
+            }
+            if (extra.imaginary != nullptr)
+            {
+                extra.imaginary[i] = float (next.imag() + (prev.imag() - next.imag()) * prevWeight);
+            }
+        }
+    }
+
+    if (state.crossings.isEnabled())
+    {
+        // the first segment starts from the tick before startTick, from the last buffer
+        double phase0 = state.lastComputedPhase;
+        double mag0 = state.lastComputedMag;
+        double pos0 = resampler.getOutputPosition (startTick - 1) - double (firstTarget);
+        for (int k = 0; k < numTicks; ++k)
+        {
+            double phase1 = std::arg (htOutput[k]);
+            double mag1 = std::abs (htOutput[k]);
+            double pos1 = resampler.getOutputPosition (startTick + k) - double (firstTarget);
+            state.crossings.checkSegment (phase0, mag0, pos0, phase1, mag1, pos1);
+
+            phase0 = phase1;
+            mag0 = mag1;
+            pos0 = pos1;
+        }
+    }
+
+    // the next buffer starts interpolating from the last tick before it
+    int64 lastTickBefore = resampler.getFirstOutputAtOrAfter (firstTarget + nSamples) - 1;
+    if (lastTickBefore >= startTick)
+    {
+        state.lastComputedPhase = std::arg (htOutput[int (lastTickBefore - startTick)]);
+        state.lastComputedMag = std::abs (htOutput[int (lastTickBefore - startTick)]);
+    }
+    clock.lap (StageTimings::INTERPOLATE);
+
+    // unwrapping / smoothing
+    unwrapBuffer (wpOut, nSamples, state.lastPhase);
+    smoothBuffer (wpOut, nSamples, state.lastPhase);
+    state.lastPhase = wpOut[nSamples - 1];
+    clock.lap (StageTimings::UNWRAP);
+
+    return true;
+}
+
+bool PhaseEngine::processFullRate (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra, StageClock& clock)
+{
+    // crossing detection needs the magnitude, if it is not an output already
+    const bool detectCrossings = state.crossings.isEnabled();
+    float* magOut = extra.magnitude;
+    if (detectCrossings && magOut == nullptr)
+    {
+        jassert (state.fullRateMag.size() >= nSamples);
+        magOut = state.fullRateMag.getRawDataPointer();
+    }
+
+    float* wpOut = data;
+    if (! state.usesModel())
+    {
+        // each sample (horizon samples later) is estimated from the history, with the taps of its
+        // own polyphase branch; past the end of the buffer, the last sample advances at the center frequency
+        const Hilbert::EndpointKernel& kernel = *state.endpointKernel;
+        const int stride = state.dsFactor;
+        const int horizon = params.getHorizonSamples (state.sampleRate);
+        const double sampleRadians = 2 * Dsp::doublePi * kernel.centerFreq / state.sampleRate;
+        const std::complex<double> lastSample = horizon > 0 ? endpointSample (state.history, 0, kernel, stride) : std::complex<double>();
+
+        for (int i = 0; i < nSamples; ++i)
+        {
+            const int target = i + horizon;
+            std::complex<double> sampleOut = target < nSamples
+                                                 ? endpointSample (state.history, nSamples - 1 - target, kernel, stride)
+                                                 : lastSample * std::polar (1.0, sampleRadians * (target - nSamples + 1));
+
+            wpOut[i] = float (std::arg (sampleOut) * (180.0 / Dsp::doublePi));
+            if (magOut != nullptr)
+            {
+                magOut[i] = float (std::abs (sampleOut));
+            }
+            if (extra.imaginary != nullptr)
+            {
+                extra.imaginary[i] = float (sampleOut.imag());
+            }
+        }
+        clock.lap (StageTimings::TRANSFORM);
+    }
+    else
+    {
+        state.arModeler.getModel (localARParams);
+
+        // The output at each sample needs htDelay samples of its own polyphase branch (stride samples
+        // apart) on either side of the sample horizon samples later. Lay out, in time order: enough
+        // of the past for the transformer and the AR model, the buffer (both from the history), and
+        // the prediction of each branch up to the horizon plus htDelay ticks after the buffer.
+        const Hilbert::Transformer& transformer = *state.transformer;
+        const int stride = state.dsFactor;
+        const int horizon = params.getHorizonSamples (state.sampleRate);
+        const int nPast = jmax (transformer.delay, params.arOrder) * stride;
+        const int nKnown = nPast + nSamples;
+        const int nPredict = horizon + transformer.delay * stride;
+
+        jassert (state.fullRateData.size() >= nKnown + nPredict);
+        double* pData = state.fullRateData.getRawDataPointer();
+        const double* rpHistory = state.history.begin();
+        const int histSize = state.history.size();
+        const int newest = state.history.getHeadOffset() + 1;
+
+        // the history covers at least a second, which is more than any buffer plus the past needed
+        jassert (nKnown <= histSize);
+        for (int i = 0; i < nKnown; ++i)
+        {
+            int back = nKnown - 1 - i;
+            pData[i] = back < histSize ? rpHistory[(newest + back) % histSize] : 0.0;
+        }
+
+        arExtend (pData, nKnown, nPredict, localARParams.getRawDataPointer(), stride, params.arOrder);
+        clock.lap (StageTimings::PREDICT);
+
+        htPhaseFullRate (pData + nPast + horizon, wpOut, nSamples, transformer, stride, params.htScaleFactor, magOut, extra.imaginary);
+        clock.lap (StageTimings::TRANSFORM);
+    }
+
+    if (detectCrossings)
+    {
+        // every sample is a computed frame; the first segment starts from the last buffer's last sample
+        double phase0 = state.lastComputedPhase;
+        double mag0 = state.lastComputedMag;
+        for (int i = 0; i < nSamples; ++i)
+        {
+            double phase1 = wpOut[i] * (Dsp::doublePi / 180.0);
+            double mag1 = magOut[i];
+            state.crossings.checkSegment (phase0, mag0, i - 1, phase1, mag1, i);
+
+            phase0 = phase1;
+            mag0 = mag1;
+        }
+
+        state.lastComputedPhase = phase0;
+        state.lastComputedMag = mag0;
+        clock.lap (StageTimings::INTERPOLATE);
+    }
+
+    // unwrapping / smoothing
+    unwrapBuffer (wpOut, nSamples, state.lastPhase);
+    smoothBuffer (wpOut, nSamples, state.lastPhase);
+    state.lastPhase = wpOut[nSamples - 1];
+    clock.lap (StageTimings::UNWRAP);
+
+    return true;
+}
+
+void PhaseEngine::arPredict (const ReverseStack& history, int interpCountdown, double* prediction, const double* params, int samps, int stride, int order)
+{
+    const double* rpHistory = history.begin();
+    int histSize = history.size();
+    int histStart = history.getHeadOffset() + stride - interpCountdown;
+
+    // s = index to write output
+    for (int s = 0; s < samps; ++s)
+    {
+        prediction[s] = 0;
+
+        // p = which AR param we are on
+        for (int p = 0; p < order; ++p)
+        {
+            double pastSamp = p < s
+                                  ? prediction[s - 1 - p]
+                                  : rpHistory[(histStart + (p - s) * stride) % histSize];
+
+            prediction[s] -= params[p] * pastSamp;
+        }
+    }
+}
+
+void PhaseEngine::arExtend (double* data, int nKnown, int samps, const double* params, int stride, int order)
+{
+    for (int s = nKnown; s < nKnown + samps; ++s)
+    {
+        const double* pastSamp = data + s - stride;
+        double prediction = 0;
+
+        // p = which AR param we are on
+        for (int p = 0; p < order; ++p, pastSamp -= stride)
+        {
+            prediction -= params[p] * *pastSamp;
+        }
+
+        data[s] = prediction;
+    }
+}
+
+std::complex<double> PhaseEngine::endpointSample (const ReverseStack& source, int back, const Hilbert::EndpointKernel& kernel, int stride)
+{
+    const double* rpSource = source.begin();
+    const int sourceSize = source.size();
+    const std::complex<double>* coef = kernel.coefficients.begin();
+    const int nCoefs = kernel.coefficients.size();
+    jassert (back + (nCoefs - 1) * stride < sourceSize);
+
+    // tap m is m * stride samples before the endpoint
+    int ind = (source.getHeadOffset() + 1 + back) % sourceSize;
+    double re = 0, im = 0;
+    for (int m = 0; m < nCoefs; ++m)
+    {
+        re += coef[m].real() * rpSource[ind];
+        im += coef[m].imag() * rpSource[ind];
+
+        ind += stride;
+        if (ind >= sourceSize)
+        {
+            ind -= sourceSize;
+        }
+    }
+    return { re, im };
+}
+
+double PhaseEngine::htFilterSamp (double input, const Hilbert::Transformer& transformer, Array<double>& state)
+{
+    double* state_p = state.getRawDataPointer();
+
+    // initialize new state entry
+    int nCoefs = transformer.delay;
+    int order = nCoefs * 2;
+    jassert (order == state.size() - 1);
+    state_p[order] = 0;
+
+    // incorporate new input
+    const double* transf = transformer.coefficients.begin();
+    for (int kCoef = 0; kCoef < nCoefs; ++kCoef)
+    {
+        double val = input * transf[kCoef];
+        state_p[kCoef] += val; // near component
+        state_p[order - kCoef] -= val; // mirrored component
+    }
+
+    // output and shift state
+    double sampOut = state_p[0];
+    std::memmove (state_p, state_p + 1, order * sizeof (double));
+    return sampOut;
+}
+
+void PhaseEngine::htPhaseFullRate (const double* data, float* phaseOut, int nOut, const Hilbert::Transformer& transformer, int stride, double scaleFactor, float* magOut, float* imagOut)
+{
+    const int nCoefs = transformer.delay;
+    const double* transf = transformer.coefficients.begin();
+
+    for (int i = 0; i < nOut; ++i)
+    {
+        // the transformer is antisymmetric about its center: coefficient nCoefs - k weighs the
+        // difference between the samples k ticks after and k ticks before the center
+        const double* center = data + i;
+        double imag = 0;
+        for (int k = 1; k <= nCoefs; ++k)
+        {
+            imag += transf[nCoefs - k] * (center[k * stride] - center[-k * stride]);
+        }
+
+        phaseOut[i] = float (std::atan2 (scaleFactor * imag, center[0]) * (180.0 / Dsp::doublePi));
+        if (magOut != nullptr)
+        {
+            magOut[i] = float (std::abs (std::complex<double> (center[0], scaleFactor * imag)));
+        }
+        if (imagOut != nullptr)
+        {
+            imagOut[i] = float (scaleFactor * imag);
+        }
+    }
+}
+
+void PhaseEngine::clearOutputs (float* data, const ExtraOutputs& extra, int nSamples)
+{
+    FloatVectorOperations::clear (data, nSamples);
+    if (extra.magnitude != nullptr)
+    {
+        FloatVectorOperations::clear (extra.magnitude, nSamples);
+    }
+    if (extra.imaginary != nullptr)
+    {
+        FloatVectorOperations::clear (extra.imaginary, nSamples);
+    }
+}
+
+void PhaseEngine::unwrapBuffer (float* wp, int nSamples, float lastPhase)
+{
+    for (int startInd = 0; startInd < nSamples - 1; startInd++)
+    {
+        float diff = wp[startInd] - (startInd == 0 ? lastPhase : wp[startInd - 1]);
+        if (abs (diff) > 180)
+        {
+            // search forward for a jump in the opposite direction
+            int endInd;
+            int maxInd;
+            if (diff < 0)
+            // for downward jumps, unwrap if there's a jump back up within glitchLimit samples
+            {
+                endInd = -1;
+                maxInd = jmin (startInd + glitchLimit, nSamples - 1);
+            }
+            else
+            // for upward jumps, default to unwrapping until the end of the buffer, but stop if there's a jump back down sooner.
+            {
+                endInd = nSamples;
+                maxInd = nSamples - 1;
+            }
+            for (int currInd = startInd + 1; currInd <= maxInd; currInd++)
+            {
+                float diff2 = wp[currInd] - wp[currInd - 1];
+                if (abs (diff2) > 180 && ((diff > 0) != (diff2 > 0)))
+                {
+                    endInd = currInd;
+                    break;
+                }
+            }
+
+            // unwrap [startInd, endInd)
+            for (int i = startInd; i < endInd; i++)
+            {
+                wp[i] -= 360 * (diff / abs (diff));
+            }
+
+            if (endInd > -1)
+            {
+                // skip to the end of this unwrapped section
+                startInd = endInd;
+            }
+        }
+    }
+}
+
+void PhaseEngine::smoothBuffer (float* wp, int nSamples, float lastPhase)
+{
+    int actualGL = jmin (glitchLimit, nSamples - 1);
+    float diff = wp[0] - lastPhase;
+    if (diff < 0 && diff > -180)
+    {
+        // identify whether signal exceeds last sample of the previous buffer within glitchLimit samples.
+        int endIndex = -1;
+        for (int i = 1; i <= actualGL; i++)
+        {
+            if (wp[i] > lastPhase)
+            {
+                endIndex = i;
+                break;
+            }
+            // corner case where signal wraps before it exceeds lastSample
+            else if (wp[i] - wp[i - 1] < -180 && (wp[i] + 360) > lastPhase)
+            {
+                wp[i] += 360;
+                endIndex = i;
+                break;
+            }
+        }
+
+        if (endIndex != -1)
+        {
+            // interpolate points from buffer start to endIndex
+            float slope = (wp[endIndex] - lastPhase) / (endIndex + 1);
+            for (int i = 0; i < endIndex; i++)
+            {
+                wp[i] = lastPhase + (i + 1) * slope;
+            }
+        }
+    }
+}
+
+double PhaseEngine::circDist (double x, double ref, double cutoff)
+{
+    static const double twoPi = 2 * Dsp::doublePi;
+    double xMod = std::fmod (x - ref, twoPi);
+    double xPos = (xMod < 0 ? xMod + twoPi : xMod);
+    return (xPos > cutoff ? xPos - twoPi : xPos);
+}
+} // namespace PhaseCalculator
@@ -0,0 +1,381 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PHASE_ENGINE_H_INCLUDED
+#define PHASE_ENGINE_H_INCLUDED
+
+/*
+
+The real-time phase estimation pipeline, independent of the GUI's processor and editor
+classes so that it can also be driven by the benchmark and offline tools:
+
+- EngineParams:  the user-facing parameters shared by all channels of a stream.
+- ChannelState:  everything kept per channel between buffers (filter, history, AR model,
+                 Hilbert transformer state, interpolation state).
+- PhaseEngine:   scratch buffers for the processing thread, plus the processing kernels.
+
+Per buffer, PhaseEngine::processChannel bandpass-filters the data, adds it to the history,
+predicts as many samples as the Hilbert transformer's delay (at the downsampled rate) with the AR model,
+runs the Hilbert transformer over the buffer and the prediction, and writes the
+interpolated, glitch-corrected phase (in degrees) over the input. ChannelState::fitModel
+refits the AR model from the history and is called from a separate, lower-priority thread.
+
+The AR model and Hilbert transformer run at the modeling rate (EngineParams::modelRate); see
+EngineParams for the other modes (full-rate evaluation, look-ahead horizon and endpoint estimator).
+
+*/
+
+#include <BasicJuceHeader.h>
+#include <DspLib.h> // Filtering
+
+#include <atomic>
+#include <complex>
+
+#include "ARModeler.h" // Autoregressive modeling
+#include "EndpointHilbert.h" // Endpoint-corrected Hilbert transform
+#include "FractionalResampler.h" // Resampling for arbitrary sample rates
+#include "HTransformers.h" // Hilbert transformers & frequency bands
+#include "HilbertDesigner.h" // Runtime Hilbert transformer design
+#include "PhaseCrossings.h" // Target phase crossing detection
+#include "StageTimings.h" // Instrumentation
+
+namespace PhaseCalculator
+{
+class ReverseStack : public Array<double, CriticalSection>
+{
+public:
+    ReverseStack (int size = 0);
+
+    // Just resets the free space
+    void reset();
+
+    // Resets free space and resizes the array. There's no way to resize
+    // the array while keeping the data contained in it.
+    void resetAndResize (int newSize);
+
+    bool isFull() const;
+
+    void enqueue (const float* source, int n);
+
+    int getHeadOffset() const;
+
+    // copies to given array, with first element corresponding to most recent data point.
+    // if maxSamples is nonnegative, only copies the maxSamples most recent data points.
+    void unwrapAndCopy (double* dest, bool useLock, int maxSamples = -1) const;
+
+private:
+    int freeSpace;
+    int headOffset; // offset of write head from start of buffer
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ReverseStack);
+};
+
+struct EngineParams
+{
+    EngineParams();
+
+    // order of the AR model
+    int arOrder;
+
+    // frequency band (determines which Hilbert transformer to use)
+    Band band;
+
+    // filter passband
+    float highCut;
+    float lowCut;
+
+    // delay of a Hilbert transformer designed for the passband at runtime (see HilbertDesigner.h),
+    // or 0 to use the band's built-in transformer
+    int htDelay;
+
+    // the Hilbert transformer in use (set by updateTransformer)
+    Hilbert::TransformerPtr transformer;
+
+    // rate (Hz) at which the AR model and Hilbert transformer run. the built-in transformers are
+    // only used at Hilbert::fs; at other rates, a transformer is designed for the passband. if the
+    // sample rate is not a multiple of it, the filtered data is resampled to it (see FractionalResampler.h).
+    int modelRate;
+
+    // whether to evaluate the transformer at every input sample rather than interpolating the
+    // phase between computed frames (only for sample rates that are a multiple of modelRate).
+    // removes the up to one frame of lag that interpolation adds, at one transformer output per sample.
+    bool fullRate;
+
+    // how far ahead of each sample its output phase is (ms, up to maxHorizonMs), e.g. to compensate
+    // for a stimulator's latency. the AR prediction is extended by the horizon, in whole input samples.
+    float horizonMs;
+
+    static constexpr float maxHorizonMs = 50.0f;
+
+    // the horizon in samples at the given rate
+    int getHorizonSamples (float sampleRate) const { return roundToInt (horizonMs * sampleRate / 1000); }
+
+    // how the analytic signal is estimated at the end of the data
+    enum Estimator
+    {
+        AR_PREDICTION = 0, // predict the Hilbert transformer's delay with the AR model
+        ENDPOINT_HT // endpoint-corrected Hilbert transform (no AR model, see EndpointHilbert.h)
+    };
+
+    Estimator estimator;
+
+    // approximate multiplier for the imaginary component output of the HT (depends on filter band)
+    double htScaleFactor;
+
+    // Selects the Hilbert transformer for the band, passband, htDelay and modelRate (designing it
+    // if it is not in the cache yet), and updates the htScaleFactor for the passband.
+    void updateTransformer();
+
+    // range of passbands that the transformer can be used for, as a pair (lower limit, upper limit):
+    // the band's valid range unless htDelay is set, otherwise the designable range.
+    Array<float> getValidBand() const;
+
+    // modeling rates offered by the plugin
+    static Array<int> getModelRates() { return { 500, 1000, 2000 }; }
+};
+
+struct ChannelState
+{
+    ChannelState();
+
+    // filter design copied from FilterNode
+    using BandpassFilter = Dsp::SimpleFilter<Dsp::Butterworth::BandPass // filter type
+                                             <2>, // order
+                                             1, // number of channels
+                                             Dsp::DirectFormII>; // realization
+
+    /*
+        * Resizes the history and sets up the filter, AR model and Hilbert transformer state for
+        * the given parameters, then resets. The history holds at least minHistoryMs of data (and
+        * enough to train an AR model of the requested order, using at least 1 second of data).
+        * Precondition: isSupportedRate (sampleRate, params.modelRate).
+        */
+    void configure (const EngineParams& params, float sampleRate, int minHistoryMs);
+
+    // reset to perform after end of acquisition or update
+    void reset();
+
+    /*
+        * Refits the AR model from the current history (with the history's lock held while copying).
+        * reverseData is scratch space of at least the history's size. Returns false if the history
+        * is not full yet. If recordTiming is true, adds the fit and lock wait times to timings.
+        */
+    bool fitModel (Array<double>& reverseData, bool recordTiming = false);
+
+    // time since the AR model was last fit, in ms (negative if it has not been fit since the last reset)
+    double getModelAgeMs() const;
+
+    // bytes allocated for this channel (state, history, AR model and Hilbert transformer)
+    size_t getMemoryBytes() const;
+
+    // factor between the sample rate and the modeling rate, or 0 if it is not an integer
+    static int getDsFactor (float sampleRate, int modelRate = Hilbert::fs);
+
+    // whether channels at this rate can be processed at the modeling rate (directly or by resampling)
+    static bool isSupportedRate (float sampleRate, int modelRate = Hilbert::fs);
+
+    // whether the data is resampled to the modeling rate (the sample rate is not a multiple of it)
+    bool isResampling() const { return dsFactor == 0; }
+
+    // whether the channel estimates with an AR model (otherwise, fitModel does nothing)
+    bool usesModel() const { return estimator == EngineParams::AR_PREDICTION; }
+
+    // whether the estimator can be used once the history is full (the AR model has been fit, if any)
+    bool isEstimatorReady() const { return ! usesModel() || arModeler.hasBeenFit(); }
+
+    float sampleRate;
+    int modelRate;
+    int dsFactor;
+
+    // the estimator the channel was configured for
+    EngineParams::Estimator estimator;
+
+    ReverseStack history;
+
+    // only used when resampling: the resampler, and the resampled data that the AR model is fit on
+    FractionalResampler resampler;
+    ReverseStack modelHistory;
+
+    BandpassFilter filter;
+
+    ARModeler arModeler;
+
+    // the transformer that htState was set up for (from the parameters at configure time)
+    Hilbert::TransformerPtr transformer;
+    Array<double> htState;
+
+    // full-rate scratch space, sized at configure time for any block the history can hold and any
+    // horizon (only allocated in full-rate mode): the signal with each branch's prediction, and
+    // the magnitudes for crossing detection
+    Array<double> fullRateData;
+    Array<float> fullRateMag;
+
+    // the endpoint-corrected Hilbert transform kernel (only with EngineParams::ENDPOINT_HT)
+    Hilbert::EndpointKernelPtr endpointKernel;
+
+    // number of samples until a new non-interpolated output. e.g. if this
+    // equals 1 after a buffer is processed, then there is one interpolated
+    // sample in the next buffer, and then the second sample will be computed.
+    // in range [0, dsFactor). (not used when resampling or in full-rate mode)
+    int interpCountdown;
+
+    // last non-interpolated ("computed") transformer output
+    // (when resampling, at the last resampled sample before the next buffer;
+    // in full-rate mode, at the last sample, and only kept while crossings are detected)
+    double lastComputedPhase;
+    double lastComputedMag;
+
+    // target phase crossings in the last buffer (see PhaseCrossings.h)
+    CrossingDetector crossings;
+
+    // last phase output, for glitch correction
+    float lastPhase;
+
+    // time spent in each stage, written by the audio and AR threads (not cleared by reset)
+    StageTimings timings;
+
+    // StageTimings::now() at the end of the last fit (0 if none since the last reset),
+    // and number of fits since the channel was created
+    std::atomic<int64> lastFitTime;
+    std::atomic<int64> numFits;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ChannelState);
+};
+
+// optional outputs of the analytic signal next to the phase (in the units of the input), nSamples each
+struct ExtraOutputs
+{
+    float* magnitude = nullptr;
+    float* imaginary = nullptr;
+
+    bool any() const { return magnitude != nullptr || imaginary != nullptr; }
+};
+
+class PhaseEngine
+{
+public:
+    PhaseEngine();
+
+    /*
+        * Filters nSamples of data in place and adds them to the channel's history. Then, if the
+        * history is full and the AR model has been fit, overwrites the data with the phase in degrees
+        * (and writes the extra outputs) and returns true; otherwise, overwrites it (and the extra
+        * outputs) with zeros and returns false.
+        */
+    bool processChannel (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra = {});
+
+    /*
+        * The rest of processChannel, for data that has already been filtered with the channel's
+        * filter design (the channel's own filter is not used). Lets offline tools filter once for
+        * several AR and Hilbert transformer settings.
+        */
+    bool processFiltered (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra = {});
+
+    /** Whether processChannel adds the time of each stage to the channel's timings (on by default) */
+    void setTimingEnabled (bool enabled) { timingEnabled = enabled; }
+
+    bool isTimingEnabled() const { return timingEnabled; }
+
+    // ---- kernels ----
+
+    /*
+        * arPredict: use autoregressive model of order to predict future data.
+        *
+        * lastSample points to the most recent sample of past data that will be used to
+        * compute phase, and there must be at least stride * (order - 1) samples
+        * preceding it in order to do the AR prediction.
+        *
+        * Input params is an array of coefficients of an AR model of length 'order'.
+        *
+        * Writes samps future data values to prediction.
+        */
+    static void arPredict (const ReverseStack& history, int interpCountdown, double* prediction, const double* params, int samps, int stride, int order);
+
+    /*
+        * arExtend: the prediction of arPredict for every sample of a full-rate sequence, i.e. for
+        * each of the stride polyphase branches with the same model. Writes data[nKnown] to
+        * data[nKnown + samps - 1] in order, each from the order values stride, 2 * stride, ...
+        * samples before it. There must be at least stride * order samples before data[nKnown].
+        */
+    static void arExtend (double* data, int nKnown, int samps, const double* params, int stride, int order);
+
+    /*
+        * The endpoint-corrected analytic signal (see EndpointHilbert.h) at the sample back samples
+        * before the most recent one in source, with the kernel's taps stride samples apart. The
+        * source must hold back + (kernel length - 1) * stride + 1 samples.
+        */
+    static std::complex<double> endpointSample (const ReverseStack& source, int back, const Hilbert::EndpointKernel& kernel, int stride);
+
+    /** Execute the hilbert transformer on one sample and update the state. */
+    static double htFilterSamp (double input, const Hilbert::Transformer& transformer, Array<double>& state);
+
+    /*
+        * Phase (in degrees) of the Hilbert transformer's output centered at each of the nOut
+        * samples from data[0], with the taps stride samples apart (every polyphase branch of the
+        * transformer at the modeling rate). There must be transformer.delay * stride samples of
+        * data before data[0] and after data[nOut - 1]. If magOut or imagOut is not null, also
+        * writes the magnitude or imaginary part of each output to it.
+        */
+    static void htPhaseFullRate (const double* data, float* phaseOut, int nOut, const Hilbert::Transformer& transformer, int stride, double scaleFactor, float* magOut = nullptr, float* imagOut = nullptr);
+
+    /** Perform glitch unwrapping */
+    static void unwrapBuffer (float* wp, int nSamples, float lastPhase);
+
+    /** Do start-of-buffer smoothing */
+    static void smoothBuffer (float* wp, int nSamples, float lastPhase);
+
+    /*
+        * Circular distance between angles x and ref (in radians). The "cutoff" is the maximum
+        * possible positive output; greater differences will be wrapped to negative angles.
+        */
+    static double circDist (double x, double ref, double cutoff = 2 * Dsp::doublePi);
+
+    // "glitch limit" (how long of a segment is allowed to be unwrapped or smoothed, in samples)
+    static const int glitchLimit = 200;
+
+private:
+    // the rest of processFiltered for channels that are resampled (after the history is updated)
+    bool processResampled (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra, StageClock& clock);
+
+    // the rest of processFiltered in full-rate mode (after the AR model is checked): the transformer runs
+    // as dsFactor interleaved branches at the modeling rate, directly over the history and each branch's prediction
+    bool processFullRate (const EngineParams& params, ChannelState& state, float* data, int nSamples, const ExtraOutputs& extra, StageClock& clock);
+
+    // output zeros while the AR model is not ready
+    static void clearOutputs (float* data, const ExtraOutputs& extra, int nSamples);
+
+    std::atomic<bool> timingEnabled;
+
+    // storage areas
+    Array<double, CriticalSection> localARParams;
+    Array<int> htInds;
+    Array<std::complex<double>> htOutput;
+    Array<double> predSamps;
+    Array<double> htTempState;
+    Array<float> resampled;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PhaseEngine);
+};
+} // namespace PhaseCalculator
+
+#endif // PHASE_ENGINE_H_INCLUDED
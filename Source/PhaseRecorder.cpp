@@ -0,0 +1,199 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cmath> // isnan
+
+#include "PhaseCalculator.h"
+#include "PhaseRecorder.h"
+
+namespace PhaseCalculator
+{
+PhaseRecorder::PhaseRecorder()
+    : Thread ("Phase recorder"),
+      recording (false),
+      format (OFF),
+      sampleRate (0),
+      fifo (fifoSize),
+      records (fifoSize),
+      numDropped (0)
+{
+}
+
+PhaseRecorder::~PhaseRecorder()
+{
+    stop();
+}
+
+void PhaseRecorder::start (const File& fileWithoutExtension, Format newFormat, double newSampleRate)
+{
+    stop();
+
+    if (newFormat == OFF)
+    {
+        return;
+    }
+
+    file = fileWithoutExtension.withFileExtension (getFileExtension (newFormat));
+    format = newFormat;
+    sampleRate = newSampleRate;
+
+    fifo.reset();
+    numDropped = 0;
+    recording = true;
+
+    startThread();
+}
+
+void PhaseRecorder::stop()
+{
+    recording = false;
+
+    if (isThreadRunning())
+    {
+        // the writer drains the FIFO before exiting
+        signalThreadShouldExit();
+        notify();
+        stopThread (10000);
+
+        if (numDropped > 0)
+        {
+            LOGC ("PhaseCalculator: ", numDropped.load(), " event phases could not be written to ", file.getFullPathName());
+        }
+    }
+}
+
+void PhaseRecorder::push (const EventPhase& phase)
+{
+    if (! recording)
+    {
+        return;
+    }
+
+    if (fifo.getFreeSpace() == 0)
+    {
+        ++numDropped;
+        return;
+    }
+
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+    records[start1] = phase;
+    fifo.finishedWrite (1);
+
+    // wake the writer once a batch is ready
+    if (fifo.getNumReady() >= fifoSize / 16)
+    {
+        notify();
+    }
+}
+
+void PhaseRecorder::run()
+{
+    // find a new name rather than overwriting a previous recording in the same directory
+    File outFile = file.getNonexistentSibling();
+    outFile.getParentDirectory().createDirectory();
+    std::unique_ptr<FileOutputStream> stream = outFile.createOutputStream();
+    if (stream == nullptr || stream->failedToOpen())
+    {
+        LOGE ("PhaseCalculator: Could not open ", outFile.getFullPathName(), " to write event phases");
+        recording = false;
+        return;
+    }
+
+    LOGC ("PhaseCalculator: Writing event phases to ", outFile.getFullPathName());
+
+    outBuffer.reset();
+    if (format == CSV)
+    {
+        outBuffer << "sample_number,event_line,channel,phase,online_phase,amplitude\n";
+    }
+    else
+    {
+        outBuffer.write ("PHCEVT01", 8);
+        outBuffer.writeInt (binaryVersion);
+        outBuffer.writeInt (binaryRecordSize);
+        outBuffer.writeDouble (sampleRate);
+        outBuffer.writeInt64 (0);
+    }
+
+    while (! threadShouldExit())
+    {
+        drain (*stream);
+        wait (500);
+    }
+
+    drain (*stream);
+    stream->flush();
+}
+
+void PhaseRecorder::drain (OutputStream& stream)
+{
+    int numReady = fifo.getNumReady();
+    if (numReady > 0)
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead (numReady, start1, size1, start2, size2);
+        appendRecords (records + start1, size1);
+        appendRecords (records + start2, size2);
+        fifo.finishedRead (size1 + size2);
+    }
+
+    if (outBuffer.getDataSize() > 0)
+    {
+        stream.write (outBuffer.getData(), outBuffer.getDataSize());
+        stream.flush();
+        outBuffer.reset();
+    }
+}
+
+void PhaseRecorder::appendRecords (const EventPhase* phases, int numRecords)
+{
+    for (int i = 0; i < numRecords; ++i)
+    {
+        const EventPhase& phase = phases[i];
+        if (format == CSV)
+        {
+            outBuffer << String (phase.sampleNumber) << ","
+                      << String (phase.eventLine) << ","
+                      << String (phase.chan) << ","
+                      << String (phase.phase, 6) << ","
+                      << (std::isnan (phase.onlinePhase) ? String ("NaN") : String (phase.onlinePhase, 6)) << ","
+                      << String (phase.amplitude, 6) << "\n";
+        }
+        else
+        {
+            outBuffer.writeInt64 (phase.sampleNumber);
+            outBuffer.writeInt (phase.eventLine);
+            outBuffer.writeInt (phase.chan);
+            outBuffer.writeDouble (phase.phase);
+            outBuffer.writeDouble (phase.onlinePhase);
+            outBuffer.writeDouble (phase.amplitude);
+        }
+    }
+}
+
+String PhaseRecorder::getFileExtension (Format format)
+{
+    return format == BINARY ? ".phases" : ".csv";
+}
+} // namespace PhaseCalculator
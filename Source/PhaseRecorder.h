@@ -0,0 +1,119 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef PHASE_RECORDER_H_INCLUDED
+#define PHASE_RECORDER_H_INCLUDED
+
+/*
+
+Streams the event phases calculated by the GroundTruthEngine to a file while recording.
+
+Records are passed from the engine's analysis thread through a preallocated single-producer
+FIFO to a writer thread, which does all file I/O (including opening the file) in batches.
+If the writer falls behind and the FIFO fills up, records are dropped and counted.
+
+Formats:
+- CSV:    one header line, then one line per event:
+          sample_number,event_line,channel,phase,online_phase,amplitude
+- Binary: a 32-byte header (magic "PHCEVT01", int32 version, int32 record size,
+          float64 sample rate, int64 reserved), then one 40-byte little-endian record per event:
+          int64 sample number, int32 event line, int32 channel,
+          float64 phase, float64 online phase, float64 amplitude
+
+Phases are in radians; the online phase is NaN if none was output at the event sample. With a
+look-ahead horizon, it is referred back to the event (see EventPhase::onlinePhase).
+Event lines and channels are 0-based. The amplitude is the magnitude of the (zero-phase
+filtered) analytic signal at the event, in the units of the continuous channel.
+
+*/
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+
+#include "GroundTruth.h"
+
+namespace PhaseCalculator
+{
+class PhaseRecorder : public Thread
+{
+public:
+    enum Format
+    {
+        OFF = 0,
+        CSV,
+        BINARY
+    };
+
+    PhaseRecorder();
+
+    ~PhaseRecorder();
+
+    /** Starts writing to the given file (without extension) in a new thread. */
+    void start (const File& fileWithoutExtension, Format format, double sampleRate);
+
+    /** Writes out any remaining records, closes the file and stops the thread. */
+    void stop();
+
+    bool isRecording() const { return recording.load(); }
+
+    /** Queues a record; called from a single producer thread. Never blocks or allocates. */
+    void push (const EventPhase& phase);
+
+    /** Number of records dropped because the writer could not keep up */
+    int64 getNumDropped() const { return numDropped.load(); }
+
+    /** Writer thread */
+    void run() override;
+
+    static String getFileExtension (Format format);
+
+    static const int fifoSize = 1 << 16;
+    static const int binaryRecordSize = 40;
+    static const int binaryVersion = 1;
+
+private:
+    // formats a batch of records into outBuffer
+    void appendRecords (const EventPhase* records, int numRecords);
+
+    // writes out everything currently queued
+    void drain (OutputStream& stream);
+
+    std::atomic<bool> recording;
+
+    File file;
+    Format format;
+    double sampleRate;
+
+    AbstractFifo fifo;
+    HeapBlock<EventPhase> records;
+
+    MemoryOutputStream outBuffer;
+
+    std::atomic<int64> numDropped;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PhaseRecorder);
+};
+} // namespace PhaseCalculator
+
+#endif // PHASE_RECORDER_H_INCLUDED
@@ -0,0 +1,247 @@
+/*
+------------------------------------------------------------------
+
+This file is part of a plugin for the Open Ephys GUI
+Copyright (C) 2018 Translational NeuroEngineering Laboratory, MGH
+
+------------------------------------------------------------------
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef STAGE_TIMINGS_H_INCLUDED
+#define STAGE_TIMINGS_H_INCLUDED
+
+#include <BasicJuceHeader.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath> // ceil, ldexp
+
+/*
+
+Low-overhead timing of the processing stages of each channel.
+
+- LatencyHistogram: count, total and maximum of a sequence of durations in nanoseconds, plus a
+                    histogram with power-of-two bins (bin k counts durations in [2^k, 2^(k+1)) ns).
+                    Adding is O(1), never allocates or locks, and must only be done from one
+                    thread at a time; any thread can take a snapshot while it runs (a snapshot
+                    may be off by the duration being added).
+- StageTimings:     one histogram per stage of the phase calculation (audio thread) and of the
+                    AR model fit (AR thread).
+- StageClock:       records the time since the previous lap (or since it was created) to a stage.
+                    With null timings it does nothing, so that timing can be switched off.
+
+*/
+
+namespace PhaseCalculator
+{
+class LatencyHistogram
+{
+public:
+    // the last bin also counts everything longer than 2^numBins ns (~4 s)
+    static const int numBins = 32;
+
+    struct Snapshot
+    {
+        uint64 count = 0;
+        uint64 totalNs = 0;
+        uint64 maxNs = 0;
+        uint64 bins[numBins] = {};
+
+        double getMeanNs() const
+        {
+            return count > 0 ? double (totalNs) / double (count) : 0;
+        }
+
+        // upper edge of the bin that contains the given quantile (in [0, 1]), capped at the maximum
+        double getPercentileNs (double p) const
+        {
+            if (count == 0)
+            {
+                return 0;
+            }
+
+            uint64 target = uint64 (std::ceil (p * double (count)));
+            uint64 cumulative = 0;
+            for (int bin = 0; bin < numBins; ++bin)
+            {
+                cumulative += bins[bin];
+                if (cumulative >= jmax (uint64 (1), target))
+                {
+                    return jmin (double (maxNs), std::ldexp (1.0, bin + 1));
+                }
+            }
+            return double (maxNs);
+        }
+    };
+
+    LatencyHistogram()
+    {
+        clear();
+    }
+
+    void add (uint64 ns)
+    {
+        int bin = 0;
+        for (uint64 rest = ns >> 1; rest != 0 && bin < numBins - 1; rest >>= 1)
+        {
+            ++bin;
+        }
+
+        bins[bin].store (bins[bin].load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        totalNs.store (totalNs.load (std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > maxNs.load (std::memory_order_relaxed))
+        {
+            maxNs.store (ns, std::memory_order_relaxed);
+        }
+        count.store (count.load (std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // not concurrently with add
+    void clear()
+    {
+        for (auto& bin : bins)
+        {
+            bin.store (0, std::memory_order_relaxed);
+        }
+        totalNs.store (0, std::memory_order_relaxed);
+        maxNs.store (0, std::memory_order_relaxed);
+        count.store (0, std::memory_order_release);
+    }
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot snapshot;
+        snapshot.count = count.load (std::memory_order_acquire);
+        snapshot.totalNs = totalNs.load (std::memory_order_relaxed);
+        snapshot.maxNs = maxNs.load (std::memory_order_relaxed);
+        for (int bin = 0; bin < numBins; ++bin)
+        {
+            snapshot.bins[bin] = bins[bin].load (std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+private:
+    std::atomic<uint64> count;
+    std::atomic<uint64> totalNs;
+    std::atomic<uint64> maxNs;
+    std::atomic<uint64> bins[numBins];
+
+    JUCE_DECLARE_NON_COPYABLE (LatencyHistogram);
+};
+
+struct StageTimings
+{
+    enum Stage
+    {
+        // audio thread, per buffer
+        FILTER = 0,
+        ENQUEUE, // adding to the history (including waiting for its lock)
+        PREDICT, // reading the AR model and predicting
+        TRANSFORM, // Hilbert transformer over the buffer and prediction
+        INTERPOLATE,
+        UNWRAP, // glitch unwrapping and smoothing
+        GROUND_TRUTH, // capturing events and queueing data for the visualizer
+        CHANNEL_TOTAL, // all of the above
+        // AR thread, per fit
+        FIT, // AR model fit (including the lock wait)
+        FIT_LOCK_WAIT, // waiting for the history's lock
+        NUM_STAGES
+    };
+
+    static const char* getStageName (int stage)
+    {
+        static const char* const names[NUM_STAGES] = {
+            "filter", "enqueue", "predict", "transform", "interpolate", "unwrap", "ground truth", "channel total", "AR fit", "AR lock wait"
+        };
+        return stage >= 0 && stage < NUM_STAGES ? names[stage] : "";
+    }
+
+    struct Snapshot
+    {
+        LatencyHistogram::Snapshot stages[NUM_STAGES];
+    };
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot snapshot;
+        for (int stage = 0; stage < NUM_STAGES; ++stage)
+        {
+            snapshot.stages[stage] = stages[stage].getSnapshot();
+        }
+        return snapshot;
+    }
+
+    void clear()
+    {
+        for (auto& stage : stages)
+        {
+            stage.clear();
+        }
+    }
+
+    void add (Stage stage, uint64 ns)
+    {
+        stages[stage].add (ns);
+    }
+
+    static int64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    LatencyHistogram stages[NUM_STAGES];
+};
+
+class StageClock
+{
+public:
+    StageClock (StageTimings* t)
+        : timings (t),
+          start (t != nullptr ? StageTimings::now() : 0),
+          last (start)
+    {
+    }
+
+    // records the time since the last lap
+    void lap (StageTimings::Stage stage)
+    {
+        if (timings != nullptr)
+        {
+            int64 time = StageTimings::now();
+            timings->add (stage, uint64 (jmax (int64 (0), time - last)));
+            last = time;
+        }
+    }
+
+    // records the time since the clock was created
+    void total (StageTimings::Stage stage)
+    {
+        if (timings != nullptr)
+        {
+            timings->add (stage, uint64 (jmax (int64 (0), StageTimings::now() - start)));
+        }
+    }
+
+private:
+    StageTimings* const timings;
+    const int64 start;
+    int64 last;
+};
+} // namespace PhaseCalculator
+
+#endif // STAGE_TIMINGS_H_INCLUDED